@@ -0,0 +1,1420 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * chat-engine.c - run a chat script on a device without blocking.
+ *
+ * The caller polls the descriptors chat_pollfds gives it, for no
+ * longer than the timeout it gives, and then calls chat_handle; the
+ * script is done when that returns something other than CHAT_RUNNING.
+ * The engine itself reads and writes the device, and never sleeps.
+ *
+ * This version is Copyright 1995-2024 Paul Mackerras <paulus@ozlabs.org>
+ * based on the original public-domain version by Karl Fox.
+ * Copyright 2026 The ppp project contributors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "chat-engine.h"
+
+/* what the engine is doing */
+#define PH_SCRIPT	0	/* taking the next string of the script */
+#define PH_EXPECT	1	/* waiting for an expect string */
+#define PH_SEND		2	/* sending a string */
+#define PH_GATHER	3	/* reading the rest of a REPORT line */
+#define PH_END		4
+
+/* IDs of the strings looked for in the matcher */
+#define EXPECT_ID		0
+#define ABORT_ID(n)		(1 + (n))
+#define REPORT_ID(n)		(1 + CHAT_MAX_ABORTS + (n))
+#define N_IDS			(1 + CHAT_MAX_ABORTS + CHAT_MAX_REPORTS)
+
+#define isoctal(chr)	(((chr) >= '0') && ((chr) <= '7'))
+#define isalnumx(chr)	((((chr) >= '0') && ((chr) <= '9')) \
+			 || (((chr) >= 'a') && ((chr) <= 'z')) \
+			 || (((chr) >= 'A') && ((chr) <= 'Z')) \
+			 || (chr) == '_')
+
+static void do_send(struct chat *, char *);
+static void expect_failed(struct chat *);
+static void finish(struct chat *, int);
+
+static long long
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void
+set_deadline(struct chat *c, int secs)
+{
+    c->deadline = secs > 0? now_ms() + secs * 1000LL: 0;
+}
+
+static int
+timed_out(struct chat *c)
+{
+    return c->deadline != 0 && now_ms() >= c->deadline;
+}
+
+static void
+vmsg(struct chat *c, int level, const char *fmt, va_list args)
+{
+    if (c->ops != NULL && c->ops->log != NULL)
+	c->ops->log(c->arg, level, fmt, args);
+}
+
+static void
+msgf(struct chat *c, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vmsg(c, CHAT_LOG_INFO, fmt, args);
+    va_end(args);
+}
+
+/*
+ * Log an error and end the script with exit code `code'.
+ */
+static void
+fail(struct chat *c, int code, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vmsg(c, CHAT_LOG_ERR, fmt, args);
+    va_end(args);
+    finish(c, code);
+}
+
+/*
+ * Translate the input character to the appropriate string for printing
+ * the data.
+ */
+static char *
+character(int c)
+{
+    static char string[10];
+    char *meta;
+
+    meta = (c & 0x80) ? "M-" : "";
+    c &= 0x7F;
+
+    if (c < 32)
+	sprintf(string, "%s^%c", meta, (int)c + '@');
+    else if (c == 127)
+	sprintf(string, "%s^?", meta);
+    else
+	sprintf(string, "%s%c", meta, c);
+
+    return (string);
+}
+
+static int
+put_err(struct chat *c, const char *s, int len)
+{
+    return write(c->errfd, s, len) != len;
+}
+
+/*
+ *	Echo a character to the error output.
+ *	When called with -1, a '\n' character is generated when
+ *	the cursor is not at the beginning of a line.
+ */
+static int
+echo_char(struct chat *c, int n)
+{
+    char *s;
+    int len, ret = 0;
+
+    switch (n) {
+    case '\r':		/* ignore '\r' */
+	break;
+    case -1:
+	if (c->need_lf == 0)
+	    break;
+	/* fall through */
+    case '\n':
+	ret = put_err(c, "\n", 1);
+	c->need_lf = 0;
+	break;
+    default:
+	s = character(n);
+	len = strlen(s);
+	ret = put_err(c, s, len);
+	c->need_lf = 1;
+	break;
+    }
+    return ret;
+}
+
+/* grow a char buffer and keep a pointer offset */
+static char *
+grow(char *s, char **p, size_t len)
+{
+    size_t l = *p - s;		/* save p as distance into s */
+
+    s = realloc(s, len);
+    if (s != NULL)
+	*p = s + l;		/* restore p */
+    return s;
+}
+
+/*
+ *	'Clean up' this string.  Returns NULL if out of memory.
+ */
+static char *
+clean(struct chat *c, char *s,
+      int sending)  /* set to 1 when sending (putting) this string. */
+{
+    char cur_chr, *s1, *s2, *p, *phchar;
+    int add_return = sending;
+    size_t len = strlen(s) + 3;		/* see len comments below */
+
+#define GROW(n)	do {						\
+	len += (n);						\
+	if ((s2 = grow(s1, &p, len)) == NULL) {			\
+	    free(s1);						\
+	    return NULL;					\
+	}							\
+	s1 = s2;						\
+    } while (0)
+
+    p = s1 = malloc(len);
+    if (!p)
+	return NULL;
+    while (*s) {
+	cur_chr = *s++;
+	if (cur_chr == '^') {
+	    cur_chr = *s++;
+	    if (cur_chr == '\0') {
+		*p++ = '^';
+		break;
+	    }
+	    cur_chr &= 0x1F;
+	    if (cur_chr != 0) {
+		*p++ = cur_chr;
+	    }
+	    continue;
+	}
+
+	if (c->use_env && cur_chr == '$') {		/* ARI */
+	    char ch;
+
+	    phchar = s;
+	    while (isalnumx(*s))
+		s++;
+	    ch = *s;		/* save */
+	    *s = '\0';
+	    phchar = getenv(phchar);
+	    *s = ch;		/* restore */
+	    if (phchar) {
+		GROW(strlen(phchar));
+		while (*phchar)
+		    *p++ = *phchar++;
+	    }
+	    continue;
+	}
+
+	if (cur_chr != '\\') {
+	    *p++ = cur_chr;
+	    continue;
+	}
+
+	cur_chr = *s++;
+	if (cur_chr == '\0') {
+	    if (sending) {
+		*p++ = '\\';
+		*p++ = '\\';	/* +1 for len */
+	    }
+	    break;
+	}
+
+	switch (cur_chr) {
+	case 'b':
+	    *p++ = '\b';
+	    break;
+
+	case 'c':
+	    if (sending && *s == '\0')
+		add_return = 0;
+	    else
+		*p++ = cur_chr;
+	    break;
+
+	case '\\':
+	case 'K':
+	case 'p':
+	case 'd':
+	    if (sending)
+		*p++ = '\\';
+	    *p++ = cur_chr;
+	    break;
+
+	case 'T':
+	    if (sending && c->phone_num) {
+		GROW(strlen(c->phone_num));
+		for (phchar = c->phone_num; *phchar != '\0'; phchar++)
+		    *p++ = *phchar;
+	    }
+	    else {
+		*p++ = '\\';
+		*p++ = 'T';
+	    }
+	    break;
+
+	case 'U':
+	    if (sending && c->phone_num2) {
+		GROW(strlen(c->phone_num2));
+		for (phchar = c->phone_num2; *phchar != '\0'; phchar++)
+		    *p++ = *phchar;
+	    }
+	    else {
+		*p++ = '\\';
+		*p++ = 'U';
+	    }
+	    break;
+
+	case 'q':
+	    c->quiet = 1;
+	    break;
+
+	case 'r':
+	    *p++ = '\r';
+	    break;
+
+	case 'n':
+	    *p++ = '\n';
+	    break;
+
+	case 's':
+	    *p++ = ' ';
+	    break;
+
+	case 't':
+	    *p++ = '\t';
+	    break;
+
+	case 'N':
+	    if (sending) {
+		*p++ = '\\';
+		*p++ = '\0';
+	    }
+	    else
+		*p++ = 'N';
+	    break;
+
+	case '$':			/* ARI */
+	    if (c->use_env) {
+		*p++ = cur_chr;
+		break;
+	    }
+	    /* FALL THROUGH */
+
+	default:
+	    if (isoctal (cur_chr)) {
+		cur_chr &= 0x07;
+		if (isoctal (*s)) {
+		    cur_chr <<= 3;
+		    cur_chr |= *s++ - '0';
+		    if (isoctal (*s)) {
+			cur_chr <<= 3;
+			cur_chr |= *s++ - '0';
+		    }
+		}
+
+		if (cur_chr != 0 || sending) {
+		    if (sending && (cur_chr == '\\' || cur_chr == 0))
+			*p++ = '\\';
+		    *p++ = cur_chr;
+		}
+		break;
+	    }
+
+	    if (sending)
+		*p++ = '\\';
+	    *p++ = cur_chr;
+	    break;
+	}
+    }
+#undef GROW
+
+    if (add_return)
+	*p++ = '\r';	/* +2 for len */
+
+    *p = '\0';		/* +3 for len */
+    return s1;
+}
+
+/*
+ * A modified version of 'strtok', taking the rest of the current
+ * expect-send-expect... string. This version skips \ sequences.
+ */
+static char *
+expect_strtok(struct chat *c, char *term)
+{
+    char *str = c->subexp, *result;
+    int escape_flag = 0;
+
+    if (*str)
+	result = str;
+    else
+	result = (char *) 0;
+
+    while (*str) {
+	if (escape_flag) {
+	    escape_flag = 0;
+	    ++str;
+	    continue;
+	}
+
+	if (*str == '\\') {
+	    ++str;
+	    escape_flag = 1;
+	    continue;
+	}
+
+/*
+ * If this is not in the termination string, continue.
+ */
+	if (strchr (term, *str) == (char *) 0) {
+	    ++str;
+	    continue;
+	}
+
+/*
+ * This is the terminator. Mark the end of the string and stop.
+ */
+	*str++ = '\0';
+	break;
+    }
+    c->subexp = str;
+    return (result);
+}
+
+/*
+ * Pack the array by removing the NULL entries.
+ */
+static void
+pack_array(char **array, int end)
+{
+    int i, j;
+
+    for (i = 0; i < end; i++) {
+	if (array[i] == NULL) {
+	    for (j = i+1; j < end; ++j)
+		if (array[j] != NULL)
+		    array[i++] = array[j];
+	    for (; i < end; ++i)
+		array[i] = NULL;
+	    break;
+	}
+    }
+}
+
+void
+chat_init(struct chat *c, int infd, int outfd, const struct chat_ops *ops,
+	  void *arg)
+{
+    memset(c, 0, sizeof(*c));
+    c->infd = infd;
+    c->outfd = outfd;
+    c->errfd = 2;
+    c->timeout = CHAT_DEFAULT_TIMEOUT;
+    c->char_delay = 10;
+    c->ops = ops;
+    c->arg = arg;
+    c->status = CHAT_RUNNING;
+    c->phase = PH_SCRIPT;
+}
+
+/*
+ * Add a string to the end of the script.
+ */
+int
+chat_add_arg(struct chat *c, const char *s)
+{
+    char **args;
+
+    if (c->nargs >= c->maxargs) {
+	args = realloc(c->args, (c->maxargs + 32) * sizeof(char *));
+	if (args == NULL)
+	    return -1;
+	c->args = args;
+	c->maxargs += 32;
+    }
+    if ((c->args[c->nargs] = strdup(s)) == NULL)
+	return -1;
+    ++c->nargs;
+    return 0;
+}
+
+/*
+ *  Add the strings of a chat script file to the script.
+ */
+int
+chat_read_file(struct chat *c, const char *chat_file)
+{
+    int linect;
+    char *sp, *arg, quote;
+    char buf [CHAT_STR_LEN];
+    FILE *cfp;
+
+    cfp = fopen (chat_file, "r");
+    if (cfp == NULL) {
+	fail(c, 1, "%s -- open failed: %m", chat_file);
+	return -1;
+    }
+
+    linect = 0;
+
+    while (fgets(buf, CHAT_STR_LEN, cfp) != NULL) {
+	sp = strchr (buf, '\n');
+	if (sp)
+	    *sp = '\0';
+
+	linect++;
+	sp = buf;
+
+        /* lines starting with '#' are comments. If a real '#'
+           is to be expected, it should be quoted .... */
+        if ( *sp == '#' )
+	    continue;
+
+	while (*sp != '\0') {
+	    if (*sp == ' ' || *sp == '\t') {
+		++sp;
+		continue;
+	    }
+
+	    if (*sp == '"' || *sp == '\'') {
+		quote = *sp++;
+		arg = sp;
+		while (*sp != quote) {
+		    if (*sp == '\0') {
+			fclose (cfp);
+			fail(c, 1, "unterminated quote (line %d)", linect);
+			return -1;
+		    }
+
+		    if (*sp++ == '\\') {
+			if (*sp != '\0')
+			    ++sp;
+		    }
+		}
+	    }
+	    else {
+		arg = sp;
+		while (*sp != '\0' && *sp != ' ' && *sp != '\t')
+		    ++sp;
+	    }
+
+	    if (*sp != '\0')
+		*sp++ = '\0';
+
+	    if (chat_add_arg(c, arg) < 0) {
+		fclose (cfp);
+		fail(c, 2, "memory error!");
+		return -1;
+	    }
+	}
+    }
+    fclose (cfp);
+    return 0;
+}
+
+/*
+ * The script is over: read the rest of a REPORT line if one is being
+ * gathered, then stop.
+ */
+static void
+finish(struct chat *c, int code)
+{
+    if (c->phase == PH_END || c->phase == PH_GATHER)
+	return;
+    echo_char(c, -1);
+    matcher_free(&c->m);
+    c->exit_code = code;
+    if (c->report_gathering) {
+	c->phase = PH_GATHER;
+	c->deadline = now_ms() + 1000;
+	return;
+    }
+    c->phase = PH_END;
+    c->status = code == 0? CHAT_DONE: CHAT_FAILED;
+}
+
+/*
+ * Stop the script straight away, as when chat is killed.
+ */
+void
+chat_stop(struct chat *c, int code, const char *why)
+{
+    if (c->status != CHAT_RUNNING)
+	return;
+    if (why != NULL)
+	msgf(c, "%s", why);
+    echo_char(c, -1);
+    if (c->report_gathering && c->ops != NULL && c->ops->report != NULL)
+	c->ops->report(c->arg, c->report_buffer);
+    c->report_gathering = 0;
+    c->exit_code = code;
+    c->phase = PH_END;
+    c->status = code == 0? CHAT_DONE: CHAT_FAILED;
+}
+
+/*
+ *	Start waiting for this expect string, and the ABORT and REPORT
+ *	strings with it.  Returns 1 when the string is empty, so there is
+ *	nothing to wait for, 0 when waiting, -1 on error.
+ */
+static int
+start_expect(struct chat *c, char *string)
+{
+    char *ids[N_IDS];
+    size_t len;
+    int n;
+
+    c->fail_reason = (char *)0;
+    free(c->expect);
+    c->expect = string = clean(c, string, 0);
+    if (string == NULL) {
+	fail(c, 2, "memory error!");
+	return -1;
+    }
+    len = strlen(string);
+    c->minlen = (len > sizeof(c->fail_buffer)? len: sizeof(c->fail_buffer)) - 1;
+
+    if (c->verbose)
+	msgf(c, "expect (%v)", string);
+
+    if (len > CHAT_STR_LEN) {
+	msgf(c, "expect string is too long");
+	c->exit_code = 1;
+	expect_failed(c);
+	return -1;
+    }
+
+    if (len == 0) {
+	if (c->verbose)
+	    msgf(c, "got it");
+	return (1);
+    }
+
+    memset(ids, 0, sizeof(ids));
+    ids[EXPECT_ID] = string;
+    for (n = 0; n < c->n_aborts; ++n)
+	ids[ABORT_ID(n)] = c->abort_string[n];
+    for (n = 0; n < c->n_reports; ++n)
+	ids[REPORT_ID(n)] = c->report_string[n];
+    matcher_free(&c->m);
+    if (matcher_build(&c->m, ids, N_IDS) < 0) {
+	fail(c, 2, "memory error!");
+	return -1;
+    }
+    c->mstate = 0;
+    c->tlen = c->logged = 0;
+
+    set_deadline(c, c->timeout);
+    c->phase = PH_EXPECT;
+    return 0;
+}
+
+/*
+ * Take the next expect string of an expect-send-expect... string, or
+ * go on with the script when there are no more.
+ */
+static void
+next_expect(struct chat *c)
+{
+    char *expect;
+
+    expect = expect_strtok(c, "-");
+    if (expect == (char *) 0) {
+	c->subexp = NULL;
+	c->phase = PH_SCRIPT;
+	return;
+    }
+    c->reply = expect_strtok(c, "-");
+
+    if (start_expect(c, expect) > 0) {
+	c->subexp = NULL;
+	c->phase = PH_SCRIPT;
+    }
+}
+
+/*
+ * The expect string did not come: send the sub-reply if there is one
+ * and this was a timeout.  Otherwise the script fails.
+ */
+static void
+expect_failed(struct chat *c)
+{
+    matcher_free(&c->m);
+    if (c->reply != (char *) 0 && c->exit_code == 3) {
+	do_send(c, c->reply);
+	if (c->phase == PH_EXPECT)
+	    next_expect(c);	/* it was a keyword's string */
+	return;
+    }
+
+    if (c->fail_reason)
+	msgf(c, "Failed (%s)", c->fail_reason);
+    else
+	msgf(c, "Failed");
+    finish(c, c->exit_code);
+}
+
+/*
+ * Process the expect string
+ */
+static void
+do_expect(struct chat *c, char *s)
+{
+    if (strcmp(s, "HANGUP") == 0) {
+	++c->hup_next;
+        return;
+    }
+
+    if (strcmp(s, "ABORT") == 0) {
+	++c->abort_next;
+	return;
+    }
+
+    if (strcmp(s, "CLR_ABORT") == 0) {
+	++c->clear_abort_next;
+	return;
+    }
+
+    if (strcmp(s, "REPORT") == 0) {
+	++c->report_next;
+	return;
+    }
+
+    if (strcmp(s, "CLR_REPORT") == 0) {
+	++c->clear_report_next;
+	return;
+    }
+
+    if (strcmp(s, "TIMEOUT") == 0) {
+	++c->timeout_next;
+	return;
+    }
+
+    if (strcmp(s, "ECHO") == 0) {
+	++c->echo_next;
+	return;
+    }
+
+    if (strcmp(s, "SAY") == 0) {
+	++c->say_next;
+	return;
+    }
+
+    c->subexp = s;
+    next_expect(c);
+}
+
+/*
+ * Look at the next character received while waiting for an expect
+ * string.  Returns 1 if the expect string has been seen, -1 if an
+ * ABORT string has, 0 otherwise.
+ */
+static int
+expect_char(struct chat *c, int ch)
+{
+    char *s;
+    int n;
+
+    if (c->echo) {
+	if (echo_char(c, ch) != 0) {
+	    fail(c, 2, "Could not write to stderr, %m");
+	    return -1;
+	}
+    }
+    if (c->verbose && ch == '\n') {
+	if (c->tlen == c->logged)
+	    msgf(c, "");	/* blank line */
+	else
+	    msgf(c, "%0.*v", c->tlen - c->logged, c->temp + c->logged);
+	c->logged = c->tlen + 1;
+    }
+
+    c->temp[c->tlen++] = ch;
+
+    if (c->verbose && c->tlen >= c->logged + 80) {
+	msgf(c, "%0.*v", c->tlen - c->logged, c->temp + c->logged);
+	c->logged = c->tlen;
+    }
+
+    if (c->Verbose) {
+	if (ch == '\n')
+	    echo_char(c, '\n');
+	else if (ch != '\r') {
+	    s = character(ch);
+	    put_err(c, s, strlen(s));
+	}
+    }
+
+    c->mstate = match_step(&c->m, c->mstate, ch);
+
+    if (!c->report_gathering) {
+	for (n = 0; match_hit(&c->m, c->mstate) && n < c->n_reports; ++n) {
+	    /* a REPORT string that has been seen is freed */
+	    if (c->report_string[n] != (char*) NULL &&
+		match_ends(&c->m, c->mstate, REPORT_ID(n))) {
+		time_t time_now   = time ((time_t*) NULL);
+		struct tm* tm_now = localtime (&time_now);
+
+		strftime (c->report_buffer, 20, "%b %d %H:%M:%S ", tm_now);
+		strcat (c->report_buffer, c->report_string[n]);
+
+		free(c->report_string[n]);
+		c->report_string[n] = (char *) NULL;
+		c->report_gathering = 1;
+		break;
+	    }
+	}
+    }
+    else {
+	if (!iscntrl (ch)) {
+	    size_t rep_len = strlen (c->report_buffer);
+	    if (rep_len < sizeof(c->report_buffer) - 1) {
+		c->report_buffer[rep_len]     = ch;
+		c->report_buffer[rep_len + 1] = '\0';
+	    }
+	}
+	else {
+	    c->report_gathering = 0;
+	    if (c->ops != NULL && c->ops->report != NULL)
+		c->ops->report(c->arg, c->report_buffer);
+	}
+    }
+
+    if (match_hit(&c->m, c->mstate)
+	&& match_ends(&c->m, c->mstate, EXPECT_ID)) {
+	if (c->verbose) {
+	    if (c->tlen > c->logged)
+		msgf(c, "%0.*v", c->tlen - c->logged, c->temp + c->logged);
+	    msgf(c, " -- got it\n");
+	}
+	return (1);
+    }
+
+    for (n = 0; match_hit(&c->m, c->mstate) && n < c->n_aborts; ++n) {
+	if (match_ends(&c->m, c->mstate, ABORT_ID(n))) {
+	    if (c->verbose) {
+		if (c->tlen > c->logged)
+		    msgf(c, "%0.*v", c->tlen - c->logged, c->temp + c->logged);
+		msgf(c, " -- failed");
+	    }
+
+	    c->exit_code = n + 4;
+	    strcpy(c->fail_reason = c->fail_buffer, c->abort_string[n]);
+	    return (-1);
+	}
+    }
+
+    if (c->tlen >= CHAT_STR_LEN) {
+	if (c->logged < c->tlen - c->minlen) {
+	    if (c->verbose)
+		msgf(c, "%0.*v", c->tlen - c->logged, c->temp + c->logged);
+	    c->logged = c->tlen;
+	}
+	memmove(c->temp, c->temp + c->tlen - c->minlen, c->minlen);
+	c->logged -= c->tlen - c->minlen;
+	c->tlen = c->minlen;
+    }
+    return (0);
+}
+
+/*
+ * Wait for the expect string: take what has been received.  Returns 1
+ * if the script has moved on, 0 to wait for more.
+ */
+static int
+step_expect(struct chat *c)
+{
+    int r;
+
+    while (c->in_next < c->in_count) {
+	r = expect_char(c, c->inbuf[c->in_next++] & 0x7F);
+	if (c->status != CHAT_RUNNING || c->phase != PH_EXPECT)
+	    return 1;
+	if (r > 0) {
+	    matcher_free(&c->m);
+	    c->subexp = NULL;
+	    c->phase = PH_SCRIPT;
+	    return 1;
+	}
+	if (r < 0) {
+	    expect_failed(c);
+	    return 1;
+	}
+    }
+
+    if (!c->in_eof && !timed_out(c))
+	return 0;
+    if (c->verbose) {
+	if (c->in_eof)
+	    msgf(c, " -- read failed: %m");
+	else
+	    msgf(c, " -- read timed out");
+    }
+    c->in_eof = 0;
+    c->exit_code = 3;
+    expect_failed(c);
+    return 1;
+}
+
+/*
+ *  process the reply string
+ */
+static void
+do_send(struct chat *c, char *s)
+{
+    char file_data[CHAT_STR_LEN];
+    char *s1;
+    int i, old_max, pack;
+
+    if (c->say_next) {
+	c->say_next = 0;
+	s = clean(c, s, 1);
+	if (s == NULL) {
+	    fail(c, 2, "memory error!");
+	    return;
+	}
+	put_err(c, s, strlen(s));
+        free(s);
+	return;
+    }
+
+    if (c->hup_next) {
+        c->hup_next = 0;
+	if (c->ops != NULL && c->ops->hangup != NULL)
+	    c->ops->hangup(c->arg, strcmp(s, "OFF") != 0);
+        return;
+    }
+
+    if (c->echo_next) {
+	c->echo_next = 0;
+	c->echo = (strcmp(s, "ON") == 0);
+	return;
+    }
+
+    if (c->abort_next) {
+	c->abort_next = 0;
+
+	if (c->n_aborts >= CHAT_MAX_ABORTS) {
+	    fail(c, 2, "Too many ABORT strings");
+	    return;
+	}
+
+	s1 = clean(c, s, 0);
+	if (s1 == NULL) {
+	    fail(c, 2, "memory error!");
+	    return;
+	}
+
+	if (strlen(s1) + 1 > sizeof(c->fail_buffer)) {
+	    free(s1);
+	    fail(c, 1, "Illegal or too-long ABORT string ('%v')", s);
+	    return;
+	}
+
+	c->abort_string[c->n_aborts++] = s1;
+
+	if (c->verbose)
+	    msgf(c, "abort on (%v)", s1);
+	return;
+    }
+
+    if (c->clear_abort_next) {
+	c->clear_abort_next = 0;
+	pack = 0;
+
+	s1 = clean(c, s, 0);
+	if (s1 == NULL) {
+	    fail(c, 2, "memory error!");
+	    return;
+	}
+
+	if (strlen(s1) + 1 > sizeof(c->fail_buffer)) {
+	    free(s1);
+	    fail(c, 1, "Illegal or too-long CLR_ABORT string ('%v')", s);
+	    return;
+	}
+
+        old_max = c->n_aborts;
+	for (i=0; i < c->n_aborts; i++) {
+	    if ( strcmp(s1,c->abort_string[i]) == 0 ) {
+		free(c->abort_string[i]);
+		c->abort_string[i] = NULL;
+		pack++;
+		c->n_aborts--;
+		if (c->verbose)
+		    msgf(c, "clear abort on (%v)", s1);
+	    }
+	}
+        free(s1);
+	if (pack)
+	    pack_array(c->abort_string,old_max);
+	return;
+    }
+
+    if (c->report_next) {
+	c->report_next = 0;
+	if (c->n_reports >= CHAT_MAX_REPORTS) {
+	    fail(c, 2, "Too many REPORT strings");
+	    return;
+	}
+
+	s1 = clean(c, s, 0);
+	if (s1 == NULL) {
+	    fail(c, 2, "memory error!");
+	    return;
+	}
+	if (strlen(s1) + 1 > sizeof(c->fail_buffer)) {
+	    free(s1);
+	    fail(c, 1, "Illegal or too-long REPORT string ('%v')", s);
+	    return;
+	}
+
+	c->report_string[c->n_reports++] = s1;
+
+	if (c->verbose)
+	    msgf(c, "report (%v)", s1);
+	return;
+    }
+
+    if (c->clear_report_next) {
+	c->clear_report_next = 0;
+	pack = 0;
+
+	s1 = clean(c, s, 0);
+	if (s1 == NULL) {
+	    fail(c, 2, "memory error!");
+	    return;
+	}
+
+	if (strlen(s1) + 1 > sizeof(c->fail_buffer)) {
+	    free(s1);
+	    fail(c, 1, "Illegal or too-long REPORT string ('%v')", s);
+	    return;
+	}
+
+	old_max = c->n_reports;
+	for (i=0; i < c->n_reports; i++) {
+	    if ( strcmp(s1,c->report_string[i]) == 0 ) {
+		free(c->report_string[i]);
+		c->report_string[i] = NULL;
+		pack++;
+		c->n_reports--;
+		if (c->verbose)
+		    msgf(c, "clear report (%v)", s1);
+	    }
+	}
+        free(s1);
+        if (pack)
+	    pack_array(c->report_string,old_max);
+
+	return;
+    }
+
+    if (c->timeout_next) {
+	c->timeout_next = 0;
+	s = clean(c, s, 0);
+	if (s == NULL) {
+	    fail(c, 2, "memory error!");
+	    return;
+	}
+	c->timeout = atoi(s);
+
+	if (c->timeout <= 0)
+	    c->timeout = CHAT_DEFAULT_TIMEOUT;
+
+	if (c->verbose)
+	    msgf(c, "timeout set to %d seconds", c->timeout);
+	free(s);
+	return;
+    }
+
+    /*
+     * The syntax @filename means read the string to send from the
+     * file `filename'.
+     */
+    if (s[0] == '@') {
+	/* skip the @ and any following white-space */
+	char *fn = s;
+	while (*++fn == ' ' || *fn == '\t')
+	    ;
+
+	if (*fn != 0) {
+	    FILE *f;
+	    int n = 0;
+
+	    /* open the file and read until STR_LEN-1 bytes or end-of-file */
+	    f = fopen(fn, "r");
+	    if (f == NULL) {
+		fail(c, 1, "%s -- open failed: %m", fn);
+		return;
+	    }
+	    while (n < CHAT_STR_LEN - 1) {
+		int nr = fread(&file_data[n], 1, CHAT_STR_LEN - 1 - n, f);
+		if (nr < 0) {
+		    fclose(f);
+		    fail(c, 1, "%s -- read error", fn);
+		    return;
+		}
+		if (nr == 0)
+		    break;
+		n += nr;
+	    }
+	    fclose(f);
+
+	    /* use the string we got as the string to send,
+	       but trim off the final newline if any. */
+	    if (n > 0 && file_data[n-1] == '\n')
+		--n;
+	    file_data[n] = 0;
+	    s = file_data;
+	}
+    }
+
+    if (strcmp(s, "EOT") == 0)
+	s = "^D\\c";
+    else if (strcmp(s, "BREAK") == 0)
+	s = "\\K\\c";
+
+    c->quiet = 0;
+    free(c->send);
+    c->send = clean(c, s, 1);
+    if (c->send == NULL) {
+	fail(c, 2, "memory error!");
+	return;
+    }
+
+    if (c->verbose) {
+	if (c->quiet)
+	    msgf(c, "send (?????\?)");
+	else
+	    msgf(c, "send (%v)", c->send);
+    }
+
+    c->sendp = c->send;
+    c->wake = 0;
+    c->delayed = 0;
+    set_deadline(c, c->timeout);
+    c->phase = PH_SEND;
+}
+
+/*
+ * The string could not be sent.
+ */
+static void
+send_failed(struct chat *c, int timeout)
+{
+    if (c->verbose) {
+	if (timeout)
+	    msgf(c, " -- write timed out");
+	else
+	    msgf(c, " -- write failed: %m");
+    }
+    c->out_count = 0;
+    fail(c, 1, "Failed");
+}
+
+/*
+ * Send what is queued.
+ */
+static void
+flush_out(struct chat *c)
+{
+    int n;
+
+    n = write(c->outfd, c->outbuf, c->out_count);
+    if (n < 0) {
+	if (errno != EINTR && errno != EAGAIN)
+	    send_failed(c, 0);
+	return;
+    }
+    if (n == 0) {
+	msgf(c, "warning: write() on stdout returned %d", n);
+	send_failed(c, 0);
+	return;
+    }
+    memmove(c->outbuf, c->outbuf + n, c->out_count - n);
+    c->out_count -= n;
+}
+
+/*
+ * Queue characters of the send string until a delay, a break or a
+ * full buffer, and carry on from there once it has been sent.  Returns
+ * 1 if the script has moved on, 0 to wait.
+ */
+static int
+step_send(struct chat *c)
+{
+    int ch;
+
+    for (;;) {
+	if (c->wake != 0) {
+	    if (now_ms() < c->wake)
+		return 0;
+	    c->wake = 0;
+	}
+	if (c->out_count > 0) {
+	    if (timed_out(c)) {
+		send_failed(c, 1);
+		return 1;
+	    }
+	    /* wait until it has gone before the next delay or break */
+	    ch = c->sendp[0] == '\\'? c->sendp[1]: 0;
+	    if (c->char_delay > 0 || c->out_count == sizeof(c->outbuf)
+		|| *c->sendp == 0 || ch == 'd' || ch == 'K' || ch == 'p')
+		return 0;
+	}
+
+	ch = *c->sendp;
+	if (ch == 0) {
+	    free(c->send);
+	    c->send = NULL;
+	    if (c->subexp != NULL)
+		next_expect(c);
+	    else
+		c->phase = PH_SCRIPT;
+	    return 1;
+	}
+
+	if (ch == '\\') {
+	    ch = c->sendp[1];
+	    switch (ch) {
+	    case 'd':
+		c->sendp += 2;
+		c->wake = now_ms() + 1000;
+		continue;
+
+	    case 'K':
+		c->sendp += 2;
+		tcsendbreak(c->outfd, 0);
+		continue;
+
+	    case 'p':
+		c->sendp += 2;
+		c->wake = now_ms() + 10;  /* 1/100th of a second */
+		continue;
+	    }
+	}
+
+	if (c->char_delay > 0 && !c->delayed) {
+	    /* inter-character typing delay */
+	    c->delayed = 1;
+	    c->wake = now_ms() + c->char_delay;
+	    continue;
+	}
+	c->delayed = 0;
+	if (ch == '\\')
+	    ++c->sendp;
+	c->outbuf[c->out_count++] = *c->sendp++;
+    }
+}
+
+/*
+ * Reading the rest of a REPORT line after the script: up to a control
+ * character, or a second with nothing received.
+ */
+static int
+step_gather(struct chat *c)
+{
+    size_t rep_len = strlen(c->report_buffer);
+    int ch, done = c->in_eof || timed_out(c);
+
+    while (!done && c->in_next < c->in_count) {
+	ch = c->inbuf[c->in_next++] & 0x7F;
+	if (iscntrl(ch))
+	    done = 1;
+	else
+	    c->report_buffer[rep_len++] = ch;
+	if (rep_len + 1 >= sizeof(c->report_buffer))
+	    done = 1;
+	c->deadline = now_ms() + 1000;
+    }
+    c->report_buffer[rep_len] = 0;
+    if (!done)
+	return 0;
+
+    c->report_gathering = 0;
+    if (c->ops != NULL && c->ops->report != NULL)
+	c->ops->report(c->arg, c->report_buffer);
+    c->phase = PH_END;
+    c->status = c->exit_code == 0? CHAT_DONE: CHAT_FAILED;
+    return 1;
+}
+
+/*
+ * Go as far as possible through the script without waiting.
+ */
+static void
+run(struct chat *c)
+{
+    int more = 1, n;
+
+    while (more && c->status == CHAT_RUNNING) {
+	switch (c->phase) {
+	case PH_SCRIPT:
+	    if (c->next_arg >= c->nargs) {
+		finish(c, 0);
+		break;
+	    }
+	    n = c->next_arg++;
+	    if (n % 2 == 0)
+		do_expect(c, c->args[n]);
+	    else
+		do_send(c, c->args[n]);
+	    break;
+	case PH_EXPECT:
+	    more = step_expect(c);
+	    break;
+	case PH_SEND:
+	    more = step_send(c);
+	    break;
+	case PH_GATHER:
+	    more = step_gather(c);
+	    break;
+	default:
+	    more = 0;
+	    break;
+	}
+    }
+}
+
+void
+chat_start(struct chat *c)
+{
+    run(c);
+}
+
+/*
+ * Say what to wait for before calling chat_handle: pfd[0] is for the
+ * input and pfd[1] the output descriptor, with fd -1 when not needed,
+ * and *timeout is in milliseconds, or -1 for no limit.
+ */
+void
+chat_pollfds(struct chat *c, struct pollfd pfd[2], int *timeout)
+{
+    long long when = 0, now;
+
+    pfd[0].fd = -1;
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = -1;
+    pfd[1].events = POLLOUT;
+    pfd[1].revents = 0;
+    *timeout = -1;
+    if (c->status != CHAT_RUNNING) {
+	*timeout = 0;
+	return;
+    }
+
+    switch (c->phase) {
+    case PH_EXPECT:
+    case PH_GATHER:
+	if (c->in_next >= c->in_count)
+	    pfd[0].fd = c->infd;
+	when = c->deadline;
+	break;
+    case PH_SEND:
+	if (c->wake != 0)
+	    when = c->wake;
+	else if (c->out_count > 0) {
+	    pfd[1].fd = c->outfd;
+	    when = c->deadline;
+	}
+	break;
+    }
+    if (when != 0) {
+	now = now_ms();
+	*timeout = when > now? when - now: 0;
+    }
+}
+
+/*
+ * Do what can be done now that poll has returned with pfd, which
+ * may be NULL after a timeout.  Returns the status of the script.
+ */
+int
+chat_handle(struct chat *c, struct pollfd pfd[2])
+{
+    int n;
+
+    if (c->status != CHAT_RUNNING)
+	return c->status;
+    if (pfd != NULL && pfd[1].fd >= 0 && pfd[1].revents != 0
+	&& c->out_count > 0)
+	flush_out(c);
+    if (pfd != NULL && pfd[0].fd >= 0 && pfd[0].revents != 0
+	&& c->in_next >= c->in_count && c->status == CHAT_RUNNING) {
+	n = read(c->infd, c->inbuf, sizeof(c->inbuf));
+	if (n > 0) {
+	    c->in_next = 0;
+	    c->in_count = n;
+	} else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+	    if (n == 0)
+		msgf(c, "warning: read() on stdin returned %d", n);
+	    c->in_eof = 1;
+	}
+    }
+    run(c);
+    return c->status;
+}
+
+void
+chat_free(struct chat *c)
+{
+    int i;
+
+    for (i = 0; i < c->nargs; ++i)
+	free(c->args[i]);
+    free(c->args);
+    for (i = 0; i < c->n_aborts; ++i)
+	free(c->abort_string[i]);
+    for (i = 0; i < c->n_reports; ++i)
+	free(c->report_string[i]);
+    free(c->expect);
+    free(c->send);
+    matcher_free(&c->m);
+    c->args = NULL;
+    c->nargs = c->maxargs = 0;
+    c->n_aborts = c->n_reports = 0;
+    c->expect = c->send = NULL;
+}
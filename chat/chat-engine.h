@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * chat-engine.h - the expect/send state machine of chat, driven by the
+ * caller's event loop, so that pppd can run a chat script on the tty
+ * itself as well as the chat program doing so.
+ *
+ * Copyright 2026 The ppp project contributors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CHAT_ENGINE_H
+#define CHAT_ENGINE_H
+
+#include <stdarg.h>
+#include <poll.h>
+
+#include "match.h"
+
+#define	CHAT_STR_LEN		1024
+#define	CHAT_MAX_ABORTS		50
+#define	CHAT_MAX_REPORTS	50
+#define	CHAT_DEFAULT_TIMEOUT	45
+
+/* status of a script */
+#define CHAT_RUNNING	0
+#define CHAT_DONE	1	/* exit_code is 0 */
+#define CHAT_FAILED	2	/* exit_code says why, as chat's exit status */
+
+/* levels for the log callback */
+#define CHAT_LOG_INFO	0
+#define CHAT_LOG_ERR	1
+
+/*
+ * What the script does beyond reading and writing the device is passed
+ * to the caller.  The log callback's format may use %v for a string
+ * shown with control characters escaped, and %m.
+ */
+struct chat_ops {
+    void (*log)(void *arg, int level, const char *fmt, va_list);
+    void (*report)(void *arg, const char *line);	/* a REPORT string seen */
+    void (*hangup)(void *arg, int on);			/* HANGUP ON/OFF */
+};
+
+struct chat {
+    /* set by the caller before chat_start */
+    int		infd, outfd;	/* the device */
+    int		errfd;		/* for SAY, ECHO and -V output */
+    int		timeout;	/* seconds to wait for an expect string */
+    int		char_delay;	/* ms between characters sent */
+    int		echo, verbose, Verbose, use_env;
+    char	*phone_num, *phone_num2;
+    const struct chat_ops *ops;
+    void	*arg;
+
+    /* the script, as expect and send strings */
+    char	**args;
+    int		nargs, maxargs, next_arg;
+
+    int		status, exit_code;
+    char	*fail_reason, fail_buffer[50];
+
+    /* set by keywords, for the string that follows */
+    int		abort_next, clear_abort_next, report_next, clear_report_next;
+    int		timeout_next, echo_next, say_next, hup_next;
+
+    char	*abort_string[CHAT_MAX_ABORTS];
+    int		n_aborts;
+    char	*report_string[CHAT_MAX_REPORTS];
+    int		n_reports, report_gathering;
+    char	report_buffer[4096];
+
+    /* what the engine is doing: see chat-engine.c */
+    int		phase;
+    long long	deadline;	/* ms, monotonic, 0 for none */
+    char	*subexp;	/* rest of expect-send-expect... */
+    char	*expect;	/* cleaned expect string */
+    char	*reply;		/* to send if the expect string times out */
+    struct matcher m;
+    int		mstate;
+    char	temp[CHAT_STR_LEN];	/* received, for logging */
+    int		tlen, logged, minlen;
+    int		need_lf;
+
+    char	*send;		/* cleaned send string */
+    char	*sendp;		/* next character of it */
+    long long	wake;		/* ms, end of a delay while sending */
+    int		delayed;	/* typing delay before this char done */
+    int		quiet;
+
+    unsigned char inbuf[CHAT_STR_LEN];
+    int		in_next, in_count, in_eof;
+    unsigned char outbuf[CHAT_STR_LEN];
+    int		out_count;
+};
+
+void chat_init(struct chat *, int infd, int outfd, const struct chat_ops *,
+	       void *arg);
+int chat_add_arg(struct chat *, const char *);
+int chat_read_file(struct chat *, const char *);
+void chat_start(struct chat *);
+void chat_pollfds(struct chat *, struct pollfd pfd[2], int *timeout);
+int chat_handle(struct chat *, struct pollfd pfd[2]);
+void chat_stop(struct chat *, int code, const char *why);
+void chat_free(struct chat *);
+
+#endif /* CHAT_ENGINE_H */
@@ -120,6 +120,8 @@
 #include <syslog.h>
 #include <stdarg.h>
 
+#include "chat-engine.h"
+
 #ifndef TERMIO
 #undef	TERMIOS
 #define TERMIOS
@@ -132,8 +134,6 @@
 #include <termios.h>
 #endif
 
-#define	STR_LEN	1024
-
 #ifndef SIGTYPE
 #define SIGTYPE void
 #endif
@@ -164,10 +164,6 @@ static int _O = 0;		/* Internal state */
 
 char *program_name;
 
-#define	MAX_ABORTS		50
-#define	MAX_REPORTS		50
-#define	DEFAULT_CHAT_TIMEOUT	45
-
 int echo          = 0;
 int verbose       = 0;
 int to_log        = 1;
@@ -176,13 +172,13 @@ int Verbose       = 0;
 int quiet         = 0;
 int report        = 0;
 int use_env       = 0;
-int exit_code     = 0;
 FILE* report_fp   = (FILE *) 0;
 char *report_file = (char *) 0;
 char *chat_file   = (char *) 0;
 char *phone_num   = (char *) 0;
 char *phone_num2  = (char *) 0;
-int timeout       = DEFAULT_CHAT_TIMEOUT;
+int timeout       = CHAT_DEFAULT_TIMEOUT;
+int char_delay    = 10;		/* ms between characters sent */
 
 int have_tty_parameters = 0;
 
@@ -200,47 +196,22 @@ struct termio saved_tty_parameters;
 struct termios saved_tty_parameters;
 #endif
 
-char *abort_string[MAX_ABORTS], *fail_reason = (char *)0,
-	fail_buffer[50];
-int n_aborts = 0, abort_next = 0, timeout_next = 0, echo_next = 0;
-int clear_abort_next = 0;
-
-char *report_string[MAX_REPORTS] ;
-char  report_buffer[4096] ;
-int n_reports = 0, report_next = 0, report_gathering = 0 ; 
-int clear_report_next = 0;
-
-int say_next = 0, hup_next = 0;
+struct chat script;		/* the expect/send engine */
+static const struct chat_ops chat_ops;
 
 void *dup_mem (void *b, size_t c);
 void *copy_of (char *s);
-char *grow (char *s, char **p, size_t len);
 void usage (void);
 void msgf (const char *fmt, ...);
 void fatal (int code, const char *fmt, ...);
-SIGTYPE sigalrm (int signo);
 SIGTYPE sigint (int signo);
 SIGTYPE sigterm (int signo);
 SIGTYPE sighup (int signo);
 void checksigs(void);
 void init (void);
 void set_tty_parameters (void);
-int  echo_stderr (int);
-void break_sequence (void);
 void terminate (int status);
-void do_file (char *chat_file);
-int  get_string (register char *string);
-int  put_string (register char *s);
-int  write_char (int c);
-int  put_char (int c);
-int  get_char (void);
-int  chat_send (register char *s);
-char *character (int c);
-void chat_expect (register char *s);
-char *clean (register char *s, int sending);
-void break_sequence (void);
-void pack_array (char **array, int end);
-char *expect_strtok (char *, char *);
+void run_script (void);
 int vfmtmsg (char *, int, const char *, va_list);	/* vsprintf++ */
 
 int main (int, char *[]);
@@ -260,18 +231,6 @@ void *copy_of (char *s)
     return dup_mem (s, strlen (s) + 1);
 }
 
-/* grow a char buffer and keep a pointer offset */
-char *grow(char *s, char **p, size_t len)
-{
-    size_t l = *p - s;		/* save p as distance into s */
-
-    s = realloc(s, len);
-    if (!s)
-	fatal(2, "memory error!");
-    *p = s + l;			/* restore p */
-    return s;
-}
-
 /*
  * chat [ -v ] [ -E ] [ -T number ] [ -U number ] [ -t timeout ] [ -f chat-file ] \
  * [ -r report-file ] \
@@ -328,6 +287,13 @@ main(int argc, char **argv)
 		usage();
 	    break;
 
+	case 'd':
+	    if ((arg = OPTARG(argc, argv)) != NULL)
+		char_delay = atoi(arg);
+	    else
+		usage();
+	    break;
+
 	case 'r':
 	    arg = OPTARG (argc, argv);
 	    if (arg) {
@@ -379,105 +345,41 @@ main(int argc, char **argv)
     }
 
     init();
-    
+
+    chat_init(&script, 0, 1, &chat_ops, NULL);
+    script.timeout = timeout;
+    script.char_delay = char_delay;
+    script.echo = echo;
+    script.verbose = verbose;
+    script.Verbose = Verbose;
+    script.use_env = use_env;
+    script.phone_num = phone_num;
+    script.phone_num2 = phone_num2;
+
     if (chat_file != NULL) {
 	arg = ARG(argc, argv);
 	if (arg != NULL)
 	    usage();
-	else
-	    do_file (chat_file);
+	else if (chat_read_file(&script, chat_file) < 0)
+	    terminate(script.exit_code);
     } else {
-	while ((arg = ARG(argc, argv)) != NULL) {
-	    chat_expect(arg);
-
-	    if ((arg = ARG(argc, argv)) != NULL)
-		chat_send(arg);
-	    checksigs();
-	}
+	while ((arg = ARG(argc, argv)) != NULL)
+	    if (chat_add_arg(&script, arg) < 0)
+		fatal(2, "memory error!");
     }
 
-    terminate(0);
+    run_script();
+    terminate(script.exit_code);
     return 0;
 }
 
-/*
- *  Process a chat script when read from a file.
- */
-
-void do_file (char *chat_file)
-{
-    int linect, sendflg;
-    char *sp, *arg, quote;
-    char buf [STR_LEN];
-    FILE *cfp;
-
-    cfp = fopen (chat_file, "r");
-    if (cfp == NULL)
-	fatal(1, "%s -- open failed: %m", chat_file);
-
-    linect = 0;
-    sendflg = 0;
-
-    while (fgets(buf, STR_LEN, cfp) != NULL) {
-	sp = strchr (buf, '\n');
-	if (sp)
-	    *sp = '\0';
-
-	linect++;
-	sp = buf;
-
-        /* lines starting with '#' are comments. If a real '#'
-           is to be expected, it should be quoted .... */
-        if ( *sp == '#' )
-	    continue;
-
-	while (*sp != '\0') {
-	    if (*sp == ' ' || *sp == '\t') {
-		++sp;
-		continue;
-	    }
-
-	    if (*sp == '"' || *sp == '\'') {
-		quote = *sp++;
-		arg = sp;
-		while (*sp != quote) {
-		    if (*sp == '\0')
-			fatal(1, "unterminated quote (line %d)", linect);
-
-		    if (*sp++ == '\\') {
-			if (*sp != '\0')
-			    ++sp;
-		    }
-		}
-	    }
-	    else {
-		arg = sp;
-		while (*sp != '\0' && *sp != ' ' && *sp != '\t')
-		    ++sp;
-	    }
-
-	    if (*sp != '\0')
-		*sp++ = '\0';
-
-	    if (sendflg)
-		chat_send (arg);
-	    else
-		chat_expect (arg);
-	    sendflg = !sendflg;
-	    checksigs();
-	}
-    }
-    checksigs();
-    fclose (cfp);
-}
-
 /*
  *	We got an error parsing the command line.
  */
 void usage(void)
 {
     fprintf(stderr, "\
-Usage: %s [-e] [-E] [-v] [-V] [-t timeout] [-r report-file]\n\
+Usage: %s [-e] [-E] [-v] [-V] [-t timeout] [-d delay] [-r report-file]\n\
      [-T phone-number] [-U phone-number2] {-f chat-file | chat-script}\n", program_name);
     exit(1);
 }
@@ -520,51 +422,103 @@ void fatal(int code, const char *fmt, ...)
     terminate(code);
 }
 
-int alarmed = 0;
-int alarmsig = 0;
+const char *fatalsig = NULL;
+
+/*
+ * The handlers also write to this pipe, which run_script polls, so that
+ * a signal arriving just before poll() still wakes it up at once.
+ */
+static int sigpipe[2] = { -1, -1 };
 
-SIGTYPE sigalrm(int signo)
+static void sigwake(void)
 {
-    int flags;
+    int saved_errno = errno;
 
-    alarm(1);
-    alarmed = 1;
-    alarmsig = 1;
+    if (sigpipe[1] >= 0 && write(sigpipe[1], "", 1) < 0)
+	;	/* the pipe is full: poll will return anyway */
+    errno = saved_errno;
 }
 
-const char *fatalsig = NULL;
-
 SIGTYPE sigint(int signo)
 {
     fatalsig = "SIGINT";
+    sigwake();
 }
 
 SIGTYPE sigterm(int signo)
 {
     fatalsig = "SIGTERM";
+    sigwake();
 }
 
 SIGTYPE sighup(int signo)
 {
     fatalsig = "SIGHUP";
+    sigwake();
 }
 
 void checksigs(void)
 {
-    int err;
     const char *signame;
 
     if (fatalsig) {
 	signame = fatalsig;
 	fatalsig = NULL;
-	alarmsig = 0;
 	fatal(2, signame);
     }
-    if (alarmsig && verbose) {
-	err = errno;
-	msgf("alarm");
-	errno = err;
-	alarmsig = 0;
+}
+
+/*
+ * What the script does besides talking to the modem.
+ */
+static void chat_log(void *arg, int level, const char *fmt, va_list args)
+{
+    vfmtmsg(line, sizeof(line), fmt, args);
+    if (to_log)
+	syslog(level == CHAT_LOG_ERR? LOG_ERR: LOG_INFO, "%s", line);
+    if (to_stderr)
+	fprintf(stderr, "%s\n", line);
+}
+
+static void chat_report(void *arg, const char *report)
+{
+    fprintf (report_fp, "chat:  %s\n", report);
+}
+
+static void chat_hangup(void *arg, int on)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on? sighup: SIG_IGN;
+    sigaction(SIGHUP, &sa, NULL);
+}
+
+static const struct chat_ops chat_ops = {
+    chat_log, chat_report, chat_hangup
+};
+
+/*
+ * Run the script on stdin and stdout until it succeeds or fails.
+ */
+void run_script(void)
+{
+    struct pollfd pfd[3];
+    int ms;
+
+    chat_start(&script);
+    while (script.status == CHAT_RUNNING) {
+	chat_pollfds(&script, pfd, &ms);
+	pfd[2].fd = sigpipe[0];
+	pfd[2].events = POLLIN;
+	if (poll(pfd, 3, ms) < 0) {
+	    if (errno != EINTR)
+		fatal(2, "poll: %m");
+	    checksigs();
+	    continue;
+	}
+	checksigs();
+	chat_handle(&script, pfd);
     }
 }
 
@@ -572,6 +526,11 @@ void init(void)
 {
     struct sigaction sa;
 
+    if (pipe(sigpipe) < 0)
+	fatal(2, "pipe: %m");
+    fcntl(sigpipe[0], F_SETFL, fcntl(sigpipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(sigpipe[1], F_SETFL, fcntl(sigpipe[1], F_GETFL) | O_NONBLOCK);
+
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = sigint;
     sigaction(SIGINT, &sa, NULL);
@@ -581,10 +540,6 @@ void init(void)
     sigaction(SIGHUP, &sa, NULL);
 
     set_tty_parameters();
-    sa.sa_handler = sigalrm;
-    sigaction(SIGALRM, &sa, NULL);
-    alarm(0);
-    alarmed = 0;
 }
 
 void set_tty_parameters(void)
@@ -611,13 +566,6 @@ void set_tty_parameters(void)
 #endif
 }
 
-void break_sequence(void)
-{
-#ifdef TERMIOS
-    tcsendbreak (0, 0);
-#endif
-}
-
 void terminate(int status)
 {
     static int terminating = 0;
@@ -625,26 +573,9 @@ void terminate(int status)
     if (terminating)
 	exit(status);
     terminating = 1;
-    echo_stderr(-1);
-/*
- * Allow the last of the report string to be gathered before we terminate.
- */
-    if (report_gathering) {
-	int c;
-
-	size_t rep_len = strlen(report_buffer);
-	while (rep_len + 1 < sizeof(report_buffer)) {
-	    alarm(1);
-	    c = get_char();
-	    alarm(0);
-	    if (c < 0 || iscntrl(c))
-		break;
-	    report_buffer[rep_len] = c;
-	    ++rep_len;
-	}
-	report_buffer[rep_len] = 0;
-	fprintf (report_fp, "chat:  %s\n", report_buffer);
-    }
+    /* report what there is of a REPORT line, when killed */
+    if (script.ops != NULL)
+	chat_stop(&script, status, NULL);
     if (report_file != (char *) 0 && report_fp != (FILE *) NULL) {
 	if (verbose)
 	    fprintf (report_fp, "Closing \"%s\".\n", report_file);
@@ -662,921 +593,6 @@ void terminate(int status)
     exit(status);
 }
 
-/*
- *	'Clean up' this string.
- */
-char *clean(register char *s,
-	    int sending)  /* set to 1 when sending (putting) this string. */
-{
-    char cur_chr;
-    char *s1, *p, *phchar;
-    int add_return = sending;
-    size_t len = strlen(s) + 3;		/* see len comments below */
-
-#define isoctal(chr)	(((chr) >= '0') && ((chr) <= '7'))
-#define isalnumx(chr)	((((chr) >= '0') && ((chr) <= '9')) \
-			 || (((chr) >= 'a') && ((chr) <= 'z')) \
-			 || (((chr) >= 'A') && ((chr) <= 'Z')) \
-			 || (chr) == '_')
-
-    p = s1 = malloc(len);
-    if (!p)
-	fatal(2, "memory error!");
-    while (*s) {
-	cur_chr = *s++;
-	if (cur_chr == '^') {
-	    cur_chr = *s++;
-	    if (cur_chr == '\0') {
-		*p++ = '^';
-		break;
-	    }
-	    cur_chr &= 0x1F;
-	    if (cur_chr != 0) {
-		*p++ = cur_chr;
-	    }
-	    continue;
-	}
-
-	if (use_env && cur_chr == '$') {		/* ARI */
-	    char c;
-
-	    phchar = s;
-	    while (isalnumx(*s))
-		s++;
-	    c = *s;		/* save */
-	    *s = '\0';
-	    phchar = getenv(phchar);
-	    *s = c;		/* restore */
-	    if (phchar) {
-		len += strlen(phchar);
-		s1 = grow(s1, &p, len);
-		while (*phchar)
-		    *p++ = *phchar++;
-	    }
-	    continue;
-	}
-
-	if (cur_chr != '\\') {
-	    *p++ = cur_chr;
-	    continue;
-	}
-
-	cur_chr = *s++;
-	if (cur_chr == '\0') {
-	    if (sending) {
-		*p++ = '\\';
-		*p++ = '\\';	/* +1 for len */
-	    }
-	    break;
-	}
-
-	switch (cur_chr) {
-	case 'b':
-	    *p++ = '\b';
-	    break;
-
-	case 'c':
-	    if (sending && *s == '\0')
-		add_return = 0;
-	    else
-		*p++ = cur_chr;
-	    break;
-
-	case '\\':
-	case 'K':
-	case 'p':
-	case 'd':
-	    if (sending)
-		*p++ = '\\';
-	    *p++ = cur_chr;
-	    break;
-
-	case 'T':
-	    if (sending && phone_num) {
-		len += strlen(phone_num);
-		s1 = grow(s1, &p, len);
-		for (phchar = phone_num; *phchar != '\0'; phchar++) 
-		    *p++ = *phchar;
-	    }
-	    else {
-		*p++ = '\\';
-		*p++ = 'T';
-	    }
-	    break;
-
-	case 'U':
-	    if (sending && phone_num2) {
-		len += strlen(phone_num2);
-		s1 = grow(s1, &p, len);
-		for (phchar = phone_num2; *phchar != '\0'; phchar++) 
-		    *p++ = *phchar;
-	    }
-	    else {
-		*p++ = '\\';
-		*p++ = 'U';
-	    }
-	    break;
-
-	case 'q':
-	    quiet = 1;
-	    break;
-
-	case 'r':
-	    *p++ = '\r';
-	    break;
-
-	case 'n':
-	    *p++ = '\n';
-	    break;
-
-	case 's':
-	    *p++ = ' ';
-	    break;
-
-	case 't':
-	    *p++ = '\t';
-	    break;
-
-	case 'N':
-	    if (sending) {
-		*p++ = '\\';
-		*p++ = '\0';
-	    }
-	    else
-		*p++ = 'N';
-	    break;
-
-	case '$':			/* ARI */
-	    if (use_env) {
-		*p++ = cur_chr;
-		break;
-	    }
-	    /* FALL THROUGH */
-
-	default:
-	    if (isoctal (cur_chr)) {
-		cur_chr &= 0x07;
-		if (isoctal (*s)) {
-		    cur_chr <<= 3;
-		    cur_chr |= *s++ - '0';
-		    if (isoctal (*s)) {
-			cur_chr <<= 3;
-			cur_chr |= *s++ - '0';
-		    }
-		}
-
-		if (cur_chr != 0 || sending) {
-		    if (sending && (cur_chr == '\\' || cur_chr == 0))
-			*p++ = '\\';
-		    *p++ = cur_chr;
-		}
-		break;
-	    }
-
-	    if (sending)
-		*p++ = '\\';
-	    *p++ = cur_chr;
-	    break;
-	}
-    }
-
-    if (add_return)
-	*p++ = '\r';	/* +2 for len */
-
-    *p = '\0';		/* +3 for len */
-    return s1;
-}
-
-/*
- * A modified version of 'strtok'. This version skips \ sequences.
- */
-
-char *expect_strtok (char *s, char *term)
-{
-    static  char *str   = "";
-    int	    escape_flag = 0;
-    char   *result;
-
-/*
- * If a string was specified then do initial processing.
- */
-    if (s)
-	str = s;
-
-/*
- * If this is the escape flag then reset it and ignore the character.
- */
-    if (*str)
-	result = str;
-    else
-	result = (char *) 0;
-
-    while (*str) {
-	if (escape_flag) {
-	    escape_flag = 0;
-	    ++str;
-	    continue;
-	}
-
-	if (*str == '\\') {
-	    ++str;
-	    escape_flag = 1;
-	    continue;
-	}
-
-/*
- * If this is not in the termination string, continue.
- */
-	if (strchr (term, *str) == (char *) 0) {
-	    ++str;
-	    continue;
-	}
-
-/*
- * This is the terminator. Mark the end of the string and stop.
- */
-	*str++ = '\0';
-	break;
-    }
-    return (result);
-}
-
-/*
- * Process the expect string
- */
-
-void chat_expect (char *s)
-{
-    char *expect;
-    char *reply;
-
-    if (strcmp(s, "HANGUP") == 0) {
-	++hup_next;
-        return;
-    }
- 
-    if (strcmp(s, "ABORT") == 0) {
-	++abort_next;
-	return;
-    }
-
-    if (strcmp(s, "CLR_ABORT") == 0) {
-	++clear_abort_next;
-	return;
-    }
-
-    if (strcmp(s, "REPORT") == 0) {
-	++report_next;
-	return;
-    }
-
-    if (strcmp(s, "CLR_REPORT") == 0) {
-	++clear_report_next;
-	return;
-    }
-
-    if (strcmp(s, "TIMEOUT") == 0) {
-	++timeout_next;
-	return;
-    }
-
-    if (strcmp(s, "ECHO") == 0) {
-	++echo_next;
-	return;
-    }
-
-    if (strcmp(s, "SAY") == 0) {
-	++say_next;
-	return;
-    }
-
-/*
- * Fetch the expect and reply string.
- */
-    for (;;) {
-	expect = expect_strtok (s, "-");
-	s      = (char *) 0;
-
-	if (expect == (char *) 0)
-	    return;
-
-	reply = expect_strtok (s, "-");
-
-/*
- * Handle the expect string. If successful then exit.
- */
-	if (get_string (expect))
-	    return;
-
-/*
- * If there is a sub-reply string then send it. Otherwise any condition
- * is terminal.
- */
-	if (reply == (char *) 0 || exit_code != 3)
-	    break;
-
-	chat_send (reply);
-	checksigs();
-    }
-
-/*
- * The expectation did not occur. This is terminal.
- */
-    if (fail_reason)
-	msgf("Failed (%s)", fail_reason);
-    else
-	msgf("Failed");
-    terminate(exit_code);
-}
-
-/*
- * Translate the input character to the appropriate string for printing
- * the data.
- */
-
-char *character(int c)
-{
-    static char string[10];
-    char *meta;
-
-    meta = (c & 0x80) ? "M-" : "";
-    c &= 0x7F;
-
-    if (c < 32)
-	sprintf(string, "%s^%c", meta, (int)c + '@');
-    else if (c == 127)
-	sprintf(string, "%s^?", meta);
-    else
-	sprintf(string, "%s%c", meta, c);
-
-    return (string);
-}
-
-/*
- *  process the reply string
- */
-int chat_send (register char *s)
-{
-    char file_data[STR_LEN];
-    int len, ret = 0;
-    struct sigaction sa;
-
-    if (say_next) {
-	say_next = 0;
-	s = clean(s, 1);
-	len = strlen(s);
-	ret = write(2, s, len) != len;
-        free(s);
-	return ret;
-    }
-
-    if (hup_next) {
-        hup_next = 0;
-	memset(&sa, 0, sizeof(sa));
-
-	if (strcmp(s, "OFF") == 0)
-	    sa.sa_handler = SIG_IGN;
-	else
-	    sa.sa_handler = sighup;
-	sigaction(SIGHUP, &sa, NULL);
-        return 0;
-    }
-
-    if (echo_next) {
-	echo_next = 0;
-	echo = (strcmp(s, "ON") == 0);
-	return 0;
-    }
-
-    if (abort_next) {
-	char *s1;
-	
-	abort_next = 0;
-	
-	if (n_aborts >= MAX_ABORTS)
-	    fatal(2, "Too many ABORT strings");
-	
-	s1 = clean(s, 0);
-	
-	if (strlen(s1) + 1 > sizeof(fail_buffer))
-	    fatal(1, "Illegal or too-long ABORT string ('%v')", s);
-
-	abort_string[n_aborts++] = s1;
-
-	if (verbose)
-	    msgf("abort on (%v)", s1);
-	return 0;
-    }
-
-    if (clear_abort_next) {
-	char *s1;
-	int   i;
-        int   old_max;
-	int   pack = 0;
-	
-	clear_abort_next = 0;
-	
-	s1 = clean(s, 0);
-	
-	if (strlen(s1) + 1 > sizeof(fail_buffer))
-	    fatal(1, "Illegal or too-long CLR_ABORT string ('%v')", s);
-
-        old_max = n_aborts;
-	for (i=0; i < n_aborts; i++) {
-	    if ( strcmp(s1,abort_string[i]) == 0 ) {
-		free(abort_string[i]);
-		abort_string[i] = NULL;
-		pack++;
-		n_aborts--;
-		if (verbose)
-		    msgf("clear abort on (%v)", s1);
-	    }
-	}
-        free(s1);
-	if (pack)
-	    pack_array(abort_string,old_max);
-	return 0;
-    }
-
-    if (report_next) {
-	char *s1;
-	
-	report_next = 0;
-	if (n_reports >= MAX_REPORTS)
-	    fatal(2, "Too many REPORT strings");
-	
-	s1 = clean(s, 0);
-	if (strlen(s1) + 1 > sizeof(fail_buffer))
-	    fatal(1, "Illegal or too-long REPORT string ('%v')", s);
-	
-	report_string[n_reports++] = s1;
-	
-	if (verbose)
-	    msgf("report (%v)", s1);
-	return 0;
-    }
-
-    if (clear_report_next) {
-	char *s1;
-	int   i;
-	int   old_max;
-	int   pack = 0;
-	
-	clear_report_next = 0;
-	
-	s1 = clean(s, 0);
-	
-	if (strlen(s1) + 1 > sizeof(fail_buffer))
-	    fatal(1, "Illegal or too-long REPORT string ('%v')", s);
-
-	old_max = n_reports;
-	for (i=0; i < n_reports; i++) {
-	    if ( strcmp(s1,report_string[i]) == 0 ) {
-		free(report_string[i]);
-		report_string[i] = NULL;
-		pack++;
-		n_reports--;
-		if (verbose)
-		    msgf("clear report (%v)", s1);
-	    }
-	}
-        free(s1);
-        if (pack)
-	    pack_array(report_string,old_max);
-	
-	return 0;
-    }
-
-    if (timeout_next) {
-	timeout_next = 0;
-	s = clean(s, 0);
-	timeout = atoi(s);
-	
-	if (timeout <= 0)
-	    timeout = DEFAULT_CHAT_TIMEOUT;
-
-	if (verbose)
-	    msgf("timeout set to %d seconds", timeout);
-	free(s);
-	return 0;
-    }
-
-    /*
-     * The syntax @filename means read the string to send from the
-     * file `filename'.
-     */
-    if (s[0] == '@') {
-	/* skip the @ and any following white-space */
-	char *fn = s;
-	while (*++fn == ' ' || *fn == '\t')
-	    ;
-
-	if (*fn != 0) {
-	    FILE *f;
-	    int n = 0;
-
-	    /* open the file and read until STR_LEN-1 bytes or end-of-file */
-	    f = fopen(fn, "r");
-	    if (f == NULL)
-		fatal(1, "%s -- open failed: %m", fn);
-	    while (n < STR_LEN - 1) {
-		int nr = fread(&file_data[n], 1, STR_LEN - 1 - n, f);
-		if (nr < 0)
-		    fatal(1, "%s -- read error", fn);
-		if (nr == 0)
-		    break;
-		n += nr;
-	    }
-	    fclose(f);
-
-	    /* use the string we got as the string to send,
-	       but trim off the final newline if any. */
-	    if (n > 0 && file_data[n-1] == '\n')
-		--n;
-	    file_data[n] = 0;
-	    s = file_data;
-	}
-    }
-
-    if (strcmp(s, "EOT") == 0)
-	s = "^D\\c";
-    else if (strcmp(s, "BREAK") == 0)
-	s = "\\K\\c";
-
-    if (!put_string(s))
-	fatal(1, "Failed");
-
-    return 0;
-}
-
-int get_char(void)
-{
-    int status;
-    char c;
-
-    status = read(0, &c, 1);
-    checksigs();
-
-    switch (status) {
-    case 1:
-	return ((int)c & 0x7F);
-
-    default:
-	msgf("warning: read() on stdin returned %d", status);
-
-    case -1:
-	return (-1);
-    }
-}
-
-int put_char(int c)
-{
-    int status;
-    char ch = c;
-
-    usleep(10000);		/* inter-character typing delay (?) */
-    checksigs();
-
-    status = write(1, &ch, 1);
-    checksigs();
-
-    switch (status) {
-    case 1:
-	return (0);
-	
-    default:
-	msgf("warning: write() on stdout returned %d", status);
-	
-    case -1:
-	return (-1);
-    }
-}
-
-int write_char(int c)
-{
-    if (alarmed || put_char(c) < 0) {
-	alarm(0);
-	alarmed = 0;
-
-	if (verbose) {
-	    if (errno == EINTR || errno == EWOULDBLOCK)
-		msgf(" -- write timed out");
-	    else
-		msgf(" -- write failed: %m");
-	}
-	return (0);
-    }
-    return (1);
-}
-
-int put_string(register char *s)
-{
-    char *s1;
-    quiet = 0;
-
-    s = clean(s, 1);
-    s1 = s;
-
-    if (verbose) {
-	if (quiet)
-	    msgf("send (?????\?)");
-	else
-	    msgf("send (%v)", s);
-    }
-
-    alarm(timeout); alarmed = 0;
-
-    while (*s) {
-	register char c = *s++;
-
-	if (c != '\\') {
-	    if (!write_char (c)) {
-		free(s1);
-		return 0;
-	    }
-	    continue;
-	}
-
-	c = *s++;
-	switch (c) {
-	case 'd':
-	    sleep(1);
-	    break;
-
-	case 'K':
-	    break_sequence();
-	    break;
-
-	case 'p':
-	    usleep(10000); 	/* 1/100th of a second (arg is microseconds) */
-	    break;
-
-	default:
-	    if (!write_char (c)) {
-		free(s1);
-		return 0;
-	    }
-	    break;
-	}
-	checksigs();
-    }
-
-    alarm(0);
-    alarmed = 0;
-    free(s1);
-    return (1);
-}
-
-/*
- *	Echo a character to stderr.
- *	When called with -1, a '\n' character is generated when
- *	the cursor is not at the beginning of a line.
- */
-int echo_stderr(int n)
-{
-    static int need_lf;
-    char *s;
-    int len, ret = 0;
-
-    switch (n) {
-    case '\r':		/* ignore '\r' */
-	break;
-    case -1:
-	if (need_lf == 0)
-	    break;
-	/* fall through */
-    case '\n':
-	ret = write(2, "\n", 1) != 1;
-	need_lf = 0;
-	break;
-    default:
-	s = character(n);
-	len = strlen(s);
-	ret = write(2, s, len) != len;
-	need_lf = 1;
-	break;
-    }
-    checksigs();
-    return ret;
-}
-
-/*
- *	'Wait for' this string to appear on this file descriptor.
- */
-int get_string(register char *string)
-{
-    char temp[STR_LEN];
-    int c, printed = 0;
-    size_t len, minlen;
-    register char *s = temp, *end = s + STR_LEN;
-    char *s1, *logged = temp;
-
-    fail_reason = (char *)0;
-    string = s1 = clean(string, 0);
-    len = strlen(string);
-    minlen = (len > sizeof(fail_buffer)? len: sizeof(fail_buffer)) - 1;
-
-    if (verbose)
-	msgf("expect (%v)", string);
-
-    if (len > STR_LEN) {
-	msgf("expect string is too long");
-	exit_code = 1;
-	free(s1);
-	return 0;
-    }
-
-    if (len == 0) {
-	if (verbose)
-	    msgf("got it");
-	free(s1);
-	return (1);
-    }
-
-    alarm(timeout);
-    alarmed = 0;
-
-    while ( ! alarmed && (c = get_char()) >= 0) {
-	int n;
-	size_t abort_len, report_len;
-
-	if (echo) {
-	    if (echo_stderr(c) != 0) {
-		fatal(2, "Could not write to stderr, %m");
-	    }
-	}
-	if (verbose && c == '\n') {
-	    if (s == logged)
-		msgf("");	/* blank line */
-	    else
-		msgf("%0.*v", s - logged, logged);
-	    logged = s + 1;
-	}
-
-	*s++ = c;
-
-	if (verbose && s >= logged + 80) {
-	    msgf("%0.*v", s - logged, logged);
-	    logged = s;
-	}
-
-	if (Verbose) {
-	   if (c == '\n')
-	       fputc( '\n', stderr );
-	   else if (c != '\r')
-	       fprintf( stderr, "%s", character(c) );
-	}
-
-	if (!report_gathering) {
-	    for (n = 0; n < n_reports; ++n) {
-		if ((report_string[n] != (char*) NULL) &&
-		    s - temp >= (report_len = strlen(report_string[n])) &&
-		    strncmp(s - report_len, report_string[n], report_len) == 0) {
-		    time_t time_now   = time ((time_t*) NULL);
-		    struct tm* tm_now = localtime (&time_now);
-
-		    strftime (report_buffer, 20, "%b %d %H:%M:%S ", tm_now);
-		    strcat (report_buffer, report_string[n]);
-
-		    free(report_string[n]);
-		    report_string[n] = (char *) NULL;
-		    report_gathering = 1;
-		    break;
-		}
-	    }
-	}
-	else {
-	    if (!iscntrl (c)) {
-		size_t rep_len = strlen (report_buffer);
-		if (rep_len < sizeof(report_buffer) - 1) {
-		    report_buffer[rep_len]     = c;
-		    report_buffer[rep_len + 1] = '\0';
-		}
-	    }
-	    else {
-		report_gathering = 0;
-		fprintf (report_fp, "chat:  %s\n", report_buffer);
-	    }
-	}
-
-	if (s - temp >= len &&
-	    c == string[len - 1] &&
-	    strncmp(s - len, string, len) == 0) {
-	    if (verbose) {
-		if (s > logged)
-		    msgf("%0.*v", s - logged, logged);
-		msgf(" -- got it\n");
-	    }
-
-	    alarm(0);
-	    alarmed = 0;
-	    free(s1);
-	    return (1);
-	}
-
-	for (n = 0; n < n_aborts; ++n) {
-	    if (s - temp >= (abort_len = strlen(abort_string[n])) &&
-		strncmp(s - abort_len, abort_string[n], abort_len) == 0) {
-		if (verbose) {
-		    if (s > logged)
-			msgf("%0.*v", s - logged, logged);
-		    msgf(" -- failed");
-		}
-
-		alarm(0);
-		alarmed = 0;
-		exit_code = n + 4;
-		strcpy(fail_reason = fail_buffer, abort_string[n]);
-		free(s1);
-		return (0);
-	    }
-	}
-
-	if (s >= end) {
-	    if (logged < s - minlen) {
-		if (verbose)
-		    msgf("%0.*v", s - logged, logged);
-		logged = s;
-	    }
-	    s -= minlen;
-	    memmove(temp, s, minlen);
-	    logged = temp + (logged - s);
-	    s = temp + minlen;
-	}
-
-	if (alarmed && verbose)
-	    msgf("warning: alarm synchronization problem");
-    }
-
-    alarm(0);
-    
-    if (verbose && printed) {
-	if (alarmed)
-	    msgf(" -- read timed out");
-	else
-	    msgf(" -- read failed: %m");
-    }
-
-    exit_code = 3;
-    alarmed   = 0;
-    free(s1);
-    return (0);
-}
-
-/*
- * Gross kludge to handle Solaris versions >= 2.6 having usleep.
- */
-#ifdef SOL2
-#include <sys/param.h>
-#if MAXUID > 65536		/* then this is Solaris 2.6 or later */
-#undef NO_USLEEP
-#endif
-#endif /* SOL2 */
-
-#ifdef NO_USLEEP
-#include <sys/types.h>
-#include <sys/time.h>
-
-/*
-  usleep -- support routine for 4.2BSD system call emulations
-  last edit:  29-Oct-1984     D A Gwyn
-  */
-
-extern int	  select();
-
-/* returns 0 if ok, else -1 */
-int usleep(long usec)		/* delay in microseconds */
-{
-    static struct {		/* `timeval' */
-	long	tv_sec;		/* seconds */
-	long	tv_usec;	/* microsecs */
-    } delay;	    		/* _select() timeout */
-
-    delay.tv_sec  = usec / 1000000L;
-    delay.tv_usec = usec % 1000000L;
-
-    return select(0, (long *)0, (long *)0, (long *)0, &delay);
-}
-#endif
-
-void pack_array (
-    char **array, /* The address of the array of string pointers */
-    int end)      /* The index of the next free entry before CLR_ */
-{
-    int i, j;
-
-    for (i = 0; i < end; i++) {
-	if (array[i] == NULL) {
-	    for (j = i+1; j < end; ++j)
-		if (array[j] != NULL)
-		    array[i++] = array[j];
-	    for (; i < end; ++i)
-		array[i] = NULL;
-	    break;
-	}
-    }
-}
-
 /*
  * vfmtmsg - format a message into a buffer.  Like vsprintf except we
  * also specify the length of the output buffer, and we handle the
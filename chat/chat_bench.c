@@ -0,0 +1,308 @@
+/*
+ * chat_bench.c - measure how fast chat gets through a long banner to
+ * its expect string, and how long it takes to send a dial string.
+ *
+ * Runs ./chat on a pseudo-terminal with the usual ABORT strings and
+ * "CONNECT" to expect, and writes it banners of 64 kB and 1 MB before
+ * the CONNECT, printing the elapsed and CPU time.  Then times sending
+ * a 40-character dial string with the default inter-character delay
+ * and with -d 0.  Last, compares a short AT/OK exchange done by
+ * running chat through a shell, as a connect script is, with the same
+ * exchange done by the script engine in this process, as pppd's
+ * connect-chat option does.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "chat-engine.h"
+
+static void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, " (errno %d)\n", errno);
+    exit(1);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char *abort_args[] = {
+    "ABORT", "BUSY", "ABORT", "NO CARRIER", "ABORT", "NO DIALTONE",
+    "ABORT", "NO ANSWER", "ABORT", "ERROR", "ABORT", "DELAYED",
+    "ABORT", "BLACKLISTED", "ABORT", "Access denied",
+};
+#define N_ABORT_ARGS	(sizeof(abort_args) / sizeof(abort_args[0]))
+
+/*
+ * run - run ./chat with args on a pseudo-terminal, writing it the
+ * input given and reading what it sends, until it exits.
+ */
+static void
+run(char *what, char **args, char *input, size_t len)
+{
+    struct termios t;
+    struct rusage ru;
+    struct pollfd pfd;
+    char buf[4096], *slave;
+    double t0, t1;
+    size_t done = 0;
+    pid_t pid;
+    int master, fd, n, status;
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+	|| grantpt(master) < 0 || unlockpt(master) < 0
+	|| (slave = ptsname(master)) == NULL)
+	fatal("can't make a pty");
+    if ((fd = open(slave, O_RDWR | O_NOCTTY)) < 0)
+	fatal("open %s", slave);
+    tcgetattr(fd, &t);
+    cfmakeraw(&t);
+    tcsetattr(fd, TCSANOW, &t);
+
+    t0 = now_ns();
+    pid = fork();
+    if (pid < 0)
+	fatal("fork");
+    if (pid == 0) {
+	dup2(fd, 0);
+	dup2(fd, 1);
+	close(fd);
+	close(master);
+	execv("./chat", args);
+	_exit(127);
+    }
+    close(fd);
+
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    for (;;) {
+	pfd.fd = master;
+	pfd.events = POLLIN | (done < len ? POLLOUT : 0);
+	if (poll(&pfd, 1, -1) < 0)
+	    fatal("poll");
+	if (pfd.revents & POLLIN) {
+	    if (read(master, buf, sizeof(buf)) <= 0)
+		break;
+	} else if (pfd.revents & POLLOUT) {
+	    n = write(master, input + done, len - done);
+	    if (n > 0)
+		done += n;
+	} else if (pfd.revents & (POLLHUP | POLLERR))
+	    break;
+    }
+    if (wait4(pid, &status, 0, &ru) < 0)
+	fatal("wait4");
+    t1 = now_ns();
+    close(master);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	fatal("./chat (%s) failed with status %x", what, status);
+    printf("  %-22s %8.2f ms, cpu %6.2f ms\n", what, (t1 - t0) / 1e6,
+	   (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3
+	   + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3);
+}
+
+/*
+ * banner - make kbytes of terminal server banner followed by CONNECT.
+ */
+static char *
+banner(int kbytes, size_t *lenp)
+{
+    static const char line[] =
+	"Welcome to the terminal server. Unauthorised access prohibited. "
+	"Line 00 ready\r\n";
+    size_t len = (size_t) kbytes << 10, n = 0, l = sizeof(line) - 1;
+    char *b;
+
+    if ((b = malloc(len + l + 16)) == NULL)
+	fatal("no memory");
+    while (n < len) {
+	memcpy(b + n, line, l);
+	n += l;
+    }
+    strcpy(b + n, "CONNECT 115200\r\n");
+    *lenp = n + strlen(b + n);
+    return b;
+}
+
+/*
+ * open_pty - make a raw pseudo-terminal, returning the master and
+ * putting the slave in *slavep.
+ */
+static int
+open_pty(int *slavep)
+{
+    struct termios t;
+    char *slave;
+    int master;
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+	|| grantpt(master) < 0 || unlockpt(master) < 0
+	|| (slave = ptsname(master)) == NULL)
+	fatal("can't make a pty");
+    if ((*slavep = open(slave, O_RDWR | O_NOCTTY)) < 0)
+	fatal("open %s", slave);
+    tcgetattr(*slavep, &t);
+    cfmakeraw(&t);
+    tcsetattr(*slavep, TCSANOW, &t);
+    return master;
+}
+
+/*
+ * modem - act as the modem on the master side: answer OK to a line.
+ * Returns -1 when the other side has closed.
+ */
+static int
+modem(int master)
+{
+    char buf[256];
+    int n;
+
+    n = read(master, buf, sizeof(buf));
+    if (n <= 0)
+	return -1;
+    if (memchr(buf, '\r', n) != NULL && write(master, "OK\r\n", 4) != 4)
+	fatal("write");
+    return 0;
+}
+
+#define N_DIALS		200
+
+static void
+dial_exec(void)
+{
+    struct pollfd pfd;
+    double t0;
+    pid_t pid;
+    int i, master, fd, status;
+
+    t0 = now_ns();
+    for (i = 0; i < N_DIALS; ++i) {
+	master = open_pty(&fd);
+	pid = fork();
+	if (pid < 0)
+	    fatal("fork");
+	if (pid == 0) {
+	    dup2(fd, 0);
+	    dup2(fd, 1);
+	    close(fd);
+	    close(master);
+	    execl("/bin/sh", "sh", "-c", "./chat -d 0 '' AT OK", (char *)0);
+	    _exit(127);
+	}
+	close(fd);
+	pfd.fd = master;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, -1) > 0 && !(pfd.revents & (POLLHUP | POLLERR)))
+	    if (modem(master) < 0)
+		break;
+	if (waitpid(pid, &status, 0) < 0)
+	    fatal("waitpid");
+	close(master);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    fatal("./chat (dial) failed with status %x", status);
+    }
+    printf("  %-22s %8.3f ms per dial\n", "sh -c chat",
+	   (now_ns() - t0) / 1e6 / N_DIALS);
+}
+
+static void
+dial_engine(void)
+{
+    struct chat c;
+    struct pollfd pfd[3];
+    double t0;
+    int i, master, fd, ms;
+
+    t0 = now_ns();
+    for (i = 0; i < N_DIALS; ++i) {
+	master = open_pty(&fd);
+	chat_init(&c, fd, fd, NULL, NULL);
+	c.char_delay = 0;
+	if (chat_add_arg(&c, "") < 0 || chat_add_arg(&c, "AT") < 0
+	    || chat_add_arg(&c, "OK") < 0)
+	    fatal("no memory");
+	chat_start(&c);
+	while (c.status == CHAT_RUNNING) {
+	    chat_pollfds(&c, pfd, &ms);
+	    pfd[2].fd = master;
+	    pfd[2].events = POLLIN;
+	    if (poll(pfd, 3, ms) < 0)
+		fatal("poll");
+	    if ((pfd[2].revents & POLLIN) && modem(master) < 0)
+		break;
+	    chat_handle(&c, pfd);
+	}
+	if (c.status != CHAT_DONE)
+	    fatal("engine (dial) failed with code %d", c.exit_code);
+	chat_free(&c);
+	close(fd);
+	close(master);
+    }
+    printf("  %-22s %8.3f ms per dial\n", "in-process engine",
+	   (now_ns() - t0) / 1e6 / N_DIALS);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int sizes[] = { 64, 1024 };
+    char *args[N_ABORT_ARGS + 8], *input, what[32];
+    size_t len;
+    int i, n;
+
+    printf("chat reading a banner before CONNECT, %d ABORT strings:\n",
+	   (int) N_ABORT_ARGS / 2);
+    n = 0;
+    args[n++] = "chat";
+    args[n++] = "-S";
+    memcpy(args + n, abort_args, sizeof(abort_args));
+    n += N_ABORT_ARGS;
+    args[n++] = "CONNECT";
+    args[n] = NULL;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	input = banner(sizes[i], &len);
+	sprintf(what, "%5d kB banner", sizes[i]);
+	run(what, args, input, len);
+	free(input);
+    }
+
+    printf("chat sending a 40-character dial string:\n");
+    n = 0;
+    args[n++] = "chat";
+    args[n++] = "-S";
+    args[n++] = "";
+    args[n++] = "ATDT012345678901234567890123456789012345\\c";
+    args[n] = NULL;
+    run("default delay", args, "", 0);
+    memmove(args + 3, args + 1, 4 * sizeof(args[0]));
+    args[1] = "-d";
+    args[2] = "0";
+    run("-d 0", args, "", 0);
+
+    printf("chat dialling (AT, OK) %d times:\n", N_DIALS);
+    dial_exec();
+    dial_engine();
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * match.c - find any of a set of strings in the characters received.
+ *
+ * Copyright 2026 The ppp project contributors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+
+/*
+ * matcher_build - make the automaton for strings[0..n-1].  String i
+ * is reported as bit i of out; NULL entries are left out, as are
+ * strings with a character that can never be received.  Returns 0, or
+ * -1 if out of memory.
+ */
+int
+matcher_build(struct matcher *m, char **strings, int n)
+{
+    int *fail, *queue;
+    int i, c, u, v, f, w, head, tail, size = 1;
+    unsigned char *p;
+
+    for (i = 0; i < n; ++i)
+	if (strings[i] != NULL)
+	    size += strlen(strings[i]);
+    memset(m, 0, sizeof(*m));
+    m->words = (n + 63) / 64;
+    if (m->words == 0)
+	m->words = 1;
+    m->next = calloc(size, sizeof(*m->next));
+    m->out = calloc((size_t) size * m->words, sizeof(*m->out));
+    m->hit = calloc(size, 1);
+    fail = calloc(size, sizeof(int));
+    queue = calloc(size, sizeof(int));
+    if (!m->next || !m->out || !m->hit || !fail || !queue) {
+	free(fail);
+	free(queue);
+	matcher_free(m);
+	return -1;
+    }
+
+    /* the trie; 0 means no edge, as no edge leads back to the start */
+    m->nstates = 1;
+    for (i = 0; i < n; ++i) {
+	if (strings[i] == NULL)
+	    continue;
+	for (p = (unsigned char *) strings[i]; *p != 0; ++p)
+	    if (*p >= MATCH_CHARS)
+		break;
+	if (*p != 0)
+	    continue;
+	u = 0;
+	for (p = (unsigned char *) strings[i]; *p != 0; ++p) {
+	    if (m->next[u][*p] == 0)
+		m->next[u][*p] = m->nstates++;
+	    u = m->next[u][*p];
+	}
+	m->out[u * m->words + i / 64] |= (uint64_t) 1 << (i % 64);
+	m->hit[u] = 1;
+    }
+
+    /*
+     * Breadth first, so the failure state of each state is done before
+     * it: an edge the trie lacks goes where the failure state's does,
+     * and a state also ends the strings its failure state ends.
+     */
+    head = tail = 0;
+    for (c = 0; c < MATCH_CHARS; ++c) {
+	v = m->next[0][c];
+	if (v != 0) {
+	    fail[v] = 0;
+	    queue[tail++] = v;
+	}
+    }
+    while (head < tail) {
+	u = queue[head++];
+	f = fail[u];
+	for (w = 0; w < m->words; ++w)
+	    m->out[u * m->words + w] |= m->out[f * m->words + w];
+	m->hit[u] |= m->hit[f];
+	for (c = 0; c < MATCH_CHARS; ++c) {
+	    v = m->next[u][c];
+	    if (v != 0) {
+		fail[v] = m->next[f][c];
+		queue[tail++] = v;
+	    } else
+		m->next[u][c] = m->next[f][c];
+	}
+    }
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+void
+matcher_free(struct matcher *m)
+{
+    free(m->next);
+    free(m->out);
+    free(m->hit);
+    memset(m, 0, sizeof(*m));
+}
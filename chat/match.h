@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * match.h - find any of a set of strings in the characters received,
+ * for chat's expect, ABORT and REPORT strings.
+ *
+ * Copyright 2026 The ppp project contributors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CHAT_MATCH_H
+#define CHAT_MATCH_H
+
+#include <stdint.h>
+
+#define MATCH_CHARS	128	/* received characters are 7-bit */
+
+/*
+ * An Aho-Corasick automaton over all the strings, with its failure
+ * transitions folded in so that each received character takes one
+ * table lookup.  State 0 is the start state.  out holds, for each
+ * state, a bitmap of the strings that end there (words 64-bit words
+ * per state); hit says whether any do.
+ */
+struct matcher {
+    int		nstates;
+    int		words;
+    int		(*next)[MATCH_CHARS];
+    uint64_t	*out;
+    char	*hit;
+};
+
+int matcher_build(struct matcher *, char **strings, int n);
+void matcher_free(struct matcher *);
+
+#define match_step(m, state, c)	((m)->next[state][(c) & (MATCH_CHARS - 1)])
+#define match_hit(m, state)	((m)->hit[state])
+#define match_ends(m, state, i)	\
+	(((m)->out[(state) * (m)->words + (i) / 64] >> ((i) % 64)) & 1)
+
+#endif /* CHAT_MATCH_H */
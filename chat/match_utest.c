@@ -0,0 +1,279 @@
+/*
+ * match_utest.c - check the matcher for chat's expect, ABORT and REPORT
+ * strings against a plain search of the characters received, and check
+ * that the script engine still finds strings that straddle the point
+ * where it shifts its buffer of received characters.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "chat-engine.h"
+
+static int failures;
+
+/*
+ * ends_at - does s end at text[i], the way chat compared strings before
+ * the matcher: received characters have their top bit stripped, and a
+ * string with a character >= 0x80 can never be received.
+ */
+static int
+ends_at(const char *s, const unsigned char *text, int i)
+{
+    int j, len = strlen(s);
+
+    if (len > i + 1)
+	return 0;
+    for (j = 0; j < len; ++j)
+	if ((unsigned char) s[j] >= MATCH_CHARS
+	    || (unsigned char) s[j] != (text[i + 1 - len + j] & 0x7F))
+	    return 0;
+    return 1;
+}
+
+/*
+ * check_set - feed text to the matcher for strings[0..n-1] and compare
+ * each string's ends with ends_at after every character.
+ */
+static void
+check_set(const char *what, char **strings, int n,
+	  const unsigned char *text, int tlen)
+{
+    struct matcher m;
+    int i, k, state, any, want;
+
+    if (matcher_build(&m, strings, n) < 0) {
+	printf("%s: matcher_build failed\n", what);
+	++failures;
+	return;
+    }
+    state = 0;
+    for (i = 0; i < tlen; ++i) {
+	state = match_step(&m, state, text[i]);
+	any = 0;
+	for (k = 0; k < n; ++k) {
+	    want = strings[k] != NULL && ends_at(strings[k], text, i);
+	    any |= want;
+	    if ((int) match_ends(&m, state, k) != want) {
+		printf("%s: string %d \"%s\" after %d chars: got %d\n",
+		       what, k, strings[k]? strings[k]: "(null)", i + 1, !want);
+		++failures;
+		goto out;
+	    }
+	}
+	if (!!match_hit(&m, state) != any) {
+	    printf("%s: hit wrong after %d chars\n", what, i + 1);
+	    ++failures;
+	    goto out;
+	}
+    }
+out:
+    matcher_free(&m);
+}
+
+static void
+test_fixed(void)
+{
+    static char *suffixes[] = { "CONNECT", "NNECT", "ECT", "T", "CONNECT" };
+    static char *overlap[] = { "he", "she", "his", "hers" };
+    static char *runs[] = { "aaa", "a", "aa", "aaaa" };
+    static char *empty[] = { "", "OK", NULL, "K" };
+    static char *high[] = { "\xC3\x89T\xC3\x89", "ET", "\x80", "A" };
+    static char *chat_like[] = {
+	"CONNECT", "BUSY", "NO CARRIER", "CARRIER", "ERROR", "NO DIALTONE",
+	"CONNECT"
+    };
+    const char *text;
+
+    text = "CONNECTCONNECONNECT ECT T";
+    check_set("suffixes", suffixes, 5, (unsigned char *) text, strlen(text));
+    text = "ushershishehershis";
+    check_set("overlap", overlap, 4, (unsigned char *) text, strlen(text));
+    text = "aaaaaabaaaba";
+    check_set("runs", runs, 4, (unsigned char *) text, strlen(text));
+    text = "xOKOKK";
+    check_set("empty", empty, 4, (unsigned char *) text, strlen(text));
+    text = "\xC3\x89T\xC3\x89 \xC5\xD4 \x80\x80 \xC1";
+    check_set("high", high, 4, (unsigned char *) text, strlen(text));
+    text = "ATDT\r\nNO CARRIER\r\nBUSY\r\nCONNECT 9600\r\nNO DIALTONE";
+    check_set("chat", chat_like, 7, (unsigned char *) text, strlen(text));
+}
+
+/*
+ * test_random - random strings over a small alphabet, so they overlap a
+ * lot, as many as pppd's connect-chat gives the matcher (so out takes
+ * more than one word per state), against random text.
+ */
+static void
+test_random(void)
+{
+    static const char alphabet[] = "ABAB\r\xC1\xC2";
+    char *strings[1 + CHAT_MAX_ABORTS + CHAT_MAX_REPORTS];
+    unsigned char text[4000];
+    int round, n, k, j, len;
+
+    srand(1);
+    for (round = 0; round < 50; ++round) {
+	n = 1 + rand() % (sizeof(strings) / sizeof(strings[0]));
+	for (k = 0; k < n; ++k) {
+	    if (rand() % 10 == 0) {
+		strings[k] = NULL;
+		continue;
+	    }
+	    len = rand() % 7;
+	    strings[k] = malloc(len + 1);
+	    for (j = 0; j < len; ++j)
+		strings[k][j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+	    strings[k][len] = 0;
+	}
+	for (j = 0; j < sizeof(text); ++j)
+	    text[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+	check_set("random", strings, n, text, sizeof(text));
+	for (k = 0; k < n; ++k)
+	    free(strings[k]);
+    }
+}
+
+static char report_line[4096];
+
+static void
+test_report(void *arg, const char *line)
+{
+    strcpy(report_line, line);
+}
+
+static void
+test_log(void *arg, int level, const char *fmt, va_list ap)
+{
+}
+
+static const struct chat_ops test_ops = {
+    test_log, test_report, NULL
+};
+
+/*
+ * run_script - run the engine on script with input already waiting on
+ * a pipe, which is closed after it.  Returns chat's exit code.
+ */
+static int
+run_script(char **script, const char *input, size_t len)
+{
+    struct chat c;
+    struct pollfd pfd[2];
+    int p[2], out, ms, code;
+
+    if (pipe(p) < 0 || (out = open("/dev/null", O_WRONLY)) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    if (write(p[1], input, len) != len) {
+	perror("write");
+	exit(1);
+    }
+    close(p[1]);
+    chat_init(&c, p[0], out, &test_ops, NULL);
+    c.char_delay = 0;
+    for (; *script != NULL; ++script)
+	if (chat_add_arg(&c, *script) < 0) {
+	    printf("chat_add_arg failed\n");
+	    exit(1);
+	}
+    report_line[0] = 0;
+    chat_start(&c);
+    while (c.status == CHAT_RUNNING) {
+	chat_pollfds(&c, pfd, &ms);
+	if (poll(pfd, 2, ms) < 0) {
+	    perror("poll");
+	    exit(1);
+	}
+	chat_handle(&c, pfd);
+    }
+    code = c.status == CHAT_DONE? 0: c.exit_code;
+    chat_free(&c);
+    close(p[0]);
+    close(out);
+    return code;
+}
+
+/*
+ * test_shift - put each string so that it ends a little either side of
+ * where the engine has a full buffer and keeps only its tail.
+ */
+static void
+test_shift(void)
+{
+    static char *expect[] = { "ABORT", "NO CARRIER", "CONNECT", NULL };
+    static char *report[] = {
+	"REPORT", "CONNECT", "ABORT", "BUSY", "OK", NULL
+    };
+    char input[3 * CHAT_STR_LEN];
+    int pad, code;
+
+    for (pad = CHAT_STR_LEN - 12; pad <= 2 * CHAT_STR_LEN + 4; ++pad) {
+	if (pad == CHAT_STR_LEN + 4)
+	    pad = 2 * CHAT_STR_LEN - 12;
+
+	memset(input, 'x', pad);
+	strcpy(input + pad, "CONNECT 115200\r\n");
+	code = run_script(expect, input, strlen(input));
+	if (code != 0) {
+	    printf("shift %d: CONNECT not seen, code %d\n", pad, code);
+	    ++failures;
+	}
+
+	strcpy(input + pad, "NO CARRIER\r\n");
+	code = run_script(expect, input, strlen(input));
+	if (code != 4) {
+	    printf("shift %d: ABORT not seen, code %d\n", pad, code);
+	    ++failures;
+	}
+
+	/* the top bit of what is received doesn't count */
+	memcpy(input + pad, "C\xCFNNEC\xD4", 7);
+	code = run_script(expect, input, pad + 7);
+	if (code != 0) {
+	    printf("shift %d: CONNECT with parity not seen, code %d\n",
+		   pad, code);
+	    ++failures;
+	}
+
+	/* a REPORT string is gathered to the end of its line */
+	strcpy(input + pad, "CONNECT 9600/V42\r\nOK\r\n");
+	code = run_script(report, input, strlen(input));
+	if (code != 0 || strstr(report_line, "CONNECT 9600/V42") == NULL) {
+	    printf("shift %d: REPORT gave code %d, \"%s\"\n",
+		   pad, code, report_line);
+	    ++failures;
+	}
+    }
+
+    /* an expect and an ABORT string that end on the same character */
+    expect[2] = "CARRIER";
+    code = run_script(expect, "NO CARRIER\r\n", 12);
+    expect[2] = "CONNECT";
+    if (code != 0) {
+	printf("same end: got code %d, not the expect string\n", code);
+	++failures;
+    }
+
+    /* with nothing received, the expect string times out */
+    code = run_script(expect, "", 0);
+    if (code != 3) {
+	printf("no input: got code %d\n", code);
+	++failures;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_fixed();
+    test_random();
+    test_shift();
+    if (failures == 0)
+	printf("all match tests passed\n");
+    return failures;
+}
@@ -181,6 +181,9 @@ pap_check_hook_fn *pap_check_hook = NULL;
 /* Hook for a plugin to check the PAP user and password */
 pap_auth_hook_fn *pap_auth_hook = NULL;
 
+/* Hook for a plugin to drop a pending pap_auth_hook check */
+pap_auth_cancel_hook_fn *pap_auth_cancel_hook = NULL;
+
 /* Hook for a plugin to know about the PAP user logout */
 pap_logout_hook_fn *pap_logout_hook = NULL;
 
@@ -650,6 +653,18 @@ void start_link(int unit)
 
     hungup = 0;
     devfd = the_channel->connect();
+    if (devfd != CONNECT_PENDING)
+	ppp_link_connected(devfd);
+}
+
+/*
+ * ppp_link_connected - set up the channel the_channel->connect gave us,
+ * directly or after returning CONNECT_PENDING, and start LCP on it.
+ */
+void
+ppp_link_connected(int fd)
+{
+    devfd = fd;
     if (devfd < 0)
 	goto fail;
 
@@ -708,6 +723,17 @@ link_terminated(int unit)
 	return;
     new_phase(PHASE_DISCONNECT);
 
+    if (devfd == CONNECT_PENDING) {
+	/* give up connecting; the link never came up */
+	if (the_channel->disconnect)
+	    the_channel->disconnect();
+	devfd = -1;
+	if (the_channel->cleanup)
+	    (*the_channel->cleanup)();
+	new_phase(PHASE_DEAD);
+	return;
+    }
+
     if (pap_logout_hook) {
 	pap_logout_hook();
     }
@@ -1487,7 +1513,10 @@ auth_reset(int unit)
  * returns:
  *	UPAP_AUTHNAK: Authentication failed.
  *	UPAP_AUTHACK: Authentication succeeded.
- * In either case, msg points to an appropriate message.
+ *	UPAP_AUTHPENDING: pap_auth_hook is still checking; the plugin
+ *		delivers the result later through upap_auth_complete(),
+ *		which applies it with check_passwd_done().
+ * In the first two cases, msg points to an appropriate message.
  */
 int
 check_passwd(int unit,
@@ -1516,17 +1545,13 @@ check_passwd(int unit,
      */
     if (pap_auth_hook) {
 	ret = (*pap_auth_hook)(user, passwd, msg, &addrs, &opts);
+	if (ret == PAP_AUTH_PENDING) {
+	    BZERO(passwd, sizeof(passwd));
+	    return UPAP_AUTHPENDING;
+	}
 	if (ret >= 0) {
-	    /* note: set_allowed_addrs() saves opts (but not addrs):
-	       don't free it! */
-	    if (ret)
-		set_allowed_addrs(unit, addrs, opts);
-	    else if (opts != 0)
-		free_wordlist(opts);
-	    if (addrs != 0)
-		free_wordlist(addrs);
 	    BZERO(passwd, sizeof(passwd));
-	    return ret? UPAP_AUTHACK: UPAP_AUTHNAK;
+	    return check_passwd_done(unit, ret, addrs, opts);
 	}
     }
 
@@ -1616,6 +1641,26 @@ check_passwd(int unit,
     return ret;
 }
 
+/*
+ * check_passwd_done - apply the result of a pap_auth_hook check, made
+ * either from check_passwd or later via upap_auth_complete.
+ * Consumes addrs and opts.  Returns UPAP_AUTHACK or UPAP_AUTHNAK.
+ */
+int
+check_passwd_done(int unit, int ok, struct wordlist *addrs,
+		  struct wordlist *opts)
+{
+    /* note: set_allowed_addrs() saves opts (but not addrs):
+       don't free it! */
+    if (ok)
+	set_allowed_addrs(unit, addrs, opts);
+    else if (opts != 0)
+	free_wordlist(opts);
+    if (addrs != 0)
+	free_wordlist(addrs);
+    return ok? UPAP_AUTHACK: UPAP_AUTHNAK;
+}
+
 /*
  * null_login - Check if a username of "" and a password of "" are
  * acceptable, and iff so, set the list of acceptable IP addresses
@@ -47,6 +47,8 @@ int chap_mdtype_all = MDTYPE_ALL;
 
 /* Hook for a plugin to validate CHAP challenge */
 chap_verify_hook_fn *chap_verify_hook = NULL;
+chap_verify_hook_fn *chap_verify_async_hook = NULL;
+chap_verify_cancel_hook_fn *chap_verify_cancel_hook = NULL;
 
 /*
  * Option variables.
@@ -100,6 +102,8 @@ static struct chap_server_state {
 	int challenge_pktlen;
 	unsigned char challenge[CHAL_MAX_PKTLEN];
 	char message[256];
+	int pending_id;			/* response being verified ... */
+	char pending_name[MAXNAMELEN+1];	/* ... and the peer's name */
 } server;
 
 /* Values for flags in chap_client_state and chap_server_state */
@@ -109,6 +113,7 @@ static struct chap_server_state {
 #define AUTH_FAILED		8
 #define TIMEOUT_PENDING		0x10
 #define CHALLENGE_VALID		0x20
+#define VERIFY_PENDING		0x40
 
 /*
  * Prototypes.
@@ -116,12 +121,15 @@ static struct chap_server_state {
 static void chap_init(int unit);
 static void chap_lowerup(int unit);
 static void chap_lowerdown(int unit);
+static void chap_verify_cancel(struct chap_server_state *ss);
 static void chap_server_timeout(void *arg);
 static void chap_client_timeout(void *arg);
 static void chap_generate_challenge(struct chap_server_state *ss);
 static void chap_handle_response(struct chap_server_state *ss, int code,
 		unsigned char *pkt, int len);
 static chap_verify_hook_fn chap_verify_response;
+static void chap_send_result(struct chap_server_state *ss, int id,
+		char *name);
 static void chap_respond(struct chap_client_state *cs, int id,
 		unsigned char *pkt, int len);
 static void chap_handle_status(struct chap_client_state *cs, int code, int id,
@@ -197,9 +205,25 @@ chap_lowerdown(int unit)
 	cs->flags = 0;
 	if (ss->flags & TIMEOUT_PENDING)
 		UNTIMEOUT(chap_server_timeout, ss);
+	chap_verify_cancel(ss);
 	ss->flags = 0;
 }
 
+/*
+ * chap_verify_cancel - tell the plugin to drop the check of a response
+ * which is still pending, so that its answer can't be taken for that
+ * of a later response.
+ */
+static void
+chap_verify_cancel(struct chap_server_state *ss)
+{
+	if ((ss->flags & VERIFY_PENDING) == 0)
+		return;
+	ss->flags &= ~VERIFY_PENDING;
+	if (chap_verify_cancel_hook)
+		(*chap_verify_cancel_hook)();
+}
+
 /*
  * chap_auth_peer - Start authenticating the peer.
  * If the lower layer is already up, we start sending challenges,
@@ -332,13 +356,13 @@ static void
 chap_handle_response(struct chap_server_state *ss, int id,
 		     unsigned char *pkt, int len)
 {
-	int response_len, ok, mlen;
-	unsigned char *response, *p;
+	int response_len, ok;
+	unsigned char *response;
 	char *name = NULL;
 	chap_verify_hook_fn *verifier;
 	char rname[MAXNAMELEN+1];
 
-	if ((ss->flags & LOWERUP) == 0)
+	if ((ss->flags & (LOWERUP | VERIFY_PENDING)) != LOWERUP)
 		return;
 	if (id != ss->challenge[PPP_HDRLEN+1] || len < 2)
 		return;
@@ -371,13 +395,22 @@ chap_handle_response(struct chap_server_state *ss, int id,
 			}
 		}
 
-		if (chap_verify_hook)
+		if (chap_verify_async_hook)
+			verifier = chap_verify_async_hook;
+		else if (chap_verify_hook)
 			verifier = chap_verify_hook;
 		else
 			verifier = chap_verify_response;
 		ok = (*verifier)(name, ss->name, id, ss->digest,
 				 ss->challenge + PPP_HDRLEN + CHAP_HDRLEN,
 				 response, ss->message, sizeof(ss->message));
+		if (ok == CHAP_VERIFY_PENDING) {
+			ss->flags |= VERIFY_PENDING;
+			ss->pending_id = id;
+			strlcpy(ss->pending_name, name,
+				sizeof(ss->pending_name));
+			return;
+		}
 		if (!ok || !auth_number()) {
 			ss->flags |= AUTH_FAILED;
 			warn("Peer %q failed CHAP authentication", name);
@@ -385,6 +418,38 @@ chap_handle_response(struct chap_server_state *ss, int id,
 	} else if ((ss->flags & AUTH_DONE) == 0)
 		return;
 
+	chap_send_result(ss, id, name);
+}
+
+/*
+ * chap_verify_complete - called by a plugin when it has finished
+ * verifying the response chap_verify_async_hook left pending.
+ */
+void
+chap_verify_complete(int ok)
+{
+	struct chap_server_state *ss = &server;
+
+	if ((ss->flags & VERIFY_PENDING) == 0)
+		return;		/* link went down meanwhile */
+	ss->flags &= ~VERIFY_PENDING;
+	if (!ok || !auth_number()) {
+		ss->flags |= AUTH_FAILED;
+		warn("Peer %q failed CHAP authentication", ss->pending_name);
+	}
+	chap_send_result(ss, ss->pending_id, ss->pending_name);
+}
+
+/*
+ * chap_send_result - send success or failure for a checked response
+ * and act on it.
+ */
+static void
+chap_send_result(struct chap_server_state *ss, int id, char *name)
+{
+	unsigned char *p;
+	int len, mlen;
+
 	/* send the response */
 	p = outpacket_buf;
 	MAKEHEADER(p, PPP_CHAP);
@@ -600,6 +665,7 @@ chap_protrej(int unit)
 		ss->flags &= ~TIMEOUT_PENDING;
 		UNTIMEOUT(chap_server_timeout, ss);
 	}
+	chap_verify_cancel(ss);
 	if (ss->flags & AUTH_STARTED) {
 		ss->flags = 0;
 		auth_peer_fail(0, PPP_CHAP);
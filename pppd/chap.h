@@ -150,6 +150,26 @@ typedef int (chap_verify_hook_fn)(char *name, char *ourname, int id,
 			char *message, int message_space);
 extern chap_verify_hook_fn *chap_verify_hook;
 
+/*
+ * Like chap_verify_hook, but may also return CHAP_VERIFY_PENDING and
+ *   report the result later through chap_verify_complete().  Only used
+ *   for CHAP proper; EAP still calls chap_verify_hook.
+ */
+extern chap_verify_hook_fn *chap_verify_async_hook;
+
+#define CHAP_VERIFY_PENDING	(-1)
+
+/* Called by a plugin to finish a pending chap_verify_async_hook check */
+extern void chap_verify_complete(int ok);
+
+/*
+ * Called when the link goes down or CHAP is rejected while a
+ *   chap_verify_async_hook check is pending.  The plugin must forget
+ *   the check and not call chap_verify_complete() for it.
+ */
+typedef void (chap_verify_cancel_hook_fn)(void);
+extern chap_verify_cancel_hook_fn *chap_verify_cancel_hook;
+
 /* Called by digest code to register a digest type */
 extern void chap_register_digest(struct chap_digest_type *);
 
@@ -1,5 +1,6 @@
 /*
- * event-handler.c - generic select() based event handler.  Should be system
+ * event-handler.c - generic event handler.  Uses epoll() where configure
+ * found it, select() otherwise; the select() version should be system
  * independent.
  *
  * Copyright (c) 1994-2025 Paul Mackerras. All rights reserved.
@@ -26,14 +27,30 @@
  *
  * Derived from sys-linux.c and sys-solaris.c by Jaco Kroon <jaco@uls.co.za>.
  */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <limits.h>
 #include <stddef.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/select.h>
 
 #include "pppd.h"
 #include "pppd-private.h"
 
+/*
+ * The bench program builds this file a second time with
+ * PPP_EVENT_FORCE_SELECT to compare the two backends.
+ */
+#if defined(PPP_WITH_EPOLL) && !defined(PPP_EVENT_FORCE_SELECT)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifndef USE_EPOLL
+
 struct event_handler {
     struct event_handler* next;
     int fd;
@@ -93,9 +110,15 @@ void add_fd(int fd)
 	max_in_fd = fd;
 }
 
-void add_fd_callback(int fd, event_cb cb, void* ctx)
+/*
+ * add_fd_callback_flags - as add_fd_callback.  select() is always
+ * level-triggered, so EVENT_EDGE makes no difference here.
+ */
+void add_fd_callback_flags(int fd, event_cb cb, void* ctx, int flags)
 {
     struct event_handler *n = malloc(sizeof(*n));
+    if (n == NULL)
+	novm("event handler");
     n->next = handlers;
     n->fd = fd;
     n->cb = cb;
@@ -128,3 +151,189 @@ void event_handler_init()
     FD_ZERO(&in_fds);
     max_in_fd = 0;
 }
+
+#else /* USE_EPOLL */
+
+/*
+ * Per-fd state, indexed directly by fd number so that dispatching a
+ * ready fd costs O(1) whatever the number of registered fds.  The
+ * generation count is stored in the epoll event data alongside the fd,
+ * so an event for an fd that was removed (and perhaps re-added with a
+ * different callback) by an earlier callback in the same batch is
+ * recognised as stale and dropped.
+ */
+struct event_slot {
+    event_cb cb;
+    void* ctx;
+    unsigned int gen;		/* bumped on every add/remove */
+    unsigned char active;	/* fd is in the wait set */
+    unsigned char edge;		/* registered with EPOLLET */
+    unsigned char nopoll;	/* epoll refused it (e.g. regular file) */
+};
+
+#define MAX_EVENTS	64	/* events fetched per epoll_wait() call */
+
+static int epoll_fd = -1;
+static struct event_slot *slots;
+static int n_slots;
+static int n_nopoll;		/* fds that are always considered ready */
+
+static struct event_slot *get_slot(int fd)
+{
+    int n;
+
+    if (fd < 0)
+	fatal("internal error: bad file descriptor (%d)", fd);
+    if (fd >= n_slots) {
+	n = n_slots? n_slots: 64;
+	while (n <= fd)
+	    n *= 2;
+	slots = realloc(slots, n * sizeof(*slots));
+	if (slots == NULL)
+	    novm("event handler table");
+	memset(slots + n_slots, 0, (n - n_slots) * sizeof(*slots));
+	n_slots = n;
+    }
+    return &slots[fd];
+}
+
+static void set_interest(int fd, struct event_slot *s, int edge)
+{
+    struct epoll_event ev;
+    int op = s->active? EPOLL_CTL_MOD: EPOLL_CTL_ADD;
+
+    if (s->nopoll)
+	return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLPRI | (edge? EPOLLET: 0);
+    ev.data.u64 = ((uint64_t) s->gen << 32) | (uint32_t) fd;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+	if (errno != EPERM)
+	    fatal("epoll_ctl(%d): %m", fd);
+	/* select() reports such fds as always readable; do the same */
+	s->nopoll = 1;
+	++n_nopoll;
+    }
+    s->edge = edge;
+}
+
+static void dispatch(int fd)
+{
+    struct event_slot *s = &slots[fd];
+
+    if (s->active && s->cb != NULL)
+	s->cb(fd, s->ctx);
+}
+
+/********************************************************************
+ *
+ * wait_input - wait until there is data available,
+ * for the length of time specified by *timo (indefinite
+ * if timo is NULL).
+ */
+
+void wait_input(struct timeval *timo)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int i, n, fd, ms = -1;
+    unsigned int gen;
+
+    if (n_nopoll)
+	ms = 0;
+    else if (timo != NULL)
+	/* round up so that we never wake before the timeout is due */
+	ms = timo->tv_sec * 1000 + (timo->tv_usec + 999) / 1000;
+
+    n = epoll_wait(epoll_fd, events, MAX_EVENTS, ms);
+    if (n < 0) {
+	if (errno != EINTR)
+	    fatal("epoll_wait: %m");
+	n = 0;
+    }
+
+    for (i = 0; i < n; ++i) {
+	fd = (int) (events[i].data.u64 & 0xffffffff);
+	gen = (unsigned int) (events[i].data.u64 >> 32);
+	if (fd < n_slots && slots[fd].gen == gen)
+	    dispatch(fd);
+    }
+
+    if (n_nopoll) {
+	for (fd = 0; fd < n_slots; ++fd)
+	    if (slots[fd].nopoll)
+		dispatch(fd);
+    }
+}
+
+/*
+ * add_fd - add an fd to the set that wait_input waits for.
+ */
+void add_fd(int fd)
+{
+    struct event_slot *s = get_slot(fd);
+
+    if (s->active)
+	return;
+    ++s->gen;
+    set_interest(fd, s, 0);
+    s->active = 1;
+}
+
+/*
+ * add_fd_callback_flags - add an fd with a callback to be run when it
+ * becomes readable.  With EVENT_EDGE the fd is edge-triggered, so the
+ * callback must read until EAGAIN or it may not be called again.
+ */
+void add_fd_callback_flags(int fd, event_cb cb, void* ctx, int flags)
+{
+    struct event_slot *s = get_slot(fd);
+    int edge = (flags & EVENT_EDGE) != 0;
+
+    s->cb = cb;
+    s->ctx = ctx;
+    if (s->active && s->edge == edge)
+	return;
+    if (!s->active)
+	++s->gen;
+    set_interest(fd, s, edge);
+    s->active = 1;
+}
+
+/*
+ * remove_fd - remove an fd from the set that wait_input waits for.
+ */
+void remove_fd(int fd)
+{
+    struct event_slot *s;
+
+    if (fd < 0 || fd >= n_slots || !slots[fd].active)
+	return;
+    s = &slots[fd];
+    if (s->nopoll) {
+	s->nopoll = 0;
+	--n_nopoll;
+    } else {
+	/* the fd may already have been closed, which removes it anyway */
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    s->active = 0;
+    s->cb = NULL;
+    s->ctx = NULL;
+    ++s->gen;
+}
+
+void event_handler_init()
+{
+    if (epoll_fd < 0) {
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+	    fatal("epoll_create1: %m");
+    }
+}
+
+#endif /* USE_EPOLL */
+
+void add_fd_callback(int fd, event_cb cb, void* ctx)
+{
+    add_fd_callback_flags(fd, cb, ctx, 0);
+}
@@ -0,0 +1,132 @@
+/*
+ * event_bench.c - measure event handler wakeup latency.
+ *
+ * Registers 1, 16 and 256 pipes with add_fd_callback(), then repeatedly
+ * makes one of them readable and times how long wait_input() takes to
+ * get to its callback.  Built against both the configured backend
+ * (bench_event) and the select() backend (bench_event_select).
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "pppd-private.h"
+
+#define ITERATIONS	20000
+
+static int fired;
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, " (errno %d)\n", errno);
+    exit(1);
+}
+
+void
+novm(const char *msg)
+{
+    fatal("no memory for %s", msg);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+drain(int fd, void *ctx)
+{
+    char buf[16];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+	;
+    ++fired;
+}
+
+static int
+run(int nfds)
+{
+    int (*pipes)[2];
+    int i, k;
+    double t0, total = 0, best = 1e18, d;
+    struct timeval timo;
+
+    pipes = calloc(nfds, sizeof(*pipes));
+    if (pipes == NULL)
+	novm("pipes");
+    for (i = 0; i < nfds; ++i) {
+	if (pipe(pipes[i]) < 0)
+	    fatal("pipe");
+	fcntl(pipes[i][0], F_SETFL, O_NONBLOCK);
+	add_fd_callback(pipes[i][0], drain, NULL);
+    }
+
+    for (k = 0; k < ITERATIONS; ++k) {
+	/* spread the ready fd across the whole set */
+	i = (k * 7919) % nfds;
+	fired = 0;
+	if (write(pipes[i][1], "x", 1) != 1)
+	    fatal("write");
+	timo.tv_sec = 1;
+	timo.tv_usec = 0;
+	t0 = now_ns();
+	wait_input(&timo);
+	d = now_ns() - t0;
+	if (fired != 1) {
+	    fprintf(stderr, "expected one callback, got %d\n", fired);
+	    return -1;
+	}
+	total += d;
+	if (d < best)
+	    best = d;
+    }
+
+    printf("  %4d fds: avg %8.0f ns, min %8.0f ns per wakeup\n",
+	   nfds, total / ITERATIONS, best);
+
+    for (i = 0; i < nfds; ++i) {
+	remove_fd(pipes[i][0]);
+	close(pipes[i][0]);
+	close(pipes[i][1]);
+    }
+    free(pipes);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int sizes[] = { 1, 16, 256 };
+    int i;
+
+    event_handler_init();
+#if defined(PPP_WITH_EPOLL) && !defined(PPP_EVENT_FORCE_SELECT)
+    printf("event handler wakeup latency (epoll):\n");
+#else
+    printf("event handler wakeup latency (select):\n");
+#endif
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	if (run(sizes[i]) < 0)
+	    return 1;
+    return 0;
+}
@@ -152,6 +152,7 @@ int childwait_done;		/* have timed out waiting for children */
 
 #ifdef PPP_WITH_TDB
 TDB_CONTEXT *pppdb;		/* database for storing status etc. */
+int pppdb_hash_size = 8191;	/* hash chains when creating pppdb */
 #endif
 
 char db_key[32];
@@ -204,6 +205,13 @@ unsigned link_connect_time;
 int link_stats_valid;
 int link_stats_print;
 
+/* Receive batching counters, reported with debug when the link ends */
+static struct {
+    unsigned long	wakeups;	/* calls to get_input that read frames */
+    unsigned long	frames;		/* frames read */
+    int			max_batch;	/* most frames read in one call */
+} rx_stats;
+
 int error_count;
 
 bool bundle_eof;
@@ -231,6 +239,8 @@ static void create_pidfile(int pid);
 static void create_linkpidfile(int pid);
 static void cleanup(void);
 static void get_input(void);
+static void input_frame(u_char *, int);
+static void build_proto_dispatch(void);
 static void calltimeout(void);
 static struct timeval *timeleft(struct timeval *);
 static void kill_my_pg(int);
@@ -248,6 +258,7 @@ static void run_net_script(char* script, int wait);
 
 #ifdef PPP_WITH_TDB
 static void update_db_entry(void);
+static void flush_db_entry(void);
 static void add_db_key(const char *);
 static void delete_db_key(const char *);
 static void cleanup_db(void);
@@ -264,6 +275,26 @@ const char *ppp_hostname()
     return hostname;
 }
 
+/*
+ * signal_wait_start - for code which waits outside the main loop: have
+ * the signal handlers write to the (now empty) signal pipe and return
+ * its read end, so that a signal which arrives after got_sigterm etc.
+ * have been checked still ends the wait.  Undone by signal_wait_end.
+ */
+int signal_wait_start(void)
+{
+    char buf[16];
+
+    waiting = 1;
+    for (; read(sigpipe[0], buf, sizeof(buf)) > 0; );
+    return sigpipe[0];
+}
+
+void signal_wait_end(void)
+{
+    waiting = 0;
+}
+
 bool ppp_signaled(int sig)
 {
     if (sig == SIGTERM)
@@ -479,6 +510,8 @@ main(int argc, char *argv[])
     if (the_channel->check_options)
 	(*the_channel->check_options)();
 
+    build_proto_dispatch();
+
 
     if (dump_options || dryrun) {
 	init_pr_log(NULL, LOG_INFO);
@@ -508,10 +541,11 @@ main(int argc, char *argv[])
     sys_init();
 
 #ifdef PPP_WITH_TDB
-    pppdb = tdb_open(PPP_PATH_PPPDB, 0, 0, O_RDWR|O_CREAT, 0644);
+    pppdb = tdb_open(PPP_PATH_PPPDB, pppdb_hash_size, 0, O_RDWR|O_CREAT, 0644);
     if (pppdb != NULL) {
 	slprintf(db_key, sizeof(db_key), "pppd%d", getpid());
 	update_db_entry();
+	flush_db_entry();
     } else {
 	warn("Warning: couldn't open ppp database %s", PPP_PATH_PPPDB);
 	if (multilink) {
@@ -611,10 +645,19 @@ main(int argc, char *argv[])
 	start_link(0);
 	while (phase != PHASE_DEAD) {
 	    handle_events();
-	    get_input();
+	    /*
+	     * Until a pending connect finishes there is no ppp channel
+	     * to read, and read_packet() would report a hangup.  Nor is
+	     * there once a pending connect has failed.
+	     */
+	    if (devfd != CONNECT_PENDING && phase != PHASE_DEAD)
+		get_input();
 	    if (kill_link) {
 		lcp_close(0, "User request");
 		need_holdoff = 0;
+		/* LCP isn't up yet to end a pending connect */
+		if (devfd == CONNECT_PENDING)
+		    link_terminated(0);
 	    }
 	    if (asked_to_quit) {
 		bundle_terminating = 1;
@@ -631,6 +674,11 @@ main(int argc, char *argv[])
 	/* restore FSMs to original state */
 	lcp_close(0, "");
 
+	if (debug && rx_stats.wakeups > 0)
+	    dbglog("Received %lu frames in %lu wakeups (at most %d per wakeup)",
+		   rx_stats.frames, rx_stats.wakeups, rx_stats.max_batch);
+	memset(&rx_stats, 0, sizeof(rx_stats));
+
 	if (!persist || asked_to_quit || (maxfail > 0 && unsuccess >= maxfail))
 	    break;
 
@@ -686,16 +734,20 @@ handle_events(void)
 
     kill_link = open_ccp_flag = 0;
 
+#ifdef PPP_WITH_TDB
+    /* write out the changes to our entry since the last time round */
+    if (pppdb != NULL)
+	flush_db_entry();
+#endif
+
     /* alert via signal pipe */
     waiting = 1;
     /* flush signal pipe */
     for (; read(sigpipe[0], buf, sizeof(buf)) > 0; );
-    add_fd(sigpipe[0]);
     /* wait if necessary */
     if (!(got_sighup || got_sigterm || got_sigusr2 || got_sigchld))
 	wait_input(timeleft(&timo));
     waiting = 0;
-    remove_fd(sigpipe[0]);
 
     calltimeout();
     if (got_sighup) {
@@ -738,6 +790,12 @@ setup_signals(void)
     fcntl(sigpipe[1], F_SETFD, fcntl(sigpipe[1], F_GETFD) | FD_CLOEXEC);
     fcntl(sigpipe[0], F_SETFL, fcntl(sigpipe[0], F_GETFL) | O_NONBLOCK);
     fcntl(sigpipe[1], F_SETFL, fcntl(sigpipe[1], F_GETFL) | O_NONBLOCK);
+    /*
+     * Watched for good rather than added and removed round each wait,
+     * which with epoll would cost two syscalls per wakeup.  It is only
+     * written to while waiting, and flushed before each wait.
+     */
+    add_fd(sigpipe[0]);
 
     /*
      * Compute mask of all interesting signals and install signal handlers
@@ -1135,21 +1193,81 @@ protocol_name(int proto)
 }
 
 /*
- * get_input - called when incoming data is available.
+ * proto_dispatch[protocol] is 1 + the index in protocols[] of the first
+ * entry whose input or datainput routine handles that PPP protocol
+ * number, or 0 if none does, so input_frame() doesn't have to search
+ * protocols[] for every frame.
+ */
+static unsigned char proto_dispatch[65536];
+
+/*
+ * build_proto_dispatch - fill in proto_dispatch from protocols[].
+ * Called once the options have been processed and any plugins loaded.
  */
 static void
-get_input(void)
+build_proto_dispatch(void)
 {
-    int len, i;
-    u_char *p;
-    u_short protocol;
+    int i, data;
     struct protent *protp;
 
-    p = inpacket_buf;	/* point to beginning of packet buffer */
+    memset(proto_dispatch, 0, sizeof(proto_dispatch));
+    for (i = 0; (protp = protocols[i]) != NULL; ++i) {
+	if (i >= 255)
+	    fatal("internal error: too many protocols");
+	if (proto_dispatch[protp->protocol] == 0)
+	    proto_dispatch[protp->protocol] = i + 1;
+	data = protp->protocol & ~0x8000;
+	if (protp->datainput != NULL && proto_dispatch[data] == 0)
+	    proto_dispatch[data] = i + 1;
+    }
+}
 
-    len = read_packet(inpacket_buf);
-    if (len < 0)
-	return;
+/*
+ * Upper bound on the number of frames get_input() handles per wakeup,
+ * so that a stream of control packets can't hold off timeouts and
+ * signals indefinitely.
+ */
+#define MAX_RX_BATCH	16
+
+/*
+ * get_input - called when incoming data is available.  Reads and
+ * dispatches frames until there are none left, the link goes down,
+ * or MAX_RX_BATCH frames have been handled.  Each frame is dispatched
+ * before the next is read, since it may change which fds are open.
+ */
+static void
+get_input(void)
+{
+    int len, n;
+
+    for (n = 0; n < MAX_RX_BATCH; ) {
+	len = read_packet(inpacket_buf);
+	if (len < 0)
+	    break;
+	++n;
+	input_frame(inpacket_buf, len);
+	if (len == 0 || phase == PHASE_DEAD)
+	    break;
+    }
+
+    if (n > 0) {
+	++rx_stats.wakeups;
+	rx_stats.frames += n;
+	if (n > rx_stats.max_batch)
+	    rx_stats.max_batch = n;
+    }
+}
+
+/*
+ * input_frame - process one frame returned by read_packet().
+ * A length of 0 means that the link has hung up.
+ */
+static void
+input_frame(u_char *p, int len)
+{
+    int i;
+    u_short protocol;
+    struct protent *protp;
 
     if (len == 0) {
 	if (bundle_eof && mp_master()) {
@@ -1200,17 +1318,23 @@ get_input(void)
     }
 
     /*
-     * Upcall the proper protocol input routine.
+     * Upcall the proper protocol input routine.  The dispatch table
+     * gives the first protocol entry that could take this frame, so
+     * normally we only look at one; we only carry on down the list
+     * if that entry is disabled.
      */
-    for (i = 0; (protp = protocols[i]) != NULL; ++i) {
-	if (protp->protocol == protocol && protp->enabled_flag) {
-	    (*protp->input)(0, p, len);
-	    return;
-	}
-        if (protocol == (protp->protocol & ~0x8000) && protp->enabled_flag
-	    && protp->datainput != NULL) {
-	    (*protp->datainput)(0, p, len);
-	    return;
+    i = proto_dispatch[protocol];
+    if (i != 0) {
+	for (--i; (protp = protocols[i]) != NULL; ++i) {
+	    if (protp->protocol == protocol && protp->enabled_flag) {
+		(*protp->input)(0, p, len);
+		return;
+	    }
+	    if (protocol == (protp->protocol & ~0x8000) && protp->enabled_flag
+		&& protp->datainput != NULL) {
+		(*protp->datainput)(0, p, len);
+		return;
+	    }
 	}
     }
 
@@ -1284,6 +1408,10 @@ new_phase(ppp_phase_t p)
     }
 
     phase = p;
+#ifdef PPP_WITH_TDB
+    if (pppdb != NULL)
+	flush_db_entry();
+#endif
     if (new_phase_hook)
 	(*new_phase_hook)(p);
     notify(phasechange, p);
@@ -1400,31 +1528,167 @@ ppp_get_link_stats(ppp_link_stats_st *stats)
 }
 
 
+/*
+ * Pending timeouts live in a binary min-heap ordered by expiry time
+ * (ties broken by insertion order, so timeouts set for the same time
+ * run in the order they were set).  Callouts are kept in one array and
+ * recycled through a freelist, and are also hashed on (func, arg) so
+ * that ppp_untimeout() doesn't need to search the heap.  Everything
+ * refers to callouts by index since the array can be reallocated.
+ */
 struct	callout {
     struct timeval	c_time;		/* time at which to call routine */
     void		*c_arg;		/* argument to routine */
     void		(*c_func)(void *); /* routine */
-    struct		callout *c_next;
+    unsigned long	c_seq;		/* insertion order, for ties */
+    unsigned int	c_gen;		/* bumped when freed, for handles */
+    int			c_heap;		/* index in heap, -1 if free */
+    int			c_next;		/* hash chain or freelist link */
 };
 
-static struct callout *callout = NULL;	/* Callout list */
+#define CALLOUT_HASH	64		/* must be a power of 2 */
+
+static struct callout *callouts;	/* Callout array */
+static int n_callouts;			/* # allocated entries */
+static int callout_free = -1;		/* Head of freelist */
+static int *callout_heap;		/* Heap of callout indices */
+static int n_heap;			/* # pending timeouts */
+static int callout_hash[CALLOUT_HASH];	/* Chains by (func, arg) */
+static unsigned long callout_seq;
 static struct timeval timenow;		/* Current time */
 
+#define CALLOUT_BEFORE(a, b)					\
+    ((a)->c_time.tv_sec < (b)->c_time.tv_sec			\
+     || ((a)->c_time.tv_sec == (b)->c_time.tv_sec		\
+	 && ((a)->c_time.tv_usec < (b)->c_time.tv_usec		\
+	     || ((a)->c_time.tv_usec == (b)->c_time.tv_usec	\
+		 && (a)->c_seq < (b)->c_seq))))
+
+static int
+callout_hashfn(void (*func)(void *), void *arg)
+{
+    uintptr_t h = (uintptr_t) func ^ ((uintptr_t) arg * 31);
+
+    return (h ^ (h >> 6) ^ (h >> 12)) & (CALLOUT_HASH - 1);
+}
+
+static int
+callout_alloc(void)
+{
+    int i, n;
+
+    if (callout_free < 0) {
+	if (n_callouts == 0)
+	    for (i = 0; i < CALLOUT_HASH; ++i)
+		callout_hash[i] = -1;
+	n = n_callouts? n_callouts * 2: 32;
+	callouts = realloc(callouts, n * sizeof(struct callout));
+	callout_heap = realloc(callout_heap, n * sizeof(int));
+	if (callouts == NULL || callout_heap == NULL)
+	    fatal("Out of memory in timeout()!");
+	for (i = n - 1; i >= n_callouts; --i) {
+	    callouts[i].c_gen = 0;
+	    callouts[i].c_heap = -1;
+	    callouts[i].c_next = callout_free;
+	    callout_free = i;
+	}
+	n_callouts = n;
+    }
+    i = callout_free;
+    callout_free = callouts[i].c_next;
+    return i;
+}
+
+static void
+heap_set(int pos, int i)
+{
+    callout_heap[pos] = i;
+    callouts[i].c_heap = pos;
+}
+
+static void
+heap_up(int pos)
+{
+    int i = callout_heap[pos], parent;
+
+    while (pos > 0) {
+	parent = (pos - 1) / 2;
+	if (!CALLOUT_BEFORE(&callouts[i], &callouts[callout_heap[parent]]))
+	    break;
+	heap_set(pos, callout_heap[parent]);
+	pos = parent;
+    }
+    heap_set(pos, i);
+}
+
+static void
+heap_down(int pos)
+{
+    int i = callout_heap[pos], child;
+
+    for (;;) {
+	child = 2 * pos + 1;
+	if (child >= n_heap)
+	    break;
+	if (child + 1 < n_heap
+	    && CALLOUT_BEFORE(&callouts[callout_heap[child + 1]],
+			      &callouts[callout_heap[child]]))
+	    ++child;
+	if (!CALLOUT_BEFORE(&callouts[callout_heap[child]], &callouts[i]))
+	    break;
+	heap_set(pos, callout_heap[child]);
+	pos = child;
+    }
+    heap_set(pos, i);
+}
+
 /*
- * timeout - Schedule a timeout.
+ * callout_remove - take a pending callout off the heap and its hash
+ * chain and put it back on the freelist.
  */
-void
-ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
+static void
+callout_remove(int i)
+{
+    struct callout *p = &callouts[i];
+    int *ip, pos, last;
+
+    for (ip = &callout_hash[callout_hashfn(p->c_func, p->c_arg)];
+	 *ip != i; ip = &callouts[*ip].c_next)
+	;
+    *ip = p->c_next;
+
+    pos = p->c_heap;
+    last = callout_heap[--n_heap];
+    if (pos < n_heap) {
+	heap_set(pos, last);
+	if (pos > 0 && CALLOUT_BEFORE(&callouts[last],
+				      &callouts[callout_heap[(pos - 1) / 2]]))
+	    heap_up(pos);
+	else
+	    heap_down(pos);
+    }
+
+    p->c_heap = -1;
+    ++p->c_gen;
+    p->c_next = callout_free;
+    callout_free = i;
+}
+
+/*
+ * ppp_timeout_handle - Schedule a timeout, returning a handle which
+ * can be passed to ppp_untimeout_handle() to cancel it.
+ */
+ppp_timer_t
+ppp_timeout_handle(void (*func)(void *), void *arg, int secs, int usecs)
 {
-    struct callout *newp, *p, **pp;
+    struct callout *newp;
+    int i, h;
 
-    /*
-     * Allocate timeout.
-     */
-    if ((newp = (struct callout *) malloc(sizeof(struct callout))) == NULL)
-	fatal("Out of memory in timeout()!");
+    i = callout_alloc();
+    newp = &callouts[i];
     newp->c_arg = arg;
     newp->c_func = func;
+    newp->c_seq = callout_seq++;
     ppp_get_time(&timenow);
     newp->c_time.tv_sec = timenow.tv_sec + secs;
     newp->c_time.tv_usec = timenow.tv_usec + usecs;
@@ -1433,16 +1697,23 @@ ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
 	newp->c_time.tv_usec %= 1000000;
     }
 
-    /*
-     * Find correct place and link it in.
-     */
-    for (pp = &callout; (p = *pp); pp = &p->c_next)
-	if (newp->c_time.tv_sec < p->c_time.tv_sec
-	    || (newp->c_time.tv_sec == p->c_time.tv_sec
-		&& newp->c_time.tv_usec < p->c_time.tv_usec))
-	    break;
-    newp->c_next = p;
-    *pp = newp;
+    h = callout_hashfn(func, arg);
+    newp->c_next = callout_hash[h];
+    callout_hash[h] = i;
+
+    callout_heap[n_heap] = i;
+    heap_up(n_heap++);
+
+    return ((ppp_timer_t) newp->c_gen << 32) | (unsigned int) (i + 1);
+}
+
+/*
+ * timeout - Schedule a timeout.
+ */
+void
+ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
+{
+    ppp_timeout_handle(func, arg, secs, usecs);
 }
 
 
@@ -1452,42 +1723,64 @@ ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
 void
 ppp_untimeout(void (*func)(void *), void *arg)
 {
-    struct callout **copp, *freep;
+    int i, first = -1;
 
     /*
-     * Find first matching timeout and remove it from the list.
+     * Find the first matching timeout to expire and remove it.
      */
-    for (copp = &callout; (freep = *copp); copp = &freep->c_next)
-	if (freep->c_func == func && freep->c_arg == arg) {
-	    *copp = freep->c_next;
-	    free((char *) freep);
-	    break;
-	}
+    for (i = callout_hash[callout_hashfn(func, arg)]; i >= 0;
+	 i = callouts[i].c_next)
+	if (callouts[i].c_func == func && callouts[i].c_arg == arg
+	    && (first < 0 || CALLOUT_BEFORE(&callouts[i], &callouts[first])))
+	    first = i;
+    if (first >= 0)
+	callout_remove(first);
+}
+
+/*
+ * untimeout_handle - Unschedule the timeout identified by a handle from
+ * ppp_timeout_handle().  Does nothing if it has already run or been
+ * cancelled.
+ */
+void
+ppp_untimeout_handle(ppp_timer_t handle)
+{
+    int i = (int) (handle & 0xffffffff) - 1;
+
+    if (i >= 0 && i < n_callouts && callouts[i].c_heap >= 0
+	&& callouts[i].c_gen == (unsigned int) (handle >> 32))
+	callout_remove(i);
 }
 
 
 /*
  * calltimeout - Call any timeout routines which are now due.
+ * The time is read once per pass; anything that becomes due while
+ * the routines run is picked up on the next pass.
  */
 static void
 calltimeout(void)
 {
     struct callout *p;
+    void (*func)(void *);
+    void *arg;
 
-    while (callout != NULL) {
-	p = callout;
+    if (n_heap == 0)
+	return;
+    if (ppp_get_time(&timenow) < 0)
+	fatal("Failed to get time of day: %m");
 
-	if (ppp_get_time(&timenow) < 0)
-	    fatal("Failed to get time of day: %m");
+    while (n_heap > 0) {
+	p = &callouts[callout_heap[0]];
 	if (!(p->c_time.tv_sec < timenow.tv_sec
 	      || (p->c_time.tv_sec == timenow.tv_sec
 		  && p->c_time.tv_usec <= timenow.tv_usec)))
 	    break;		/* no, it's not time yet */
 
-	callout = p->c_next;
-	(*p->c_func)(p->c_arg);
-
-	free((char *) p);
+	func = p->c_func;
+	arg = p->c_arg;
+	callout_remove(callout_heap[0]);
+	(*func)(arg);
     }
 }
 
@@ -1498,12 +1791,15 @@ calltimeout(void)
 static struct timeval *
 timeleft(struct timeval *tvp)
 {
-    if (callout == NULL)
+    struct callout *p;
+
+    if (n_heap == 0)
 	return NULL;
 
+    p = &callouts[callout_heap[0]];
     ppp_get_time(&timenow);
-    tvp->tv_sec = callout->c_time.tv_sec - timenow.tv_sec;
-    tvp->tv_usec = callout->c_time.tv_usec - timenow.tv_usec;
+    tvp->tv_sec = p->c_time.tv_sec - timenow.tv_sec;
+    tvp->tv_usec = p->c_time.tv_usec - timenow.tv_usec;
     if (tvp->tv_usec < 0) {
 	tvp->tv_usec += 1000000;
 	tvp->tv_sec -= 1;
@@ -2314,6 +2610,8 @@ void unlock_db(void)
 #ifdef PPP_WITH_TDB
 	TDB_DATA key;
 
+	/* others may look at our entry as soon as we let go */
+	flush_db_entry();
 	key.dptr = PPPD_LOCK_KEY;
 	key.dsize = strlen(key.dptr);
 	tdb_chainunlock(pppdb, key);
@@ -2322,26 +2620,56 @@ void unlock_db(void)
 
 #ifdef PPP_WITH_TDB
 /*
- * update_db_entry - update our entry in the database.
+ * Our entry holds the whole script environment, so rather than rewrite
+ * it on every ppp_script_setenv(), which happens dozens of times as
+ * the link comes up, update_db_entry() just notes that it is out of
+ * date and flush_db_entry() writes it, once per trip round the main
+ * loop, on a phase change, and before unlock_db() lets anyone else in.
+ */
+static int db_dirty;		/* our entry needs to be rewritten */
+
+/*
+ * update_db_entry - note that our entry in the database needs updating.
  */
 static void
 update_db_entry(void)
 {
+    db_dirty = 1;
+}
+
+/*
+ * flush_db_entry - update our entry in the database if necessary.
+ */
+static void
+flush_db_entry(void)
+{
+    static char *vbuf;
+    static int vbuf_size;
     TDB_DATA key, dbuf;
-    int vlen, i;
-    char *p, *q, *vbuf;
+    int vlen, i, n;
+    char *p, *q;
 
-    if (script_env == NULL)
+    if (!db_dirty || script_env == NULL)
 	return;
+    db_dirty = 0;
     vlen = 0;
     for (i = 0; (p = script_env[i]) != 0; ++i)
 	vlen += strlen(p) + 1;
-    vbuf = malloc(vlen + 1);
-    if (vbuf == 0)
-	novm("database entry");
+    if (vlen + 1 > vbuf_size) {
+	free(vbuf);
+	vbuf_size = vlen + 1 + 256;
+	vbuf = malloc(vbuf_size);
+	if (vbuf == 0)
+	    novm("database entry");
+    }
     q = vbuf;
-    for (i = 0; (p = script_env[i]) != 0; ++i)
-	q += slprintf(q, vbuf + vlen - q, "%s;", p);
+    for (i = 0; (p = script_env[i]) != 0; ++i) {
+	n = strlen(p);
+	memcpy(q, p, n);
+	q += n;
+	*q++ = ';';
+    }
+    *q = 0;
 
     key.dptr = db_key;
     key.dsize = strlen(db_key);
@@ -2349,10 +2677,6 @@ update_db_entry(void)
     dbuf.dsize = vlen;
     if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
 	error("tdb_store failed: %s", tdb_errorstr(pppdb));
-
-    if (vbuf)
-        free(vbuf);
-
 }
 
 /*
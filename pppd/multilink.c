@@ -31,23 +31,29 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pppd-private.h"
 #include "fsm.h"
 #include "lcp.h"
 #include "tdb.h"
 #include "multilink.h"
+#include "pathnames.h"
 
 bool endpoint_specified;	/* user gave explicit endpoint discriminator */
 char *bundle_id;		/* identifier for our bundle */
 char *blinks_id;		/* key for the list of links */
 bool doing_multilink;		/* multilink was enabled and agreed to */
 bool multilink_master;		/* we own the multilink bundle */
+bool multilink_registry;	/* find bundles in the shared registry */
 
 extern TDB_CONTEXT *pppdb;
 extern char db_key[];
@@ -59,6 +65,57 @@ static void iterate_bundle_links(void (*func)(char *));
 static int get_default_epdisc(struct epdisc *);
 static int parse_num(char *str, const char *key, int *valp);
 static int owns_unit(TDB_DATA pid, int unit);
+static int db_bundle_unit(TDB_DATA key);
+static void sendhup_pid(int pid);
+
+/*
+ * With the multilink-registry option, bundles are found through a
+ * table of fixed-size entries in a file that every pppd maps, rather
+ * than through the TDB database.  An entry records the bundle ID, the
+ * pid and unit of the pppd that owns the bundle, and the pids of the
+ * pppds with links in it.  The table is split into buckets of
+ * MPREG_WAYS entries, each with its own fcntl lock, so that links
+ * joining different bundles don't wait for each other, and a lookup is
+ * a hash and a few compares rather than fetching and parsing the
+ * owner's environment.  A bundle whose ID doesn't fit in an entry, or
+ * whose bucket is full, is looked up in the database as before.
+ */
+#define MPREG_MAGIC	"PPPMPREG"
+#define MPREG_VERSION	1
+#define MPREG_BUCKETS	512
+#define MPREG_WAYS	8
+#define MPREG_KEYLEN	220
+#define MPREG_LINKS	32
+
+struct mpreg_header {
+	char	magic[8];	/* MPREG_MAGIC, no NUL */
+	uint32_t version;	/* MPREG_VERSION */
+	uint32_t buckets;	/* MPREG_BUCKETS */
+	uint32_t ways;		/* MPREG_WAYS */
+	uint32_t entry_size;	/* sizeof(struct mpreg_entry) */
+	uint32_t pad[10];
+};
+
+struct mpreg_entry {
+	uint32_t hash;		/* of the bundle ID */
+	int32_t	owner;		/* pid of the owning pppd, 0 if free */
+	int32_t	unit;		/* ppp unit of the bundle */
+	uint16_t keylen;
+	uint16_t nlinks;
+	int32_t	links[MPREG_LINKS];	/* pids of pppds with links */
+	char	key[MPREG_KEYLEN];	/* bundle ID, no NUL */
+};
+
+static struct mpreg_header *mpreg;	/* the mapped registry */
+static int mpreg_fd = -1;
+static bool registry_bundle;	/* our bundle is in the registry */
+static uint32_t bundle_hash;	/* of bundle_id */
+
+static uint32_t oat_hash(TDB_DATA key);
+static int mpreg_open(void);
+static int mpreg_lock(int type);
+static struct mpreg_entry *mpreg_find(int create);
+static void mpreg_add_link(struct mpreg_entry *);
 
 #define set_ip_epdisc(ep, addr) do {	\
 	ep->length = 4;			\
@@ -121,10 +178,11 @@ mp_join_bundle(void)
 	lcp_options *go = &lcp_gotoptions[0];
 	lcp_options *ho = &lcp_hisoptions[0];
 	lcp_options *ao = &lcp_allowoptions[0];
-	int unit, pppd_pid;
+	int unit;
 	int l, mtu;
 	char *p;
-	TDB_DATA key, pid, rec;
+	TDB_DATA key;
+	struct mpreg_entry *ent = NULL;
 
 	if (doing_multilink) {
 		/* have previously joined a bundle */
@@ -204,29 +262,39 @@ mp_join_bundle(void)
 	}
 
 	/*
-	 * Check if the bundle ID is already in the database.
+	 * Check if the bundle ID is already in the registry or the
+	 * database.
 	 */
 	unit = -1;
-	lock_db();
 	key.dptr = bundle_id;
 	key.dsize = p - bundle_id;
-	pid = tdb_fetch(pppdb, key);
-	if (pid.dptr != NULL) {
-		/* bundle ID exists, see if the pppd record exists */
-		rec = tdb_fetch(pppdb, pid);
-		if (rec.dptr != NULL && rec.dsize > 0) {
-			/* make sure the string is null-terminated */
-			rec.dptr[rec.dsize-1] = 0;
-			/* parse the interface number */
-			parse_num(rec.dptr, "UNIT=", &unit);
-			/* check the pid value */
-			if (!parse_num(rec.dptr, "PPPD_PID=", &pppd_pid)
-			    || !process_exists(pppd_pid)
-			    || !owns_unit(pid, unit))
-				unit = -1;
-			free(rec.dptr);
+	bundle_hash = oat_hash(key);
+	if (multilink_registry && key.dsize <= MPREG_KEYLEN && mpreg_open()
+	    && mpreg_lock(F_WRLCK)) {
+		if ((ent = mpreg_find(1)) != NULL) {
+			registry_bundle = 1;
+			if (ent->owner != 0)
+				unit = ent->unit;
+		} else {
+			/* bucket full */
+			mpreg_lock(F_UNLCK);
+		}
+	}
+	if (!registry_bundle || unit < 0) {
+		/*
+		 * A bundle made while its bucket was full, or by a pppd
+		 * without multilink-registry, is only in the database.
+		 * The registry bucket stays locked while we look.
+		 */
+		lock_db();
+		unit = db_bundle_unit(key);
+		if (registry_bundle) {
+			if (unit >= 0) {
+				mpreg_lock(F_UNLCK);
+				registry_bundle = 0;
+			} else
+				unlock_db();
 		}
-		free(pid.dptr);
 	}
 
 	if (unit >= 0) {
@@ -234,8 +302,13 @@ mp_join_bundle(void)
 		if (bundle_attach(unit)) {
 			set_ifunit(0);
 			ppp_script_setenv("BUNDLE", bundle_id + 7, 0);
-			make_bundle_links(1);
-			unlock_db();
+			if (registry_bundle) {
+				mpreg_add_link(ent);
+				mpreg_lock(F_UNLCK);
+			} else {
+				make_bundle_links(1);
+				unlock_db();
+			}
 			info("Link attached to %s", ifname);
 			return 1;
 		}
@@ -247,31 +320,96 @@ mp_join_bundle(void)
 	set_ifunit(1);
 	ppp_set_mtu(0, mtu);
 	ppp_script_setenv("BUNDLE", bundle_id + 7, 1);
-	make_bundle_links(0);
-	unlock_db();
+	if (registry_bundle) {
+		ent->hash = bundle_hash;
+		ent->owner = getpid();
+		ent->unit = ifunit;
+		ent->keylen = key.dsize;
+		memcpy(ent->key, key.dptr, key.dsize);
+		ent->nlinks = 0;
+		mpreg_add_link(ent);
+		mpreg_lock(F_UNLCK);
+	} else {
+		make_bundle_links(0);
+		unlock_db();
+	}
 	info("New bundle %s created", ifname);
 	multilink_master = 1;
 	return 0;
 }
 
+/*
+ * db_bundle_unit - look up the unit of a bundle in the database, with
+ * the database locked.  Returns -1 if there is no such bundle.
+ */
+static int
+db_bundle_unit(TDB_DATA key)
+{
+	TDB_DATA pid, rec;
+	int unit = -1, pppd_pid;
+
+	pid = tdb_fetch(pppdb, key);
+	if (pid.dptr != NULL) {
+		/* bundle ID exists, see if the pppd record exists */
+		rec = tdb_fetch(pppdb, pid);
+		if (rec.dptr != NULL && rec.dsize > 0) {
+			/* make sure the string is null-terminated */
+			rec.dptr[rec.dsize-1] = 0;
+			/* parse the interface number */
+			parse_num(rec.dptr, "UNIT=", &unit);
+			/* check the pid value */
+			if (!parse_num(rec.dptr, "PPPD_PID=", &pppd_pid)
+			    || !process_exists(pppd_pid)
+			    || !owns_unit(pid, unit))
+				unit = -1;
+			free(rec.dptr);
+		}
+		free(pid.dptr);
+	}
+	return unit;
+}
+
 void mp_exit_bundle(void)
 {
+	struct mpreg_entry *ent;
+	int i;
+
+	if (registry_bundle) {
+		if (!mpreg_lock(F_WRLCK))
+			return;
+		if ((ent = mpreg_find(0)) != NULL) {
+			for (i = 0; i < ent->nlinks; ++i) {
+				if (ent->links[i] == getpid()) {
+					ent->links[i] = ent->links[--ent->nlinks];
+					break;
+				}
+			}
+		}
+		mpreg_lock(F_UNLCK);
+		return;
+	}
 	lock_db();
 	remove_bundle_link();
 	unlock_db();
 }
 
-static void sendhup(char *str)
+static void sendhup_pid(int pid)
 {
-	int pid;
-
-	if (parse_num(str, "PPPD_PID=", &pid) && pid != getpid()) {
+	if (pid != getpid()) {
 		if (debug)
 			dbglog("sending SIGHUP to process %d", pid);
 		kill(pid, SIGHUP);
 	}
 }
 
+static void sendhup(char *str)
+{
+	int pid;
+
+	if (parse_num(str, "PPPD_PID=", &pid))
+		sendhup_pid(pid);
+}
+
 void mp_bundle_terminated(void)
 {
 	TDB_DATA key;
@@ -285,13 +423,28 @@ void mp_bundle_terminated(void)
 		ppp_script_unsetenv("IFNAME");
 	}
 
-	lock_db();
-	destroy_bundle();
-	iterate_bundle_links(sendhup);
-	key.dptr = blinks_id;
-	key.dsize = strlen(blinks_id);
-	tdb_delete(pppdb, key);
-	unlock_db();
+	if (registry_bundle) {
+		struct mpreg_entry *ent;
+		int i;
+
+		mpreg_lock(F_WRLCK);
+		destroy_bundle();
+		if ((ent = mpreg_find(0)) != NULL && ent->owner == getpid()) {
+			for (i = 0; i < ent->nlinks; ++i)
+				sendhup_pid(ent->links[i]);
+			memset(ent, 0, sizeof(*ent));
+		}
+		mpreg_lock(F_UNLCK);
+		registry_bundle = 0;
+	} else {
+		lock_db();
+		destroy_bundle();
+		iterate_bundle_links(sendhup);
+		key.dptr = blinks_id;
+		key.dsize = strlen(blinks_id);
+		tdb_delete(pppdb, key);
+		unlock_db();
+	}
 
 	new_phase(PHASE_DEAD);
 
@@ -401,6 +554,196 @@ static void iterate_bundle_links(void (*func)(char *))
 	free(rec.dptr);
 }
 
+/*
+ * oat_hash - Bob Jenkins' one-at-a-time hash of a bundle ID.
+ */
+static uint32_t
+oat_hash(TDB_DATA key)
+{
+	const unsigned char *p = (const unsigned char *) key.dptr;
+	uint32_t h = 0;
+	size_t i;
+
+	for (i = 0; i < key.dsize; ++i) {
+		h += p[i];
+		h += h << 10;
+		h ^= h >> 6;
+	}
+	h += h << 3;
+	h ^= h >> 11;
+	h += h << 15;
+	return h;
+}
+
+/*
+ * mpreg_open - map the registry, creating or resetting it if it is
+ * missing or was made by a different version.  Returns 0 and logs the
+ * reason if it can't be used.
+ */
+static int
+mpreg_open(void)
+{
+	struct flock fl;
+	struct stat sbuf;
+	size_t size;
+	int fd, err;
+	const char *what;
+
+	if (mpreg != NULL)
+		return 1;
+	size = sizeof(struct mpreg_header)
+		+ MPREG_BUCKETS * MPREG_WAYS * sizeof(struct mpreg_entry);
+	fd = open(PPP_PATH_MPREG, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		error("Couldn't open multilink registry %s: %m", PPP_PATH_MPREG);
+		return 0;
+	}
+
+	/* the header's lock serialises setting the file up */
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_len = 1;
+	what = "lock";
+	if (fcntl(fd, F_SETLKW, &fl) < 0)
+		goto fail;
+	what = "fstat";
+	if (fstat(fd, &sbuf) < 0)
+		goto fail;
+	/*
+	 * Cut a file which is too long down to size (fallocate never
+	 * shrinks one), and allocate the blocks now rather than take
+	 * SIGBUS later.  What is in it is only thrown away below if the
+	 * header doesn't match.
+	 */
+	if (sbuf.st_size != size) {
+		what = "ftruncate";
+		if (sbuf.st_size > size && ftruncate(fd, size) < 0)
+			goto fail;
+		what = "fallocate";
+		if ((err = posix_fallocate(fd, 0, size)) != 0) {
+			errno = err;
+			goto fail;
+		}
+	}
+	what = "mmap";
+	mpreg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mpreg == MAP_FAILED) {
+		mpreg = NULL;
+		goto fail;
+	}
+	if (memcmp(mpreg->magic, MPREG_MAGIC, sizeof(mpreg->magic)) != 0
+	    || mpreg->version != MPREG_VERSION
+	    || mpreg->buckets != MPREG_BUCKETS || mpreg->ways != MPREG_WAYS
+	    || mpreg->entry_size != sizeof(struct mpreg_entry)) {
+		memset(mpreg, 0, size);
+		mpreg->version = MPREG_VERSION;
+		mpreg->buckets = MPREG_BUCKETS;
+		mpreg->ways = MPREG_WAYS;
+		mpreg->entry_size = sizeof(struct mpreg_entry);
+		memcpy(mpreg->magic, MPREG_MAGIC, sizeof(mpreg->magic));
+	}
+	fl.l_type = F_UNLCK;
+	fcntl(fd, F_SETLK, &fl);
+	/* keep fd open: closing it would drop our bucket locks */
+	mpreg_fd = fd;
+	return 1;
+
+ fail:
+	error("Couldn't set up multilink registry %s: %s: %m",
+	      PPP_PATH_MPREG, what);
+	close(fd);
+	return 0;
+}
+
+/*
+ * mpreg_bucket - the entries our bundle ID hashes to.
+ */
+static struct mpreg_entry *
+mpreg_bucket(void)
+{
+	struct mpreg_entry *table = (struct mpreg_entry *) (mpreg + 1);
+
+	return table + (bundle_hash % MPREG_BUCKETS) * MPREG_WAYS;
+}
+
+/*
+ * mpreg_lock - lock (F_WRLCK) or unlock (F_UNLCK) the bucket of our
+ * bundle ID.  The lock is on the first byte of the bucket.
+ */
+static int
+mpreg_lock(int type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (char *) mpreg_bucket() - (char *) mpreg;
+	fl.l_len = 1;
+	while (fcntl(mpreg_fd, F_SETLKW, &fl) < 0) {
+		if (errno != EINTR) {
+			error("Couldn't %slock multilink registry: %m",
+			      type == F_UNLCK? "un": "");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * mpreg_find - find the entry for our bundle ID in its bucket, which
+ * must be locked.  Entries whose owner has gone away are freed on the
+ * way.  With create, returns a free entry if there is no entry for
+ * the bundle; the caller fills it in.
+ */
+static struct mpreg_entry *
+mpreg_find(int create)
+{
+	struct mpreg_entry *ent = mpreg_bucket(), *free_ent = NULL;
+	char pidkey[32];
+	TDB_DATA kd;
+	int i;
+
+	for (i = 0; i < MPREG_WAYS; ++i, ++ent) {
+		if (ent->owner != 0 && !process_exists(ent->owner))
+			memset(ent, 0, sizeof(*ent));
+		if (ent->owner == 0) {
+			if (free_ent == NULL)
+				free_ent = ent;
+			continue;
+		}
+		if (ent->hash != bundle_hash || ent->keylen != strlen(bundle_id)
+		    || memcmp(ent->key, bundle_id, ent->keylen) != 0)
+			continue;
+		/* check the pid hasn't been reused by a pppd on another unit */
+		slprintf(pidkey, sizeof(pidkey), "pppd%d", ent->owner);
+		kd.dptr = pidkey;
+		kd.dsize = strlen(pidkey);
+		if (ent->owner != getpid() && !owns_unit(kd, ent->unit)) {
+			memset(ent, 0, sizeof(*ent));
+			if (free_ent == NULL)
+				free_ent = ent;
+			continue;
+		}
+		return ent;
+	}
+	return create? free_ent: NULL;
+}
+
+/*
+ * mpreg_add_link - add ourselves to the links of a bundle.
+ */
+static void
+mpreg_add_link(struct mpreg_entry *ent)
+{
+	if (ent->nlinks >= MPREG_LINKS) {
+		warn("Too many links in bundle to record in multilink registry");
+		return;
+	}
+	ent->links[ent->nlinks++] = getpid();
+}
+
 static int
 parse_num(char *str, const char *key, int *valp)
 {
@@ -150,6 +150,7 @@ char	path_ipv6down[MAXPATHLEN]; /* pathname of ipv6-down script */
 unsigned int  maxoctets = 0;    /* default - no limit */
 session_limit_dir_t maxoctets_dir = PPP_OCTETS_DIRECTION_SUM; /* default - sum of traffic */
 int maxoctets_timeout = 1;   /* default 1 second */ 
+int stats_cache_ms = 100;    /* reuse link stats for 100ms */
 
 
 extern struct option auth_options[];
@@ -169,6 +170,7 @@ bool devnam_fixed;		/* can no longer change device name */
 
 static int logfile_fd = -1;	/* fd opened for log file */
 static char logfile_name[MAXPATHLEN];	/* name of log file */
+static char tracefile_name[MAXPATHLEN];	/* name of trace file */
 
 static bool noipx_opt;		/* dummy for noipx option */
 
@@ -182,6 +184,7 @@ static int showversion(char **);
 static int showhelp(char **);
 static void usage(void);
 static int setlogfile(char **);
+static int settracefile(char **);
 #ifdef PPP_WITH_PLUGINS
 static int loadplugin(char **);
 #endif
@@ -289,6 +292,12 @@ struct option general_options[] = {
     { "logfd", o_int, &log_to_fd,
       "Send log messages to this file descriptor",
       OPT_PRIOSUB | OPT_A2CLR, &log_default },
+    { "tracefile", o_special, (void *)settracefile,
+      "Record packets in binary form in this file",
+      OPT_PRIO | OPT_A2STRVAL | OPT_STATIC, &tracefile_name },
+    { "tracefile-size", o_int, &trace_kbytes,
+      "Size of the tracefile ring in kilobytes",
+      OPT_PRIO | OPT_LIMITS, NULL, 1048576, 4 },
     { "nolog", o_int, &log_to_fd,
       "Don't send log messages to any file",
       OPT_PRIOSUB | OPT_NOARG | OPT_VAL(-1) },
@@ -391,8 +400,18 @@ struct option general_options[] = {
 
     { "bundle", o_string, &bundle_name,
       "Bundle name for multilink", OPT_PRIO },
+    { "multilink-registry", o_bool, &multilink_registry,
+      "Find multilink bundles in a shared-memory registry", OPT_PRIO | 1 },
+    { "nomultilink-registry", o_bool, &multilink_registry,
+      "Find multilink bundles in the ppp database", OPT_PRIOSUB | 0 },
 #endif /* PPP_WITH_MULTILINK */
 
+#ifdef PPP_WITH_TDB
+    { "pppdb-hash-size", o_int, &pppdb_hash_size,
+      "Number of hash chains in a newly created ppp database",
+      OPT_PRIV | OPT_LIMITS, NULL, 524287, 1 },
+#endif
+
 #ifdef PPP_WITH_PLUGINS
     { "plugin", o_special, (void *)loadplugin,
       "Load a plug-in module into pppd", OPT_PRIV | OPT_A2LIST },
@@ -417,6 +436,10 @@ struct option general_options[] = {
     { "mo-timeout", o_int, &maxoctets_timeout,
       "Check for traffic limit every N seconds", OPT_PRIO | OPT_LLIMIT | 1 },
 
+    { "stats-cache", o_int, &stats_cache_ms,
+      "Reuse link statistics for up to N milliseconds",
+      OPT_PRIO | OPT_LLIMIT | 0 },
+
     /* Dummy option, does nothing */
     { "noipx", o_bool, &noipx_opt, NULL, OPT_NOPRINT | 1 },
 
@@ -1812,6 +1835,36 @@ setlogfile(char **argv)
     return 1;
 }
 
+/*
+ * settracefile - open the file for the binary packet trace.
+ */
+static int
+settracefile(char **argv)
+{
+    int fd, err;
+    uid_t euid;
+
+    euid = geteuid();
+    if (!privileged_option && seteuid(getuid()) == -1) {
+	ppp_option_error("unable to drop permissions to open %s: %m", *argv);
+	return 0;
+    }
+    fd = open(*argv, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    err = errno;
+    if (!privileged_option && seteuid(euid) == -1)
+	fatal("unable to regain privileges: %m");
+    if (fd < 0) {
+	errno = err;
+	ppp_option_error("Can't open trace file %s: %m", *argv);
+	return 0;
+    }
+    strlcpy(tracefile_name, *argv, sizeof(tracefile_name));
+    if (trace_fd >= 0)
+	close(trace_fd);
+    trace_fd = fd;
+    return 1;
+}
+
 static int
 setmodir(char **argv)
 {
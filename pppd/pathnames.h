@@ -117,6 +117,7 @@
 #endif
 
 #define PPP_PATH_PPPDB          PPP_PATH_VARRUN  "/pppd2.tdb"
+#define PPP_PATH_MPREG          PPP_PATH_VARRUN  "/pppd-bundles"
 
 #ifdef __linux__
 #define PPP_PATH_LOCKDIR        "/var/lock"
@@ -50,6 +50,15 @@ int get_time(struct timeval *tv);
 
 #endif
 
+/* A wait for PADOs, kept between packets */
+struct PADOWait {
+    struct timeval sent_at;	/* when our PADI went */
+    struct timeval expire_at;	/* when to stop waiting */
+    int mtu, mru;		/* conn->mtu and conn->mru before any PADOs */
+    int bestLatency;		/* response time of best, or -1 */
+    PPPoEPacket best;		/* quickest acceptable PADO so far */
+};
+
 /* Calculate time remaining until *exp, return 0 if now >= *exp */
 static int time_left(struct timeval *diff, struct timeval *exp)
 {
@@ -74,6 +83,87 @@ static int time_left(struct timeval *diff, struct timeval *exp)
     return 1;
 }
 
+/* Add ms milliseconds to *tv */
+static void add_ms(struct timeval *tv, int ms)
+{
+    tv->tv_sec += ms / 1000;
+    tv->tv_usec += (ms % 1000) * 1000;
+    if (tv->tv_usec >= 1000000) {
+	tv->tv_usec -= 1000000;
+	++tv->tv_sec;
+    }
+}
+
+/* Wait for ms milliseconds; returns 0 if we were asked to stop */
+static int pause_ms(int ms)
+{
+    struct timeval tv, expire_at;
+
+    if (ms <= 0)
+	return 1;
+    if (get_time(&expire_at) < 0) {
+	error("get_time: %m");
+	return 1;
+    }
+    add_ms(&expire_at, ms);
+    while (time_left(&tv, &expire_at)) {
+	if (select(0, NULL, NULL, NULL, &tv) < 0 && errno != EINTR) {
+	    error("select (pause): %m");
+	    break;
+	}
+	if (signaled(SIGTERM))
+	    return 0;
+    }
+    return 1;
+}
+
+/* Milliseconds from *start to *end */
+static int ms_between(struct timeval *start, struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000
+	+ (end->tv_usec - start->tv_usec) / 1000;
+}
+
+/**********************************************************************
+*%FUNCTION: recordPADO
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+* mac -- MAC address of an AC that sent us a PADO
+* ms -- how long after our PADI the PADO came
+*%RETURNS:
+* The AC's smoothed PADO response time, in milliseconds
+*%DESCRIPTION:
+* Keeps a moving average of each AC's response time, over all our
+* PADIs and reconnects.  A busy AC answers slowly, so this is also a
+* measure of its load.  When the table is full the slowest AC is
+* forgotten.
+***********************************************************************/
+static int
+recordPADO(PPPoEConnection *conn, unsigned char *mac, int ms)
+{
+    PPPoEAC *ac;
+    int i;
+
+    for (i = 0; i < conn->numACs; ++i) {
+	ac = &conn->acs[i];
+	if (memcmp(ac->mac, mac, ETH_ALEN) == 0) {
+	    ac->latency = (3 * ac->latency + ms) / 4;
+	    return ac->latency;
+	}
+    }
+    if (conn->numACs < MAX_ACS)
+	ac = &conn->acs[conn->numACs++];
+    else {
+	ac = &conn->acs[0];
+	for (i = 1; i < MAX_ACS; ++i)
+	    if (conn->acs[i].latency > ac->latency)
+		ac = &conn->acs[i];
+    }
+    memcpy(ac->mac, mac, ETH_ALEN);
+    ac->latency = ms;
+    return ms;
+}
+
 /**********************************************************************
 *%FUNCTION: parseForHostUniq
 *%ARGUMENTS:
@@ -292,6 +382,45 @@ parsePADSTags(UINT16_t type, UINT16_t len, unsigned char *data,
     }
 }
 
+/**********************************************************************
+*%FUNCTION: choosePADO
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+* packet -- the PADO of the AC we have chosen
+* mtu, mru -- conn->mtu and conn->mru before any PADOs were parsed
+* latency -- the AC's smoothed PADO response time
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Settles on the AC that sent packet.  PADOs from other ACs seen
+* while choosing may have left their cookie, relay ID or payload size
+* in conn, so these are taken from packet afresh.
+***********************************************************************/
+static void
+choosePADO(PPPoEConnection *conn, PPPoEPacket *packet, int mtu, int mru,
+	   int latency)
+{
+    struct PacketCriteria pc;
+
+    memset(&pc, 0, sizeof(pc));
+    pc.conn = conn;
+    conn->mtu = mtu;
+    conn->mru = mru;
+    conn->seenMaxPayload = 0;
+    conn->cookie.type = 0;
+    conn->relayId.type = 0;
+    parsePacket(packet, parsePADOTags, &pc);
+    memcpy(conn->peerEth, packet->ethHdr.h_source, ETH_ALEN);
+    conn->discoveryState = STATE_RECEIVED_PADO;
+    info("Chose access concentrator %02x:%02x:%02x:%02x:%02x:%02x%s%s,"
+	 " PADO in %d ms",
+	 (unsigned) conn->peerEth[0], (unsigned) conn->peerEth[1],
+	 (unsigned) conn->peerEth[2], (unsigned) conn->peerEth[3],
+	 (unsigned) conn->peerEth[4], (unsigned) conn->peerEth[5],
+	 conn->actualACname? " ": "",
+	 conn->actualACname? conn->actualACname: "", latency);
+}
+
 /***********************************************************************
 *%FUNCTION: sendPADI
 *%ARGUMENTS:
@@ -369,11 +498,169 @@ sendPADI(PPPoEConnection *conn)
     sendPacket(conn, conn->discoverySocket, &packet, (int) (plen + HDR_SIZE));
 }
 
+/**********************************************************************
+*%FUNCTION: readDiscoveryPacket
+*%ARGUMENTS:
+* conn -- PPPoEConnection structure
+* packet -- where to put the packet
+*%RETURNS:
+* 1 if we read a discovery packet for us; 0 otherwise
+*%DESCRIPTION:
+* Reads a packet from the discovery socket and checks that it is sane
+* and meant for us.
+***********************************************************************/
+static int
+readDiscoveryPacket(PPPoEConnection *conn, PPPoEPacket *packet)
+{
+    int len;
+
+    if (receivePacket(conn->discoverySocket, packet, &len) < 0)
+	return 0;
+
+    /* Check length */
+    if (ntohs(packet->length) + HDR_SIZE > len) {
+	error("Bogus PPPoE length field (%u)",
+	       (unsigned int) ntohs(packet->length));
+	return 0;
+    }
+
+#ifdef USE_BPF
+    /* If it's not a Discovery packet, ignore it */
+    if (etherType(packet) != Eth_PPPOE_Discovery) return 0;
+#endif
+
+    return packetIsForMe(conn, packet);
+}
+
+/**********************************************************************
+*%FUNCTION: startPADOWait
+*%ARGUMENTS:
+* conn -- PPPoEConnection structure
+* w -- the wait to start
+* timeout -- how long to wait (in milliseconds)
+*%RETURNS:
+* 1 if all went well; 0 otherwise
+*%DESCRIPTION:
+* Starts waiting for PADOs to the PADI we have just sent.
+***********************************************************************/
+static int
+startPADOWait(PPPoEConnection *conn, struct PADOWait *w, int timeout)
+{
+    if (get_time(&w->sent_at) < 0) {
+	error("get_time (waitForPADO): %m");
+	return 0;
+    }
+    w->expire_at = w->sent_at;
+    add_ms(&w->expire_at, timeout);
+    w->mtu = conn->mtu;
+    w->mru = conn->mru;
+    w->bestLatency = -1;
+    conn->seenMaxPayload = 0;
+    return 1;
+}
+
+/**********************************************************************
+*%FUNCTION: handlePADO
+*%ARGUMENTS:
+* conn -- PPPoEConnection structure
+* w -- the wait the PADO is for
+* packet -- a PADO for us
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Copies useful information from a PADO.  Normally the first acceptable
+* PADO is taken.  If conn->padoWait is set, PADOs are collected for that
+* many milliseconds after the first, by bringing w->expire_at forward,
+* and the AC with the lowest smoothed response time is chosen by
+* endPADOWait(), unless the AC we last had a session with answers,
+* which is taken at once.
+***********************************************************************/
+static void
+handlePADO(PPPoEConnection *conn, struct PADOWait *w, PPPoEPacket *packet)
+{
+    struct PacketCriteria pc;
+    struct timeval now;
+    int latency;
+
+    if (NOT_UNICAST(packet->ethHdr.h_source)) {
+	error("Ignoring PADO packet from non-unicast MAC address");
+	return;
+    }
+    if (conn->req_peer
+	&& memcmp(packet->ethHdr.h_source, conn->req_peer_mac, ETH_ALEN) != 0) {
+	warn("Ignoring PADO packet from wrong MAC address");
+	return;
+    }
+    pc.conn          = conn;
+    pc.acNameOK      = (conn->acName)      ? 0 : 1;
+    pc.serviceNameOK = (conn->serviceName) ? 0 : 1;
+    pc.seenACName    = 0;
+    pc.seenServiceName = 0;
+    if (parsePacket(packet, parsePADOTags, &pc) < 0)
+	return;
+    if (conn->error)
+	return;
+    if (!pc.seenACName) {
+	error("Ignoring PADO packet with no AC-Name tag");
+	return;
+    }
+    if (!pc.seenServiceName) {
+	error("Ignoring PADO packet with no Service-Name tag");
+	return;
+    }
+    if (pppoe_verbose >= 1) {
+	info("AC-Ethernet-Address: %02x:%02x:%02x:%02x:%02x:%02x",
+	       (unsigned) packet->ethHdr.h_source[0],
+	       (unsigned) packet->ethHdr.h_source[1],
+	       (unsigned) packet->ethHdr.h_source[2],
+	       (unsigned) packet->ethHdr.h_source[3],
+	       (unsigned) packet->ethHdr.h_source[4],
+	       (unsigned) packet->ethHdr.h_source[5]);
+	info("--------------------------------------------------");
+    }
+    conn->numPADOs++;
+    if (!pc.acNameOK || !pc.serviceNameOK
+	|| conn->discoveryState == STATE_RECEIVED_PADO)
+	return;
+    if (conn->padoWait <= 0) {
+	memcpy(conn->peerEth, packet->ethHdr.h_source, ETH_ALEN);
+	conn->discoveryState = STATE_RECEIVED_PADO;
+	return;
+    }
+    if (get_time(&now) < 0)
+	now = w->sent_at;
+    latency = recordPADO(conn, packet->ethHdr.h_source,
+			 ms_between(&w->sent_at, &now));
+    if (conn->haveCachedAC
+	&& memcmp(packet->ethHdr.h_source, conn->cachedACEth, ETH_ALEN) == 0) {
+	choosePADO(conn, packet, w->mtu, w->mru, latency);
+	return;
+    }
+    if (w->bestLatency < 0) {
+	/* stop collecting padoWait ms after the first offer */
+	add_ms(&now, conn->padoWait);
+	if (ms_between(&now, &w->expire_at) > 0)
+	    w->expire_at = now;
+    }
+    if (w->bestLatency < 0 || latency < w->bestLatency) {
+	memcpy(&w->best, packet, sizeof(*packet));
+	w->bestLatency = latency;
+    }
+}
+
+/* Finish waiting for PADOs, taking the best one collected if any */
+static void
+endPADOWait(PPPoEConnection *conn, struct PADOWait *w)
+{
+    if (w->bestLatency >= 0 && conn->discoveryState != STATE_RECEIVED_PADO)
+	choosePADO(conn, &w->best, w->mtu, w->mru, w->bestLatency);
+}
+
 /**********************************************************************
 *%FUNCTION: waitForPADO
 *%ARGUMENTS:
 * conn -- PPPoEConnection structure
-* timeout -- how long to wait (in seconds)
+* timeout -- how long to wait (in milliseconds)
 *%RETURNS:
 * Nothing
 *%DESCRIPTION:
@@ -385,29 +672,16 @@ waitForPADO(PPPoEConnection *conn, int timeout, int waitWholeTimeoutForPADO)
     fd_set readable;
     int r;
     struct timeval tv;
-    struct timeval expire_at;
-
+    struct PADOWait w;
     PPPoEPacket packet;
-    int len;
-
-    struct PacketCriteria pc;
-    pc.conn          = conn;
-    pc.acNameOK      = (conn->acName)      ? 0 : 1;
-    pc.serviceNameOK = (conn->serviceName) ? 0 : 1;
-    pc.seenACName    = 0;
-    pc.seenServiceName = 0;
-    conn->seenMaxPayload = 0;
 
-    if (get_time(&expire_at) < 0) {
-	error("get_time (waitForPADO): %m");
+    if (!startPADOWait(conn, &w, timeout))
 	return;
-    }
-    expire_at.tv_sec += timeout;
 
     do {
 	if (BPF_BUFFER_IS_EMPTY) {
-	    if (!time_left(&tv, &expire_at))
-		return;		/* Timed out */
+	    if (!time_left(&tv, &w.expire_at))
+		break;		/* Timed out */
 
 	    FD_ZERO(&readable);
 	    FD_SET(conn->discoverySocket, &readable);
@@ -421,67 +695,15 @@ waitForPADO(PPPoEConnection *conn, int timeout, int waitWholeTimeoutForPADO)
 		return;
 	    }
 	    if (r == 0)
-		return;		/* Timed out */
+		break;		/* Timed out */
 	}
 
 	conn->error = 0;
-	/* Get the packet */
-	receivePacket(conn->discoverySocket, &packet, &len);
-
-	/* Check length */
-	if (ntohs(packet.length) + HDR_SIZE > len) {
-	    error("Bogus PPPoE length field (%u)",
-		   (unsigned int) ntohs(packet.length));
-	    continue;
-	}
-
-#ifdef USE_BPF
-	/* If it's not a Discovery packet, loop again */
-	if (etherType(&packet) != Eth_PPPOE_Discovery) continue;
-#endif
-
-	/* If it's not for us, loop again */
-	if (!packetIsForMe(conn, &packet)) continue;
-
-	if (packet.code == CODE_PADO) {
-	    if (NOT_UNICAST(packet.ethHdr.h_source)) {
-		error("Ignoring PADO packet from non-unicast MAC address");
-		continue;
-	    }
-	    if (conn->req_peer
-		&& memcmp(packet.ethHdr.h_source, conn->req_peer_mac, ETH_ALEN) != 0) {
-		warn("Ignoring PADO packet from wrong MAC address");
-		continue;
-	    }
-	    if (parsePacket(&packet, parsePADOTags, &pc) < 0)
-		continue;
-	    if (conn->error)
-		continue;
-	    if (!pc.seenACName) {
-		error("Ignoring PADO packet with no AC-Name tag");
-		continue;
-	    }
-	    if (!pc.seenServiceName) {
-		error("Ignoring PADO packet with no Service-Name tag");
-		continue;
-	    }
-	    if (pppoe_verbose >= 1) {
-		info("AC-Ethernet-Address: %02x:%02x:%02x:%02x:%02x:%02x",
-		       (unsigned) packet.ethHdr.h_source[0],
-		       (unsigned) packet.ethHdr.h_source[1],
-		       (unsigned) packet.ethHdr.h_source[2],
-		       (unsigned) packet.ethHdr.h_source[3],
-		       (unsigned) packet.ethHdr.h_source[4],
-		       (unsigned) packet.ethHdr.h_source[5]);
-		info("--------------------------------------------------");
-	    }
-	    conn->numPADOs++;
-	    if (pc.acNameOK && pc.serviceNameOK && conn->discoveryState != STATE_RECEIVED_PADO) {
-		memcpy(conn->peerEth, packet.ethHdr.h_source, ETH_ALEN);
-		conn->discoveryState = STATE_RECEIVED_PADO;
-	    }
-	}
+	if (readDiscoveryPacket(conn, &packet) && packet.code == CODE_PADO)
+	    handlePADO(conn, &w, &packet);
     } while (waitWholeTimeoutForPADO || conn->discoveryState != STATE_RECEIVED_PADO);
+
+    endPADOWait(conn, &w);
 }
 
 /***********************************************************************
@@ -567,6 +789,46 @@ sendPADR(PPPoEConnection *conn)
     sendPacket(conn, conn->discoverySocket, &packet, (int) (plen + HDR_SIZE));
 }
 
+/**********************************************************************
+*%FUNCTION: handlePADS
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+* packet -- a packet for us
+*%RETURNS:
+* 1 if packet ends the wait for a PADS; 0 otherwise
+*%DESCRIPTION:
+* If packet is the AC's PADS, copies useful information from it, and
+* moves to STATE_SESSION unless the AC reported an error.
+***********************************************************************/
+static int
+handlePADS(PPPoEConnection *conn, PPPoEPacket *packet)
+{
+    /* If it's not from the AC, it's not for me */
+    if (memcmp(packet->ethHdr.h_source, conn->peerEth, ETH_ALEN)) return 0;
+
+    /* Is it PADS?  */
+    if (packet->code != CODE_PADS) return 0;
+
+    /* Parse for goodies */
+    conn->error = 0;
+    if (parsePacket(packet, parsePADSTags, conn) < 0)
+	return 1;
+    if (conn->error)
+	return 1;
+    conn->discoveryState = STATE_SESSION;
+
+    /* Don't bother with ntohs; we'll just end up converting it back... */
+    conn->session = packet->session;
+
+    info("PPP session is %d", (int) ntohs(conn->session));
+
+    /* RFC 2516 says session id MUST NOT be zero or 0xFFFF */
+    if (ntohs(conn->session) == 0 || ntohs(conn->session) == 0xFFFF) {
+	error("Access concentrator used a session value of %x -- the AC is violating RFC 2516", (unsigned int) ntohs(conn->session));
+    }
+    return 1;
+}
+
 /**********************************************************************
 *%FUNCTION: waitForPADS
 *%ARGUMENTS:
@@ -586,7 +848,6 @@ waitForPADS(PPPoEConnection *conn, int timeout)
     struct timeval expire_at;
 
     PPPoEPacket packet;
-    int len;
 
     if (get_time(&expire_at) < 0) {
 	error("get_time (waitForPADS): %m");
@@ -594,7 +855,6 @@ waitForPADS(PPPoEConnection *conn, int timeout)
     }
     expire_at.tv_sec += timeout;
 
-    conn->error = 0;
     do {
 	if (BPF_BUFFER_IS_EMPTY) {
 	    if (!time_left(&tv, &expire_at))
@@ -614,49 +874,33 @@ waitForPADS(PPPoEConnection *conn, int timeout)
 	    if (r == 0)
 		return;		/* Timed out */
 	}
+    } while (!readDiscoveryPacket(conn, &packet) || !handlePADS(conn, &packet));
+}
 
-	/* Get the packet */
-	receivePacket(conn->discoverySocket, &packet, &len);
-
-	/* Check length */
-	if (ntohs(packet.length) + HDR_SIZE > len) {
-	    error("Bogus PPPoE length field (%u)",
-		   (unsigned int) ntohs(packet.length));
-	    continue;
-	}
-
-#ifdef USE_BPF
-	/* If it's not a Discovery packet, loop again */
-	if (etherType(&packet) != Eth_PPPOE_Discovery) continue;
-#endif
-
-	/* If it's not from the AC, it's not for me */
-	if (memcmp(packet.ethHdr.h_source, conn->peerEth, ETH_ALEN)) continue;
-
-	/* If it's not for us, loop again */
-	if (!packetIsForMe(conn, &packet)) continue;
-
-	/* Is it PADS?  */
-	if (packet.code == CODE_PADS) {
-	    /* Parse for goodies */
-	    if (parsePacket(&packet, parsePADSTags, conn) < 0)
-		return;
-	    if (conn->error)
-		return;
-	    conn->discoveryState = STATE_SESSION;
-	    break;
-	}
-    } while (conn->discoveryState != STATE_SESSION);
-
-    /* Don't bother with ntohs; we'll just end up converting it back... */
-    conn->session = packet.session;
-
-    info("PPP session is %d", (int) ntohs(conn->session));
-
-    /* RFC 2516 says session id MUST NOT be zero or 0xFFFF */
-    if (ntohs(conn->session) == 0 || ntohs(conn->session) == 0xFFFF) {
-	error("Access concentrator used a session value of %x -- the AC is violating RFC 2516", (unsigned int) ntohs(conn->session));
+/**********************************************************************
+*%FUNCTION: sessionUp
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Settles the MTU and MRU once we have a session, and remembers the AC
+* to prefer it next time.
+***********************************************************************/
+static void
+sessionUp(PPPoEConnection *conn)
+{
+    if (!conn->seenMaxPayload) {
+	/* RFC 4638: MUST limit MTU/MRU to 1492 */
+	if (conn->mtu > ETH_PPPOE_MTU)
+	    conn->mtu = ETH_PPPOE_MTU;
+	if (conn->mru > ETH_PPPOE_MTU)
+	    conn->mru = ETH_PPPOE_MTU;
     }
+
+    /* Prefer this AC next time */
+    memcpy(conn->cachedACEth, conn->peerEth, ETH_ALEN);
+    conn->haveCachedAC = 1;
 }
 
 /**********************************************************************
@@ -666,17 +910,20 @@ waitForPADS(PPPoEConnection *conn, int timeout)
 *%RETURNS:
 * Nothing
 *%DESCRIPTION:
-* Performs the PPPoE discovery phase 1
+* Performs the PPPoE discovery phase 1.  Each PADI may be delayed by
+* the pacing settings in conn; see pacing.c.
 ***********************************************************************/
 void
 discovery1(PPPoEConnection *conn, int waitWholeTimeoutForPADO)
 {
     int padiAttempts = 0;
-    int timeout = conn->discoveryTimeout;
+    int timeout = conn->discoveryTimeout * 1000;
+    int delay = padiFirstDelay(conn);
 
     do {
 	padiAttempts++;
-	if (signaled(SIGTERM) || padiAttempts > conn->discoveryAttempts) {
+	if (signaled(SIGTERM) || padiAttempts > conn->discoveryAttempts
+	    || !pause_ms(delay + padiSlot(conn))) {
 	    warn("Timeout waiting for PADO packets");
 	    close(conn->discoverySocket);
 	    conn->discoverySocket = -1;
@@ -686,7 +933,8 @@ discovery1(PPPoEConnection *conn, int waitWholeTimeoutForPADO)
 	conn->discoveryState = STATE_SENT_PADI;
 	waitForPADO(conn, timeout, waitWholeTimeoutForPADO);
 
-	timeout *= 2;
+	timeout = padiNextTimeout(conn, timeout);
+	delay = 0;
     } while (conn->discoveryState == STATE_SENT_PADI);
 }
 
@@ -709,6 +957,7 @@ discovery2(PPPoEConnection *conn)
 	padrAttempts++;
 	if (signaled(SIGTERM) || padrAttempts > conn->discoveryAttempts) {
 	    warn("Timeout waiting for PADS packets");
+	    conn->haveCachedAC = 0;
 	    close(conn->discoverySocket);
 	    conn->discoverySocket = -1;
 	    return;
@@ -719,13 +968,7 @@ discovery2(PPPoEConnection *conn)
 	timeout *= 2;
     } while (conn->discoveryState == STATE_SENT_PADR);
 
-    if (!conn->seenMaxPayload) {
-	/* RFC 4638: MUST limit MTU/MRU to 1492 */
-	if (conn->mtu > ETH_PPPOE_MTU)
-	    conn->mtu = ETH_PPPOE_MTU;
-	if (conn->mru > ETH_PPPOE_MTU)
-	    conn->mru = ETH_PPPOE_MTU;
-    }
+    sessionUp(conn);
 
     /* We're done. */
     close(conn->discoverySocket);
@@ -733,3 +976,209 @@ discovery2(PPPoEConnection *conn)
     conn->discoveryState = STATE_SESSION;
     return;
 }
+
+#ifdef PLUGIN
+/*
+ * Discovery driven by pppd's event loop, so that pppd carries on
+ * running its timers and other fds while we wait for the AC.  Each
+ * connection has its own state, and the timeouts and fd callback are
+ * keyed on the connection, so several can be in discovery at once.
+ */
+struct PPPoEDiscoveryStruct {
+    void (*done)(PPPoEConnection *conn);
+    int attempts;		/* PADIs or PADRs sent so far */
+    int timeout;		/* how long to wait for an answer (ms) */
+    struct PADOWait pado;
+};
+
+static void discoverySendPADI(void *arg);
+static void discoveryPADOTimeout(void *arg);
+static void discoverySendPADR(void *arg);
+
+/* Call func(conn) in ms milliseconds */
+static void
+discoveryAfter(void (*func)(void *), PPPoEConnection *conn, int ms)
+{
+    ppp_timeout(func, conn, ms / 1000, (ms % 1000) * 1000);
+}
+
+/* Stop discovery, leaving conn->discoveryState to say how far we got */
+static void
+discoveryStop(PPPoEConnection *conn)
+{
+    ppp_untimeout(discoverySendPADI, conn);
+    ppp_untimeout(discoveryPADOTimeout, conn);
+    ppp_untimeout(discoverySendPADR, conn);
+    remove_fd(conn->discoverySocket);
+    close(conn->discoverySocket);
+    conn->discoverySocket = -1;
+    free(conn->discovery);
+    conn->discovery = NULL;
+}
+
+static void
+discoveryFinish(PPPoEConnection *conn)
+{
+    void (*done)(PPPoEConnection *) = conn->discovery->done;
+
+    discoveryStop(conn);
+    done(conn);
+}
+
+static void
+discoveryStartPADR(PPPoEConnection *conn)
+{
+    conn->discovery->attempts = 0;
+    conn->discovery->timeout = conn->discoveryTimeout * 1000;
+    discoverySendPADR(conn);
+}
+
+/* Send a PADI, or give up if we have sent enough */
+static void
+discoverySendPADI(void *arg)
+{
+    PPPoEConnection *conn = arg;
+    struct PPPoEDiscoveryStruct *d = conn->discovery;
+
+    if (++d->attempts > conn->discoveryAttempts) {
+	warn("Timeout waiting for PADO packets");
+	discoveryFinish(conn);
+	return;
+    }
+    sendPADI(conn);
+    conn->discoveryState = STATE_SENT_PADI;
+    if (!startPADOWait(conn, &d->pado, d->timeout)) {
+	discoveryFinish(conn);
+	return;
+    }
+    discoveryAfter(discoveryPADOTimeout, conn, d->timeout);
+}
+
+/* The wait for PADOs is over: take the best, or try another PADI */
+static void
+discoveryPADOTimeout(void *arg)
+{
+    PPPoEConnection *conn = arg;
+    struct PPPoEDiscoveryStruct *d = conn->discovery;
+
+    endPADOWait(conn, &d->pado);
+    if (conn->discoveryState == STATE_RECEIVED_PADO) {
+	discoveryStartPADR(conn);
+	return;
+    }
+    d->timeout = padiNextTimeout(conn, d->timeout);
+    discoveryAfter(discoverySendPADI, conn,
+		   d->attempts < conn->discoveryAttempts? padiSlot(conn): 0);
+}
+
+/* Send a PADR, again if the last got no PADS, or give up */
+static void
+discoverySendPADR(void *arg)
+{
+    PPPoEConnection *conn = arg;
+    struct PPPoEDiscoveryStruct *d = conn->discovery;
+
+    if (++d->attempts > conn->discoveryAttempts) {
+	warn("Timeout waiting for PADS packets");
+	conn->haveCachedAC = 0;
+	discoveryFinish(conn);
+	return;
+    }
+    if (d->attempts > 1)
+	d->timeout *= 2;
+    sendPADR(conn);
+    conn->discoveryState = STATE_SENT_PADR;
+    discoveryAfter(discoverySendPADR, conn, d->timeout);
+}
+
+/* A packet has arrived on the discovery socket */
+static void
+discoveryInput(int fd, void *arg)
+{
+    PPPoEConnection *conn = arg;
+    struct PPPoEDiscoveryStruct *d = conn->discovery;
+    struct timeval expire_at, tv;
+    PPPoEPacket packet;
+
+    conn->error = 0;
+    if (!readDiscoveryPacket(conn, &packet) || d->attempts == 0)
+	return;
+
+    switch (conn->discoveryState) {
+    case STATE_SENT_PADI:
+	if (packet.code != CODE_PADO)
+	    break;
+	expire_at = d->pado.expire_at;
+	handlePADO(conn, &d->pado, &packet);
+	if (conn->discoveryState == STATE_RECEIVED_PADO) {
+	    ppp_untimeout(discoveryPADOTimeout, conn);
+	    discoveryStartPADR(conn);
+	} else if (ms_between(&d->pado.expire_at, &expire_at) > 0) {
+	    /* collecting PADOs: the wait now ends sooner */
+	    ppp_untimeout(discoveryPADOTimeout, conn);
+	    if (time_left(&tv, &d->pado.expire_at))
+		ppp_timeout(discoveryPADOTimeout, conn, tv.tv_sec, tv.tv_usec);
+	    else
+		discoveryPADOTimeout(conn);
+	}
+	break;
+    case STATE_SENT_PADR:
+	if (!handlePADS(conn, &packet))
+	    break;
+	ppp_untimeout(discoverySendPADR, conn);
+	if (conn->discoveryState == STATE_SESSION) {
+	    sessionUp(conn);
+	    discoveryFinish(conn);
+	} else
+	    discoverySendPADR(conn);
+	break;
+    }
+}
+
+/**********************************************************************
+*%FUNCTION: discoveryStart
+*%ARGUMENTS:
+* conn -- PPPoE connection info structure, with its discovery socket open
+* done -- called when discovery has finished
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Starts PPPoE discovery phases 1 and 2, as discovery1() and
+* discovery2() do, but from pppd's event loop rather than waiting for
+* it.  When done is called, conn->discoveryState is STATE_SESSION if
+* we have a session, and the discovery socket has been closed.
+***********************************************************************/
+void
+discoveryStart(PPPoEConnection *conn, void (*done)(PPPoEConnection *conn))
+{
+    struct PPPoEDiscoveryStruct *d;
+
+    d = calloc(1, sizeof(*d));
+    if (d == NULL)
+	novm("PPPoE discovery");
+    d->done = done;
+    d->timeout = conn->discoveryTimeout * 1000;
+    conn->discovery = d;
+    conn->discoveryState = STATE_SENT_PADI;
+    add_fd_callback(conn->discoverySocket, discoveryInput, conn);
+    discoveryAfter(discoverySendPADI, conn,
+		   padiFirstDelay(conn) + padiSlot(conn));
+}
+
+/**********************************************************************
+*%FUNCTION: discoveryCancel
+*%ARGUMENTS:
+* conn -- PPPoE connection info structure
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Abandons discovery started by discoveryStart(), if it is still
+* going, without calling its done function.
+***********************************************************************/
+void
+discoveryCancel(PPPoEConnection *conn)
+{
+    if (conn->discovery != NULL)
+	discoveryStop(conn);
+}
+#endif /* PLUGIN */
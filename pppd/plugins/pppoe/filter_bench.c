@@ -0,0 +1,256 @@
+/*
+ * filter_bench.c - measure what the discovery socket filter saves when
+ * many pppoe dialers share an interface.
+ *
+ * Opens a discovery socket on the loopback interface for each of a
+ * number of dialers, all with the same MAC address and each with its
+ * own Host-Uniq, as pppd processes on one aggregation box would have.
+ * Then sends a stream of discovery traffic: a PADI from some dialer,
+ * and a PADO and a PADS for another, and reads whatever each socket
+ * gets, with and without setDiscoveryFilter().  Prints how many packets
+ * the dialers were woken for, and checks that with the filter each
+ * dialer got its own PADO and PADS and nothing else.
+ *
+ * Needs CAP_NET_RAW; prints a note and exits successfully without it.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "pppoe.h"
+
+#define N_DIALERS	500
+#define N_ROUNDS	2000
+
+static const unsigned char dialer_mac[ETH_ALEN] = { 2, 0, 0, 0, 0, 1 };
+static const unsigned char ac_mac[ETH_ALEN] = { 2, 0, 0, 0, 0, 2 };
+
+static PPPoEConnection conns[N_DIALERS];
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, " (errno %d)\n", errno);
+    exit(1);
+}
+
+void
+error(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+void
+warn(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+bool
+debug_on(void)
+{
+    return 0;
+}
+
+void
+pppoe_log_packet(const char *prefix, PPPoEPacket *packet)
+{
+}
+
+size_t
+strlcpy(char *dest, const char *src, size_t len)
+{
+    size_t ret = strlen(src);
+
+    if (len != 0) {
+	if (ret < len)
+	    strcpy(dest, src);
+	else {
+	    memcpy(dest, src, len - 1);
+	    dest[len-1] = 0;
+	}
+    }
+    return ret;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned char *
+add_tag(unsigned char *p, UINT16_t type, const void *data, int len)
+{
+    p[0] = type >> 8;
+    p[1] = type;
+    p[2] = len >> 8;
+    p[3] = len;
+    memcpy(p + TAG_HDR_SIZE, data, len);
+    return p + TAG_HDR_SIZE + len;
+}
+
+/*
+ * make - build a discovery packet with code from src to dst, carrying
+ * the Host-Uniq of dialer i, and return its length.
+ */
+static int
+make(PPPoEPacket *pkt, int code, const unsigned char *src,
+     const unsigned char *dst, int i)
+{
+    static const char cookie[20] = "0123456789abcdefghi";
+    unsigned char *p = pkt->payload;
+    UINT32_t uniq = i;
+
+    memcpy(pkt->ethHdr.h_dest, dst, ETH_ALEN);
+    memcpy(pkt->ethHdr.h_source, src, ETH_ALEN);
+    pkt->ethHdr.h_proto = htons(Eth_PPPOE_Discovery);
+    pkt->vertype = PPPOE_VER_TYPE(1, 1);
+    pkt->code = code;
+    pkt->session = code == CODE_PADS? htons(i + 1): 0;
+    p = add_tag(p, TAG_SERVICE_NAME, "", 0);
+    if (code != CODE_PADI) {
+	p = add_tag(p, TAG_AC_NAME, "bench-ac", 8);
+	p = add_tag(p, TAG_AC_COOKIE, cookie, sizeof(cookie));
+    }
+    p = add_tag(p, TAG_HOST_UNIQ, &uniq, sizeof(uniq));
+    pkt->length = htons(p - pkt->payload);
+    return p - (unsigned char *) pkt;
+}
+
+static double
+cpu_ms(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3
+	+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+static void
+run(int filter)
+{
+    static int got[N_DIALERS];
+    struct epoll_event ev, evs[64];
+    PPPoEPacket pkt;
+    double t0, c0;
+    long wakeups = 0, packets = 0;
+    int i, j, n, len, ep, tx;
+    UINT32_t uniq;
+
+    if ((ep = epoll_create1(0)) < 0)
+	fatal("epoll_create1");
+    if ((tx = openInterface("lo", Eth_PPPOE_Discovery, NULL)) < 0)
+	fatal("openInterface");
+    for (i = 0; i < N_DIALERS; ++i) {
+	conns[i].discoverySocket = openInterface("lo", Eth_PPPOE_Discovery,
+						 NULL);
+	if (conns[i].discoverySocket < 0)
+	    fatal("openInterface");
+	memcpy(conns[i].myEth, dialer_mac, ETH_ALEN);
+	uniq = i;
+	conns[i].hostUniq.type = htons(TAG_HOST_UNIQ);
+	conns[i].hostUniq.length = htons(sizeof(uniq));
+	memcpy(conns[i].hostUniq.payload, &uniq, sizeof(uniq));
+	if (filter)
+	    setDiscoveryFilter(&conns[i]);
+	ev.events = EPOLLIN;
+	ev.data.u32 = i;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].discoverySocket, &ev) < 0)
+	    fatal("epoll_ctl");
+	got[i] = 0;
+    }
+
+    t0 = now_ns();
+    c0 = cpu_ms();
+    for (j = 0; j < N_ROUNDS; ++j) {
+	static const unsigned char bcast[ETH_ALEN] =
+	    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+	i = j % N_DIALERS;
+	len = make(&pkt, CODE_PADI, dialer_mac, bcast, (i + 1) % N_DIALERS);
+	send(tx, &pkt, len, 0);
+	len = make(&pkt, CODE_PADO, ac_mac, dialer_mac, i);
+	send(tx, &pkt, len, 0);
+	len = make(&pkt, CODE_PADS, ac_mac, dialer_mac, i);
+	send(tx, &pkt, len, 0);
+
+	/* each dialer reads what it has been woken for */
+	while ((n = epoll_wait(ep, evs, 64, 0)) > 0) {
+	    for (i = 0; i < n; ++i) {
+		int k = evs[i].data.u32;
+
+		++wakeups;
+		while (recv(conns[k].discoverySocket, &pkt, sizeof(pkt),
+			    MSG_DONTWAIT) > 0) {
+		    ++packets;
+		    memcpy(&uniq, pkt.payload + ntohs(pkt.length)
+			   - sizeof(uniq), sizeof(uniq));
+		    if (pkt.code != CODE_PADI && uniq == k)
+			++got[k];
+		    else if (filter)
+			fatal("dialer %d got a packet for %u", k, uniq);
+		}
+	    }
+	}
+    }
+    printf("  %-10s %9ld wakeups, %9ld packets read, %8.1f ms, cpu %8.1f ms\n",
+	   filter? "filter": "no filter", wakeups, packets,
+	   (now_ns() - t0) / 1e6, cpu_ms() - c0);
+
+    for (i = 0; i < N_DIALERS; ++i) {
+	if (got[i] != 2 * (N_ROUNDS / N_DIALERS))
+	    fatal("dialer %d got %d of its packets", i, got[i]);
+	close(conns[i].discoverySocket);
+    }
+    close(tx);
+    close(ep);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int fd;
+
+    fd = socket(PF_PACKET, SOCK_RAW, htons(Eth_PPPOE_Discovery));
+    if (fd < 0) {
+	printf("pppoe discovery filter: skipped, can't open a raw socket\n");
+	return 0;
+    }
+    close(fd);
+
+    printf("pppoe discovery, %d dialers on one interface, %d PADI/PADO/PADS:\n",
+	   N_DIALERS, N_ROUNDS);
+    run(0);
+    run(1);
+    return 0;
+}
@@ -35,6 +35,10 @@
 #include <asm/types.h>
 #endif
 
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
 #endif
@@ -193,6 +197,172 @@ openInterface(char const *ifname, UINT16_t type, unsigned char *hwaddr)
     return fd;
 }
 
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+
+/* How many tags the filter steps over looking for Host-Uniq before it
+   lets the packet through for packetIsForMe() to decide */
+#define FILTER_MAX_TAGS 16
+
+/* Longest Host-Uniq the filter compares; longer ones are left to
+   packetIsForMe() */
+#define FILTER_MAX_UNIQ 64
+
+#define FILTER_LEN (10 + 6 * FILTER_MAX_TAGS + 3 + 2 * (FILTER_MAX_UNIQ / 4 + 2))
+
+/* Jump targets, resolved when the program is complete; only jumps
+   of 0 or 1 are written as such */
+#define J_UNIQ		253
+#define J_REJECT	254
+#define J_ACCEPT	255
+
+struct filter_asm {
+    struct sock_filter insn[FILTER_LEN];
+    int n;
+};
+
+static void
+filter_emit(struct filter_asm *f, UINT16_t code, UINT32_t k, int jt, int jf)
+{
+    struct sock_filter *p = &f->insn[f->n++];
+
+    p->code = code;
+    p->k = k;
+    p->jt = jt;
+    p->jf = jf;
+}
+
+/* Compare the len bytes of data with the packet at X + off */
+static void
+filter_match(struct filter_asm *f, UINT32_t off, unsigned char *data, int len)
+{
+    UINT32_t v;
+
+    while (len >= 4) {
+	v = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	filter_emit(f, BPF_LD | BPF_W | BPF_IND, off, 0, 0);
+	filter_emit(f, BPF_JMP | BPF_JEQ | BPF_K, v, 0, J_REJECT);
+	data += 4;
+	off += 4;
+	len -= 4;
+    }
+    if (len >= 2) {
+	filter_emit(f, BPF_LD | BPF_H | BPF_IND, off, 0, 0);
+	filter_emit(f, BPF_JMP | BPF_JEQ | BPF_K, (data[0] << 8) | data[1],
+		    0, J_REJECT);
+	data += 2;
+	off += 2;
+	len -= 2;
+    }
+    if (len) {
+	filter_emit(f, BPF_LD | BPF_B | BPF_IND, off, 0, 0);
+	filter_emit(f, BPF_JMP | BPF_JEQ | BPF_K, data[0], 0, J_REJECT);
+    }
+}
+#endif
+
+/***********************************************************************
+*%FUNCTION: setDiscoveryFilter
+*%ARGUMENTS:
+* conn -- PPPoE connection, with its discovery socket open and myEth set
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Attaches a socket filter to the discovery socket so that the kernel
+* only passes us PADO and PADS packets sent to our MAC address with our
+* Host-Uniq tag, rather than waking us for every PPPoE discovery packet
+* on the segment, including everyone else's PADIs.  packetIsForMe()
+* still checks what gets through; without the filter everything works
+* as before, only less efficiently.
+***********************************************************************/
+void
+setDiscoveryFilter(PPPoEConnection *conn)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+    struct filter_asm f;
+    struct sock_fprog fprog;
+    PPPoEPacket packet;
+    unsigned char *mac = conn->myEth;
+    int len = ntohs(conn->hostUniq.length);
+    int i, t, uniq = -1, accept, reject;
+
+    f.n = 0;
+    /* PPPoE code: PADO or PADS */
+    filter_emit(&f, BPF_LD | BPF_B | BPF_ABS, ETH_HLEN + 1, 0, 0);
+    filter_emit(&f, BPF_JMP | BPF_JEQ | BPF_K, CODE_PADO, 1, 0);
+    filter_emit(&f, BPF_JMP | BPF_JEQ | BPF_K, CODE_PADS, 0, J_REJECT);
+    /* destination MAC is ours */
+    filter_emit(&f, BPF_LD | BPF_W | BPF_ABS, 0, 0, 0);
+    filter_emit(&f, BPF_JMP | BPF_JEQ | BPF_K,
+		(mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3],
+		0, J_REJECT);
+    filter_emit(&f, BPF_LD | BPF_H | BPF_ABS, 4, 0, 0);
+    filter_emit(&f, BPF_JMP | BPF_JEQ | BPF_K, (mac[4] << 8) | mac[5],
+		0, J_REJECT);
+
+    if (len > 0 && len <= FILTER_MAX_UNIQ) {
+	/*
+	 * Step X over the tags to Host-Uniq.  A packet whose tags run
+	 * past its end has no Host-Uniq, and loading beyond the end
+	 * rejects it.
+	 */
+	filter_emit(&f, BPF_LDX | BPF_W | BPF_IMM, HDR_SIZE, 0, 0);
+	for (i = 0; i < FILTER_MAX_TAGS; ++i) {
+	    filter_emit(&f, BPF_LD | BPF_H | BPF_IND, 0, 0, 0);
+	    filter_emit(&f, BPF_JMP | BPF_JEQ | BPF_K, TAG_HOST_UNIQ, J_UNIQ, 0);
+	    filter_emit(&f, BPF_LD | BPF_H | BPF_IND, 2, 0, 0);
+	    filter_emit(&f, BPF_ALU | BPF_ADD | BPF_K, TAG_HDR_SIZE, 0, 0);
+	    filter_emit(&f, BPF_ALU | BPF_ADD | BPF_X, 0, 0, 0);
+	    filter_emit(&f, BPF_MISC | BPF_TAX, 0, 0, 0);
+	}
+	filter_emit(&f, BPF_RET | BPF_K, 0xffffffff, 0, 0);
+	uniq = f.n;
+	filter_emit(&f, BPF_LD | BPF_H | BPF_IND, 2, 0, 0);
+	filter_emit(&f, BPF_JMP | BPF_JEQ | BPF_K, len, 0, J_REJECT);
+	filter_match(&f, TAG_HDR_SIZE, conn->hostUniq.payload, len);
+    }
+    accept = f.n;
+    filter_emit(&f, BPF_RET | BPF_K, 0xffffffff, 0, 0);
+    reject = f.n;
+    filter_emit(&f, BPF_RET | BPF_K, 0, 0, 0);
+
+    /* all jumps are forward, and must be within 255 instructions */
+    for (i = 0; i < f.n; ++i) {
+	if (BPF_CLASS(f.insn[i].code) != BPF_JMP)
+	    continue;
+	t = f.insn[i].jt;
+	if (t >= J_UNIQ) {
+	    t = (t == J_ACCEPT? accept: t == J_REJECT? reject: uniq) - i - 1;
+	    if (t > 255)
+		goto toolong;
+	    f.insn[i].jt = t;
+	}
+	t = f.insn[i].jf;
+	if (t >= J_UNIQ) {
+	    t = (t == J_ACCEPT? accept: t == J_REJECT? reject: uniq) - i - 1;
+	    if (t > 255)
+		goto toolong;
+	    f.insn[i].jf = t;
+	}
+    }
+
+    fprog.len = f.n;
+    fprog.filter = f.insn;
+    if (setsockopt(conn->discoverySocket, SOL_SOCKET, SO_ATTACH_FILTER,
+		   &fprog, sizeof(fprog)) < 0) {
+	warn("Couldn't attach PPPoE discovery filter: %m");
+	return;
+    }
+
+    /* Drop what arrived before the filter was there */
+    while (recv(conn->discoverySocket, &packet, sizeof(packet),
+		MSG_DONTWAIT) >= 0)
+	;
+    return;
+
+ toolong:
+    warn("PPPoE discovery filter is too long");
+#endif
+}
 
 /***********************************************************************
 *%FUNCTION: sendPacket
@@ -0,0 +1,261 @@
+/***********************************************************************
+*
+* pacing.c
+*
+* Pacing of PPPoE discovery, so that many clients on a host, or many
+* hosts, don't all send their PADIs at the same moment after an access
+* concentrator comes back, and then retry in lockstep.
+*
+* This program may be distributed according to the terms of the GNU
+* General Public License, version 2 or (at your option) any later version.
+*
+***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE 1
+#include "pppoe.h"
+#include <pppd/pppd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/*
+ * The host-wide PADI bucket, shared through a small file mapped by each
+ * process using it, is a generic cell rate algorithm: tat is when the
+ * bucket will next be empty, in CLOCK_MONOTONIC nanoseconds, which are
+ * the same for every process, and boot is the kernel's boot_id when
+ * tat was last checked against the clock.  A file of zeroes is an idle
+ * bucket.  Updates are under an fcntl lock on the file.
+ */
+struct padiBucket {
+    int64_t tat;
+    char boot[40];
+};
+
+static struct padiBucket *bucket;
+static int bucketFd = -1;
+static int bucketFailed;
+static char bootId[40];		/* empty if it can't be read */
+
+static uint64_t randomState;
+
+static int64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**********************************************************************
+*%FUNCTION: pacingRandom
+*%ARGUMENTS:
+* n -- range
+*%RETURNS:
+* A random number from 0 to n-1, or 0 if n <= 0
+*%DESCRIPTION:
+* xorshift64*, seeded from our pid and the clock so that clients
+* started together don't draw the same delays.
+***********************************************************************/
+static int
+pacingRandom(int n)
+{
+    uint64_t x;
+
+    if (n <= 0)
+	return 0;
+    if (randomState == 0)
+	randomState = ((uint64_t) getpid() << 32) ^ nowNs() ^ 0x9e3779b97f4a7c15ULL;
+    x = randomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    randomState = x;
+    return (int) (((x * 0x2545f4914f6cdd1dULL) >> 33) % (uint64_t) n);
+}
+
+/**********************************************************************
+*%FUNCTION: padiFirstDelay
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+*%RETURNS:
+* How long to wait before the first PADI, in milliseconds
+*%DESCRIPTION:
+* A random delay of up to conn->padiDelay spreads out the first PADIs
+* of clients that start together.
+***********************************************************************/
+int
+padiFirstDelay(PPPoEConnection *conn)
+{
+    return pacingRandom(conn->padiDelay + 1);
+}
+
+/**********************************************************************
+*%FUNCTION: padiNextTimeout
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+* timeout -- the last time we waited for a PADO, in milliseconds
+*%RETURNS:
+* How long to wait for a PADO after the next PADI, in milliseconds
+*%DESCRIPTION:
+* Doubles the timeout, or with conn->padiJitter uses decorrelated
+* jitter: a random time between the initial timeout and three times
+* the last, capped at what doubling would reach on the last attempt.
+* Clients that lost the same PADI then don't retry together.
+***********************************************************************/
+int
+padiNextTimeout(PPPoEConnection *conn, int timeout)
+{
+    int base = conn->discoveryTimeout * 1000;
+    int cap = base, i;
+
+    if (!conn->padiJitter)
+	return timeout * 2;
+    for (i = 1; i < conn->discoveryAttempts && cap < 3600 * 1000; ++i)
+	cap *= 2;
+    if (timeout > cap / 3)
+	timeout = cap / 3;
+    timeout = base + pacingRandom(3 * timeout - base + 1);
+    return MIN(timeout, cap);
+}
+
+/*
+ * readBootId - get the kernel's random boot_id into bootId.
+ */
+static void
+readBootId(void)
+{
+    int fd, n;
+
+    fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+	return;
+    n = read(fd, bootId, sizeof(bootId) - 1);
+    close(fd);
+    if (n < 0)
+	n = 0;
+    while (n > 0 && bootId[n-1] == '\n')
+	--n;
+    bootId[n] = 0;
+}
+
+/*
+ * bucketOpen - map the shared PADI bucket, returning 0 if it can't be
+ * used, which is reported once.
+ */
+static int
+bucketOpen(PPPoEConnection *conn)
+{
+    struct stat sbuf;
+    const char *what;
+
+    if (bucket != NULL)
+	return 1;
+    if (bucketFailed)
+	return 0;
+    readBootId();
+    bucketFd = open(conn->padiBucketFile, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    what = "open";
+    if (bucketFd < 0)
+	goto fail;
+    what = "fstat";
+    if (fstat(bucketFd, &sbuf) < 0)
+	goto fail;
+    /* growing it fills it with zeroes, which is an idle bucket */
+    what = "ftruncate";
+    if (sbuf.st_size < (off_t) sizeof(struct padiBucket)
+	&& ftruncate(bucketFd, sizeof(struct padiBucket)) < 0)
+	goto fail;
+    what = "mmap";
+    bucket = mmap(NULL, sizeof(struct padiBucket), PROT_READ | PROT_WRITE,
+		  MAP_SHARED, bucketFd, 0);
+    if (bucket == MAP_FAILED) {
+	bucket = NULL;
+	goto fail;
+    }
+    return 1;
+
+ fail:
+    error("Couldn't set up PADI rate limit %s: %s: %m",
+	  conn->padiBucketFile, what);
+    if (bucketFd >= 0)
+	close(bucketFd);
+    bucketFd = -1;
+    bucketFailed = 1;
+    return 0;
+}
+
+static int
+bucketLock(int type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_len = 1;
+    while (fcntl(bucketFd, F_SETLKW, &fl) < 0) {
+	if (errno != EINTR) {
+	    error("Couldn't %slock PADI rate limit: %m",
+		  type == F_UNLCK? "un": "");
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/**********************************************************************
+*%FUNCTION: padiSlot
+*%ARGUMENTS:
+* conn -- PPPoE connection info
+*%RETURNS:
+* How long to wait before sending a PADI, in milliseconds
+*%DESCRIPTION:
+* Takes the next slot in the host-wide PADI rate limit of
+* conn->padiRate per second, allowing bursts of conn->padiBurst.  The
+* slot is ours once taken, so the caller sends its PADI after the wait
+* rather than asking again; if the limit can't be used, PADIs are not
+* limited.
+***********************************************************************/
+int
+padiSlot(PPPoEConnection *conn)
+{
+    int64_t now, t, tau, slot;
+    int burst = MAX(conn->padiBurst, 1);
+
+    if (conn->padiRate <= 0 || conn->padiBucketFile == NULL
+	|| !bucketOpen(conn) || !bucketLock(F_WRLCK))
+	return 0;
+    now = nowNs();
+    t = 1000000000 / conn->padiRate;
+    tau = (int64_t) (burst - 1) * t;
+    /*
+     * A bucket file that outlived a reboot holds a tat from the old
+     * boot's CLOCK_MONOTONIC, which may be far ahead of ours.  The
+     * first of us to use it this boot starts it again from now if it
+     * is further ahead than a full bucket and a slot.  Later on it
+     * can be, with more clients waiting than the burst.
+     */
+    if (bootId[0] == 0 || memcmp(bucket->boot, bootId, sizeof(bootId)) != 0) {
+	if (bucket->tat > now + tau + t)
+	    bucket->tat = now;
+	memcpy(bucket->boot, bootId, sizeof(bootId));
+    }
+    slot = MAX(bucket->tat, now - tau);
+    bucket->tat = slot + t;
+    bucketLock(F_UNLCK);
+    return slot > now? (slot - now + 999999) / 1000000: 0;
+}
@@ -66,9 +66,19 @@ unsigned char pppoe_reqd_mac_addr[6];
 static char *pppoe_host_uniq;
 static int pppoe_padi_timeout = PADI_TIMEOUT;
 static int pppoe_padi_attempts = MAX_PADI_ATTEMPTS;
+static int pppoe_padi_delay = 0;
+static bool pppoe_padi_jitter = 0;
+static int pppoe_padi_rate = 0;
+static int pppoe_padi_burst = 1;
+static char padi_bucket_file[MAXPATHLEN];
+static int pppoe_pado_wait = 0;
+static bool pppoe_ac_cache = 0;
+static char ac_cache_file[MAXPATHLEN];
 static char devnam[MAXNAMELEN];
 
 static int PPPoEDevnameHook(char *cmd, char **argv, int doit);
+static void PPPOEDiscoveryDone(PPPoEConnection *c);
+static int PPPOEConnectSession(void);
 static struct option Options[] = {
     { "device name", o_wild, (void *) &PPPoEDevnameHook,
       "PPPoE device name",
@@ -100,6 +110,18 @@ static struct option Options[] = {
       "Initial timeout for discovery packets in seconds" },
     { "pppoe-padi-attempts", o_int, &pppoe_padi_attempts,
       "Number of discovery attempts" },
+    { "pppoe-padi-delay", o_int, &pppoe_padi_delay,
+      "Longest random delay before the first PADI, in milliseconds" },
+    { "pppoe-padi-jitter", o_bool, &pppoe_padi_jitter,
+      "Randomise the timeouts between PADIs", 1 },
+    { "pppoe-padi-rate", o_int, &pppoe_padi_rate,
+      "Most PADIs per second sent by all PPPoE sessions on this host" },
+    { "pppoe-padi-burst", o_int, &pppoe_padi_burst,
+      "PADIs that may be sent together within pppoe-padi-rate" },
+    { "pppoe-pado-wait", o_int, &pppoe_pado_wait,
+      "How long to collect PADOs for before choosing an AC, in milliseconds" },
+    { "pppoe-ac-cache", o_bool, &pppoe_ac_cache,
+      "Remember the last access concentrator across restarts", 1 },
     { NULL }
 };
 int (*OldDevnameHook)(char *cmd, char **argv, int doit) = NULL;
@@ -128,6 +150,85 @@ PPPOEInitDevice(void)
     return 1;
 }
 
+/**********************************************************************
+ * %FUNCTION: PPPOELoadAC
+ * %ARGUMENTS:
+ * None
+ * %RETURNS:
+ * Nothing
+ * %DESCRIPTION:
+ * Reads the AC we last had a session with on this interface from the
+ * pppoe-ac-cache file, if it was for the AC name and service we want.
+ * The file has the AC's MAC address, its AC-Name and the service name
+ * on three lines.
+ ***********************************************************************/
+static void
+PPPOELoadAC(void)
+{
+    char line[3][MAXNAMELEN];
+    unsigned int mac[ETH_ALEN];
+    FILE *f;
+    int i;
+
+    f = fopen(ac_cache_file, "r");
+    if (f == NULL)
+	return;
+    for (i = 0; i < 3; ++i) {
+	if (fgets(line[i], sizeof(line[i]), f) == NULL)
+	    break;
+	line[i][strcspn(line[i], "\n")] = 0;
+    }
+    fclose(f);
+    if (i < 3 || sscanf(line[0], "%x:%x:%x:%x:%x:%x",
+			&mac[0], &mac[1], &mac[2],
+			&mac[3], &mac[4], &mac[5]) != 6) {
+	warn("Ignoring malformed %s", ac_cache_file);
+	return;
+    }
+    if ((acName && strcmp(line[1], acName) != 0)
+	|| strcmp(line[2], pppd_pppoe_service? pppd_pppoe_service: "") != 0)
+	return;
+    for (i = 0; i < ETH_ALEN; ++i)
+	conn->cachedACEth[i] = mac[i];
+    conn->haveCachedAC = 1;
+}
+
+/**********************************************************************
+ * %FUNCTION: PPPOESaveAC
+ * %ARGUMENTS:
+ * None
+ * %RETURNS:
+ * Nothing
+ * %DESCRIPTION:
+ * Writes the AC we now have a session with to the pppoe-ac-cache file.
+ ***********************************************************************/
+static void
+PPPOESaveAC(void)
+{
+    char tmp[MAXPATHLEN + 8];
+    char *ac = conn->actualACname? conn->actualACname: "";
+    char *service = conn->serviceName? conn->serviceName: "";
+    FILE *f;
+
+    if (strchr(ac, '\n') || strchr(service, '\n'))
+	return;
+    slprintf(tmp, sizeof(tmp), "%s.new", ac_cache_file);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+	error("Couldn't create %s: %m", tmp);
+	return;
+    }
+    fprintf(f, "%02x:%02x:%02x:%02x:%02x:%02x\n%s\n%s\n",
+	    (unsigned) conn->peerEth[0], (unsigned) conn->peerEth[1],
+	    (unsigned) conn->peerEth[2], (unsigned) conn->peerEth[3],
+	    (unsigned) conn->peerEth[4], (unsigned) conn->peerEth[5],
+	    ac, service);
+    if (fclose(f) == EOF || rename(tmp, ac_cache_file) < 0) {
+	error("Couldn't write %s: %m", ac_cache_file);
+	unlink(tmp);
+    }
+}
+
 /**********************************************************************
  * %FUNCTION: PPPOEConnectDevice
  * %ARGUMENTS:
@@ -140,10 +241,8 @@ PPPOEInitDevice(void)
 static int
 PPPOEConnectDevice(void)
 {
-    struct sockaddr_pppox sp;
     struct ifreq ifr;
     int s;
-    char remote_number[MAXNAMELEN];
 
     /* Open session socket before discovery phase, to avoid losing session */
     /* packets sent by peer just after PADS packet (noted on some Cisco    */
@@ -212,23 +311,62 @@ PPPOEConnectDevice(void)
 	    error("Failed to create PPPoE discovery socket: %m");
 	    goto errout;
 	}
-	discovery1(conn, 0);
-	/* discovery1() may update conn->mtu and conn->mru */
-	lcp_allowoptions[0].mru = conn->mtu;
-	lcp_wantoptions[0].mru = conn->mru;
-	if (conn->discoveryState != STATE_RECEIVED_PADO) {
-	    error("Unable to complete PPPoE Discovery phase 1");
-	    goto errout;
-	}
-	discovery2(conn);
-	/* discovery2() may update conn->mtu and conn->mru */
-	lcp_allowoptions[0].mru = conn->mtu;
-	lcp_wantoptions[0].mru = conn->mru;
-	if (conn->discoveryState != STATE_SESSION) {
+	setDiscoveryFilter(conn);
+	/* carry on in PPPOEDiscoveryDone() */
+	discoveryStart(conn, PPPOEDiscoveryDone);
+	return CONNECT_PENDING;
+    }
+    return PPPOEConnectSession();
+
+ errout:
+    close(conn->sessionSocket);
+    return -1;
+}
+
+/**********************************************************************
+ * %FUNCTION: PPPOEDiscoveryDone
+ * %ARGUMENTS:
+ * c -- PPPoE connection info (conn)
+ * %RETURNS:
+ * Nothing
+ * %DESCRIPTION:
+ * Called when discovery started by PPPOEConnectDevice has finished;
+ * tells pppd whether we are connected.
+ ***********************************************************************/
+static void
+PPPOEDiscoveryDone(PPPoEConnection *c)
+{
+    /* discovery may update conn->mtu and conn->mru */
+    lcp_allowoptions[0].mru = conn->mtu;
+    lcp_wantoptions[0].mru = conn->mru;
+    if (conn->discoveryState != STATE_SESSION) {
+	if (conn->discoveryState == STATE_SENT_PADR)
 	    error("Unable to complete PPPoE Discovery phase 2");
-	    goto errout;
-	}
+	else
+	    error("Unable to complete PPPoE Discovery phase 1");
+	close(conn->sessionSocket);
+	ppp_link_connected(-1);
+	return;
     }
+    if (ac_cache_file[0])
+	PPPOESaveAC();
+    ppp_link_connected(PPPOEConnectSession());
+}
+
+/**********************************************************************
+ * %FUNCTION: PPPOEConnectSession
+ * %ARGUMENTS:
+ * None
+ * %RETURNS:
+ * Non-negative if all goes well; -1 otherwise
+ * %DESCRIPTION:
+ * Connects the PPPoE session socket once we have a session.
+ ***********************************************************************/
+static int
+PPPOEConnectSession(void)
+{
+    struct sockaddr_pppox sp;
+    char remote_number[MAXNAMELEN];
 
     /* Set PPPoE session-number for further consumption */
     ppp_set_session_number(ntohs(conn->session));
@@ -298,6 +436,13 @@ PPPOEDisconnectDevice(void)
 {
     struct sockaddr_pppox sp;
 
+    if (conn->discovery != NULL) {
+	/* pppd gave up while we were still in discovery */
+	discoveryCancel(conn);
+	close(conn->sessionSocket);
+	return;
+    }
+
     sp.sa_family = AF_PPPOX;
     sp.sa_protocol = PX_PROTO_OE;
     sp.sa_addr.pppoe.sid = 0;
@@ -430,6 +575,7 @@ plugin_init(void)
 void pppoe_check_options(void)
 {
     unsigned int mac[6];
+    char name[MAXPATHLEN];
     int i;
 
     if (pppoe_reqd_mac != NULL) {
@@ -468,6 +614,28 @@ void pppoe_check_options(void)
 
     conn->discoveryTimeout = pppoe_padi_timeout;
     conn->discoveryAttempts = pppoe_padi_attempts;
+    conn->padiDelay = pppoe_padi_delay;
+    conn->padiJitter = pppoe_padi_jitter;
+    conn->padiRate = pppoe_padi_rate;
+    conn->padiBurst = pppoe_padi_burst;
+    if (pppoe_padi_rate > 0) {
+	if (ppp_get_filepath(PPP_DIR_RUNTIME, "pppoe-padi", padi_bucket_file,
+			     sizeof(padi_bucket_file)) >= sizeof(padi_bucket_file)) {
+	    ppp_option_error("pppoe-padi-rate: path too long");
+	    exit(EXIT_OPTION_ERROR);
+	}
+	conn->padiBucketFile = padi_bucket_file;
+    }
+    conn->padoWait = pppoe_pado_wait;
+    if (pppoe_ac_cache) {
+	slprintf(name, sizeof(name), "pppoe-ac.%s", devnam);
+	if (ppp_get_filepath(PPP_DIR_RUNTIME, name, ac_cache_file,
+			     sizeof(ac_cache_file)) >= sizeof(ac_cache_file)) {
+	    ppp_option_error("pppoe-ac-cache: path too long");
+	    exit(EXIT_OPTION_ERROR);
+	}
+	PPPOELoadAC();
+    }
 }
 
 struct channel pppoe_channel = {
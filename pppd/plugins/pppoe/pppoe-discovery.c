@@ -147,7 +147,8 @@ static void usage(void);
 
 int main(int argc, char *argv[])
 {
-    int opt;
+    int opt, surveying = 0, numIfs = 0;
+    char **ifNames;
     PPPoEConnection *conn;
 
     signal(SIGINT, term_handler);
@@ -161,11 +162,17 @@ int main(int argc, char *argv[])
 
     memset(conn, 0, sizeof(PPPoEConnection));
 
+    ifNames = malloc(argc * sizeof(char *));
+    if (!ifNames) {
+        perror("malloc");
+        exit(1);
+    }
+
     pppoe_verbose = 1;
     conn->discoveryTimeout = PADI_TIMEOUT;
     conn->discoveryAttempts = MAX_PADI_ATTEMPTS;
 
-    while ((opt = getopt(argc, argv, "I:D:VUQS:C:W:t:a:h")) > 0) {
+    while ((opt = getopt(argc, argv, "I:D:VUQS:C:W:t:a:sh")) > 0) {
 	switch(opt) {
 	case 'S':
 	    conn->serviceName = xstrdup(optarg);
@@ -225,6 +232,10 @@ int main(int argc, char *argv[])
 	    break;
 	case 'I':
 	    conn->ifName = xstrdup(optarg);
+	    ifNames[numIfs++] = conn->ifName;
+	    break;
+	case 's':
+	    surveying = 1;
 	    break;
 	case 'Q':
 	    pppoe_verbose = 0;
@@ -239,6 +250,16 @@ int main(int argc, char *argv[])
 	}
     }
 
+    if (surveying) {
+	while (optind < argc)
+	    ifNames[numIfs++] = argv[optind++];
+	if (!numIfs) {
+	    fprintf(stderr, "No interfaces to survey\n");
+	    exit(EXIT_FAILURE);
+	}
+	exit(survey(conn, ifNames, numIfs)? 0: 1);
+    }
+
     if (optind != argc) {
 	fprintf(stderr, "%s: extra argument '%s'\n", argv[0], argv[optind]);
 	usage();
@@ -257,6 +278,7 @@ int main(int argc, char *argv[])
 	perror("Cannot create PPPoE discovery socket");
 	exit(1);
     }
+    setDiscoveryFilter(conn);
 
     discovery1(conn, 1);
 
@@ -270,12 +292,14 @@ static void
 usage(void)
 {
     fprintf(stderr, "Usage: pppoe-discovery [options]\n");
+    fprintf(stderr, "       pppoe-discovery -s [options] [if_name ...]\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "   -I if_name     -- Specify interface (mandatory option)\n");
     fprintf(stderr, "   -D filename    -- Log debugging information in filename.\n");
     fprintf(stderr,
 	    "   -t timeout     -- Initial timeout for discovery packets in seconds\n"
 	    "   -a attempts    -- Number of discovery attempts\n"
+	    "   -s             -- Survey all the -I and listed interfaces at once.\n"
 	    "   -V             -- Print version and exit.\n"
 	    "   -Q             -- Quiet Mode: Do not print access concentrator names\n"
 	    "   -S name        -- Set desired service name.\n"
@@ -212,6 +212,17 @@ typedef void ParseFunc(UINT16_t type,
 
 #define PPPINITFCS16    0xffff  /* Initial FCS value */
 
+/* Access concentrators we have had PADOs from, for choosing between them */
+#define MAX_ACS 8
+
+typedef struct PPPoEACStruct {
+    unsigned char mac[ETH_ALEN]; /* AC's MAC address */
+    int latency;		/* Smoothed PADO response time (ms) */
+} PPPoEAC;
+
+/* Discovery in progress from pppd's event loop; private to discovery.c */
+struct PPPoEDiscoveryStruct;
+
 /* Keep track of the state of a connection -- collect everything in
    one spot */
 
@@ -235,6 +246,17 @@ typedef struct PPPoEConnectionStruct {
     int error;			/* Error packet received */
     int discoveryTimeout;       /* Timeout for discovery packets */
     int discoveryAttempts;      /* Number of discovery attempts */
+    int padiDelay;		/* Longest random delay before first PADI (ms) */
+    int padiJitter;		/* Randomise timeouts between PADIs */
+    int padiRate;		/* Host-wide limit on PADIs per second */
+    int padiBurst;		/* PADIs that may go at once within padiRate */
+    char *padiBucketFile;	/* Where the host-wide limit is kept */
+    int padoWait;		/* How long to collect PADOs for (ms) */
+    PPPoEAC acs[MAX_ACS];	/* ACs that have answered our PADIs */
+    int numACs;
+    unsigned char cachedACEth[ETH_ALEN]; /* AC we last had a session with */
+    int haveCachedAC;		/* cachedACEth is valid */
+    struct PPPoEDiscoveryStruct *discovery; /* See discoveryStart() */
     int seenMaxPayload;
     int storedmtu;		/* Stored MTU */
     int storedmru;		/* Stored MRU */
@@ -255,6 +277,7 @@ struct PacketCriteria {
 /* Function Prototypes */
 UINT16_t etherType(PPPoEPacket *packet);
 int openInterface(char const *ifname, UINT16_t type, unsigned char *hwaddr);
+void setDiscoveryFilter(PPPoEConnection *conn);
 int sendPacket(PPPoEConnection *conn, int sock, PPPoEPacket *pkt, int size);
 int receivePacket(int sock, PPPoEPacket *pkt, int *size);
 int parsePacket(PPPoEPacket *packet, ParseFunc *func, void *extra);
@@ -272,7 +295,14 @@ void clampMSS(PPPoEPacket *packet, char const *dir, int clampMss);
 UINT16_t computeTCPChecksum(unsigned char *ipHdr, unsigned char *tcpHdr);
 UINT16_t pppFCS16(UINT16_t fcs, unsigned char *cp, int len);
 void discovery1(PPPoEConnection *conn, int waitWholeTimeoutForPADO);
+int padiFirstDelay(PPPoEConnection *conn);
+int padiNextTimeout(PPPoEConnection *conn, int timeout);
+int padiSlot(PPPoEConnection *conn);
 void discovery2(PPPoEConnection *conn);
+void discoveryStart(PPPoEConnection *conn,
+		    void (*done)(PPPoEConnection *conn));
+void discoveryCancel(PPPoEConnection *conn);
+int survey(PPPoEConnection *conn, char **ifNames, int numIfs);
 unsigned char *findTag(PPPoEPacket *packet, UINT16_t tagType,
 		       PPPoETag *tag);
 
@@ -0,0 +1,383 @@
+/*
+ * storm_bench.c - time how long a crowd of PPPoE clients takes to get
+ * all its sessions up when they all start discovery at once, as after
+ * an access concentrator reboots, with and without PADI pacing.
+ *
+ * Forks a simulated access concentrator, which like a real one under
+ * control-plane policing only answers so many PADIs per second and
+ * drops the rest, and then a number of clients that each run
+ * discovery1() and discovery2() from discovery.c.  The clients use one
+ * interface and the concentrator another: by default the two ends of
+ * a veth pair made for the purpose, or the loopback interface for both
+ * if a veth pair can't be made.  Other interfaces can be given with
+ * -c (clients) and -a (concentrator), and the number of clients with -n.
+ *
+ * Needs CAP_NET_RAW (and CAP_NET_ADMIN for the veth pair); prints a
+ * note and exits successfully without it.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "pppoe.h"
+
+#define VETH_CLIENT	"pppoe-bench0"
+#define VETH_AC		"pppoe-bench1"
+
+#define AC_PADI_RATE	20	/* PADIs per second the concentrator answers */
+#define AC_PADI_BURST	5
+
+int pppoe_verbose;
+static volatile sig_atomic_t got_sigterm;
+
+/* counts kept by the concentrator */
+struct acStats {
+    int padis, answered, sessions;
+};
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, " (errno %d)\n", errno);
+    exit(1);
+}
+
+void
+error(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+void
+warn(const char *fmt, ...)
+{
+}
+
+void
+info(const char *fmt, ...)
+{
+}
+
+void
+init_pr_log(const char *prefix, int level)
+{
+}
+
+void
+end_pr_log(void)
+{
+}
+
+void
+pr_log(void *arg, char *fmt, ...)
+{
+}
+
+bool
+debug_on(void)
+{
+    return 0;
+}
+
+size_t
+strlcpy(char *dest, const char *src, size_t len)
+{
+    size_t ret = strlen(src);
+
+    if (len != 0) {
+	if (ret < len)
+	    strcpy(dest, src);
+	else {
+	    memcpy(dest, src, len - 1);
+	    dest[len-1] = 0;
+	}
+    }
+    return ret;
+}
+
+int
+get_time(struct timeval *tv)
+{
+    return gettimeofday(tv, NULL);
+}
+
+int
+signaled(int signal)
+{
+    return signal == SIGTERM && got_sigterm;
+}
+
+static void
+term_handler(int signum)
+{
+    got_sigterm = 1;
+}
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+copyUniq(UINT16_t type, UINT16_t len, unsigned char *data, void *extra)
+{
+    PPPoETag *uniq = extra;
+
+    if (type == TAG_HOST_UNIQ && len <= sizeof(uniq->payload)) {
+	uniq->type = htons(type);
+	uniq->length = htons(len);
+	memcpy(uniq->payload, data, len);
+    }
+}
+
+/*
+ * reply - answer packet with code, echoing its Host-Uniq.
+ */
+static void
+reply(int sock, unsigned char *mac, PPPoEPacket *packet, int code,
+      int session)
+{
+    PPPoEPacket out;
+    PPPoETag uniq;
+    unsigned char *p = out.payload;
+
+    memcpy(out.ethHdr.h_dest, packet->ethHdr.h_source, ETH_ALEN);
+    memcpy(out.ethHdr.h_source, mac, ETH_ALEN);
+    out.ethHdr.h_proto = htons(Eth_PPPOE_Discovery);
+    out.vertype = PPPOE_VER_TYPE(1, 1);
+    out.code = code;
+    out.session = htons(session);
+    p[0] = TAG_SERVICE_NAME >> 8;
+    p[1] = TAG_SERVICE_NAME & 0xff;
+    p[2] = p[3] = 0;
+    p += TAG_HDR_SIZE;
+    if (code == CODE_PADO) {
+	p[0] = TAG_AC_NAME >> 8;
+	p[1] = TAG_AC_NAME & 0xff;
+	p[2] = 0;
+	p[3] = 8;
+	memcpy(p + TAG_HDR_SIZE, "bench-ac", 8);
+	p += TAG_HDR_SIZE + 8;
+    }
+    uniq.type = 0;
+    parsePacket(packet, copyUniq, &uniq);
+    if (uniq.type != 0) {
+	memcpy(p, &uniq, TAG_HDR_SIZE + ntohs(uniq.length));
+	p += TAG_HDR_SIZE + ntohs(uniq.length);
+    }
+    out.length = htons(p - out.payload);
+    send(sock, &out, p - (unsigned char *) &out, 0);
+}
+
+/*
+ * concentrator - answer PADIs at up to AC_PADI_RATE a second, with
+ * bursts of AC_PADI_BURST, and every PADR, until killed.
+ */
+static void
+concentrator(char *ifname, struct acStats *stats)
+{
+    PPPoEPacket packet;
+    unsigned char mac[ETH_ALEN];
+    double tokens = AC_PADI_BURST, last = now_ms(), now;
+    int sock, len;
+
+    sock = openInterface(ifname, Eth_PPPOE_Discovery, mac);
+    if (sock < 0)
+	fatal("concentrator: openInterface %s", ifname);
+    for (;;) {
+	len = recv(sock, &packet, sizeof(packet), 0);
+	if (len < (int) HDR_SIZE || (int) (ntohs(packet.length) + HDR_SIZE) > len)
+	    continue;
+	if (packet.code == CODE_PADI) {
+	    ++stats->padis;
+	    now = now_ms();
+	    tokens = MIN(AC_PADI_BURST,
+			 tokens + (now - last) * AC_PADI_RATE / 1000);
+	    last = now;
+	    if (tokens < 1)
+		continue;
+	    tokens -= 1;
+	    ++stats->answered;
+	    reply(sock, mac, &packet, CODE_PADO, 0);
+	} else if (packet.code == CODE_PADR
+		   && memcmp(packet.ethHdr.h_dest, mac, ETH_ALEN) == 0) {
+	    ++stats->sessions;
+	    reply(sock, mac, &packet, CODE_PADS, stats->sessions);
+	}
+    }
+}
+
+/*
+ * client - run discovery as pppd would, exiting 0 if it got a session.
+ */
+static void
+client(char *ifname, PPPoEConnection *conn)
+{
+    pid_t pid = getpid();
+
+    conn->ifName = ifname;
+    conn->discoverySocket = openInterface(ifname, Eth_PPPOE_Discovery,
+					  conn->myEth);
+    if (conn->discoverySocket < 0)
+	exit(2);
+    conn->hostUniq.type = htons(TAG_HOST_UNIQ);
+    conn->hostUniq.length = htons(sizeof(pid));
+    memcpy(conn->hostUniq.payload, &pid, sizeof(pid));
+    conn->mtu = conn->mru = ETH_PPPOE_MTU;
+    setDiscoveryFilter(conn);
+    discovery1(conn, 0);
+    if (conn->discoveryState != STATE_RECEIVED_PADO)
+	exit(1);
+    discovery2(conn);
+    exit(conn->discoveryState == STATE_SESSION? 0: 1);
+}
+
+static void
+run(char *what, int n, char *client_if, char *ac_if, PPPoEConnection *conf,
+    struct acStats *stats)
+{
+    double t0, last = 0;
+    pid_t ac, pid;
+    int i, status, up = 0;
+
+    if (conf->padiBucketFile != NULL)
+	truncate(conf->padiBucketFile, 0);
+    memset(stats, 0, sizeof(*stats));
+    fflush(stdout);
+    ac = fork();
+    if (ac < 0)
+	fatal("fork");
+    if (ac == 0)
+	concentrator(ac_if, stats);
+    usleep(100000);
+
+    t0 = now_ms();
+    for (i = 0; i < n; ++i) {
+	pid = fork();
+	if (pid < 0)
+	    fatal("fork");
+	if (pid == 0)
+	    client(client_if, conf);
+    }
+    for (i = 0; i < n; ++i) {
+	if (wait(&status) < 0)
+	    fatal("wait");
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 2)
+	    fatal("client couldn't open %s", client_if);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+	    ++up;
+	    last = now_ms() - t0;
+	}
+    }
+    kill(ac, SIGKILL);
+    waitpid(ac, &status, 0);
+    printf("  %-32s %3d/%d up, last after %6.2f s, %4d PADIs, %3d answered\n",
+	   what, up, n, last / 1e3, stats->padis, stats->answered);
+}
+
+int
+main(int argc, char *argv[])
+{
+    PPPoEConnection conf;
+    struct acStats *stats;
+    char *client_if = NULL, *ac_if = NULL;
+    char bucket[] = "/tmp/pppoe-padi.XXXXXX";
+    int c, fd, n = 40, veth = 0;
+
+    while ((c = getopt(argc, argv, "n:c:a:")) != -1) {
+	switch (c) {
+	case 'n':
+	    n = atoi(optarg);
+	    break;
+	case 'c':
+	    client_if = optarg;
+	    break;
+	case 'a':
+	    ac_if = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-n clients] [-c client-if] [-a ac-if]\n",
+		    argv[0]);
+	    exit(1);
+	}
+    }
+
+    fd = socket(PF_PACKET, SOCK_RAW, htons(Eth_PPPOE_Discovery));
+    if (fd < 0) {
+	printf("pppoe PADI storm: skipped, can't open a raw socket\n");
+	return 0;
+    }
+    close(fd);
+    if (client_if == NULL && ac_if == NULL) {
+	if (system("ip link add " VETH_CLIENT " type veth peer name " VETH_AC
+		   " 2>/dev/null && ip link set " VETH_CLIENT " up"
+		   " && ip link set " VETH_AC " up") == 0) {
+	    client_if = VETH_CLIENT;
+	    ac_if = VETH_AC;
+	    veth = 1;
+	    sleep(1);
+	} else
+	    client_if = ac_if = "lo";
+    } else if (client_if == NULL || ac_if == NULL)
+	fatal("give both -c and -a");
+
+    if ((fd = mkstemp(bucket)) < 0)
+	fatal("mkstemp");
+    close(fd);
+    stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED)
+	fatal("mmap");
+    signal(SIGTERM, term_handler);
+
+    printf("pppoe PADI storm, %d clients on %s, concentrator on %s"
+	   " answering %d PADIs/s:\n", n, client_if, ac_if, AC_PADI_RATE);
+    memset(&conf, 0, sizeof(conf));
+    conf.discoverySocket = -1;
+    conf.sessionSocket = -1;
+    conf.discoveryTimeout = 1;
+    conf.discoveryAttempts = 4;
+    run("no pacing", n, client_if, ac_if, &conf, stats);
+
+    conf.padiDelay = 2000;
+    conf.padiJitter = 1;
+    run("delay 2000 ms, jitter", n, client_if, ac_if, &conf, stats);
+
+    conf.padiDelay = 500;
+    conf.padiRate = 15;
+    conf.padiBurst = 5;
+    conf.padiBucketFile = bucket;
+    run("delay 500 ms, jitter, rate 15/s", n, client_if, ac_if, &conf,
+	stats);
+
+    unlink(bucket);
+    if (veth && system("ip link del " VETH_CLIENT) != 0)
+	fprintf(stderr, "couldn't delete %s\n", VETH_CLIENT);
+    return 0;
+}
@@ -0,0 +1,520 @@
+/***********************************************************************
+*
+* survey.c
+*
+* Survey mode for pppoe-discovery: send PADIs out of many interfaces
+* at once and report every access concentrator that answers on each,
+* with its services and how long it took to answer.
+*
+* PADOs for all the interfaces are read from one packet socket through
+* a TPACKET_V3 receive ring shared with the kernel, so a burst of
+* replies from hundreds of VLANs costs a poll() per ring block rather
+* than a recv() per frame, and each frame carries the kernel's receive
+* timestamp, so the latencies don't depend on how soon we get to it.
+*
+* This program may be distributed according to the terms of the GNU
+* General Public License, version 2 or (at your option) any later version.
+*
+***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "pppoe.h"
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+#endif
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
+#ifdef TPACKET3_HDRLEN
+
+int signaled(int signal);
+
+/* Receive ring geometry: 64 blocks of 64k, handed over to us when full
+   or SURVEY_BLOCK_TOV ms after their first frame, whichever is sooner */
+#define SURVEY_BLOCK_SIZE	(1 << 16)
+#define SURVEY_BLOCK_NR		64
+#define SURVEY_FRAME_SIZE	2048
+#define SURVEY_BLOCK_TOV	10
+
+#define SURVEY_NAME_LEN		64
+#define SURVEY_SERVICES_LEN	256
+
+/* An access concentrator that answered on an interface */
+struct surveyAC {
+    struct surveyAC *next;
+    unsigned char mac[ETH_ALEN];
+    double latency;			/* ms from our last PADI */
+    char name[SURVEY_NAME_LEN];
+    char services[SURVEY_SERVICES_LEN];
+};
+
+/* An interface being surveyed */
+struct surveyIf {
+    char const *name;
+    int ifindex;
+    unsigned char mac[ETH_ALEN];
+    struct timespec sent;		/* when we last sent it a PADI */
+    int numACs;
+    struct surveyAC *acs;
+};
+
+/* What a PADO told us */
+struct surveyPADO {
+    PPPoEConnection *conn;
+    int uniqOK;
+    int acNameOK;
+    char name[SURVEY_NAME_LEN];
+    char services[SURVEY_SERVICES_LEN];
+};
+
+struct surveyRing {
+    int sock;
+    unsigned char *map;
+    struct tpacket_req3 req;
+    unsigned int block;			/* next block to look at */
+};
+
+static double
+ms_since(struct timespec const *from, struct timespec const *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1e3
+	+ (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+/**********************************************************************
+*%FUNCTION: openRing
+*%ARGUMENTS:
+* ring -- ring to set up
+*%RETURNS:
+* 0 on success, -1 (with errno set) on failure
+*%DESCRIPTION:
+* Opens a packet socket that sees PPPoE discovery frames on every
+* interface, keeps only PADOs, and maps a TPACKET_V3 receive ring on it.
+***********************************************************************/
+static int
+openRing(struct surveyRing *ring)
+{
+    int version = TPACKET_V3;
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+    struct sock_filter code[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ETH_HLEN + 1),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, CODE_PADO, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog fprog = { sizeof(code) / sizeof(code[0]), code };
+#endif
+
+    ring->sock = socket(PF_PACKET, SOCK_RAW, htons(Eth_PPPOE_Discovery));
+    if (ring->sock < 0)
+	return -1;
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+    if (setsockopt(ring->sock, SOL_SOCKET, SO_ATTACH_FILTER,
+		   &fprog, sizeof(fprog)) < 0)
+	warn("Couldn't attach PADO filter: %m");
+#endif
+    if (setsockopt(ring->sock, SOL_PACKET, PACKET_VERSION,
+		   &version, sizeof(version)) < 0)
+	goto fail;
+
+    memset(&ring->req, 0, sizeof(ring->req));
+    ring->req.tp_block_size = SURVEY_BLOCK_SIZE;
+    ring->req.tp_block_nr = SURVEY_BLOCK_NR;
+    ring->req.tp_frame_size = SURVEY_FRAME_SIZE;
+    ring->req.tp_frame_nr = SURVEY_BLOCK_SIZE / SURVEY_FRAME_SIZE
+	* SURVEY_BLOCK_NR;
+    ring->req.tp_retire_blk_tov = SURVEY_BLOCK_TOV;
+    if (setsockopt(ring->sock, SOL_PACKET, PACKET_RX_RING,
+		   &ring->req, sizeof(ring->req)) < 0)
+	goto fail;
+
+    ring->map = mmap(NULL, (size_t) SURVEY_BLOCK_SIZE * SURVEY_BLOCK_NR,
+		     PROT_READ | PROT_WRITE, MAP_SHARED, ring->sock, 0);
+    if (ring->map == MAP_FAILED)
+	goto fail;
+    ring->block = 0;
+    return 0;
+
+ fail:
+    close(ring->sock);
+    return -1;
+}
+
+/**********************************************************************
+*%FUNCTION: openSurveyIf
+*%ARGUMENTS:
+* sock -- any socket, for the ioctls
+* sif -- interface to look up, with its name set
+*%RETURNS:
+* 0 on success, -1 if the interface can't be used
+*%DESCRIPTION:
+* Fills in the interface index and MAC address.
+***********************************************************************/
+static int
+openSurveyIf(int sock, struct surveyIf *sif)
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    if (strlen(sif->name) >= sizeof(ifr.ifr_name)) {
+	error("Interface name %.16s... too long", sif->name);
+	return -1;
+    }
+    strcpy(ifr.ifr_name, sif->name);
+    if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
+	error("Can't get MAC address of %s: %m", sif->name);
+	return -1;
+    }
+    memcpy(sif->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    if (NOT_UNICAST(sif->mac)) {
+	error("Interface %s has broadcast/multicast MAC address", sif->name);
+	return -1;
+    }
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+	error("Can't get index of %s: %m", sif->name);
+	return -1;
+    }
+    sif->ifindex = ifr.ifr_ifindex;
+    return 0;
+}
+
+/**********************************************************************
+*%FUNCTION: surveyPADI
+*%ARGUMENTS:
+* conn -- PPPoE connection, for the service name and Host-Uniq
+* sock -- packet socket
+* sif -- interface to send on
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Broadcasts a PADI out of sif and notes when.
+***********************************************************************/
+static void
+surveyPADI(PPPoEConnection *conn, int sock, struct surveyIf *sif)
+{
+    PPPoEPacket packet;
+    struct sockaddr_ll sll;
+    unsigned char *cursor = packet.payload;
+    int namelen = 0;
+    int len = ntohs(conn->hostUniq.length);
+
+    if (conn->serviceName)
+	namelen = strlen(conn->serviceName);
+
+    memset(packet.ethHdr.h_dest, 0xFF, ETH_ALEN);
+    memcpy(packet.ethHdr.h_source, sif->mac, ETH_ALEN);
+    packet.ethHdr.h_proto = htons(Eth_PPPOE_Discovery);
+    packet.vertype = PPPOE_VER_TYPE(1, 1);
+    packet.code = CODE_PADI;
+    packet.session = 0;
+
+    if (!conn->serviceName
+	|| strcmp(conn->serviceName, "NO-SERVICE-NAME-NON-RFC-COMPLIANT")) {
+	cursor[0] = TAG_SERVICE_NAME >> 8;
+	cursor[1] = TAG_SERVICE_NAME & 0xff;
+	cursor[2] = namelen >> 8;
+	cursor[3] = namelen & 0xff;
+	if (namelen)
+	    memcpy(cursor + TAG_HDR_SIZE, conn->serviceName, namelen);
+	cursor += TAG_HDR_SIZE + namelen;
+    }
+    memcpy(cursor, &conn->hostUniq, TAG_HDR_SIZE + len);
+    cursor += TAG_HDR_SIZE + len;
+    packet.length = htons(cursor - packet.payload);
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(Eth_PPPOE_Discovery);
+    sll.sll_ifindex = sif->ifindex;
+    sll.sll_halen = ETH_ALEN;
+    memset(sll.sll_addr, 0xFF, ETH_ALEN);
+
+    clock_gettime(CLOCK_REALTIME, &sif->sent);
+    if (sendto(sock, &packet, cursor - (unsigned char *) &packet, 0,
+	       (struct sockaddr *) &sll, sizeof(sll)) < 0)
+	error("Can't send PADI on %s: %m", sif->name);
+}
+
+/**********************************************************************
+*%FUNCTION: parseSurveyTags
+*%ARGUMENTS:
+* type -- tag type
+* len -- tag length
+* data -- tag data
+* extra -- struct surveyPADO to fill in
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Picks the AC-Name, Service-Names and Host-Uniq out of a PADO.
+***********************************************************************/
+static void
+parseSurveyTags(UINT16_t type, UINT16_t len, unsigned char *data,
+		void *extra)
+{
+    struct surveyPADO *pado = extra;
+    PPPoEConnection *conn = pado->conn;
+    size_t used = strlen(pado->services);
+
+    switch(type) {
+    case TAG_AC_NAME:
+	snprintf(pado->name, sizeof(pado->name), "%.*s", (int) len, data);
+	if (conn->acName && len == strlen(conn->acName) &&
+	    !strncmp((char *) data, conn->acName, len))
+	    pado->acNameOK = 1;
+	break;
+    case TAG_SERVICE_NAME:
+	snprintf(pado->services + used, sizeof(pado->services) - used,
+		 "%s\"%.*s\"", used? " ": "", (int) len, data);
+	break;
+    case TAG_HOST_UNIQ:
+	if (len == ntohs(conn->hostUniq.length) &&
+	    !memcmp(data, conn->hostUniq.payload, len))
+	    pado->uniqOK = 1;
+	break;
+    }
+}
+
+/**********************************************************************
+*%FUNCTION: surveyFrame
+*%ARGUMENTS:
+* conn -- PPPoE connection
+* ifs, numIfs -- interfaces being surveyed
+* frame, len -- received frame
+* sll -- where the frame came from
+* ts -- when the kernel received it
+*%RETURNS:
+* 1 if it was a PADO from a new access concentrator, 0 otherwise
+*%DESCRIPTION:
+* Records the access concentrator a PADO came from against the
+* interface it arrived on.
+***********************************************************************/
+static int
+surveyFrame(PPPoEConnection *conn, struct surveyIf *ifs, int numIfs,
+	    unsigned char *frame, unsigned int len,
+	    struct sockaddr_ll const *sll, struct timespec const *ts)
+{
+    PPPoEPacket packet;
+    struct surveyPADO pado;
+    struct surveyIf *sif = NULL;
+    struct surveyAC *ac, **tail;
+    int i;
+
+    if (sll->sll_pkttype == PACKET_OUTGOING)
+	return 0;
+    for (i = 0; i < numIfs; ++i) {
+	if (ifs[i].ifindex == sll->sll_ifindex) {
+	    sif = &ifs[i];
+	    break;
+	}
+    }
+    if (sif == NULL || len < HDR_SIZE)
+	return 0;
+    if (len > sizeof(packet))
+	len = sizeof(packet);
+    memcpy(&packet, frame, len);
+    if (packet.code != CODE_PADO
+	|| ntohs(packet.length) + HDR_SIZE > len
+	|| memcmp(packet.ethHdr.h_dest, sif->mac, ETH_ALEN)
+	|| NOT_UNICAST(packet.ethHdr.h_source))
+	return 0;
+
+    memset(&pado, 0, sizeof(pado));
+    pado.conn = conn;
+    if (parsePacket(&packet, parseSurveyTags, &pado) < 0 || !pado.uniqOK)
+	return 0;
+    if (conn->acName && !pado.acNameOK)
+	return 0;
+
+    for (tail = &sif->acs; (ac = *tail) != NULL; tail = &ac->next)
+	if (!memcmp(ac->mac, packet.ethHdr.h_source, ETH_ALEN))
+	    return 0;
+    ac = calloc(1, sizeof(*ac));
+    if (ac == NULL)
+	fatal("Out of memory");
+    memcpy(ac->mac, packet.ethHdr.h_source, ETH_ALEN);
+    ac->latency = ms_since(&sif->sent, ts);
+    strcpy(ac->name, pado.name);
+    strcpy(ac->services, pado.services);
+    *tail = ac;
+    ++sif->numACs;
+    return 1;
+}
+
+/**********************************************************************
+*%FUNCTION: readRing
+*%ARGUMENTS:
+* conn -- PPPoE connection
+* ring -- receive ring
+* ifs, numIfs -- interfaces being surveyed
+*%RETURNS:
+* The number of new access concentrators seen
+*%DESCRIPTION:
+* Goes through every block the kernel has handed over, then gives the
+* blocks back.
+***********************************************************************/
+static int
+readRing(PPPoEConnection *conn, struct surveyRing *ring,
+	 struct surveyIf *ifs, int numIfs)
+{
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ph;
+    struct timespec ts;
+    unsigned int i;
+    int found = 0;
+
+    for (;;) {
+	bd = (struct tpacket_block_desc *)
+	    (ring->map + (size_t) ring->block * ring->req.tp_block_size);
+	if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+	      & TP_STATUS_USER))
+	    break;
+	ph = (struct tpacket3_hdr *)
+	    ((unsigned char *) bd + bd->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < bd->hdr.bh1.num_pkts; ++i) {
+	    ts.tv_sec = ph->tp_sec;
+	    ts.tv_nsec = ph->tp_nsec;
+	    found += surveyFrame(conn, ifs, numIfs,
+				 (unsigned char *) ph + ph->tp_mac,
+				 ph->tp_snaplen,
+				 (struct sockaddr_ll *) ((unsigned char *) ph
+				     + TPACKET_ALIGN(sizeof(*ph))),
+				 &ts);
+	    ph = (struct tpacket3_hdr *)
+		((unsigned char *) ph + ph->tp_next_offset);
+	}
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+			 __ATOMIC_RELEASE);
+	ring->block = (ring->block + 1) % ring->req.tp_block_nr;
+    }
+    return found;
+}
+
+/**********************************************************************
+*%FUNCTION: survey
+*%ARGUMENTS:
+* conn -- PPPoE connection, with the service name, AC name, Host-Uniq,
+*         timeout and number of attempts to use
+* ifNames -- interfaces to survey
+* numIfs -- how many
+*%RETURNS:
+* The number of interfaces on which an access concentrator answered
+*%DESCRIPTION:
+* Sends a PADI out of every interface and collects PADOs for the whole
+* timeout; then sends another PADI out of those that got none, with
+* the timeout doubled, up to the number of attempts.  Prints each
+* access concentrator found on each interface.
+***********************************************************************/
+int
+survey(PPPoEConnection *conn, char **ifNames, int numIfs)
+{
+    struct surveyRing ring;
+    struct surveyIf *ifs;
+    struct surveyAC *ac;
+    struct pollfd pfd;
+    struct timespec start, now, deadline;
+    pid_t pid = getpid();
+    int i, n, attempt, timeout, left, answered = 0, numACs = 0;
+
+    if (!conn->hostUniq.length) {
+	conn->hostUniq.type = htons(TAG_HOST_UNIQ);
+	conn->hostUniq.length = htons(sizeof(pid));
+	memcpy(conn->hostUniq.payload, &pid, sizeof(pid));
+    }
+    if (conn->serviceName && strlen(conn->serviceName) + 2 * TAG_HDR_SIZE
+	+ ntohs(conn->hostUniq.length) > MAX_PPPOE_PAYLOAD)
+	fatal("Service name too long");
+    if (openRing(&ring) < 0)
+	fatal("Can't set up TPACKET_V3 receive ring: %m");
+
+    ifs = calloc(numIfs, sizeof(*ifs));
+    if (ifs == NULL)
+	fatal("Out of memory");
+    for (i = n = 0; i < numIfs; ++i) {
+	ifs[n].name = ifNames[i];
+	if (openSurveyIf(ring.sock, &ifs[n]) == 0)
+	    ++n;
+    }
+    numIfs = n;
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    timeout = conn->discoveryTimeout * 1000;
+    for (attempt = 0; attempt < conn->discoveryAttempts; ++attempt) {
+	for (i = 0, n = 0; i < numIfs; ++i) {
+	    if (ifs[i].numACs == 0) {
+		surveyPADI(conn, ring.sock, &ifs[i]);
+		++n;
+	    }
+	}
+	if (n == 0)
+	    break;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+	    ++deadline.tv_sec;
+	    deadline.tv_nsec -= 1000000000L;
+	}
+	for (;;) {
+	    numACs += readRing(conn, &ring, ifs, numIfs);
+	    clock_gettime(CLOCK_REALTIME, &now);
+	    left = (int) (ms_since(&now, &deadline) + 0.5);
+	    if (left <= 0 || signaled(SIGTERM))
+		break;
+	    pfd.fd = ring.sock;
+	    pfd.events = POLLIN | POLLERR;
+	    if (poll(&pfd, 1, left) < 0 && errno != EINTR)
+		fatal("poll: %m");
+	}
+	if (signaled(SIGTERM))
+	    break;
+	timeout *= 2;
+    }
+    numACs += readRing(conn, &ring, ifs, numIfs);
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    for (i = 0; i < numIfs; ++i) {
+	if (ifs[i].numACs)
+	    ++answered;
+	if (pppoe_verbose < 1)
+	    continue;
+	if (ifs[i].acs == NULL)
+	    printf("%-15s no access concentrator\n", ifs[i].name);
+	for (ac = ifs[i].acs; ac != NULL; ac = ac->next)
+	    printf("%-15s %02x:%02x:%02x:%02x:%02x:%02x %9.3f ms"
+		   "  AC-Name \"%s\"  Service-Name %s\n", ifs[i].name,
+		   ac->mac[0], ac->mac[1], ac->mac[2],
+		   ac->mac[3], ac->mac[4], ac->mac[5],
+		   ac->latency, ac->name, ac->services);
+    }
+    printf("%d interfaces, %d access concentrators on %d, in %.2f s\n",
+	   numIfs, numACs, answered, ms_since(&start, &now) / 1e3);
+    fflush(stdout);
+    return answered;
+}
+
+#else /* no TPACKET3_HDRLEN */
+
+int
+survey(PPPoEConnection *conn, char **ifNames, int numIfs)
+{
+    fatal("Survey mode needs TPACKET_V3 support (Linux 3.2 or later)");
+    return 0;
+}
+
+#endif
@@ -149,6 +149,160 @@ unsigned char rc_get_seqnbr(void)
 	return (unsigned char)seq_nbr;
 }
 
+/*
+ * What we have learnt about each server we have talked to.
+ */
+typedef struct server_health
+{
+	struct server_health *next;
+	char		*name;
+	unsigned short	port;
+	int		srtt;		/* smoothed round trip time, ms; 0 if unknown */
+	int		fails;		/* consecutive requests without an answer */
+	time_t		dead_until;	/* tried only as a last resort until then */
+} SERVER_HEALTH;
+
+static SERVER_HEALTH *server_health;
+
+/*
+ * Function: rc_server_health
+ *
+ * Purpose: find, or start, the record for a server.
+ *
+ * Returns: the record, or NULL if out of memory.
+ *
+ */
+
+static SERVER_HEALTH *rc_server_health(char *name, unsigned short port)
+{
+	SERVER_HEALTH	*h;
+
+	for (h = server_health; h != NULL; h = h->next)
+		if (h->port == port && strcmp(h->name, name) == 0)
+			return h;
+
+	if ((h = calloc(1, sizeof(*h))) == NULL)
+		return NULL;
+	if ((h->name = strdup(name)) == NULL) {
+		free(h);
+		return NULL;
+	}
+	h->port = port;
+	h->next = server_health;
+	server_health = h;
+	return h;
+}
+
+/*
+ * Function: rc_server_order
+ *
+ * Purpose: rank a server list for a new request: servers that are
+ *	    answering, quickest first, then those that last failed, then
+ *	    those still held down.  Ties keep the configured order.
+ *
+ * Returns: indices into servers->name in order (call by reference)
+ *
+ */
+
+void rc_server_order(SERVER *servers, int *order)
+{
+	SERVER_HEALTH	*h;
+	struct timeval	now;
+	long		key[SERVER_MAX];
+	long		k;
+	int		i, j;
+
+	ppp_get_time(&now);
+	for (i = 0; i < servers->max; ++i) {
+		h = rc_server_health(servers->name[i], servers->port[i]);
+		if (h == NULL)
+			k = 0;
+		else if (h->dead_until > now.tv_sec)
+			k = LONG_MAX;
+		else if (h->fails)
+			k = LONG_MAX - 1;
+		else
+			k = h->srtt;
+
+		/* insertion sort; stable, and the list is short */
+		for (j = i; j > 0 && key[j - 1] > k; --j) {
+			key[j] = key[j - 1];
+			order[j] = order[j - 1];
+		}
+		key[j] = k;
+		order[j] = i;
+	}
+}
+
+/*
+ * Function: rc_server_lost
+ *
+ * Purpose: note that a server was still silent when another answered the
+ *	    same request first, so it is at least that much slower.
+ *
+ */
+
+static void rc_server_lost(char *name, unsigned short port,
+			   struct timeval *sent)
+{
+	SERVER_HEALTH	*h;
+	struct timeval	now;
+	int		rtt;
+
+	if ((h = rc_server_health(name, port)) == NULL)
+		return;
+	ppp_get_time(&now);
+	rtt = (now.tv_sec - sent->tv_sec) * 1000
+		+ (now.tv_usec - sent->tv_usec) / 1000 + 1;
+	if (h->srtt < rtt)
+		h->srtt = rtt;
+}
+
+/*
+ * Function: rc_server_report
+ *
+ * Purpose: record how a request to a server went.  A server that doesn't
+ *	    answer is held down for radius_deadtime seconds.
+ *
+ */
+
+void rc_server_report(char *name, unsigned short port, int result,
+		      struct timeval *sent)
+{
+	SERVER_HEALTH	*h;
+	struct timeval	now;
+	int		rtt, deadtime;
+
+	if ((h = rc_server_health(name, port)) == NULL)
+		return;
+	ppp_get_time(&now);
+
+	if (result == OK_RC || result == BADRESP_RC) {
+		rtt = (now.tv_sec - sent->tv_sec) * 1000
+			+ (now.tv_usec - sent->tv_usec) / 1000;
+		if (rtt <= 0)
+			rtt = 1;
+		if (h->srtt == 0)
+			h->srtt = rtt;
+		else
+			h->srtt += (rtt - h->srtt) / 8;
+		if (h->dead_until)
+			info("RADIUS server %s:%u is answering again", name, port);
+		h->fails = 0;
+		h->dead_until = 0;
+	} else if (result == TIMEOUT_RC) {
+		++h->fails;
+		deadtime = rc_conf_int("radius_deadtime");
+		if (deadtime > 0) {
+			if (!h->dead_until)
+				warn("RADIUS server %s:%u not answering, "
+				     "trying it last for %d seconds",
+				     name, port, deadtime);
+			h->dead_until = now.tv_sec + deadtime;
+		}
+	}
+}
+
 /*
  * Function: rc_auth
  *
@@ -193,6 +347,8 @@ int rc_auth_using_server(SERVER *authserver,
 	SEND_DATA       data;
 	int		result;
 	int		i;
+	int		order[SERVER_MAX];
+	struct timeval	sent;
 	int		timeout = rc_conf_int("radius_timeout");
 	int		retries = rc_conf_int("radius_retries");
 
@@ -213,6 +369,7 @@ int rc_auth_using_server(SERVER *authserver,
 	if (rc_avpair_add(&(data.send_pairs), PW_NAS_PORT, &client_port, 0, VENDOR_NONE) == NULL)
 		return (ERROR_RC);
 
+	rc_server_order(authserver, order);
 	result = ERROR_RC;
 	for(i=0; (i<authserver->max) && (result != OK_RC) && (result != BADRESP_RC)
 		; i++)
@@ -221,10 +378,12 @@ int rc_auth_using_server(SERVER *authserver,
 			rc_avpair_free(data.receive_pairs);
 			data.receive_pairs = NULL;
 		}
-		rc_buildreq(&data, PW_ACCESS_REQUEST, authserver->name[i],
-			    authserver->port[i], timeout, retries);
+		rc_buildreq(&data, PW_ACCESS_REQUEST, authserver->name[order[i]],
+			    authserver->port[order[i]], timeout, retries);
 
+		ppp_get_time(&sent);
 		result = rc_send_server (&data, msg, info);
+		rc_server_report(data.server, data.svc_port, result, &sent);
 	}
 
 	*received = data.receive_pairs;
@@ -297,6 +456,7 @@ int rc_acct_using_server(SERVER *acctserver,
 	struct timeval	start_time, dtime;
 	char		msg[4096];
 	int		i;
+	int		order[SERVER_MAX];
 	int		timeout = rc_conf_int("radius_timeout");
 	int		retries = rc_conf_int("radius_retries");
 
@@ -326,6 +486,7 @@ int rc_acct_using_server(SERVER *acctserver,
 		return (ERROR_RC);
 
 	ppp_get_time(&start_time);
+	rc_server_order(acctserver, order);
 	result = ERROR_RC;
 	for(i=0; (i<acctserver->max) && (result != OK_RC) && (result != BADRESP_RC)
 		; i++)
@@ -334,14 +495,16 @@ int rc_acct_using_server(SERVER *acctserver,
 			rc_avpair_free(data.receive_pairs);
 			data.receive_pairs = NULL;
 		}
-		rc_buildreq(&data, PW_ACCOUNTING_REQUEST, acctserver->name[i],
-			    acctserver->port[i], timeout, retries);
+		rc_buildreq(&data, PW_ACCOUNTING_REQUEST, acctserver->name[order[i]],
+			    acctserver->port[order[i]], timeout, retries);
 
 		ppp_get_time(&dtime);
 		dtime.tv_sec -= start_time.tv_sec;
 		rc_avpair_assign(adt_vp, &dtime.tv_sec, 0);
 
+		ppp_get_time(&dtime);
 		result = rc_send_server (&data, msg, NULL);
+		rc_server_report(data.server, data.svc_port, result, &dtime);
 	}
 
 	rc_avpair_free(data.receive_pairs);
@@ -406,6 +569,271 @@ int rc_acct_proxy(VALUE_PAIR *send)
 	return result;
 }
 
+/*
+ * An authentication or accounting request being sent asynchronously.
+ * It goes to one server at a time, or with radius_parallel set, to the
+ * two healthiest authentication servers at once; each of those is a
+ * leg with its own identifier and reply.
+ */
+struct rc_leg
+{
+	RC_ASYNC	*a;
+	SEND_DATA	data;
+	SEND_REQ	*req;		/* NULL when the leg is idle */
+	int		server;		/* index into a->servers */
+	struct timeval	sent;
+};
+
+struct rc_async
+{
+	struct rc_leg	leg[2];
+	SERVER		*servers;
+	int		order[SERVER_MAX];	/* servers, best first */
+	int		next;		/* next entry of order[] to try */
+	int		code;
+	int		timeout;
+	int		retries;
+	VALUE_PAIR	*send;
+	VALUE_PAIR	*adt_vp;	/* Acct-Delay-Time, accounting only */
+	struct timeval	start_time;
+	REQUEST_INFO	*info;
+	rc_async_cb	*cb;
+	void		*arg;
+};
+
+static rc_send_cb rc_async_done;
+
+/*
+ * Function: rc_async_send
+ *
+ * Purpose: send the request over the given leg to the next server in
+ *	    order that will take it.
+ *
+ * Returns: OK_RC if a request is on its way, ERROR_RC otherwise.
+ *
+ */
+
+static int rc_async_send(RC_ASYNC *a, struct rc_leg *leg)
+{
+	struct timeval	dtime;
+	UINT4		delay;
+	int		i;
+
+	while (a->next < a->servers->max)
+	{
+		i = a->order[a->next++];
+
+		/* as rc_buildreq, but the socket pool assigns the identifier */
+		leg->data.send_pairs = a->send;
+		leg->data.receive_pairs = NULL;
+		leg->data.server = a->servers->name[i];
+		leg->data.svc_port = a->servers->port[i];
+		leg->data.timeout = a->timeout;
+		leg->data.retries = a->retries;
+		leg->data.code = a->code;
+
+		if (a->adt_vp != NULL) {
+			ppp_get_time(&dtime);
+			delay = dtime.tv_sec - a->start_time.tv_sec;
+			rc_avpair_assign(a->adt_vp, &delay, 0);
+		}
+
+		leg->req = rc_send_server_async(&leg->data, a->info,
+						rc_async_done, leg);
+		if (leg->req != NULL) {
+			leg->server = i;
+			ppp_get_time(&leg->sent);
+			return (OK_RC);
+		}
+	}
+	return (ERROR_RC);
+}
+
+/*
+ * Function: rc_async_free
+ *
+ * Purpose: release an asynchronous request, abandoning any leg still
+ *	    waiting for a reply.
+ *
+ */
+
+static void rc_async_free(RC_ASYNC *a)
+{
+	int		k;
+
+	for (k = 0; k < 2; ++k) {
+		if (a->leg[k].req != NULL)
+			rc_send_server_cancel(a->leg[k].req);
+		rc_avpair_free(a->leg[k].data.receive_pairs);
+	}
+	rc_avpair_free(a->send);
+	free(a);
+}
+
+/*
+ * Function: rc_async_done
+ *
+ * Purpose: called with the answer from one server.  A definite answer
+ *	    is reported straight away; otherwise wait for the other leg,
+ *	    or move on to the next server.
+ *
+ */
+
+static void rc_async_done(int result, char *msg, void *arg)
+{
+	struct rc_leg	*leg = arg, *other;
+	RC_ASYNC	*a = leg->a;
+	VALUE_PAIR	*received;
+
+	leg->req = NULL;
+	rc_server_report(a->servers->name[leg->server],
+			 a->servers->port[leg->server], result, &leg->sent);
+
+	if (result != OK_RC && result != BADRESP_RC) {
+		rc_avpair_free(leg->data.receive_pairs);
+		leg->data.receive_pairs = NULL;
+		if (a->leg[0].req != NULL || a->leg[1].req != NULL)
+			return;
+		if (rc_async_send(a, leg) == OK_RC)
+			return;
+	}
+
+	other = &a->leg[leg == &a->leg[0]];
+	if (other->req != NULL)
+		rc_server_lost(a->servers->name[other->server],
+			       a->servers->port[other->server], &other->sent);
+
+	received = leg->data.receive_pairs;
+	leg->data.receive_pairs = NULL;
+	(*a->cb)(result, received, msg, a->arg);
+	rc_async_free(a);
+}
+
+/*
+ * Function: rc_async_start
+ *
+ * Purpose: common part of rc_auth_async and rc_acct_async.
+ *
+ */
+
+static RC_ASYNC *rc_async_start(int code, SERVER *servers, UINT4 client_port,
+				VALUE_PAIR *send, REQUEST_INFO *info,
+				rc_async_cb *cb, void *arg)
+{
+	RC_ASYNC	*a;
+	UINT4		delay = 0;
+
+	if ((a = calloc(1, sizeof(*a))) == NULL) {
+		rc_avpair_free(send);
+		return (NULL);
+	}
+	a->leg[0].a = a->leg[1].a = a;
+	a->send = send;
+	a->servers = servers;
+	a->code = code;
+	a->timeout = rc_conf_int("radius_timeout");
+	a->retries = rc_conf_int("radius_retries");
+	a->info = info;
+	a->cb = cb;
+	a->arg = arg;
+	rc_server_order(servers, a->order);
+
+	/*
+	 * Fill in NAS-IP-Address or NAS-Identifier and NAS-Port
+	 */
+
+	if (rc_get_nas_id(&a->send) == ERROR_RC ||
+	    rc_avpair_add(&a->send, PW_NAS_PORT, &client_port,
+			  0, VENDOR_NONE) == NULL) {
+		rc_async_free(a);
+		return (NULL);
+	}
+
+	/*
+	 * Fill in Acct-Delay-Time
+	 */
+
+	if (code == PW_ACCOUNTING_REQUEST) {
+		a->adt_vp = rc_avpair_add(&a->send, PW_ACCT_DELAY_TIME,
+					  &delay, 0, VENDOR_NONE);
+		if (a->adt_vp == NULL) {
+			rc_async_free(a);
+			return (NULL);
+		}
+		ppp_get_time(&a->start_time);
+	}
+
+	if (rc_async_send(a, &a->leg[0]) != OK_RC) {
+		rc_async_free(a);
+		return (NULL);
+	}
+
+	/*
+	 * Don't duplicate accounting records; for authentication, whichever
+	 * server answers first wins.
+	 */
+	if (code == PW_ACCESS_REQUEST && rc_conf_int("radius_parallel"))
+		rc_async_send(a, &a->leg[1]);
+
+	return (a);
+}
+
+/*
+ * Function: rc_auth_async
+ *
+ * Purpose: as rc_auth_using_server, but returns as soon as the request
+ *	    has been sent.  cb is called from the event loop with the
+ *	    result, the received value_pairs (which it must free) and the
+ *	    messages from the server.  send is freed when done with.
+ *
+ * Returns: a handle for rc_async_cancel, or NULL if the request could
+ *	    not be sent, in which case cb is never called.
+ *
+ */
+
+RC_ASYNC *rc_auth_async(SERVER *authserver, UINT4 client_port,
+			VALUE_PAIR *send, REQUEST_INFO *info,
+			rc_async_cb *cb, void *arg)
+{
+	return rc_async_start(PW_ACCESS_REQUEST, authserver, client_port,
+			      send, info, cb, arg);
+}
+
+static void rc_acct_async_done(int result, VALUE_PAIR *received, char *msg,
+			       void *arg)
+{
+	rc_avpair_free(received);
+}
+
+/*
+ * Function: rc_acct_async
+ *
+ * Purpose: as rc_acct_using_server, but returns as soon as the request
+ *	    has been sent; see rc_auth_async.  cb may be NULL.
+ *
+ */
+
+RC_ASYNC *rc_acct_async(SERVER *acctserver, UINT4 client_port,
+			VALUE_PAIR *send, rc_async_cb *cb, void *arg)
+{
+	if (cb == NULL)
+		cb = rc_acct_async_done;
+	return rc_async_start(PW_ACCOUNTING_REQUEST, acctserver, client_port,
+			      send, NULL, cb, arg);
+}
+
+/*
+ * Function: rc_async_cancel
+ *
+ * Purpose: abandon an asynchronous request; its callback is not called.
+ *
+ */
+
+void rc_async_cancel(RC_ASYNC *a)
+{
+	rc_async_free(a);
+}
+
 /*
  * Function: rc_check
  *
@@ -21,6 +21,40 @@ static DICT_ATTR *dictionary_attributes = NULL;
 static DICT_VALUE *dictionary_values = NULL;
 static VENDOR_DICT *vendor_dictionaries = NULL;
 
+/*
+ * Hash indexes over the lists above, filled in as the dictionary is
+ * read.  Entries are pushed on the front of their chain, so as with the
+ * lists a later definition hides an earlier one.
+ */
+#define DICT_HASH_SIZE	256
+
+static DICT_ATTR *attr_by_id[DICT_HASH_SIZE];	/* by vendor and value */
+static DICT_ATTR *attr_by_name[DICT_HASH_SIZE];
+static DICT_VALUE *value_by_attr[DICT_HASH_SIZE];	/* by attrname and value */
+static DICT_VALUE *value_by_name[DICT_HASH_SIZE];
+
+/*
+ * Function: dict_hash_name
+ *
+ * Purpose: hash a name, ignoring case (FNV-1a).
+ *
+ */
+
+static unsigned int dict_hash_name (const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char) tolower ((unsigned char) *name++)) * 16777619u;
+	return h;
+}
+
+static unsigned int dict_hash_id (int vendor, int value)
+{
+	return ((unsigned int) vendor * 2654435761u + (unsigned int) value)
+		& (DICT_HASH_SIZE - 1);
+}
+
 /*
  * Function: rc_read_dictionary
  *
@@ -40,6 +74,7 @@ int rc_read_dictionary (char *filename)
 	char            attrstr[AUTH_ID_LEN];
 	char            typestr[AUTH_ID_LEN];
 	char            vendorstr[AUTH_ID_LEN];
+	char            pathstr[PATH_MAX];
 	int             line_no;
 	DICT_ATTR      *attr;
 	DICT_VALUE     *dval;
@@ -214,6 +249,14 @@ int rc_read_dictionary (char *filename)
 			    attr->next = dictionary_attributes;
 			    dictionary_attributes = attr;
 			}
+
+			/* ... and the indexes */
+			n = dict_hash_id (attr->vendorcode, value);
+			attr->id_next = attr_by_id[n];
+			attr_by_id[n] = attr;
+			n = dict_hash_name (namestr) & (DICT_HASH_SIZE - 1);
+			attr->name_next = attr_by_name[n];
+			attr_by_name[n] = attr;
 		}
 		else if (strncmp (buffer, "VALUE", 5) == 0)
 		{
@@ -271,6 +314,14 @@ int rc_read_dictionary (char *filename)
 			/* Insert it into the list */
 			dval->next = dictionary_values;
 			dictionary_values = dval;
+
+			/* ... and the indexes */
+			n = (dict_hash_name (attrstr) + value) & (DICT_HASH_SIZE - 1);
+			dval->attr_next = value_by_attr[n];
+			value_by_attr[n] = dval;
+			n = dict_hash_name (namestr) & (DICT_HASH_SIZE - 1);
+			dval->name_next = value_by_name[n];
+			value_by_name[n] = dval;
 		}
 		else if (strncmp (buffer, "INCLUDE", 7) == 0)
 		{
@@ -282,7 +333,16 @@ int rc_read_dictionary (char *filename)
 				retcode = -1;
 				break;
 			}
-			if (rc_read_dictionary(namestr) == -1)
+			/* a relative name is taken from this dictionary's directory */
+			if (namestr[0] != '/' && strchr(filename, '/') != NULL)
+			{
+				snprintf(pathstr, sizeof(pathstr), "%.*s/%s",
+					 (int) (strrchr(filename, '/') - filename),
+					 filename, namestr);
+			}
+			else
+				strlcpy(pathstr, namestr, sizeof(pathstr));
+			if (rc_read_dictionary(pathstr) == -1)
 			{
 				retcode = -1;
 				break;
@@ -305,28 +365,13 @@ int rc_read_dictionary (char *filename)
 DICT_ATTR *rc_dict_getattr (int attribute, int vendor)
 {
 	DICT_ATTR      *attr;
-	VENDOR_DICT    *dict;
 
-	if (vendor == VENDOR_NONE) {
-	    attr = dictionary_attributes;
-	    while (attr != (DICT_ATTR *) NULL) {
-		if (attr->value == attribute) {
-		    return (attr);
-		}
-		attr = attr->next;
-	    }
-	} else {
-	    dict = rc_dict_getvendor(vendor);
-	    if (!dict) {
-		return NULL;
-	    }
-	    attr = dict->attributes;
-	    while (attr) {
-		if (attr->value == attribute) {
-		    return attr;
+	attr = attr_by_id[dict_hash_id (vendor, attribute)];
+	while (attr != (DICT_ATTR *) NULL) {
+		if (attr->value == attribute && attr->vendorcode == vendor) {
+			return (attr);
 		}
-		attr = attr->next;
-	    }
+		attr = attr->id_next;
 	}
 	return NULL;
 }
@@ -335,38 +380,28 @@ DICT_ATTR *rc_dict_getattr (int attribute, int vendor)
  * Function: rc_dict_findattr
  *
  * Purpose: Return the full attribute structure based on the
- *	    attribute name.
+ *	    attribute name.  Standard attributes take precedence over
+ *	    vendor-specific ones of the same name.
  *
  */
 
 DICT_ATTR *rc_dict_findattr (char *attrname)
 {
-	DICT_ATTR      *attr;
-	VENDOR_DICT    *dict;
+	DICT_ATTR      *attr, *vsa = NULL;
 
-	attr = dictionary_attributes;
+	attr = attr_by_name[dict_hash_name (attrname) & (DICT_HASH_SIZE - 1)];
 	while (attr != (DICT_ATTR *) NULL)
 	{
 		if (strcasecmp (attr->name, attrname) == 0)
 		{
-			return (attr);
-		}
-		attr = attr->next;
-	}
-
-	/* Search vendor-specific dictionaries */
-	dict = vendor_dictionaries;
-	while (dict) {
-	    attr = dict->attributes;
-	    while (attr) {
-		if (strcasecmp (attr->name, attrname) == 0) {
-		    return (attr);
+			if (attr->vendorcode == VENDOR_NONE)
+				return (attr);
+			if (vsa == NULL)
+				vsa = attr;
 		}
-		attr = attr->next;
-	    }
-	    dict = dict->next;
+		attr = attr->name_next;
 	}
-	return ((DICT_ATTR *) NULL);
+	return (vsa);
 }
 
 
@@ -382,14 +417,14 @@ DICT_VALUE *rc_dict_findval (char *valname)
 {
 	DICT_VALUE     *val;
 
-	val = dictionary_values;
+	val = value_by_name[dict_hash_name (valname) & (DICT_HASH_SIZE - 1)];
 	while (val != (DICT_VALUE *) NULL)
 	{
 		if (strcasecmp (val->name, valname) == 0)
 		{
 			return (val);
 		}
-		val = val->next;
+		val = val->name_next;
 	}
 	return ((DICT_VALUE *) NULL);
 }
@@ -406,7 +441,7 @@ DICT_VALUE * rc_dict_getval (UINT4 value, char *attrname)
 {
 	DICT_VALUE     *val;
 
-	val = dictionary_values;
+	val = value_by_attr[(dict_hash_name (attrname) + value) & (DICT_HASH_SIZE - 1)];
 	while (val != (DICT_VALUE *) NULL)
 	{
 		if (strcmp (val->attrname, attrname) == 0 &&
@@ -414,7 +449,7 @@ DICT_VALUE * rc_dict_getval (UINT4 value, char *attrname)
 		{
 			return (val);
 		}
-		val = val->next;
+		val = val->attr_next;
 	}
 	return ((DICT_VALUE *) NULL);
 }
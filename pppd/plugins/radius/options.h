@@ -31,6 +31,8 @@ static SERVER authserver = {0};
 
 int default_tries = 4;
 int default_timeout = 60;
+int default_deadtime = 30;
+int default_parallel = 0;
 
 static OPTION config_options[] = {
 /* internally used options */
@@ -52,6 +54,8 @@ static OPTION config_options[] = {
 {"default_realm",	OT_STR, ST_UNDEF, NULL},
 {"radius_timeout",	OT_INT, ST_UNDEF, NULL},
 {"radius_retries",	OT_INT,	ST_UNDEF, NULL},
+{"radius_deadtime",	OT_INT,	ST_UNDEF, &default_deadtime},
+{"radius_parallel",	OT_INT,	ST_UNDEF, &default_parallel},
 {"nas_identifier",      OT_STR, ST_UNDEF, ""},
 {"bindaddr",            OT_STR, ST_UNDEF, NULL},
 /* local options */
@@ -75,9 +75,27 @@ static option_t Options[] = {
 static pap_check_hook_fn radius_secret_check;
 static pap_auth_hook_fn radius_pap_auth;
 static chap_verify_hook_fn radius_chap_verify;
+static chap_verify_hook_fn radius_chap_verify_async;
+static rc_async_cb radius_pap_done;
+static rc_async_cb radius_chap_done;
+static rc_async_cb radius_acct_done;
 
 static void radius_ip_up(void *opaque, int arg);
 static void radius_ip_down(void *opaque, int arg);
+static void radius_auth_cancel(void);
+static void radius_link_down(void *opaque, int arg);
+static void radius_exit(void *opaque, int arg);
+static VALUE_PAIR *radius_chap_request(char *user, int id,
+				       struct chap_digest_type *digest,
+				       unsigned char *challenge,
+				       unsigned char *response,
+				       char *radius_msg);
+static int radius_chap_result(int result, VALUE_PAIR *received,
+			      char *radius_msg, REQUEST_INFO *req_info,
+			      struct chap_digest_type *digest,
+			      unsigned char *challenge,
+			      char *message, int message_space);
+static void radius_acct_send(VALUE_PAIR *send, char *failmsg);
 static void make_username_realm(const char *user);
 static int radius_setparams(VALUE_PAIR *vp, char *msg, REQUEST_INFO *req_info,
 			    struct chap_digest_type *digest,
@@ -119,8 +137,22 @@ struct radius_state {
     int class_len;
     char class[MAXCLASSLEN];
     VALUE_PAIR *avp;	/* Additional (user supplied) vp's to send to server */
+    RC_ASYNC *auth_req;	/* Access-Request awaiting a reply */
 };
 
+/*
+ * What radius_chap_done needs from the CHAP response being checked.
+ */
+static struct radius_chap_pending {
+    struct chap_digest_type *digest;
+    unsigned char challenge[MAX_CHALLENGE_LEN];
+    char *message;
+    int message_space;
+    REQUEST_INFO req_info;
+} chap_pending;
+
+static char radius_msg[BUF_LEN];	/* for a pending PAP check */
+
 void (*radius_attributes_hook)(VALUE_PAIR *) = NULL;
 
 /* The pre_auth_hook MAY set authserver and acctserver if it wants.
@@ -147,15 +179,20 @@ plugin_init(void)
 {
     pap_check_hook = radius_secret_check;
     pap_auth_hook = radius_pap_auth;
+    pap_auth_cancel_hook = radius_auth_cancel;
 
     chap_check_hook = radius_secret_check;
     chap_verify_hook = radius_chap_verify;
+    chap_verify_async_hook = radius_chap_verify_async;
+    chap_verify_cancel_hook = radius_auth_cancel;
 
     ip_choose_hook = radius_choose_ip;
     allowed_address_hook = radius_allowed_address;
 
     ppp_add_notify(NF_IP_UP, radius_ip_up, NULL);
     ppp_add_notify(NF_IP_DOWN, radius_ip_down, NULL);
+    ppp_add_notify(NF_LINK_DOWN, radius_link_down, NULL);
+    ppp_add_notify(NF_EXIT, radius_exit, NULL);
 
     memset(&rstate, 0, sizeof(rstate));
 
@@ -231,9 +268,10 @@ radius_choose_ip(u_int32_t *addrp)
 *  paddrs -- set to a list of possible peer IP addresses
 *  popts -- set to a list of additional pppd options
 * %RETURNS:
-*  1 if we can authenticate, -1 if we cannot.
+*  PAP_AUTH_PENDING if the request went out, 0 if it could not be sent.
 * %DESCRIPTION:
-* Performs PAP authentication using RADIUS
+* Performs PAP authentication using RADIUS.  The answer is delivered
+* by radius_pap_done.
 ***********************************************************************/
 static int
 radius_pap_auth(char *user,
@@ -242,10 +280,9 @@ radius_pap_auth(char *user,
 		struct wordlist **paddrs,
 		struct wordlist **popts)
 {
-    VALUE_PAIR *send, *received;
+    VALUE_PAIR *send;
     UINT4 av_type;
-    int result;
-    static char radius_msg[BUF_LEN];
+    SERVER *authserver;
     const char *remote_number;
     const char *ipparam;
 
@@ -266,7 +303,6 @@ radius_pap_auth(char *user,
     }
 
     send = NULL;
-    received = NULL;
 
     /* Hack... the "port" is the ppp interface number.  Should really be
        the tty */
@@ -292,72 +328,78 @@ radius_pap_auth(char *user,
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
-    if (rstate.authserver) {
-	result = rc_auth_using_server(rstate.authserver,
-				      rstate.client_port, send,
-				      &received, radius_msg, NULL);
-    } else {
-	result = rc_auth(rstate.client_port, send, &received, radius_msg, NULL);
+    authserver = rstate.authserver;
+    if (!authserver)
+	authserver = rc_conf_srv("authserver");
+    if (!authserver) {
+	rc_avpair_free(send);
+	return 0;
     }
 
+    rstate.auth_req = rc_auth_async(authserver, rstate.client_port, send,
+				    NULL, radius_pap_done, NULL);
+    if (!rstate.auth_req)
+	return 0;
+    return PAP_AUTH_PENDING;
+}
+
+/**********************************************************************
+* %FUNCTION: radius_pap_done
+* %ARGUMENTS:
+*  result -- outcome of the Access-Request
+*  received -- attributes from the server
+*  msg -- Reply-Messages from the server
+*  arg -- ignored
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+* Completes the PAP authentication started by radius_pap_auth.
+***********************************************************************/
+static void
+radius_pap_done(int result, VALUE_PAIR *received, char *msg, void *arg)
+{
+    rstate.auth_req = NULL;
+    strlcpy(radius_msg, msg, sizeof(radius_msg));
+
     if (result == OK_RC) {
 	if (radius_setparams(received, radius_msg, NULL, NULL, NULL, NULL, 0) < 0) {
 	    result = ERROR_RC;
 	}
     }
 
-    /* free value pairs */
     rc_avpair_free(received);
-    rc_avpair_free(send);
 
-    return (result == OK_RC) ? 1 : 0;
+    upap_auth_complete(result == OK_RC, radius_msg, NULL, NULL);
 }
 
 /**********************************************************************
-* %FUNCTION: radius_chap_verify
+* %FUNCTION: radius_chap_request
 * %ARGUMENTS:
-*  user -- name of the peer
-*  ourname -- name for this machine
-*  id -- the ID byte in the challenge
-*  digest -- points to the structure representing the digest type
-*  challenge -- the challenge string we sent (length in first byte)
-*  response -- the response (hash) the peer sent back (length in 1st byte)
-*  message -- space for a message to be returned to the peer
-*  message_space -- number of bytes available at *message.
+*  user, id, digest, challenge, response -- as for radius_chap_verify
+*  radius_msg -- buffer of size BUF_LEN for error message
 * %RETURNS:
-*  1 if the response is good, 0 if it is bad
+*  The attributes of the Access-Request, or NULL if we can't make one
 * %DESCRIPTION:
-* Performs CHAP, MS-CHAP and MS-CHAPv2 authentication using RADIUS.
+* Builds the Access-Request for a CHAP, MS-CHAP or MS-CHAPv2 response.
 ***********************************************************************/
-static int
-radius_chap_verify(char *user, char *ourname, int id,
-		   struct chap_digest_type *digest,
-		   unsigned char *challenge, unsigned char *response,
-		   char *message, int message_space)
+static VALUE_PAIR *
+radius_chap_request(char *user, int id, struct chap_digest_type *digest,
+		    unsigned char *challenge, unsigned char *response,
+		    char *radius_msg)
 {
-    VALUE_PAIR *send, *received;
+    VALUE_PAIR *send;
     UINT4 av_type;
-    static char radius_msg[BUF_LEN];
-    int result;
     int challenge_len, response_len;
     u_char cpassword[MAX_RESPONSE_LEN + 1];
-#ifdef PPP_WITH_MPPE
-    /* Need the RADIUS secret and Request Authenticator to decode MPPE */
-    REQUEST_INFO request_info, *req_info = &request_info;
-#else
-    REQUEST_INFO *req_info = NULL;
-#endif
     const char *remote_number;
     const char *ipparam;
 
     challenge_len = *challenge++;
     response_len = *response++;
 
-    radius_msg[0] = 0;
-
     if (radius_init(radius_msg) < 0) {
 	error("%s", radius_msg);
-	return 0;
+	return NULL;
     }
 
     /* return error for types we can't handle */
@@ -368,7 +410,7 @@ radius_chap_verify(char *user, char *ourname, int id,
 #endif
 	) {
 	error("RADIUS: Challenge type %u unsupported", digest->code);
-	return 0;
+	return NULL;
     }
 
     /* Put user with potentially realm added in rstate.user */
@@ -382,7 +424,7 @@ radius_chap_verify(char *user, char *ourname, int id,
 	}
     }
 
-    send = received = NULL;
+    send = NULL;
 
     av_type = PW_FRAMED;
     rc_avpair_add (&send, PW_SERVICE_TYPE, &av_type, 0, VENDOR_NONE);
@@ -398,8 +440,10 @@ radius_chap_verify(char *user, char *ourname, int id,
     switch (digest->code) {
     case CHAP_MD5:
 	/* CHAP-Challenge and CHAP-Password */
-	if (response_len != MD5_DIGEST_LENGTH)
-	    return 0;
+	if (response_len != MD5_DIGEST_LENGTH) {
+	    rc_avpair_free(send);
+	    return NULL;
+	}
 	cpassword[0] = id;
 	memcpy(&cpassword[1], response, MD5_DIGEST_LENGTH);
 
@@ -415,8 +459,10 @@ radius_chap_verify(char *user, char *ourname, int id,
 	/* MS-CHAP-Challenge and MS-CHAP-Response */
 	u_char *p = cpassword;
 
-	if (response_len != MS_CHAP_RESPONSE_LEN)
-	    return 0;
+	if (response_len != MS_CHAP_RESPONSE_LEN) {
+	    rc_avpair_free(send);
+	    return NULL;
+	}
 	*p++ = id;
 	/* The idiots use a different field order in RADIUS than PPP */
 	*p++ = response[MS_CHAP_USENT];
@@ -434,8 +480,10 @@ radius_chap_verify(char *user, char *ourname, int id,
 	/* MS-CHAP-Challenge and MS-CHAP2-Response */
 	u_char *p = cpassword;
 
-	if (response_len != MS_CHAP2_RESPONSE_LEN)
-	    return 0;
+	if (response_len != MS_CHAP2_RESPONSE_LEN) {
+	    rc_avpair_free(send);
+	    return NULL;
+	}
 	*p++ = id;
 	/* The idiots use a different field order in RADIUS than PPP */
 	*p++ = response[MS_CHAP2_FLAGS];
@@ -463,19 +511,28 @@ radius_chap_verify(char *user, char *ourname, int id,
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
-    /*
-     * make authentication with RADIUS server
-     */
+    return send;
 
-    if (rstate.authserver) {
-	result = rc_auth_using_server(rstate.authserver,
-				      rstate.client_port, send,
-				      &received, radius_msg, req_info);
-    } else {
-	result = rc_auth(rstate.client_port, send, &received, radius_msg,
-			 req_info);
-    }
+}
 
+/**********************************************************************
+* %FUNCTION: radius_chap_result
+* %ARGUMENTS:
+*  result -- outcome of the Access-Request
+*  received -- attributes from the server
+*  radius_msg -- Reply-Messages from the server; buffer of size BUF_LEN
+*  req_info, digest, challenge, message, message_space -- as for
+*   radius_setparams
+* %RETURNS:
+*  1 if the response is good, 0 if it is bad
+* %DESCRIPTION:
+* Acts on the server's answer to a CHAP Access-Request.
+***********************************************************************/
+static int
+radius_chap_result(int result, VALUE_PAIR *received, char *radius_msg,
+		   REQUEST_INFO *req_info, struct chap_digest_type *digest,
+		   unsigned char *challenge, char *message, int message_space)
+{
     strlcpy(message, radius_msg, message_space);
 
     if (result == OK_RC) {
@@ -490,9 +547,152 @@ radius_chap_verify(char *user, char *ourname, int id,
 	}
     }
 
+    return (result == OK_RC);
+}
+
+/**********************************************************************
+* %FUNCTION: radius_chap_verify
+* %ARGUMENTS:
+*  user -- name of the peer
+*  ourname -- name for this machine
+*  id -- the ID byte in the challenge
+*  digest -- points to the structure representing the digest type
+*  challenge -- the challenge string we sent (length in first byte)
+*  response -- the response (hash) the peer sent back (length in 1st byte)
+*  message -- space for a message to be returned to the peer
+*  message_space -- number of bytes available at *message.
+* %RETURNS:
+*  1 if the response is good, 0 if it is bad
+* %DESCRIPTION:
+* Performs CHAP, MS-CHAP and MS-CHAPv2 authentication using RADIUS,
+* waiting for the answer.  EAP uses this one.
+***********************************************************************/
+static int
+radius_chap_verify(char *user, char *ourname, int id,
+		   struct chap_digest_type *digest,
+		   unsigned char *challenge, unsigned char *response,
+		   char *message, int message_space)
+{
+    VALUE_PAIR *send, *received;
+    static char radius_msg[BUF_LEN];
+    int result, ok;
+#ifdef PPP_WITH_MPPE
+    /* Need the RADIUS secret and Request Authenticator to decode MPPE */
+    REQUEST_INFO request_info, *req_info = &request_info;
+#else
+    REQUEST_INFO *req_info = NULL;
+#endif
+
+    radius_msg[0] = 0;
+    send = radius_chap_request(user, id, digest, challenge, response,
+			       radius_msg);
+    if (!send)
+	return 0;
+    received = NULL;
+
+    /*
+     * make authentication with RADIUS server
+     */
+
+    if (rstate.authserver) {
+	result = rc_auth_using_server(rstate.authserver,
+				      rstate.client_port, send,
+				      &received, radius_msg, req_info);
+    } else {
+	result = rc_auth(rstate.client_port, send, &received, radius_msg,
+			 req_info);
+    }
+
+    ok = radius_chap_result(result, received, radius_msg, req_info, digest,
+			    challenge + 1, message, message_space);
+
     rc_avpair_free(received);
     rc_avpair_free (send);
-    return (result == OK_RC);
+    return ok;
+}
+
+/**********************************************************************
+* %FUNCTION: radius_chap_verify_async
+* %ARGUMENTS:
+*  As for radius_chap_verify
+* %RETURNS:
+*  CHAP_VERIFY_PENDING if the request went out, 0 if it could not be sent.
+* %DESCRIPTION:
+* Performs CHAP, MS-CHAP and MS-CHAPv2 authentication using RADIUS
+* without waiting; radius_chap_done delivers the answer.
+***********************************************************************/
+static int
+radius_chap_verify_async(char *user, char *ourname, int id,
+			 struct chap_digest_type *digest,
+			 unsigned char *challenge, unsigned char *response,
+			 char *message, int message_space)
+{
+    VALUE_PAIR *send;
+    SERVER *authserver;
+    REQUEST_INFO *req_info = NULL;
+    char radius_msg[BUF_LEN];
+
+    radius_msg[0] = 0;
+    send = radius_chap_request(user, id, digest, challenge, response,
+			       radius_msg);
+    if (!send)
+	return 0;
+
+    authserver = rstate.authserver;
+    if (!authserver)
+	authserver = rc_conf_srv("authserver");
+    if (!authserver || challenge[0] > sizeof(chap_pending.challenge)) {
+	rc_avpair_free(send);
+	return 0;
+    }
+
+    chap_pending.digest = digest;
+    memcpy(chap_pending.challenge, challenge + 1, challenge[0]);
+    chap_pending.message = message;
+    chap_pending.message_space = message_space;
+#ifdef PPP_WITH_MPPE
+    /* Need the RADIUS secret and Request Authenticator to decode MPPE */
+    req_info = &chap_pending.req_info;
+#endif
+
+    rstate.auth_req = rc_auth_async(authserver, rstate.client_port, send,
+				    req_info, radius_chap_done, NULL);
+    if (!rstate.auth_req)
+	return 0;
+    return CHAP_VERIFY_PENDING;
+}
+
+/**********************************************************************
+* %FUNCTION: radius_chap_done
+* %ARGUMENTS:
+*  result -- outcome of the Access-Request
+*  received -- attributes from the server
+*  msg -- Reply-Messages from the server
+*  arg -- ignored
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+* Completes the CHAP authentication started by radius_chap_verify_async.
+***********************************************************************/
+static void
+radius_chap_done(int result, VALUE_PAIR *received, char *msg, void *arg)
+{
+    char radius_msg[BUF_LEN];
+    REQUEST_INFO *req_info = NULL;
+    int ok;
+
+#ifdef PPP_WITH_MPPE
+    req_info = &chap_pending.req_info;
+#endif
+    rstate.auth_req = NULL;
+    strlcpy(radius_msg, msg, sizeof(radius_msg));
+
+    ok = radius_chap_result(result, received, radius_msg, req_info,
+			    chap_pending.digest, chap_pending.challenge,
+			    chap_pending.message, chap_pending.message_space);
+    rc_avpair_free(received);
+
+    chap_verify_complete(ok);
 }
 
 /**********************************************************************
@@ -967,6 +1167,53 @@ radius_setmppekeys2(VALUE_PAIR *vp, REQUEST_INFO *req_info)
 }
 #endif /* PPP_WITH_MPPE */
 
+/**********************************************************************
+* %FUNCTION: radius_acct_send
+* %ARGUMENTS:
+*  send -- attributes of the accounting record; freed when sent
+*  failmsg -- format for the warning logged if no server takes it
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Sends an accounting record without waiting for the server's answer.
+***********************************************************************/
+static void
+radius_acct_send(VALUE_PAIR *send, char *failmsg)
+{
+    SERVER *acctserver = rstate.acctserver;
+
+    if (!acctserver)
+	acctserver = rc_conf_srv("acctserver");
+    if (!acctserver
+	|| !rc_acct_async(acctserver, rstate.client_port, send,
+			  radius_acct_done, failmsg)) {
+	if (!acctserver)
+	    rc_avpair_free(send);
+	radius_acct_done(ERROR_RC, NULL, NULL, failmsg);
+    }
+}
+
+/**********************************************************************
+* %FUNCTION: radius_acct_done
+* %ARGUMENTS:
+*  result -- outcome of the Accounting-Request
+*  received -- attributes from the server
+*  msg -- ignored
+*  arg -- format for the warning to log on failure
+* %RETURNS:
+*  Nothing
+***********************************************************************/
+static void
+radius_acct_done(int result, VALUE_PAIR *received, char *msg, void *arg)
+{
+    rc_avpair_free(received);
+
+    if (result != OK_RC) {
+	/* RADIUS server could be down so make this a warning */
+	syslog(LOG_WARNING, (char *) arg, rstate.user);
+    }
+}
+
 /**********************************************************************
 * %FUNCTION: radius_acct_start
 * %ARGUMENTS:
@@ -980,7 +1227,6 @@ static void
 radius_acct_start(void)
 {
     UINT4 av_type;
-    int result;
     VALUE_PAIR *send = NULL;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
@@ -1036,20 +1282,7 @@ radius_acct_start(void)
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
-    if (rstate.acctserver) {
-	result = rc_acct_using_server(rstate.acctserver,
-				      rstate.client_port, send);
-    } else {
-	result = rc_acct(rstate.client_port, send);
-    }
-
-    rc_avpair_free(send);
-
-    if (result != OK_RC) {
-	/* RADIUS server could be down so make this a warning */
-	syslog(LOG_WARNING,
-		"Accounting START failed for %s", rstate.user);
-    }
+    radius_acct_send(send, "Accounting START failed for %s");
 
     /* Kick off periodic accounting reports */
     if (rstate.acct_interim_interval) {
@@ -1073,7 +1306,6 @@ radius_acct_stop(void)
     VALUE_PAIR *send = NULL;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
-    int result;
     const char *remote_number;
     const char *ipparam;
     ppp_link_stats_st stats;
@@ -1205,19 +1437,7 @@ radius_acct_stop(void)
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
-    if (rstate.acctserver) {
-	result = rc_acct_using_server(rstate.acctserver,
-				      rstate.client_port, send);
-    } else {
-	result = rc_acct(rstate.client_port, send);
-    }
-
-    if (result != OK_RC) {
-	/* RADIUS server could be down so make this a warning */
-	syslog(LOG_WARNING,
-		"Accounting STOP failed for %s", rstate.user);
-    }
-    rc_avpair_free(send);
+    radius_acct_send(send, "Accounting STOP failed for %s");
 }
 
 /**********************************************************************
@@ -1236,7 +1456,6 @@ radius_acct_interim(void *ignored)
     VALUE_PAIR *send = NULL;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
-    int result;
     const char *remote_number;
     const char *ipparam;
     ppp_link_stats_st stats;
@@ -1313,19 +1532,7 @@ radius_acct_interim(void *ignored)
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
-    if (rstate.acctserver) {
-	result = rc_acct_using_server(rstate.acctserver,
-				      rstate.client_port, send);
-    } else {
-	result = rc_acct(rstate.client_port, send);
-    }
-
-    if (result != OK_RC) {
-	/* RADIUS server could be down so make this a warning */
-	syslog(LOG_WARNING,
-		"Interim accounting failed for %s", rstate.user);
-    }
-    rc_avpair_free(send);
+    radius_acct_send(send, "Interim accounting failed for %s");
 
     /* Schedule another one */
     ppp_timeout(radius_acct_interim, NULL, rstate.acct_interim_interval, 0);
@@ -1363,6 +1570,61 @@ radius_ip_down(void *opaque, int arg)
     radius_acct_stop();
 }
 
+/**********************************************************************
+* %FUNCTION: radius_auth_cancel
+* %ARGUMENTS:
+*  None
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Forget any authentication request still waiting for an answer.  Called
+*  by PAP and CHAP when the link drops or they are rejected mid-check,
+*  before the link is counted as up and NF_LINK_DOWN would be sent.
+***********************************************************************/
+static void
+radius_auth_cancel(void)
+{
+    if (rstate.auth_req) {
+	rc_async_cancel(rstate.auth_req);
+	rstate.auth_req = NULL;
+    }
+}
+
+/**********************************************************************
+* %FUNCTION: radius_link_down
+* %ARGUMENTS:
+*  opaque -- ignored
+*  arg -- ignored
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Called when the link goes down.  Forget any authentication request
+*  still waiting for an answer.
+***********************************************************************/
+static void
+radius_link_down(void *opaque, int arg)
+{
+    radius_auth_cancel();
+}
+
+/**********************************************************************
+* %FUNCTION: radius_exit
+* %ARGUMENTS:
+*  opaque -- ignored
+*  arg -- ignored
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Called when pppd exits.  Wait for outstanding accounting records,
+*  since the event loop won't run again to finish them.
+***********************************************************************/
+static void
+radius_exit(void *opaque, int arg)
+{
+    radius_link_down(NULL, 0);
+    rc_send_server_flush();
+}
+
 /**********************************************************************
 * %FUNCTION: radius_init
 * %ARGUMENTS:
@@ -320,6 +320,8 @@ typedef struct dict_attr
 	int               type;				/* string, int, etc. */
 	int               vendorcode;                   /* vendor code */
 	struct dict_attr *next;
+	struct dict_attr *id_next;			/* hash chains */
+	struct dict_attr *name_next;
 } DICT_ATTR;
 
 typedef struct dict_value
@@ -328,6 +330,8 @@ typedef struct dict_value
 	char               name[NAME_LENGTH + 1];
 	int                value;
 	struct dict_value *next;
+	struct dict_value *attr_next;			/* hash chains */
+	struct dict_value *name_next;
 } DICT_VALUE;
 
 typedef struct vendor_dict
@@ -377,6 +381,19 @@ typedef struct request_info
 	u_char		request_vector[AUTH_VECTOR_LEN];
 } REQUEST_INFO;
 
+/* A request being sent by rc_send_server_async() */
+typedef struct send_req SEND_REQ;
+
+/* Called with the result and Reply-Messages of an asynchronous request */
+typedef void (rc_send_cb)(int result, char *msg, void *arg);
+
+/* An authentication or accounting request started by rc_*_async() */
+typedef struct rc_async RC_ASYNC;
+
+/* Called with the outcome of an rc_*_async() request */
+typedef void (rc_async_cb)(int result, VALUE_PAIR *received, char *msg,
+			   void *arg);
+
 #ifndef MIN
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #endif
@@ -424,6 +441,12 @@ int rc_acct(UINT4, VALUE_PAIR *);
 int rc_acct_using_server(SERVER *, UINT4, VALUE_PAIR *);
 int rc_acct_proxy(VALUE_PAIR *);
 int rc_check(char *, unsigned short, char *);
+RC_ASYNC *rc_auth_async(SERVER *, UINT4, VALUE_PAIR *, REQUEST_INFO *,
+			rc_async_cb *, void *);
+RC_ASYNC *rc_acct_async(SERVER *, UINT4, VALUE_PAIR *, rc_async_cb *, void *);
+void rc_async_cancel(RC_ASYNC *);
+void rc_server_order(SERVER *, int *);
+void rc_server_report(char *, unsigned short, int, struct timeval *);
 
 /*	clientid.c		*/
 
@@ -460,6 +483,10 @@ UINT4 rc_own_bind_ipaddress(void);
 /*	sendserver.c		*/
 
 int rc_send_server(SEND_DATA *, char *, REQUEST_INFO *);
+SEND_REQ *rc_send_server_async(SEND_DATA *, REQUEST_INFO *, rc_send_cb *,
+			       void *);
+void rc_send_server_cancel(SEND_REQ *);
+void rc_send_server_flush(void);
 
 /*	util.c			*/
 
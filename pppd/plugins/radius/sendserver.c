@@ -16,9 +16,12 @@
 #include <radiusclient.h>
 #include <pathnames.h>
 #include <signal.h>
+#include <poll.h>
 
 static void rc_random_vector (unsigned char *);
 static int rc_check_reply (AUTH_HDR *, int, char *, unsigned char *, unsigned char);
+static void rc_send_timeout (void *);
+static void rc_sock_input (int, void *);
 
 /*
  * Function: rc_pack_list
@@ -182,36 +185,66 @@ static int rc_pack_list (VALUE_PAIR *vp, char *secret, AUTH_HDR *auth)
 }
 
 /*
- * Function: rc_send_server
- *
- * Purpose: send a request to a RADIUS server and wait for the reply
- *
+ * A long-lived socket shared by the asynchronous requests to one server.
+ * Requests are told apart by their RADIUS identifier, so a socket can
+ * carry up to 256 of them at once; more sockets are opened if needed.
  */
+typedef struct rc_sock
+{
+	struct rc_sock *next;
+	UINT4           ipaddr;		/* server address ... */
+	unsigned short  port;		/* ... and port */
+	int             fd;
+	int             npending;
+	unsigned char   next_id;	/* where to look for a free identifier */
+	SEND_REQ       *pending[256];	/* requests in flight, by identifier */
+} RC_SOCK;
 
-int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
+/*
+ * A request to one server, from building the packet to handing back
+ * the reply.  Shared by the blocking and the asynchronous senders.
+ */
+struct send_req
 {
+	struct send_req *next;		/* list of asynchronous requests */
+	SEND_DATA      *data;
+	REQUEST_INFO   *info;
 	int             sockfd;
-	struct sockaddr salocal;
-	struct sockaddr saremote;
-	struct sockaddr_in *sin;
-	struct timeval  authtime;
-	fd_set          readfds;
-	AUTH_HDR       *auth, *recv_auth;
+	RC_SOCK        *sock;		/* pooled socket, asynchronous only */
 	UINT4           auth_ipaddr;
-	char           *server_name;	/* Name of server to query */
-	socklen_t       salen;
-	int             result;
+	struct sockaddr_in saremote;
 	int             total_length;
-	socklen_t       length;
-	int             retry_max;
-	int		secretlen;
+	int             sends;		/* times the request has been sent */
+	rc_send_cb     *cb;
+	void           *arg;
 	char            secret[MAX_SECRET_LENGTH + 1];
 	unsigned char   vector[AUTH_VECTOR_LEN];
-	char            recv_buffer[BUFFER_LEN];
 	char            send_buffer[BUFFER_LEN];
-	int		retries;
+	char            msg[4096];	/* Reply-Messages for the callback */
+};
+
+static SEND_REQ *send_reqs;		/* asynchronous requests in flight */
+static RC_SOCK *rc_socks;		/* socket pool */
+
+/*
+ * Function: rc_send_lookup
+ *
+ * Purpose: find the address and shared secret of the server.
+ *
+ * Returns: OK_RC or ERROR_RC.
+ *
+ */
+
+static int rc_send_lookup (SEND_REQ *req, SEND_DATA *data, REQUEST_INFO *info)
+{
+	char           *server_name;	/* Name of server to query */
 	VALUE_PAIR	*vp;
 
+	req->data = data;
+	req->info = info;
+	req->sends = 0;
+	req->sock = NULL;
+
 	server_name = data->server;
 	if (server_name == (char *) NULL || server_name[0] == '\0')
 		return (ERROR_RC);
@@ -219,26 +252,51 @@ int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
 	if ((vp = rc_avpair_get(data->send_pairs, PW_SERVICE_TYPE)) && \
 	    (vp->lvalue == PW_ADMINISTRATIVE))
 	{
-		strcpy(secret, MGMT_POLL_SECRET);
-		if ((auth_ipaddr = rc_get_ipaddr(server_name)) == 0)
+		strcpy(req->secret, MGMT_POLL_SECRET);
+		if ((req->auth_ipaddr = rc_get_ipaddr(server_name)) == 0)
 			return (ERROR_RC);
 	}
 	else
 	{
-		if (rc_find_server (server_name, &auth_ipaddr, secret) != 0)
+		if (rc_find_server (server_name, &req->auth_ipaddr, req->secret) != 0)
 		{
-			memset (secret, '\0', sizeof (secret));
+			memset (req->secret, '\0', sizeof (req->secret));
 			return (ERROR_RC);
 		}
 	}
 
+	memset ((char *) &req->saremote, '\0', sizeof (req->saremote));
+	req->saremote.sin_family = AF_INET;
+	req->saremote.sin_addr.s_addr = htonl (req->auth_ipaddr);
+	req->saremote.sin_port = htons ((unsigned short) data->svc_port);
+
+	return (OK_RC);
+}
+
+/*
+ * Function: rc_send_socket
+ *
+ * Purpose: open a UDP socket bound to our RADIUS source address.
+ *
+ * Returns: the socket, or -1 on error.
+ *
+ */
+
+static int rc_send_socket (char *server_name)
+{
+	int             sockfd;
+	struct sockaddr salocal;
+	struct sockaddr_in *sin;
+	socklen_t       length;
+
 	sockfd = socket (AF_INET, SOCK_DGRAM, 0);
 	if (sockfd < 0)
 	{
-		memset (secret, '\0', sizeof (secret));
 		error("rc_send_server: socket: %s", strerror(errno));
-		return (ERROR_RC);
+		return (-1);
 	}
+	/* pooled sockets live as long as pppd: keep them out of scripts */
+	(void) fcntl (sockfd, F_SETFD, FD_CLOEXEC);
 
 	length = sizeof (salocal);
 	sin = (struct sockaddr_in *) & salocal;
@@ -250,136 +308,485 @@ int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
 		   getsockname (sockfd, (struct sockaddr *) sin, &length) < 0)
 	{
 		close (sockfd);
-		memset (secret, '\0', sizeof (secret));
 		error("rc_send_server: bind: %s: %m", server_name);
-		return (ERROR_RC);
+		return (-1);
 	}
 
-	retry_max = data->retries;	/* Max. numbers to try for reply */
-	retries = 0;			/* Init retry cnt for blocking call */
+	return (sockfd);
+}
+
+/*
+ * Function: rc_send_build
+ *
+ * Purpose: build the packet to send, using data->seq_nbr as identifier.
+ *
+ */
+
+static void rc_send_build (SEND_REQ *req)
+{
+	SEND_DATA      *data = req->data;
+	AUTH_HDR       *auth;
+	int		secretlen;
 
-	/* Build a request */
-	auth = (AUTH_HDR *) send_buffer;
+	auth = (AUTH_HDR *) req->send_buffer;
 	auth->code = data->code;
 	auth->id = data->seq_nbr;
 
 	if (data->code == PW_ACCOUNTING_REQUEST)
 	{
-		total_length = rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		req->total_length = rc_pack_list(data->send_pairs, req->secret, auth) + AUTH_HDR_LEN;
 
-		auth->length = htons ((unsigned short) total_length);
+		auth->length = htons ((unsigned short) req->total_length);
 
 		memset((char *) auth->vector, 0, AUTH_VECTOR_LEN);
-		secretlen = strlen (secret);
-		memcpy ((char *) auth + total_length, secret, secretlen);
-		rc_md5_calc (vector, (unsigned char *) auth, total_length + secretlen);
-		memcpy ((char *) auth->vector, (char *) vector, AUTH_VECTOR_LEN);
+		secretlen = strlen (req->secret);
+		memcpy ((char *) auth + req->total_length, req->secret, secretlen);
+		rc_md5_calc (req->vector, (unsigned char *) auth, req->total_length + secretlen);
+		memcpy ((char *) auth->vector, (char *) req->vector, AUTH_VECTOR_LEN);
 	}
 	else
 	{
-		rc_random_vector (vector);
-		memcpy (auth->vector, vector, AUTH_VECTOR_LEN);
+		rc_random_vector (req->vector);
+		memcpy (auth->vector, req->vector, AUTH_VECTOR_LEN);
 
-		total_length = rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		req->total_length = rc_pack_list(data->send_pairs, req->secret, auth) + AUTH_HDR_LEN;
 
-		auth->length = htons ((unsigned short) total_length);
+		auth->length = htons ((unsigned short) req->total_length);
 	}
+}
 
-	sin = (struct sockaddr_in *) & saremote;
-	memset ((char *) sin, '\0', sizeof (saremote));
-	sin->sin_family = AF_INET;
-	sin->sin_addr.s_addr = htonl (auth_ipaddr);
-	sin->sin_port = htons ((unsigned short) data->svc_port);
+/*
+ * Function: rc_send_xmit
+ *
+ * Purpose: (re)transmit the request.
+ *
+ */
+
+static void rc_send_xmit (SEND_REQ *req)
+{
+	sendto (req->sockfd, req->send_buffer, (unsigned int) req->total_length,
+		(int) 0, (struct sockaddr *) &req->saremote,
+		sizeof (struct sockaddr_in));
+	++req->sends;
+}
+
+/*
+ * Function: rc_send_reply
+ *
+ * Purpose: collect the attributes and Reply-Messages of a reply to the
+ *	    request, which rc_check_reply found to be "result".
+ *
+ * Returns: OK_RC if the server accepted the request, BADRESP_RC otherwise.
+ *
+ */
+
+static int rc_send_reply (SEND_REQ *req, AUTH_HDR *recv_auth, int result,
+			  char *msg)
+{
+	SEND_DATA      *data = req->data;
+	VALUE_PAIR	*vp;
+
+	data->receive_pairs = rc_avpair_gen(recv_auth);
+
+	if (req->info)
+	{
+		memcpy(req->info->secret, req->secret, sizeof(req->info->secret));
+		memcpy(req->info->request_vector, req->vector,
+		       sizeof(req->info->request_vector));
+	}
+
+	if (result != OK_RC) return (result);
+
+	*msg = '\0';
+	vp = data->receive_pairs;
+	while (vp)
+	{
+		if ((vp = rc_avpair_get(vp, PW_REPLY_MESSAGE)))
+		{
+			strcat(msg, (char*) vp->strvalue);
+			strcat(msg, "\n");
+			vp = vp->next;
+		}
+	}
+
+	if ((recv_auth->code == PW_ACCESS_ACCEPT) ||
+		(recv_auth->code == PW_PASSWORD_ACK) ||
+		(recv_auth->code == PW_ACCOUNTING_RESPONSE))
+	{
+		result = OK_RC;
+	}
+	else
+	{
+		result = BADRESP_RC;
+	}
+
+	return (result);
+}
+
+/*
+ * Function: rc_send_server
+ *
+ * Purpose: send a request to a RADIUS server and wait for the reply
+ *
+ * Remarks: uses a socket of its own rather than the pool, so that
+ *	    replies to asynchronous requests are not handled (and their
+ *	    callbacks run) from in here.
+ *
+ */
+
+int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
+{
+	SEND_REQ        req;
+	struct pollfd   pfd;
+	int             n;
+	int             result;
+	socklen_t       length;
+	char            recv_buffer[BUFFER_LEN];
+	AUTH_HDR       *recv_auth;
+
+	if (rc_send_lookup (&req, data, info) != OK_RC)
+		return (ERROR_RC);
+	if ((req.sockfd = rc_send_socket (data->server)) < 0)
+	{
+		memset (req.secret, '\0', sizeof (req.secret));
+		return (ERROR_RC);
+	}
+	rc_send_build (&req);
 
 	for (;;)
 	{
-		sendto (sockfd, (char *) auth, (unsigned int) total_length, (int) 0,
-			(struct sockaddr *) sin, sizeof (struct sockaddr_in));
-
-		authtime.tv_usec = 0L;
-		authtime.tv_sec = (long) data->timeout;
-		FD_ZERO (&readfds);
-		FD_SET (sockfd, &readfds);
-		if (select (sockfd + 1, &readfds, NULL, NULL, &authtime) < 0)
+		rc_send_xmit (&req);
+
+		/* not select(): pppd's fds may go beyond FD_SETSIZE */
+		pfd.fd = req.sockfd;
+		pfd.events = POLLIN;
+		n = poll (&pfd, 1, data->timeout * 1000);
+		if (n < 0)
 		{
 			if (errno == EINTR && !ppp_signaled(SIGTERM))
 				continue;
-			error("rc_send_server: select: %m");
-			memset (secret, '\0', sizeof (secret));
-			close (sockfd);
+			error("rc_send_server: poll: %m");
+			close (req.sockfd);
+			memset (req.secret, '\0', sizeof (req.secret));
 			return (ERROR_RC);
 		}
-		if (FD_ISSET (sockfd, &readfds))
+		if (n > 0)
 			break;
 
 		/*
 		 * Timed out waiting for response.  Retry "retry_max" times
 		 * before giving up.  If retry_max = 0, don't retry at all.
 		 */
-		if (++retries >= retry_max)
+		if (req.sends >= data->retries)
 		{
 			error("rc_send_server: no reply from RADIUS server %s:%u",
-			      rc_ip_hostname (auth_ipaddr), data->svc_port);
-			close (sockfd);
-			memset (secret, '\0', sizeof (secret));
+			      rc_ip_hostname (req.auth_ipaddr), data->svc_port);
+			close (req.sockfd);
+			memset (req.secret, '\0', sizeof (req.secret));
 			return (TIMEOUT_RC);
 		}
 	}
-	salen = sizeof (saremote);
-	length = recvfrom (sockfd, (char *) recv_buffer,
-			   (int) sizeof (recv_buffer),
-			   (int) 0, &saremote, &salen);
+	length = recv (req.sockfd, recv_buffer, sizeof (recv_buffer), 0);
+	close (req.sockfd);
 
 	if (length <= 0)
 	{
-		error("rc_send_server: recvfrom: %s:%d: %m", server_name,\
+		error("rc_send_server: recvfrom: %s:%d: %m", data->server,\
 		      data->svc_port);
-		close (sockfd);
-		memset (secret, '\0', sizeof (secret));
+		memset (req.secret, '\0', sizeof (req.secret));
 		return (ERROR_RC);
 	}
 
-	recv_auth = (AUTH_HDR *)recv_buffer;
+	recv_auth = (AUTH_HDR *) recv_buffer;
+	result = rc_check_reply (recv_auth, BUFFER_LEN, req.secret, req.vector,
+				 data->seq_nbr);
+	result = rc_send_reply (&req, recv_auth, result, msg);
+	memset (req.secret, '\0', sizeof (req.secret));
 
-	result = rc_check_reply (recv_auth, BUFFER_LEN, secret, vector, data->seq_nbr);
+	return (result);
+}
 
-	data->receive_pairs = rc_avpair_gen(recv_auth);
+/*
+ * Function: rc_sock_attach
+ *
+ * Purpose: give an asynchronous request a pooled socket to the server
+ *	    and a free identifier on it, opening a new socket if all the
+ *	    ones to that server are full.
+ *
+ * Returns: OK_RC or ERROR_RC.
+ *
+ */
+
+static int rc_sock_attach (SEND_REQ *req)
+{
+	RC_SOCK        *sock;
+	int             i, id;
+
+	for (sock = rc_socks; sock != NULL; sock = sock->next)
+		if (sock->ipaddr == req->auth_ipaddr
+		    && sock->port == req->data->svc_port
+		    && sock->npending < 256)
+			break;
+
+	if (sock == NULL)
+	{
+		if ((sock = calloc (1, sizeof (*sock))) == NULL)
+		{
+			error("rc_send_server_async: out of memory");
+			return (ERROR_RC);
+		}
+		if ((sock->fd = rc_send_socket (req->data->server)) < 0)
+		{
+			free (sock);
+			return (ERROR_RC);
+		}
+		fcntl (sock->fd, F_SETFL, fcntl (sock->fd, F_GETFL) | O_NONBLOCK);
+		sock->ipaddr = req->auth_ipaddr;
+		sock->port = req->data->svc_port;
+		sock->next_id = rc_get_seqnbr ();
+		sock->next = rc_socks;
+		rc_socks = sock;
+		add_fd_callback (sock->fd, rc_sock_input, sock);
+	}
 
-	close (sockfd);
-	if (info)
+	for (i = 0; i < 256; ++i)
 	{
-		memcpy(info->secret, secret, sizeof(info->secret));
-		memcpy(info->request_vector, vector,
-		       sizeof(info->request_vector));
+		id = (sock->next_id + i) & 0xff;
+		if (sock->pending[id] == NULL)
+			break;
 	}
-	memset (secret, '\0', sizeof (secret));
+	sock->next_id = id + 1;
+	sock->pending[id] = req;
+	++sock->npending;
 
-	if (result != OK_RC) return (result);
+	req->sock = sock;
+	req->sockfd = sock->fd;
+	req->data->seq_nbr = id;
+	return (OK_RC);
+}
 
-	*msg = '\0';
-	vp = data->receive_pairs;
-	while (vp)
+/*
+ * Function: rc_sock_detach
+ *
+ * Purpose: free the identifier of a finished asynchronous request.  The
+ *	    socket stays open for later requests.
+ *
+ */
+
+static void rc_sock_detach (SEND_REQ *req)
+{
+	SEND_REQ      **pp;
+
+	for (pp = &send_reqs; *pp != NULL; pp = &(*pp)->next)
 	{
-		if ((vp = rc_avpair_get(vp, PW_REPLY_MESSAGE)))
+		if (*pp == req)
 		{
-			strcat(msg, (char*) vp->strvalue);
-			strcat(msg, "\n");
-			vp = vp->next;
+			*pp = req->next;
+			break;
 		}
 	}
+	ppp_untimeout (rc_send_timeout, req);
+	req->sock->pending[req->data->seq_nbr] = NULL;
+	--req->sock->npending;
+	memset (req->secret, '\0', sizeof (req->secret));
+}
 
-	if ((recv_auth->code == PW_ACCESS_ACCEPT) ||
-		(recv_auth->code == PW_PASSWORD_ACK) ||
-		(recv_auth->code == PW_ACCOUNTING_RESPONSE))
+/*
+ * Function: rc_send_finish
+ *
+ * Purpose: take an asynchronous request out of the event loop and
+ *	    hand its result to the caller.
+ *
+ */
+
+static void rc_send_finish (SEND_REQ *req, int result)
+{
+	rc_sock_detach (req);
+
+	if (result != OK_RC)
+		req->msg[0] = '\0';
+	(*req->cb) (result, req->msg, req->arg);
+	free (req);
+}
+
+/*
+ * Function: rc_sock_input
+ *
+ * Purpose: event loop callback for a pooled socket: match each reply
+ *	    waiting on it to the request with that identifier.
+ *
+ */
+
+static void rc_sock_input (int fd, void *arg)
+{
+	RC_SOCK        *sock = arg;
+	SEND_REQ       *req;
+	char            recv_buffer[BUFFER_LEN];
+	AUTH_HDR       *recv_auth = (AUTH_HDR *) recv_buffer;
+	struct sockaddr_in sin;
+	socklen_t       salen;
+	ssize_t         length;
+	int             result;
+
+	for (;;)
 	{
-		result = OK_RC;
+		salen = sizeof (sin);
+		length = recvfrom (fd, recv_buffer, sizeof (recv_buffer), 0,
+				   (struct sockaddr *) &sin, &salen);
+		if (length < 0)
+		{
+			if (errno != EAGAIN && errno != EINTR)
+				error("rc_send_server: recvfrom: %s:%d: %m",
+				      rc_ip_hostname (sock->ipaddr), sock->port);
+			return;
+		}
+		if (length < AUTH_HDR_LEN
+		    || sin.sin_addr.s_addr != htonl (sock->ipaddr)
+		    || sin.sin_port != htons (sock->port))
+			continue;
+
+		req = sock->pending[recv_auth->id];
+		if (req == NULL)
+		{
+			dbglog("rc_send_server: stray reply id %d from %s:%d",
+			       recv_auth->id, rc_ip_hostname (sock->ipaddr),
+			       sock->port);
+			continue;
+		}
+
+		/*
+		 * A reply that fails the authenticator check is dropped and
+		 * the request left waiting for the real one.
+		 */
+		result = rc_check_reply (recv_auth, BUFFER_LEN, req->secret,
+					 req->vector, recv_auth->id);
+		if (result != OK_RC)
+			continue;
+
+		rc_send_finish (req, rc_send_reply (req, recv_auth, result,
+						    req->msg));
 	}
-	else
+}
+
+/*
+ * Function: rc_send_timeout
+ *
+ * Purpose: retransmit an asynchronous request, or give up on it once it
+ *	    has been sent data->retries times.
+ *
+ */
+
+static void rc_send_timeout (void *arg)
+{
+	SEND_REQ       *req = arg;
+
+	if (req->sends >= req->data->retries)
 	{
-		result = BADRESP_RC;
+		error("rc_send_server: no reply from RADIUS server %s:%u",
+		      rc_ip_hostname (req->auth_ipaddr), req->data->svc_port);
+		rc_send_finish (req, TIMEOUT_RC);
+		return;
 	}
+	rc_send_xmit (req);
+	ppp_timeout (rc_send_timeout, req, req->data->timeout, 0);
+}
 
-	return (result);
+/*
+ * Function: rc_send_server_async
+ *
+ * Purpose: send a request to a RADIUS server without waiting for the
+ *	    reply.  The request goes out on a pooled socket, with an
+ *	    identifier free on that socket replacing data->seq_nbr, and
+ *	    is retransmitted from the pppd event loop exactly as
+ *	    rc_send_server would.  cb is called with the result, the
+ *	    Reply-Messages and arg once it is known.  data and info must
+ *	    stay valid until then.
+ *
+ * Returns: a handle for rc_send_server_cancel, or NULL if the request
+ *	    could not be sent, in which case cb is never called.
+ *
+ */
+
+SEND_REQ *rc_send_server_async (SEND_DATA *data, REQUEST_INFO *info,
+				rc_send_cb *cb, void *arg)
+{
+	SEND_REQ       *req;
+
+	if ((req = malloc (sizeof (*req))) == NULL)
+	{
+		error("rc_send_server_async: out of memory");
+		return (NULL);
+	}
+	if (rc_send_lookup (req, data, info) != OK_RC
+	    || rc_sock_attach (req) != OK_RC)
+	{
+		memset (req->secret, '\0', sizeof (req->secret));
+		free (req);
+		return (NULL);
+	}
+	rc_send_build (req);
+
+	req->cb = cb;
+	req->arg = arg;
+	req->msg[0] = '\0';
+	req->next = send_reqs;
+	send_reqs = req;
+
+	rc_send_xmit (req);
+	ppp_timeout (rc_send_timeout, req, data->timeout, 0);
+
+	return (req);
+}
+
+/*
+ * Function: rc_send_server_cancel
+ *
+ * Purpose: forget an asynchronous request; its callback is not called.
+ *
+ */
+
+void rc_send_server_cancel (SEND_REQ *req)
+{
+	rc_sock_detach (req);
+	free (req);
+}
+
+/*
+ * Function: rc_send_server_flush
+ *
+ * Purpose: wait for all asynchronous requests, including any their
+ *	    callbacks start, to complete.  For use when pppd is about to
+ *	    exit and the event loop will not run again.
+ *
+ */
+
+void rc_send_server_flush (void)
+{
+	SEND_REQ       *req;
+	struct pollfd   pfd;
+	int             n;
+
+	while ((req = send_reqs) != NULL)
+	{
+		pfd.fd = req->sockfd;
+		pfd.events = POLLIN;
+		n = poll (&pfd, 1, req->data->timeout * 1000);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			error("rc_send_server: poll: %m");
+			rc_send_finish (req, ERROR_RC);
+		}
+		else if (n > 0)
+			rc_sock_input (req->sockfd, req->sock);
+		else
+		{
+			/* rc_send_timeout arms a fresh callout for a resend */
+			ppp_untimeout (rc_send_timeout, req);
+			rc_send_timeout (req);
+		}
+	}
 }
 
 /*
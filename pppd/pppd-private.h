@@ -114,6 +114,9 @@ extern int	link_stats_valid; /* set if link_stats is valid */
 extern int	link_stats_print; /* set if link_stats is to be printed on link termination */
 extern int	log_to_fd;	/* logging to this fd as well as syslog */
 extern bool	log_default;	/* log_to_fd is default (stdout) */
+extern int	trace_fd;	/* fd of the binary packet trace file */
+extern int	trace_kbytes;	/* size of the trace ring in kilobytes */
+extern int	pppdb_hash_size; /* hash chains when creating the ppp database */
 extern char	*no_ppp_msg;	/* message to print if ppp not in kernel */
 extern bool	devnam_fixed;	/* can no longer change devnam */
 extern int	unsuccess;	/* # unsuccessful connection attempts */
@@ -168,6 +171,7 @@ extern bool	updetach;	/* Detach from controlling tty when link up */
 extern bool	master_detach;	/* Detach when multilink master without link (options.c) */
 extern char	*initializer;	/* Script to initialize physical link */
 extern char	*connect_script; /* Script to establish physical link */
+extern char	*connect_chat;	/* Chat script to establish physical link */
 extern char	*disconnect_script; /* Script to disestablish physical link */
 extern char	*welcomer;	/* Script to welcome client after connection */
 extern char	*ptycommand;	/* Command to run on other side of pty */
@@ -211,6 +215,7 @@ extern char	req_vrf[];	/* VRF name to bind with PPP interface */
 extern bool	multilink;	/* enable multilink operation (options.c) */
 extern bool	noendpoint;	/* don't send or accept endpt. discrim. */
 extern char	*bundle_name;	/* bundle name for multilink */
+extern bool	multilink_registry; /* find bundles in the shared registry */
 extern bool	dump_options;	/* print out option values */
 extern bool	show_options;	/* show all option names and descriptions */
 extern bool	dryrun;		/* check everything, print options, exit */
@@ -256,6 +261,7 @@ typedef enum {
 extern unsigned int        maxoctets;           /* Maximum octetes per session (in bytes) */
 extern session_limit_dir_t maxoctets_dir;       /* Direction */
 extern int                 maxoctets_timeout;   /* Timeout for check of octets limit */
+extern int                 stats_cache_ms;      /* Max age of cached link stats (ms) */
 
 #ifdef PPP_WITH_FILTER
 extern struct	bpf_program pass_filter;   /* Filter for pkts to pass */
@@ -328,6 +334,8 @@ const char *protocol_name(int);
 void remove_pidfiles(void);
 void lock_db(void);
 void unlock_db(void);
+int  signal_wait_start(void); /* fd to poll for signals outside the loop */
+void signal_wait_end(void);
 
 /* Procedures exported from tty.c. */
 void tty_init(void);
@@ -337,6 +345,10 @@ void print_string(char *, int,  printer_func, void *);
 ssize_t complete_read(int, void *, size_t);
 				/* read a complete buffer */
 
+/* Procedures exported from trace.c. */
+void trace_packet(int, unsigned char *, int);
+				/* Append a frame to the trace file */
+
 /* Procedures exported from auth.c */
 void link_required(int);	  /* we are starting to use the link */
 void start_link(int);	  /* bring the link up now */
@@ -362,6 +374,8 @@ void auth_check_options(void);
 void auth_reset(int);	/* check what secrets we have */
 int  check_passwd(int, char *, int, char *, int, char **);
 				/* Check peer-supplied username/password */
+int  check_passwd_done(int, int, struct wordlist *, struct wordlist *);
+				/* Apply result of a deferred PAP check */
 int  get_secret(int, char *, char *, char *, int *, int);
 				/* get "secret" for chap */
 int  auth_ip_addr(int, u_int32_t);
@@ -223,9 +223,10 @@ struct channel {
 	void (*process_extra_options)(void);
 	/* check all the options that have been given */
 	void (*check_options)(void);
-	/* get the channel ready to do PPP, return a file descriptor */
+	/* get the channel ready to do PPP, return a file descriptor,
+	   or CONNECT_PENDING and call ppp_link_connected() later */
 	int  (*connect)(void);
-	/* we're finished with the channel */
+	/* we're finished with the channel, or with a pending connect */
 	void (*disconnect)(void);
 	/* put the channel into PPP `mode' */
 	int  (*establish_ppp)(int);
@@ -243,6 +244,19 @@ struct channel {
 
 extern struct channel *the_channel;
 
+/*
+ * Returned by a channel's connect to say that it is still connecting,
+ * from the event loop, and will call ppp_link_connected() with the file
+ * descriptor, or -1 if it failed, when it has finished.  If the link is
+ * closed before then, the channel's disconnect is called instead.
+ */
+#define CONNECT_PENDING	(-2)
+
+/*
+ * Carry on bringing the link up once a pending connect has finished.
+ */
+void ppp_link_connected(int fd);
+
 
 /*
  * Functions for string formatting and debugging
@@ -343,6 +357,14 @@ void ppp_timeout(ppp_timer_cb func, void *arg, int s, int us);
  */
 void ppp_untimeout(void (*func)(void *), void *arg);
 
+/*
+ * As ppp_timeout, but returns a handle which cancels just that callback
+ * when passed to ppp_untimeout_handle.  Stale handles are ignored.
+ */
+typedef uint64_t ppp_timer_t;
+ppp_timer_t ppp_timeout_handle(ppp_timer_cb func, void *arg, int s, int us);
+void ppp_untimeout_handle(ppp_timer_t handle);
+
 /*
  * Clean up in a child before execing
  */
@@ -570,6 +592,9 @@ extern void (*snoop_send_hook)(unsigned char *p, int len);
 /* mechanism to setup event handlers */
 typedef void (*event_cb)(int fd, void* ctx); /* callback signature */
 void add_fd_callback(int, event_cb, void*); /* add fd with callback */
+void add_fd_callback_flags(int, event_cb, void*, int);
+				/* add fd with callback and EVENT_* flags */
+#define EVENT_EDGE	0x1	/* edge-triggered, cb must read until EAGAIN */
 void remove_fd(int);	/* Remove fd from set to wait for */
 
 /* route management, be sure that prefix points to a correct buffer */
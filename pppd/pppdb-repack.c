@@ -0,0 +1,243 @@
+/*
+ * pppdb-repack - rebuild the pppd database with a new hash size.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Usage:
+ *	pppdb-repack [-f] [-n] [-s hash-size] [file]
+ *
+ * Copies every record of the database (by default pppd's own) into a
+ * new one made with the current hash function and the given number of
+ * hash chains, or a number suited to the records present, then renames
+ * the new database over the old one.  The database must not be in
+ * use: records stored while the copy is made may be lost, and a pppd
+ * that has the old database open carries on using it.  So unless -f is
+ * given, it refuses to run while the database has a pppd<pid> entry
+ * for a process that is still alive.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pppd-private.h"
+#include "tdb.h"
+#include "pathnames.h"
+
+char *progname;		/* declared in pppd-private.h */
+static int copy_failed;
+
+static const char *
+hash_name(unsigned kind)
+{
+    switch (kind) {
+    case TDB_HASH_GDBM:
+	return "gdbm";
+    case TDB_HASH_OAT:
+	return "one-at-a-time";
+    }
+    return "unknown";
+}
+
+static void
+log_tdb(TDB_CONTEXT *tdb, int level, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (level > 0)
+	return;
+    fprintf(stderr, "%s: ", progname);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * tdb.c only calls this to make pppd's run directory; the new
+ * database goes next to the old one, which must already exist.
+ */
+int
+mkdir_recursive(const char *path)
+{
+    errno = ENOENT;
+    return -1;
+}
+
+static int
+copy_record(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, void *arg)
+{
+    TDB_CONTEXT *dst = arg;
+
+    if (tdb_store(dst, key, dbuf, TDB_INSERT) != 0) {
+	fprintf(stderr, "%s: couldn't copy a record: %s\n", progname,
+		tdb_errorstr(dst));
+	copy_failed = 1;
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * find_live_pppd - note in *arg the pid of a pppd<pid> entry whose
+ * process is still running, and stop there.
+ */
+static int
+find_live_pppd(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, void *arg)
+{
+    char buf[16];
+    int i, pid;
+
+    if (key.dsize <= 4 || key.dsize >= sizeof(buf)
+	|| memcmp(key.dptr, "pppd", 4) != 0)
+	return 0;
+    for (i = 4; i < key.dsize; ++i)
+	if (!isdigit((unsigned char) key.dptr[i]))
+	    return 0;
+    memcpy(buf, key.dptr + 4, key.dsize - 4);
+    buf[key.dsize - 4] = 0;
+    pid = atoi(buf);
+    if (pid <= 0 || (kill(pid, 0) < 0 && errno != EPERM))
+	return 0;
+    *(int *) arg = pid;
+    return 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-f] [-n] [-s hash-size] [file]\n", progname);
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *name = PPP_PATH_PPPDB;
+    char *tmpname;
+    TDB_CONTEXT *src, *dst;
+    struct stat st;
+    int c, count, hash_size = 0, dry_run = 0, force = 0, live = 0;
+
+    progname = argv[0];
+    while ((c = getopt(argc, argv, "fns:")) != -1) {
+	switch (c) {
+	case 'f':
+	    force = 1;
+	    break;
+	case 'n':
+	    dry_run = 1;
+	    break;
+	case 's':
+	    hash_size = atoi(optarg);
+	    if (hash_size <= 0)
+		usage();
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind < argc - 1)
+	usage();
+    if (optind < argc)
+	name = argv[optind];
+
+    src = tdb_open_ex(name, 0, 0, O_RDWR, 0, log_tdb, NULL);
+    if (src == NULL) {
+	fprintf(stderr, "%s: couldn't open %s: %s\n", progname, name,
+		strerror(errno));
+	exit(1);
+    }
+    count = tdb_traverse(src, NULL, NULL);
+    if (count < 0) {
+	fprintf(stderr, "%s: couldn't read %s: %s\n", progname, name,
+		tdb_errorstr(src));
+	exit(1);
+    }
+    if (hash_size == 0)
+	hash_size = tdb_hash_size(count);
+    printf("%s: %d records, %u chains (%s hash) -> %d chains (%s hash)\n",
+	   name, count, src->header.hash_size,
+	   hash_name(src->header.hash_kind), hash_size,
+	   hash_name(TDB_HASH_OAT));
+    if (dry_run)
+	exit(0);
+
+    if (!force && tdb_traverse(src, find_live_pppd, &live) >= 0 && live) {
+	fprintf(stderr, "%s: %s is in use by pppd (pid %d); stop it first,"
+		" or give -f\n", progname, name, live);
+	exit(1);
+    }
+
+    if (fstat(src->fd, &st) < 0) {
+	perror("fstat");
+	exit(1);
+    }
+    if ((tmpname = malloc(strlen(name) + 8)) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", progname);
+	exit(1);
+    }
+    sprintf(tmpname, "%s.repack", name);
+    unlink(tmpname);
+    dst = tdb_open_ex(tmpname, hash_size, 0, O_RDWR | O_CREAT | O_EXCL,
+		      st.st_mode & 07777, log_tdb, NULL);
+    if (dst == NULL) {
+	fprintf(stderr, "%s: couldn't create %s: %s\n", progname, tmpname,
+		strerror(errno));
+	exit(1);
+    }
+    if (fchown(dst->fd, st.st_uid, st.st_gid) < 0 && errno != EPERM)
+	perror("fchown");
+
+    if (tdb_traverse(src, copy_record, dst) < 0 || copy_failed) {
+	if (!copy_failed)
+	    fprintf(stderr, "%s: couldn't read %s: %s\n", progname, name,
+		    tdb_errorstr(src));
+	unlink(tmpname);
+	exit(1);
+    }
+    if (fsync(dst->fd) < 0 || tdb_close(dst) != 0) {
+	fprintf(stderr, "%s: couldn't write %s: %s\n", progname, tmpname,
+		strerror(errno));
+	unlink(tmpname);
+	exit(1);
+    }
+    if (rename(tmpname, name) < 0) {
+	fprintf(stderr, "%s: couldn't rename %s to %s: %s\n", progname,
+		tmpname, name, strerror(errno));
+	unlink(tmpname);
+	exit(1);
+    }
+    tdb_close(src);
+    return 0;
+}
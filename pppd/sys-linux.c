@@ -1856,6 +1856,8 @@ get_ppp_stats_rtnetlink(int u, struct pppd_stats *stats)
 {
 #ifdef RTM_NEWSTATS
     static int fd = -1;
+    static unsigned int ifindex;
+    static char ifindex_name[IFNAMSIZ];
 
     struct {
         struct nlmsghdr nlh;
@@ -1872,17 +1874,29 @@ get_ppp_stats_rtnetlink(int u, struct pppd_stats *stats)
         } stats;
     } nlresp_data;
     size_t nlresp_size;
-    int resp;
+    int resp, cached;
+
+    /* if_nametoindex() costs a socket and an ioctl, so remember it */
+    cached = ifindex != 0 && strcmp(ifindex_name, ifname) == 0;
+    if (!cached) {
+	ifindex = if_nametoindex(ifname);
+	strlcpy(ifindex_name, ifname, sizeof(ifindex_name));
+    }
 
     memset(&nlreq, 0, sizeof(nlreq));
     nlreq.nlh.nlmsg_len = sizeof(nlreq);
     nlreq.nlh.nlmsg_type = RTM_GETSTATS;
     nlreq.nlh.nlmsg_flags = NLM_F_REQUEST;
-    nlreq.ifsm.ifindex = if_nametoindex(ifname);
+    nlreq.ifsm.ifindex = ifindex;
     nlreq.ifsm.filter_mask = IFLA_STATS_LINK_64;
 
     nlresp_size = sizeof(nlresp_data);
     resp = rtnetlink_msg("RTM_GETSTATS/NLM_F_REQUEST", &fd, &nlreq, sizeof(nlreq), &nlresp_data, &nlresp_size, RTM_NEWSTATS);
+    if (resp && cached) {
+	/* the interface may have been recreated under the same name */
+	ifindex = 0;
+	return get_ppp_stats_rtnetlink(u, stats);
+    }
     if (resp) {
         errno = (resp < 0) ? -resp : EINVAL;
         if (kernel_version >= KVERSION(4,7,0))
@@ -1904,6 +1918,7 @@ get_ppp_stats_rtnetlink(int u, struct pppd_stats *stats)
 err:
     close(fd);
     fd = -1;
+    ifindex = 0;
 #endif
     return 0;
 }
@@ -1911,49 +1926,80 @@ err:
 /********************************************************************
  * get_ppp_stats_sysfs - return statistics for the link, using the files in sysfs,
  * this provides native 64-bit counters.
+ *
+ * The files are kept open and re-read from the start on each call; they
+ * are reopened once if that fails, e.g. because the interface has been
+ * recreated under the same name.
  */
+static struct {
+    const char* fname;
+    size_t offset;
+    unsigned size;
+    int fd;
+} sysfs_stats[] = {
+#define statfield(fn, field)	{ .fname = #fn, .offset = offsetof(struct pppd_stats, field), \
+				  .size = sizeof(((struct pppd_stats *)0)->field), .fd = -1 }
+    statfield(rx_bytes, bytes_in),
+    statfield(tx_bytes, bytes_out),
+    statfield(rx_packets, pkts_in),
+    statfield(tx_packets, pkts_out),
+#undef statfield
+};
+static char sysfs_stats_ifname[IFNAMSIZ];
+
+static void
+close_ppp_stats_sysfs(void)
+{
+    for (int i = 0; i < sizeof(sysfs_stats) / sizeof(*sysfs_stats); ++i) {
+	if (sysfs_stats[i].fd >= 0)
+	    close(sysfs_stats[i].fd);
+	sysfs_stats[i].fd = -1;
+    }
+}
+
 static int
 get_ppp_stats_sysfs(int u, struct pppd_stats *stats)
 {
     char fname[PATH_MAX+1];
     char buf[21], *err; /* 2^64 < 10^20 */
-    int blen, fd, rlen;
+    int blen, rlen, reopened = 0;
     unsigned long long val;
+    void *ptr;
 
-    struct {
-	const char* fname;
-	void* ptr;
-	unsigned size;
-    } slist[] = {
-#define statfield(fn, field)	{ .fname = #fn, .ptr = &stats->field, .size = sizeof(stats->field) }
-	statfield(rx_bytes, bytes_in),
-	statfield(tx_bytes, bytes_out),
-	statfield(rx_packets, pkts_in),
-	statfield(tx_packets, pkts_out),
-#undef statfield
-    };
+    if (strcmp(sysfs_stats_ifname, ifname) != 0) {
+	close_ppp_stats_sysfs();
+	strlcpy(sysfs_stats_ifname, ifname, sizeof(sysfs_stats_ifname));
+    }
 
     blen = snprintf(fname, sizeof(fname), "/sys/class/net/%s/statistics/", ifname);
     if (blen >= sizeof(fname))
 	return 0; /* ifname max 15, so this should be impossible */
 
-    for (int i = 0; i < sizeof(slist) / sizeof(*slist); ++i) {
-	if (snprintf(fname + blen, sizeof(fname) - blen, "%s", slist[i].fname) >= sizeof(fname) - blen) {
+    for (int i = 0; i < sizeof(sysfs_stats) / sizeof(*sysfs_stats); ++i) {
+	if (snprintf(fname + blen, sizeof(fname) - blen, "%s", sysfs_stats[i].fname) >= sizeof(fname) - blen) {
 	    fname[blen] = 0;
-	    error("sysfs stats: filename %s/%s overflowed PATH_MAX", fname, slist[i].fname);
+	    error("sysfs stats: filename %s/%s overflowed PATH_MAX", fname, sysfs_stats[i].fname);
 	    return 0;
 	}
 
-	fd = open(fname, O_RDONLY);
-	if (fd < 0) {
-	    error("%s: %m", fname);
-	    return 0;
+	if (sysfs_stats[i].fd < 0) {
+	    sysfs_stats[i].fd = open(fname, O_RDONLY | O_CLOEXEC);
+	    if (sysfs_stats[i].fd < 0) {
+		error("%s: %m", fname);
+		return 0;
+	    }
 	}
 
-	rlen = read(fd, buf, sizeof(buf) - 1);
-	close(fd);
+	rlen = pread(sysfs_stats[i].fd, buf, sizeof(buf) - 1, 0);
+	if (rlen <= 0 && !reopened) {
+	    close_ppp_stats_sysfs();
+	    reopened = 1;
+	    i = -1;
+	    continue;
+	}
 	if (rlen < 0) {
 	    error("%s: %m", fname);
+	    close_ppp_stats_sysfs();
 	    return 0;
 	}
 	/* trim trailing \n if present */
@@ -1968,15 +2014,16 @@ get_ppp_stats_sysfs(int u, struct pppd_stats *stats)
 		    buf, fname, err, errno ? ": " : "", errno ? strerror(errno) : "");
 	    return 0;
 	}
-	switch (slist[i].size) {
-#define stattype(type)	case sizeof(type): *(type*)slist[i].ptr = (type)val; break
+	ptr = (char *)stats + sysfs_stats[i].offset;
+	switch (sysfs_stats[i].size) {
+#define stattype(type)	case sizeof(type): *(type*)ptr = (type)val; break
 	    stattype(uint64_t);
 	    stattype(uint32_t);
 	    stattype(uint16_t);
 	    stattype(uint8_t);
 #undef stattype
 	default:
-	    error("Don't know how to store stats for %s of size %u", slist[i].fname, slist[i].size);
+	    error("Don't know how to store stats for %s of size %u", sysfs_stats[i].fname, sysfs_stats[i].size);
 	    return 0;
 	}
     }
@@ -2002,35 +2049,62 @@ ppp_stats_poller(void* u)
 
 /********************************************************************
  * get_ppp_stats - return statistics for the link.
+ *
+ * LCP adaptive echoes, the traffic limit check, the link statistics at
+ * termination and plugins such as radius all ask for these, often in
+ * the same tick, so a snapshot is kept and handed out again for up to
+ * stats_cache_ms milliseconds instead of querying the kernel each time.
+ * The snapshot is only good for the same unit under the same name, so
+ * that a renamed interface or a reused unit never gets another's.
  */
 int get_ppp_stats(int u, struct pppd_stats *stats)
 {
     static int (*func)(int, struct pppd_stats*) = NULL;
+    static struct pppd_stats snapshot;
+    static struct timeval snapshot_time;
+    static int snapshot_unit = -1;
+    static char snapshot_ifname[IFNAMSIZ];
+    struct timeval now;
+    int ok;
+
+    if (stats_cache_ms > 0 && snapshot_unit == u
+	&& strcmp(snapshot_ifname, ifname) == 0
+	&& ppp_get_time(&now) >= 0
+	&& (now.tv_sec - snapshot_time.tv_sec) * 1000
+	   + (now.tv_usec - snapshot_time.tv_usec) / 1000 < stats_cache_ms) {
+	*stats = snapshot;
+	return 1;
+    }
 
-    if (!func) {
-	if (kernel_version < KVERSION(3, 8, 0)) {
-	    /* In kernel versions prior to 3.8 pppstat in kernel was
-	     * forced to __u32, so just use the IOCTL mechanism which
-	     * will track wrap-around */
-	    func = get_ppp_stats_ioctl;
-	    TIMEOUT(ppp_stats_poller, (void*)(long)u, 25);
-	    return func(u, stats);
-	}
-
-	if (get_ppp_stats_rtnetlink(u, stats)) {
-	    func = get_ppp_stats_rtnetlink;
-	    return 1;
-	}
-	if (get_ppp_stats_sysfs(u, stats)) {
-	    func = get_ppp_stats_sysfs;
-	    return 1;
-	}
+    if (func) {
+	ok = func(u, stats);
+    } else if (kernel_version < KVERSION(3, 8, 0)) {
+	/* In kernel versions prior to 3.8 pppstat in kernel was
+	 * forced to __u32, so just use the IOCTL mechanism which
+	 * will track wrap-around */
+	func = get_ppp_stats_ioctl;
+	TIMEOUT(ppp_stats_poller, (void*)(long)u, 25);
+	ok = func(u, stats);
+    } else if (get_ppp_stats_rtnetlink(u, stats)) {
+	func = get_ppp_stats_rtnetlink;
+	ok = 1;
+    } else if (get_ppp_stats_sysfs(u, stats)) {
+	func = get_ppp_stats_sysfs;
+	ok = 1;
+    } else {
 	warn("statistics falling back to ioctl which only supports 32-bit counters");
 	func = get_ppp_stats_ioctl;
 	TIMEOUT(ppp_stats_poller, (void*)(long)u, 25);
+	ok = func(u, stats);
     }
 
-    return func(u, stats);
+    snapshot_unit = -1;
+    if (ok && ppp_get_time(&snapshot_time) >= 0) {
+	snapshot = *stats;
+	snapshot_unit = u;
+	strlcpy(snapshot_ifname, ifname, sizeof(snapshot_ifname));
+    }
+    return ok;
 }
 
 /********************************************************************
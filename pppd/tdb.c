@@ -74,6 +74,7 @@
 #define TDB_ALIGNMENT 4
 #define MIN_REC_SIZE (2*sizeof(struct list_struct) + TDB_ALIGNMENT)
 #define DEFAULT_HASH_SIZE 131
+#define TDB_FREE_SCAN 8 /* records to try on a size-class freelist */
 #define TDB_PAGE_SIZE 0x2000
 #define FREELIST_TOP (sizeof(struct tdb_header))
 #define TDB_ALIGN(x,a) (((x) + (a)-1) & ~((a)-1))
@@ -172,7 +173,9 @@ static void *convert(void *buf, u32 size)
 struct list_struct {
 	tdb_off next; /* offset of the next record in the list */
 	tdb_len rec_len; /* total byte length of record */
-	tdb_len key_len; /* byte length of key */
+	tdb_len key_len; /* byte length of key; in a free record on a
+			    size-class list, the offset of the pointer to
+			    it (the list head or the previous record) */
 	tdb_len data_len; /* byte length of data */
 	u32 full_hash; /* the full 32 bit hash of the key */
 	u32 magic;   /* try to catch errors */
@@ -483,20 +486,75 @@ static int update_tailer(TDB_CONTEXT *tdb, tdb_off offset,
 			 &totalsize);
 }
 
+/* the freelist for free records of rec_len len */
+static int free_class(TDB_CONTEXT *tdb, tdb_len len)
+{
+	int c;
+
+	if (tdb->header.free_classes == 0)
+		return 0;
+	for (c = 1; c < TDB_FREE_CLASSES; c++)
+		if (len < (64U << (c-1)))
+			return c;
+	return 0;
+}
+
+/* the offset of the head of a freelist */
+static tdb_off free_top(int c)
+{
+	if (c == 0)
+		return FREELIST_TOP;
+	return offsetof(struct tdb_header, freelist) + (c-1)*sizeof(tdb_off);
+}
+
+/* unlink the free record after the pointer at last_ptr.  Must have
+   alloc lock. */
+static int unlink_free(TDB_CONTEXT *tdb, tdb_off last_ptr,
+		       const struct list_struct *rec)
+{
+	tdb_off next = rec->next;
+
+	if (ofs_write(tdb, last_ptr, &next) == -1)
+		return -1;
+	if (tdb->header.free_classes && next
+	    && ofs_write(tdb, next + offsetof(struct list_struct, key_len),
+			 &last_ptr) == -1)
+		return -1;
+	return 0;
+}
+
 /* Remove an element from the freelist.  Must have alloc lock. */
-static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off, tdb_off next)
+static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off,
+				const struct list_struct *rec)
 {
 	tdb_off last_ptr, i;
+	int c, pass;
+
+	/* with size classes the record says where it is linked from:
+	   a list head in the header or the record before it */
+	if (tdb->header.free_classes) {
+		last_ptr = rec->key_len;
+		if (last_ptr >= offsetof(struct tdb_header, freelist)
+		    && last_ptr < tdb->map_size
+		    && ofs_read(tdb, last_ptr, &i) != -1 && i == off)
+			return unlink_free(tdb, last_ptr, rec);
+	}
 
-	/* read in the freelist top */
-	last_ptr = FREELIST_TOP;
-	while (ofs_read(tdb, last_ptr, &i) != -1 && i != 0) {
-		if (i == off) {
-			/* We've found it! */
-			return ofs_write(tdb, last_ptr, &next);
+	/* otherwise (or if it is wrong) look for it on its list, and on
+	   the list at the top, where old versions put everything */
+	c = free_class(tdb, rec->rec_len);
+	for (pass = 0; pass < 2; pass++, c = 0) {
+		last_ptr = free_top(c);
+		while (ofs_read(tdb, last_ptr, &i) != -1 && i != 0) {
+			if (i == off) {
+				/* We've found it! */
+				return unlink_free(tdb, last_ptr, rec);
+			}
+			/* Follow chain (next offset is at start of record) */
+			last_ptr = i;
 		}
-		/* Follow chain (next offset is at start of record) */
-		last_ptr = i;
+		if (c == 0)
+			break;
 	}
 	TDB_LOG((tdb, 0,"remove_from_freelist: not on list at off=%d\n", off));
 	return TDB_ERRCODE(TDB_ERR_CORRUPT, -1);
@@ -506,7 +564,7 @@ static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off, tdb_off next)
    neccessary. */
 static int tdb_free(TDB_CONTEXT *tdb, tdb_off offset, struct list_struct *rec)
 {
-	tdb_off right, left;
+	tdb_off right, left, top;
 
 	/* Allocation and tailer lock */
 	if (tdb_lock(tdb, -1, F_WRLCK) != 0)
@@ -530,7 +588,7 @@ static int tdb_free(TDB_CONTEXT *tdb, tdb_off offset, struct list_struct *rec)
 
 		/* If it's free, expand to include it. */
 		if (r.magic == TDB_FREE_MAGIC) {
-			if (remove_from_freelist(tdb, right, r.next) == -1) {
+			if (remove_from_freelist(tdb, right, &r) == -1) {
 				TDB_LOG((tdb, 0, "tdb_free: right free failed at %u\n", right));
 				goto left;
 			}
@@ -560,7 +618,7 @@ left:
 
 		/* If it's free, expand to include it. */
 		if (l.magic == TDB_FREE_MAGIC) {
-			if (remove_from_freelist(tdb, left, l.next) == -1) {
+			if (remove_from_freelist(tdb, left, &l) == -1) {
 				TDB_LOG((tdb, 0, "tdb_free: left free failed at %u\n", left));
 				goto update;
 			} else {
@@ -576,12 +634,18 @@ update:
 		goto fail;
 	}
 
-	/* Now, prepend to free list */
+	/* Now, prepend to the free list for its size */
 	rec->magic = TDB_FREE_MAGIC;
+	top = free_top(free_class(tdb, rec->rec_len));
+	if (tdb->header.free_classes)
+		rec->key_len = top;
 
-	if (ofs_read(tdb, FREELIST_TOP, &rec->next) == -1 ||
+	if (ofs_read(tdb, top, &rec->next) == -1 ||
 	    rec_write(tdb, offset, rec) == -1 ||
-	    ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
+	    (tdb->header.free_classes && rec->next &&
+	     ofs_write(tdb, rec->next + offsetof(struct list_struct, key_len),
+		       &offset) == -1) ||
+	    ofs_write(tdb, top, &offset) == -1) {
 		TDB_LOG((tdb, 0, "tdb_free record write failed at offset=%d\n", offset));
 		goto fail;
 	}
@@ -716,6 +780,11 @@ static int tdb_expand(TDB_CONTEXT *tdb, tdb_off size)
    to a unconnected list_struct within the database with room for at
    least length bytes of total data
 
+   With size classes, the list for the length is searched first-fit
+   for a few records, then the head of the first non-empty list of a
+   larger class is taken, as anything on those is big enough, and the
+   list at the top, of the largest records, is searched last.
+
    0 is returned if the space could not be allocated
  */
 static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
@@ -723,6 +792,7 @@ static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
 {
 	tdb_off rec_ptr, last_ptr, newrec_ptr;
 	struct list_struct newrec;
+	int c, first, scan;
 
 	memset(&newrec, '\0', sizeof(newrec));
 
@@ -733,64 +803,28 @@ static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
 	length += sizeof(tdb_off);
 
  again:
-	last_ptr = FREELIST_TOP;
+	first = free_class(tdb, length);
+	for (c = first; ; c = (c + 1) % TDB_FREE_CLASSES) {
+		last_ptr = free_top(c);
 
-	/* read in the freelist top */
-	if (ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		goto fail;
-
-	/* keep looking until we find a freelist record big enough */
-	while (rec_ptr) {
-		if (rec_free_read(tdb, rec_ptr, rec) == -1)
+		/* read in the freelist top */
+		if (ofs_read(tdb, last_ptr, &rec_ptr) == -1)
 			goto fail;
 
-		if (rec->rec_len >= length) {
-			/* found it - now possibly split it up  */
-			if (rec->rec_len > length + MIN_REC_SIZE) {
-				/* Length of left piece */
-				length = TDB_ALIGN(length, TDB_ALIGNMENT);
-
-				/* Right piece to go on free list */
-				newrec.rec_len = rec->rec_len
-					- (sizeof(*rec) + length);
-				newrec_ptr = rec_ptr + sizeof(*rec) + length;
-
-				/* And left record is shortened */
-				rec->rec_len = length;
-			} else
-				newrec_ptr = 0;
-
-			/* Remove allocated record from the free list */
-			if (ofs_write(tdb, last_ptr, &rec->next) == -1)
-				goto fail;
-
-			/* Update header: do this before we drop alloc
-                           lock, otherwise tdb_free() might try to
-                           merge with us, thinking we're free.
-                           (Thanks Jeremy Allison). */
-			rec->magic = TDB_MAGIC;
-			if (rec_write(tdb, rec_ptr, rec) == -1)
+		/* keep looking until we find a freelist record big enough */
+		for (scan = 0; rec_ptr; scan++) {
+			if (c == first && c != 0 && scan == TDB_FREE_SCAN)
+				break;
+			if (rec_free_read(tdb, rec_ptr, rec) == -1)
 				goto fail;
-
-			/* Did we create new block? */
-			if (newrec_ptr) {
-				/* Update allocated record tailer (we
-                                   shortened it). */
-				if (update_tailer(tdb, rec_ptr, rec) == -1)
-					goto fail;
-
-				/* Free new record */
-				if (tdb_free(tdb, newrec_ptr, &newrec) == -1)
-					goto fail;
-			}
-
-			/* all done - return the new record offset */
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return rec_ptr;
+			if (rec->rec_len >= length)
+				goto found;
+			/* move to the next record */
+			last_ptr = rec_ptr;
+			rec_ptr = rec->next;
 		}
-		/* move to the next record */
-		last_ptr = rec_ptr;
-		rec_ptr = rec->next;
+		if (c == 0 || tdb->header.free_classes == 0)
+			break;
 	}
 	/* we didn't find enough space. See if we can expand the
 	   database and if we can then try again */
@@ -799,6 +833,47 @@ static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
  fail:
 	tdb_unlock(tdb, -1, F_WRLCK);
 	return 0;
+
+ found:
+	/* now possibly split it up  */
+	if (rec->rec_len > length + MIN_REC_SIZE) {
+		/* Length of left piece */
+		length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+		/* Right piece to go on free list */
+		newrec.rec_len = rec->rec_len - (sizeof(*rec) + length);
+		newrec_ptr = rec_ptr + sizeof(*rec) + length;
+
+		/* And left record is shortened */
+		rec->rec_len = length;
+	} else
+		newrec_ptr = 0;
+
+	/* Remove allocated record from the free list */
+	if (unlink_free(tdb, last_ptr, rec) == -1)
+		goto fail;
+
+	/* Update header: do this before we drop alloc lock, otherwise
+	   tdb_free() might try to merge with us, thinking we're free.
+	   (Thanks Jeremy Allison). */
+	rec->magic = TDB_MAGIC;
+	if (rec_write(tdb, rec_ptr, rec) == -1)
+		goto fail;
+
+	/* Did we create new block? */
+	if (newrec_ptr) {
+		/* Update allocated record tailer (we shortened it). */
+		if (update_tailer(tdb, rec_ptr, rec) == -1)
+			goto fail;
+
+		/* Free new record */
+		if (tdb_free(tdb, newrec_ptr, &newrec) == -1)
+			goto fail;
+	}
+
+	/* all done - return the new record offset */
+	tdb_unlock(tdb, -1, F_WRLCK);
+	return rec_ptr;
 }
 
 /* initialise a new database with a specified hash size */
@@ -815,6 +890,8 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 	/* Fill in the header */
 	newdb->version = TDB_VERSION;
 	newdb->hash_size = hash_size;
+	newdb->hash_kind = tdb->hash_fn ? TDB_HASH_CUSTOM : TDB_HASH_OAT;
+	newdb->free_classes = TDB_FREE_CLASSES;
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->map_size = size;
 		tdb->map_ptr = (char *)newdb;
@@ -996,8 +1073,9 @@ static int tdb_exists_hash(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash)
 	return 1;
 }
 
-/* record lock stops delete underneath */
-static int lock_record(TDB_CONTEXT *tdb, tdb_off off)
+/* record lock stops delete underneath.  Nothing takes one at present:
+   tdb_traverse() holds the whole chain instead. */
+static int __attribute__((unused)) lock_record(TDB_CONTEXT *tdb, tdb_off off)
 {
 	return off ? tdb_brlock(tdb, off, F_RDLCK, F_SETLKW, 0) : 0;
 }
@@ -1026,7 +1104,7 @@ static int write_unlock_record(TDB_CONTEXT *tdb, tdb_off off)
 	return tdb_brlock(tdb, off, F_UNLCK, F_SETLK, 0);
 }
 /* fcntl locks don't stack: avoid unlocking someone else's */
-static int unlock_record(TDB_CONTEXT *tdb, tdb_off off)
+static int __attribute__((unused)) unlock_record(TDB_CONTEXT *tdb, tdb_off off)
 {
 	struct tdb_traverse_lock *i;
 	u32 count = 0;
@@ -1207,11 +1285,50 @@ static u32 default_tdb_hash(TDB_DATA *key)
 	return (1103515243 * value + 12345);  
 }
 
+/* Bob Jenkins' one-at-a-time hash: every input bit affects every
+   output bit, so keys that differ only in their last digits, like
+   "pppd1234" and "pppd1235", still land in different chains */
+static u32 oat_tdb_hash(TDB_DATA *key)
+{
+	const unsigned char *p = (const unsigned char *)key->dptr;
+	u32 value = 0;
+	size_t i;
+
+	for (i = 0; i < key->dsize; i++) {
+		value += p[i];
+		value += value << 10;
+		value ^= value >> 6;
+	}
+	value += value << 3;
+	value ^= value >> 11;
+	value += value << 15;
+	return value;
+}
+
+/* a hash size for about nrecords records: the smallest of a series of
+   primes that keeps the chains to 4 records or so on average */
+int tdb_hash_size(u32 nrecords)
+{
+	static const int primes[] = {
+		131, 257, 509, 1021, 2039, 4093, 8191, 16381, 32749,
+		65521, 131071, 262139, 524287
+	};
+	int i, n = sizeof(primes) / sizeof(primes[0]);
+
+	for (i = 0; i < n - 1; i++)
+		if (primes[i] >= nrecords / 4)
+			break;
+	return primes[i];
+}
+
 /* open the database, creating it if necessary 
 
    The open_flags and mode are passed straight to the open call on the
    database file. A flags value of O_WRONLY is invalid. The hash size
-   is advisory, use zero for a default value.
+   is advisory, use zero for a default value.  It and the hash function
+   only matter when a new database is made: an existing one keeps the
+   hash size in its header, and unless hash_fn is given, the hash
+   function it was made with.
 
    Return is NULL on error, in which case errno is also set.  Don't 
    try to call tdb_error or tdb_errname, just do strerror(errno).
@@ -1246,7 +1363,7 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 	tdb->flags = tdb_flags;
 	tdb->open_flags = open_flags;
 	tdb->log_fn = log_fn;
-	tdb->hash_fn = hash_fn ? hash_fn : default_tdb_hash;
+	tdb->hash_fn = hash_fn;
 
 	if ((open_flags & O_ACCMODE) == O_WRONLY) {
 		TDB_LOG((tdb, 0, "tdb_open_ex: can't open tdb %s write-only\n",
@@ -1386,6 +1503,22 @@ again:
 	/* Internal (memory-only) databases skip all the code above to
 	 * do with disk files, and resume here by releasing their
 	 * global lock and hooking into the active list. */
+	if (!tdb->hash_fn) {
+		switch (tdb->header.hash_kind) {
+		case TDB_HASH_GDBM:
+			tdb->hash_fn = default_tdb_hash;
+			break;
+		case TDB_HASH_OAT:
+			tdb->hash_fn = oat_tdb_hash;
+			break;
+		default:
+			TDB_LOG((tdb, 0, "tdb_open_ex: "
+				 "unknown hash kind %u in %s\n",
+				 tdb->header.hash_kind, name));
+			errno = EIO;
+			goto fail;
+		}
+	}
 	if (tdb_brlock(tdb, GLOBAL_LOCK, F_UNLCK, F_SETLKW, 0) == -1)
 		goto fail;
 	tdb->next = tdbs;
@@ -1450,6 +1583,52 @@ int tdb_close(TDB_CONTEXT *tdb)
 	return ret;
 }
 
+/* call fn on each record, a chain at a time with that chain
+   read-locked, until it returns non-zero.  fn must not change the
+   database.  Returns the number of records seen, or -1 on error. */
+int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *state)
+{
+	struct list_struct rec;
+	TDB_DATA key, dbuf;
+	tdb_off rec_ptr;
+	char *buf;
+	int count = 0, stop = 0;
+	u32 i;
+
+	for (i = 0; i < tdb->header.hash_size && !stop; i++) {
+		if (tdb_lock(tdb, i, F_RDLCK) == -1)
+			return -1;
+		if (ofs_read(tdb, FREELIST_TOP + (i+1)*sizeof(tdb_off),
+			     &rec_ptr) == -1)
+			goto fail;
+		for (; rec_ptr && !stop; rec_ptr = rec.next) {
+			if (rec_read(tdb, rec_ptr, &rec) == -1)
+				goto fail;
+			if (TDB_DEAD(&rec))
+				continue;
+			count++;
+			if (!fn)
+				continue;
+			buf = tdb_alloc_read(tdb, rec_ptr + sizeof(rec),
+					     rec.key_len + rec.data_len);
+			if (!buf)
+				goto fail;
+			key.dptr = buf;
+			key.dsize = rec.key_len;
+			dbuf.dptr = buf + rec.key_len;
+			dbuf.dsize = rec.data_len;
+			stop = fn(tdb, key, dbuf, state);
+			SAFE_FREE(buf);
+		}
+		tdb_unlock(tdb, i, F_RDLCK);
+	}
+	return count;
+
+ fail:
+	tdb_unlock(tdb, i, F_RDLCK);
+	return -1;
+}
+
 /* lock/unlock one hash chain. This is meant to be used to reduce
    contention - it cannot guarantee how many records will be locked */
 int tdb_chainlock(TDB_CONTEXT *tdb, TDB_DATA key)
@@ -1461,3 +1640,259 @@ int tdb_chainunlock(TDB_CONTEXT *tdb, TDB_DATA key)
 {
 	return tdb_unlock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
 }
+
+#ifdef UNIT_TEST
+
+int debug;
+int error_count;
+int unsuccess;
+
+#define TEST_KEYS	2000
+#define TEST_OPS	60000
+#define TEST_MAX_DATA	6000
+
+/* what each test key should hold: a value made from its key, version
+   and length, or nothing if len is 0 */
+static struct {
+	u32 version;
+	u32 len;
+} model[TEST_KEYS];
+
+static char test_key[32];
+static char test_val[TEST_MAX_DATA];
+
+static unsigned int test_seed = 1;
+
+static u32 test_random(void)
+{
+	test_seed = test_seed * 1103515245 + 12345;
+	return test_seed >> 8;
+}
+
+static TDB_DATA test_record(int k, int with_value)
+{
+	TDB_DATA d;
+	u32 i;
+
+	sprintf(test_key, "key%d", k);
+	if (!with_value) {
+		d.dptr = test_key;
+		d.dsize = strlen(test_key) + 1;
+		return d;
+	}
+	for (i = 0; i < model[k].len; i++)
+		test_val[i] = 'a' + (k + model[k].version + i) % 26;
+	d.dptr = test_val;
+	d.dsize = model[k].len;
+	return d;
+}
+
+/* a value length that lands in each freelist in turn, up to the top */
+static u32 test_length(void)
+{
+	u32 r = test_random();
+
+	return 1 + (r >> 4) % (32U << (r & 7));
+}
+
+/*
+ * check_db - check that every record in the file is whole, that each
+ * free one is on exactly the list for its size, or the top list, and
+ * (if strict) records where it is linked from, and that each hash
+ * chain holds just the records that hash to it.  Returns the number
+ * of problems, after printing them.
+ */
+static int check_db(TDB_CONTEXT *tdb, int strict)
+{
+	struct list_struct rec;
+	tdb_off off, last_ptr, tailer, start;
+	u32 nfree = 0, nlisted = 0, nlive = 0, nchained = 0, h;
+	int c, errors = 0;
+
+	start = TDB_DATA_START(tdb->header.hash_size) + sizeof(tdb_off);
+	for (off = start; off < tdb->map_size;
+	     off += sizeof(rec) + rec.rec_len) {
+		if (tdb_read(tdb, off, &rec, sizeof(rec), DOCONV()) == -1
+		    || off + sizeof(rec) + rec.rec_len > tdb->map_size) {
+			printf("record at %u runs past the end\n", off);
+			return errors + 1;
+		}
+		if (ofs_read(tdb, off + sizeof(rec) + rec.rec_len
+			     - sizeof(tdb_off), &tailer) == -1
+		    || tailer != sizeof(rec) + rec.rec_len) {
+			printf("record at %u has tailer %u, not %u\n", off,
+			       tailer, (u32) sizeof(rec) + rec.rec_len);
+			errors++;
+		}
+		if (rec.magic == TDB_FREE_MAGIC)
+			nfree++;
+		else if (rec.magic == TDB_MAGIC)
+			nlive++;
+		else if (!TDB_DEAD(&rec)) {
+			printf("record at %u has bad magic 0x%x\n", off,
+			       rec.magic);
+			return errors + 1;
+		}
+	}
+	if (off != tdb->map_size) {
+		printf("records end at %u, file at %u\n", off, tdb->map_size);
+		errors++;
+	}
+
+	for (c = 0; c < TDB_FREE_CLASSES; c++) {
+		last_ptr = free_top(c);
+		while (ofs_read(tdb, last_ptr, &off) != -1 && off != 0) {
+			if (++nlisted > nfree) {
+				printf("freelist %d has a loop or live records\n",
+				       c);
+				return errors + 1;
+			}
+			if (tdb_read(tdb, off, &rec, sizeof(rec), DOCONV()) == -1)
+				return errors + 1;
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("record at %u on freelist %d is not free\n",
+				       off, c);
+				return errors + 1;
+			}
+			if (c != 0 && free_class(tdb, rec.rec_len) != c) {
+				printf("record of %u bytes on freelist %d\n",
+				       rec.rec_len, c);
+				errors++;
+			}
+			if (strict && rec.key_len != last_ptr) {
+				printf("record at %u says it is linked from %u,"
+				       " not %u\n", off, rec.key_len, last_ptr);
+				errors++;
+			}
+			last_ptr = off;
+		}
+	}
+	if (nlisted != nfree) {
+		printf("%u free records but %u on freelists\n", nfree, nlisted);
+		errors++;
+	}
+
+	for (h = 0; h < tdb->header.hash_size; h++) {
+		last_ptr = TDB_HASH_TOP(h);
+		while (ofs_read(tdb, last_ptr, &off) != -1 && off != 0) {
+			if (tdb_read(tdb, off, &rec, sizeof(rec), DOCONV()) == -1)
+				return errors + 1;
+			if (++nchained > nlive || TDB_BAD_MAGIC(&rec)) {
+				printf("hash chain %u is corrupt at %u\n", h, off);
+				return errors + 1;
+			}
+			if (BUCKET(rec.full_hash) != h) {
+				printf("record at %u is on chain %u, not %u\n",
+				       off, h, BUCKET(rec.full_hash));
+				errors++;
+			}
+			last_ptr = off;
+		}
+	}
+	return errors;
+}
+
+/* check that every key holds what it should */
+static int check_contents(TDB_CONTEXT *tdb)
+{
+	TDB_DATA d, want;
+	int k, errors = 0;
+
+	for (k = 0; k < TEST_KEYS; k++) {
+		d = tdb_fetch(tdb, test_record(k, 0));
+		want = test_record(k, 1);
+		if (model[k].len == 0 ? d.dptr != NULL
+		    : d.dptr == NULL || d.dsize != want.dsize
+		      || memcmp(d.dptr, want.dptr, want.dsize) != 0) {
+			printf("key%d holds the wrong value\n", k);
+			errors++;
+		}
+		SAFE_FREE(d.dptr);
+	}
+	return errors;
+}
+
+/* store, replace and delete records of all sizes at random */
+static int churn(TDB_CONTEXT *tdb, int ops)
+{
+	int i, k;
+
+	for (i = 0; i < ops; i++) {
+		k = test_random() % TEST_KEYS;
+		if (model[k].len != 0 && test_random() % 3 == 0) {
+			model[k].len = 0;
+			if (tdb_delete(tdb, test_record(k, 0)) != 0) {
+				printf("tdb_delete key%d: %s\n", k,
+				       tdb_errorstr(tdb));
+				return -1;
+			}
+			continue;
+		}
+		model[k].version++;
+		model[k].len = test_length();
+		if (tdb_store(tdb, test_record(k, 0), test_record(k, 1),
+			      TDB_REPLACE) != 0) {
+			printf("tdb_store key%d: %s\n", k, tdb_errorstr(tdb));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int test_freelists(int free_classes)
+{
+	char path[] = "/tmp/tdb_utest.XXXXXX";
+	TDB_CONTEXT *tdb;
+	int fd, errors = 0;
+
+	memset(model, 0, sizeof(model));
+	if ((fd = mkstemp(path)) < 0)
+		return 1;
+	close(fd);
+	tdb = tdb_open(path, 131, 0, O_RDWR | O_CREAT, 0600);
+	if (tdb == NULL) {
+		unlink(path);
+		return 1;
+	}
+	/* as if an older pppd were using the database */
+	tdb->header.free_classes = free_classes;
+
+	errors += churn(tdb, TEST_OPS) != 0;
+	errors += check_db(tdb, free_classes != 0);
+	errors += check_contents(tdb);
+
+	if (free_classes != 0) {
+		/* an older pppd puts everything it frees on the top
+		   list and leaves the pointers back stale; see that
+		   the lists by size cope with what it leaves */
+		tdb->header.free_classes = 0;
+		errors += churn(tdb, TEST_OPS / 4) != 0;
+		tdb->header.free_classes = free_classes;
+		errors += churn(tdb, TEST_OPS) != 0;
+		errors += check_db(tdb, 0);
+		errors += check_contents(tdb);
+	}
+
+	tdb_close(tdb);
+	unlink(path);
+	return errors;
+}
+
+int main(void)
+{
+	int failure = 0;
+
+	if (test_freelists(TDB_FREE_CLASSES)) {
+		printf("Freelists by size are corrupt after churn\n");
+		failure++;
+	}
+
+	if (test_freelists(0)) {
+		printf("The single freelist is corrupt after churn\n");
+		failure++;
+	}
+
+	return failure;
+}
+
+#endif /* UNIT_TEST */
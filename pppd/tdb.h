@@ -78,15 +78,27 @@ typedef struct {
 typedef u32 tdb_len;
 typedef u32 tdb_off;
 
+/* free records are kept on lists by size: below 64 bytes, below 128
+   and so on up to 4k, and on the list at FREELIST_TOP above that */
+#define TDB_FREE_CLASSES 8
+
 /* this is stored at the front of every database */
 struct tdb_header {
 	char magic_food[32]; /* for /etc/magic */
 	u32 version; /* version of the code */
 	u32 hash_size; /* number of hash entries */
 	tdb_off rwlocks;
-	tdb_off reserved[31];
+	u32 hash_kind; /* TDB_HASH_* used to place keys in chains */
+	u32 free_classes; /* number of freelists, 0 for just FREELIST_TOP */
+	tdb_off freelist[TDB_FREE_CLASSES-1]; /* heads of the others */
+	tdb_off reserved[30-TDB_FREE_CLASSES];
 };
 
+/* values of hash_kind */
+#define TDB_HASH_GDBM 0 /* the original hash, in databases made before 2.5.4 */
+#define TDB_HASH_OAT 1 /* Jenkins one-at-a-time, for new databases */
+#define TDB_HASH_CUSTOM 0xff /* given to tdb_open_ex() by the creator */
+
 struct tdb_lock_type {
 	u32 count;
 	u32 ltype;
@@ -135,6 +147,8 @@ TDB_DATA tdb_fetch(TDB_CONTEXT *tdb, TDB_DATA key);
 int tdb_delete(TDB_CONTEXT *tdb, TDB_DATA key);
 int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag);
 int tdb_close(TDB_CONTEXT *tdb);
+int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *state);
+int tdb_hash_size(u32 nrecords);
 int tdb_lockkeys(TDB_CONTEXT *tdb, u32 number, TDB_DATA keys[]);
 void tdb_unlockkeys(TDB_CONTEXT *tdb);
 
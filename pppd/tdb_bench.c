@@ -0,0 +1,340 @@
+/*
+ * tdb_bench.c - measure store and fetch latency in a ppp database
+ * holding the records of a busy concentrator.
+ *
+ * Fills a new database with 50000 records shaped like those pppd
+ * keeps (a "pppd<pid>" entry holding the session's environment, and
+ * IFNAME=, BUNDLE= and PPPD_PID= keys pointing back at it), then times
+ * fetching every key in a scattered order and rewriting the entries as
+ * pppd does when the session's state changes.  Done with the old gdbm
+ * hash in 131 chains, as pppd used to create the database, and with
+ * the one-at-a-time hash in 131 chains, in pppd's default number and
+ * in the number tdb_hash_size() picks for 50000 records.
+ *
+ * Then churns the sessions, as months of users coming and going do:
+ * each step deletes the records of one session and stores those of a
+ * new one, its environment record stored again once it grows, while
+ * small records left free between long-lived ones stay unused.  The
+ * store and delete latencies are printed after each 25000 sessions,
+ * with freelists by size and with the single freelist of older
+ * databases.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pppd-private.h"
+#include "tdb.h"
+
+#define RECORDS		50000
+#define KEYS_PER_SESSION 4
+#define SESSIONS	(RECORDS / KEYS_PER_SESSION)
+#define PPPDB_HASH_SIZE	8191	/* default of pppdb_hash_size in main.c */
+#define CHURN_ROUNDS	4
+#define CHURN_SESSIONS	25000	/* sessions replaced per round */
+#define CHURN_HOLES	20000	/* small free records that outlive them */
+
+static char keys[RECORDS][32];
+static char vals[RECORDS][256];
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, " (errno %d)\n", errno);
+    exit(1);
+}
+
+int
+mkdir_recursive(const char *path)
+{
+    errno = ENOENT;
+    return -1;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the hash pppd's database used before the hash kind was recorded */
+static u32
+gdbm_hash(TDB_DATA *key)
+{
+    u32 value, i;
+
+    for (value = 0x238F13AF * key->dsize, i = 0; i < key->dsize; i++)
+	value = (value + (key->dptr[i] << (i*5 % 24)));
+    return (1103515243 * value + 12345);
+}
+
+static void
+make_records(void)
+{
+    int i, n, pid;
+
+    for (i = 0; i < SESSIONS; ++i) {
+	n = i * KEYS_PER_SESSION;
+	pid = 2000 + i;
+	sprintf(keys[n], "pppd%d", pid);
+	sprintf(vals[n], "PPPD_PID=%d;IFNAME=ppp%d;DEVICE=eth1;"
+		"PPPLOGNAME=root;ORIG_UID=0;BUNDLE=\"user%d\";"
+		"IPLOCAL=10.0.0.1;IPREMOTE=10.%d.%d.%d;"
+		"CONNECT_TIME=%d;BYTES_SENT=%d;BYTES_RCVD=%d;",
+		pid, i, i, (i >> 16) & 255, (i >> 8) & 255, i & 255,
+		i % 3600, i * 1500, i * 40);
+	sprintf(keys[n + 1], "IFNAME=ppp%d", i);
+	sprintf(keys[n + 2], "BUNDLE=\"user%d\"", i);
+	sprintf(keys[n + 3], "PPPD_PID=%d", pid);
+	strcpy(vals[n + 1], keys[n]);
+	strcpy(vals[n + 2], keys[n]);
+	strcpy(vals[n + 3], keys[n]);
+    }
+}
+
+static TDB_DATA
+datum(char *s)
+{
+    TDB_DATA d;
+
+    d.dptr = s;
+    d.dsize = strlen(s) + 1;
+    return d;
+}
+
+static void
+run(const char *what, int hash_size, tdb_hash_func hash_fn)
+{
+    char path[] = "/tmp/tdb_benchXXXXXX";
+    TDB_CONTEXT *tdb;
+    TDB_DATA d;
+    double t0, store, fetch, update;
+    int fd, i, k;
+
+    if ((fd = mkstemp(path)) < 0)
+	fatal("mkstemp");
+    close(fd);
+    tdb = tdb_open_ex(path, hash_size, 0, O_RDWR | O_CREAT, 0600,
+		      NULL, hash_fn);
+    if (tdb == NULL)
+	fatal("tdb_open %s", path);
+
+    t0 = now_ns();
+    for (i = 0; i < RECORDS; ++i)
+	if (tdb_store(tdb, datum(keys[i]), datum(vals[i]), TDB_REPLACE))
+	    fatal("tdb_store: %s", tdb_errorstr(tdb));
+    store = now_ns() - t0;
+
+    t0 = now_ns();
+    for (i = 0; i < RECORDS; ++i) {
+	/* a scattered order, as lookups from different sessions come */
+	k = (i * 7919L) % RECORDS;
+	d = tdb_fetch(tdb, datum(keys[k]));
+	if (d.dptr == NULL || strcmp(d.dptr, vals[k]) != 0)
+	    fatal("tdb_fetch %s", keys[k]);
+	free(d.dptr);
+    }
+    fetch = now_ns() - t0;
+
+    t0 = now_ns();
+    for (i = 0; i < SESSIONS; ++i) {
+	k = ((i * 7919L) % SESSIONS) * KEYS_PER_SESSION;
+	if (tdb_store(tdb, datum(keys[k]), datum(vals[k]), TDB_REPLACE))
+	    fatal("tdb_store: %s", tdb_errorstr(tdb));
+    }
+    update = now_ns() - t0;
+
+    printf("  %-26s %6d chains: store %7.0f ns, fetch %7.0f ns,"
+	   " update %7.0f ns\n", what, hash_size, store / RECORDS,
+	   fetch / RECORDS, update / SESSIONS);
+    tdb_close(tdb);
+    unlink(path);
+}
+
+/*
+ * session_record - fill in key and value of record k of the session
+ * with process ID pid; the environment record (k == 0) is longer when
+ * grown.
+ */
+static void
+session_record(char *key, char *val, int k, int pid, int grown)
+{
+    int i = pid - 2000;
+    int pad = (pid * 2654435761u >> 24) % 400 + (grown ? 200 : 0);
+
+    switch (k) {
+    case 0:
+	sprintf(key, "pppd%d", pid);
+	sprintf(val, "PPPD_PID=%d;IFNAME=ppp%d;DEVICE=eth1;"
+		"BUNDLE=\"user%d\";IPREMOTE=10.%d.%d.%d;%-*s;",
+		pid, i, i, (i >> 16) & 255, (i >> 8) & 255, i & 255,
+		pad, "SPEED=1000000");
+	break;
+    case 1:
+	sprintf(key, "IFNAME=ppp%d", i);
+	sprintf(val, "pppd%d", pid);
+	break;
+    case 2:
+	sprintf(key, "BUNDLE=\"user%d\"", i);
+	sprintf(val, "pppd%d", pid);
+	break;
+    default:
+	sprintf(key, "PPPD_PID=%d", pid);
+	sprintf(val, "pppd%d", pid);
+	break;
+    }
+}
+
+/*
+ * make_holes - leave small free records between live ones that stay
+ * for the whole churn, as the records of long sessions do around those
+ * of short ones, so that they can't be merged with their neighbours.
+ */
+static void
+make_holes(TDB_CONTEXT *tdb)
+{
+    char key[32], val[1] = "";
+    int i;
+
+    /* too small for any record of a session */
+    for (i = 0; i < 2 * CHURN_HOLES; ++i) {
+	sprintf(key, "%c%d", i & 1 ? 'h' : 'k', i / 2);
+	if (tdb_store(tdb, datum(key), datum(val), TDB_REPLACE))
+	    fatal("tdb_store: %s", tdb_errorstr(tdb));
+    }
+    for (i = 0; i < CHURN_HOLES; ++i) {
+	sprintf(key, "h%d", i);
+	if (tdb_delete(tdb, datum(key)))
+	    fatal("tdb_delete %s: %s", key, tdb_errorstr(tdb));
+    }
+}
+
+/*
+ * store_session - store the records of a session, timing each store.
+ */
+static double
+store_session(TDB_CONTEXT *tdb, int pid)
+{
+    char key[32], val[1024];
+    double t0, t = 0;
+    int k;
+
+    for (k = 0; k <= KEYS_PER_SESSION; ++k) {
+	session_record(key, val, k % KEYS_PER_SESSION, pid,
+		       k == KEYS_PER_SESSION);
+	t0 = now_ns();
+	if (tdb_store(tdb, datum(key), datum(val), TDB_REPLACE))
+	    fatal("tdb_store: %s", tdb_errorstr(tdb));
+	t += now_ns() - t0;
+    }
+    return t;
+}
+
+static double
+delete_session(TDB_CONTEXT *tdb, int pid)
+{
+    char key[32], val[1024];
+    double t0, t = 0;
+    int k;
+
+    for (k = 0; k < KEYS_PER_SESSION; ++k) {
+	session_record(key, val, k, pid, 0);
+	t0 = now_ns();
+	if (tdb_delete(tdb, datum(key)))
+	    fatal("tdb_delete %s: %s", key, tdb_errorstr(tdb));
+	t += now_ns() - t0;
+    }
+    return t;
+}
+
+static void
+churn(const char *what, int one_freelist)
+{
+    static int live[SESSIONS];
+    char path[] = "/tmp/tdb_benchXXXXXX";
+    TDB_CONTEXT *tdb;
+    struct stat st;
+    unsigned int seed = 1;
+    u32 zero = 0;
+    double t, td;
+    int fd, i, r, s, pid = 2000;
+
+    if ((fd = mkstemp(path)) < 0)
+	fatal("mkstemp");
+    close(fd);
+    tdb = tdb_open(path, PPPDB_HASH_SIZE, 0, O_RDWR | O_CREAT, 0600);
+    if (tdb == NULL)
+	fatal("tdb_open %s", path);
+    if (one_freelist) {
+	/* make it look like a database from before size classes */
+	tdb_close(tdb);
+	if ((fd = open(path, O_RDWR)) < 0
+	    || pwrite(fd, &zero, sizeof(zero),
+		      offsetof(struct tdb_header, free_classes)) != sizeof(zero))
+	    fatal("rewriting header of %s", path);
+	close(fd);
+	if ((tdb = tdb_open(path, 0, 0, O_RDWR, 0)) == NULL)
+	    fatal("tdb_open %s", path);
+    }
+
+    for (i = 0; i < SESSIONS; ++i) {
+	live[i] = pid++;
+	store_session(tdb, live[i]);
+    }
+    make_holes(tdb);
+
+    printf("  %s:\n", what);
+    for (r = 1; r <= CHURN_ROUNDS; ++r) {
+	t = td = 0;
+	for (i = 0; i < CHURN_SESSIONS; ++i) {
+	    seed = seed * 1103515245 + 12345;
+	    s = (seed >> 8) % SESSIONS;
+	    td += delete_session(tdb, live[s]);
+	    live[s] = pid++;
+	    t += store_session(tdb, live[s]);
+	}
+	fstat(tdb->fd, &st);
+	printf("    after %6d sessions: store %7.0f ns, delete %7.0f ns,"
+	       " file %6lld kB\n", r * CHURN_SESSIONS,
+	       t / (CHURN_SESSIONS * (KEYS_PER_SESSION + 1)),
+	       td / (CHURN_SESSIONS * KEYS_PER_SESSION),
+	       (long long) st.st_size >> 10);
+    }
+    tdb_close(tdb);
+    unlink(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+    make_records();
+    printf("ppp database with %d records:\n", RECORDS);
+    run("gdbm hash (old default)", 131, gdbm_hash);
+    run("one-at-a-time hash", 131, NULL);
+    run("one-at-a-time hash (pppd)", PPPDB_HASH_SIZE, NULL);
+    run("one-at-a-time hash (sized)", tdb_hash_size(RECORDS), NULL);
+
+    printf("session churn, %d sessions live, %d small holes:\n", SESSIONS,
+	   CHURN_HOLES);
+    churn("freelists by size", 0);
+    churn("one freelist", 1);
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * trace.c - record sent and received frames in a binary ring file.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "pppd-private.h"
+#include "trace.h"
+
+/*
+ * With the tracefile option, dump_packet() hands each frame to
+ * trace_packet() instead of formatting it for the log.  The file is
+ * sized and mapped on the first frame, so that tracefile-size can be
+ * given after tracefile; from then on recording a frame is a couple of
+ * memcpy()s into the mapping.  pppdump decodes the file.
+ *
+ * The charshunt uses the same kind of ring for "record" with
+ * "record-size".
+ */
+int	trace_fd = -1;		/* fd of the file given with tracefile */
+int	trace_kbytes = 1024;	/* size of the ring in kilobytes */
+
+static struct trace_ring packet_ring;
+
+/*
+ * trace_ring_map - lock fd, size it for a ring of kbytes, map it and
+ * validate or initialize its header.  A ring left by an earlier run
+ * with the same size and magic is carried on with.  Returns 0 and
+ * logs the reason on failure.
+ */
+int
+trace_ring_map(struct trace_ring *ring, int fd, int kbytes, const char *magic)
+{
+    struct trace_header *h;
+    struct stat sbuf;
+    uint32_t size;
+    size_t total;
+    int err, fresh;
+    const char *what;
+
+    size = (uint32_t) kbytes * 1024;
+    total = sizeof(*h) + size;
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+	what = "file is in use";
+	goto fail;
+    }
+    what = "fstat";
+    if (fstat(fd, &sbuf) < 0)
+	goto fail;
+    fresh = sbuf.st_size != total;
+    what = "ftruncate";
+    if (fresh && ftruncate(fd, 0) < 0)
+	goto fail;
+    /* allocate the blocks now rather than take SIGBUS later */
+    what = "fallocate";
+    if ((err = posix_fallocate(fd, 0, total)) != 0) {
+	errno = err;
+	goto fail;
+    }
+    what = "mmap";
+    h = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED)
+	goto fail;
+    ring->hdr = h;
+    ring->data = (unsigned char *) (h + 1);
+    ring->size = size;
+
+    if (fresh || memcmp(h->magic, magic, sizeof(h->magic)) != 0
+	|| ntohl(h->version) != TRACE_VERSION
+	|| ntohl(h->size) != size
+	|| ntohl(h->head) >= size || ntohl(h->tail) >= size
+	|| ntohl(h->count) > size / TRACE_RECLEN(0)) {
+	memset(h, 0, sizeof(*h));
+	h->version = htonl(TRACE_VERSION);
+	h->size = htonl(size);
+	memcpy(h->magic, magic, sizeof(h->magic));
+    }
+    return 1;
+
+ fail:
+    error("Couldn't set up trace ring: %s: %m", what);
+    return 0;
+}
+
+/*
+ * trace_evict - drop the oldest record, or step over the end-of-ring
+ * marker in front of it.
+ */
+static void
+trace_evict(struct trace_ring *ring, uint32_t *head, uint32_t *count,
+	    uint32_t *lost)
+{
+    struct trace_record *r;
+
+    r = (struct trace_record *) (ring->data + *head);
+    if (*head + sizeof(*r) > ring->size || ntohs(r->len) == TRACE_WRAP) {
+	if (*head == 0) {
+	    /* a wrap marker at offset 0: the ring is corrupt, drop it all */
+	    *lost += *count;
+	    *count = 0;
+	}
+	*head = 0;
+	return;
+    }
+    *head += TRACE_RECLEN(ntohs(r->len));
+    if (*head >= ring->size)
+	*head = 0;
+    --*count;
+    ++*lost;
+}
+
+/*
+ * trace_ring_put - append a record to a ring, overwriting the oldest
+ * records as necessary.
+ */
+void
+trace_ring_put(struct trace_ring *ring, int dir, unsigned char *p, int len)
+{
+    struct trace_header *h = ring->hdr;
+    struct trace_record *r;
+    struct timeval tv;
+    uint32_t size = ring->size;
+    uint32_t head, tail, count, lost, need;
+
+    if (len > TRACE_MAXLEN)
+	len = TRACE_MAXLEN;
+    if (TRACE_RECLEN(len) > size)
+	len = size - sizeof(*r);
+    need = TRACE_RECLEN(len);
+
+    head = ntohl(h->head);
+    tail = ntohl(h->tail);
+    count = ntohl(h->count);
+    lost = ntohl(h->lost);
+
+    if (tail + need > size) {
+	/* the rest of the ring goes: everything from head to the end */
+	while (count > 0 && head >= tail)
+	    trace_evict(ring, &head, &count, &lost);
+	if (tail + sizeof(*r) <= size) {
+	    r = (struct trace_record *) (ring->data + tail);
+	    r->len = htons(TRACE_WRAP);
+	}
+	tail = 0;
+    }
+    while (count > 0 && head >= tail && head < tail + need)
+	trace_evict(ring, &head, &count, &lost);
+    if (count == 0)
+	head = tail;
+
+    /* publish the evictions before their space is reused */
+    h->head = htonl(head);
+    h->count = htonl(count);
+    h->lost = htonl(lost);
+
+    gettimeofday(&tv, NULL);
+    r = (struct trace_record *) (ring->data + tail);
+    r->len = htons(len);
+    r->dir = dir;
+    r->pad = 0;
+    r->sec = htonl(tv.tv_sec);
+    r->usec = htonl(tv.tv_usec);
+    memcpy(r + 1, p, len);
+
+    tail += need;
+    if (tail >= size)
+	tail = 0;
+    h->tail = htonl(tail);
+    h->count = htonl(count + 1);
+}
+
+/*
+ * trace_packet - record a frame in the tracefile ring.
+ */
+void
+trace_packet(int dir, unsigned char *p, int len)
+{
+    if (packet_ring.hdr == NULL
+	&& !trace_ring_map(&packet_ring, trace_fd, trace_kbytes, TRACE_MAGIC)) {
+	/* give up on tracing */
+	close(trace_fd);
+	trace_fd = -1;
+	return;
+    }
+    trace_ring_put(&packet_ring, dir, p, len);
+}
@@ -0,0 +1,94 @@
+/*
+ * trace.h - format of the binary packet trace ring written by pppd's
+ * "tracefile" option and read by pppdump.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PPP_TRACE_H
+#define PPP_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * The file is a trace_header followed by `size' bytes of ring space.
+ * The ring holds `count' records, the oldest at offset `head' and the
+ * next one to be written at offset `tail'.  Each record is a
+ * trace_record followed by `len' bytes of frame (PPP address/control,
+ * protocol and payload, as passed to dump_packet), padded to a
+ * multiple of 4 bytes.  A record never wraps: when the next one does
+ * not fit before the end of the ring, a record with len TRACE_WRAP is
+ * written (if there is room for one) and writing continues at offset 0.
+ *
+ * With TRACE_MAGIC each record is one PPP frame.  With
+ * TRACE_RECORD_MAGIC, written by the "record" option with
+ * "record-size", each record is a chunk of the raw character stream,
+ * and a zero-length record with TRACE_EOF set marks the end of one
+ * direction.
+ *
+ * All fields are in network byte order.
+ */
+#define TRACE_MAGIC	"PPPTRACE"
+#define TRACE_RECORD_MAGIC "PPPRECRD"	/* ring of "record" option data */
+#define TRACE_VERSION	1
+
+struct trace_header {
+    char	magic[8];	/* TRACE_MAGIC or TRACE_RECORD_MAGIC, no NUL */
+    uint32_t	version;	/* TRACE_VERSION */
+    uint32_t	size;		/* bytes of ring space after the header */
+    uint32_t	head;		/* offset of the oldest record */
+    uint32_t	tail;		/* offset of the next record to write */
+    uint32_t	count;		/* number of records in the ring */
+    uint32_t	lost;		/* records overwritten so far */
+};
+
+struct trace_record {
+    uint16_t	len;		/* bytes of frame following */
+    uint8_t	dir;		/* TRACE_SENT or TRACE_RCVD */
+    uint8_t	pad;
+    uint32_t	sec;		/* time of day */
+    uint32_t	usec;
+};
+
+#define TRACE_SENT	1
+#define TRACE_RCVD	2
+#define TRACE_EOF	0x80	/* flag in dir */
+
+#define TRACE_WRAP	0xffff	/* record len: continue at offset 0 */
+#define TRACE_MAXLEN	0xfffe	/* longer frames are truncated */
+
+#define TRACE_ALIGN(n)	(((n) + 3) & ~3)
+#define TRACE_RECLEN(len)	TRACE_ALIGN(sizeof(struct trace_record) + (len))
+
+/*
+ * A ring as mapped by the writer.
+ */
+struct trace_ring {
+    struct trace_header	*hdr;
+    unsigned char	*data;
+    uint32_t		size;
+};
+
+int trace_ring_map(struct trace_ring *, int fd, int kbytes, const char *magic);
+void trace_ring_put(struct trace_ring *, int dir, unsigned char *p, int len);
+
+#endif /* PPP_TRACE_H */
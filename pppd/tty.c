@@ -85,6 +85,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -93,8 +94,11 @@
 
 #include "pppd-private.h"
 #include "options.h"
+#include "pathnames.h"
 #include "fsm.h"
 #include "lcp.h"
+#include "trace.h"
+#include "chat-engine.h"
 
 void tty_process_extra_options(void);
 void tty_check_options(void);
@@ -114,10 +118,12 @@ static int start_charshunt(int, int);
 static void stop_charshunt(void *, int);
 static void charshunt_done(void *);
 static void charshunt(int, int, char *);
-static int record_write(FILE *, int code, u_char *buf, int nb,
-			struct timeval *);
+static void record_open(char *);
+static int record_write(int code, u_char *buf, int nb);
+static long record_flush_wait(void);
 static int open_socket(char *);
 static void maybe_relock(void *, int);
+static int run_connect_chat(int, char *);
 
 static int pty_master;		/* fd for master side of pty */
 static int pty_slave;		/* fd for slave side of pty */
@@ -142,11 +148,13 @@ int	inspeed = 0;		/* Input/Output speed requested */
 bool	lockflag = 0;		/* Create lock file to lock the serial dev */
 char	*initializer = NULL;	/* Script to initialize physical link */
 char	*connect_script = NULL;	/* Script to establish physical link */
+char	*connect_chat = NULL;	/* Chat script to run on the link */
 char	*disconnect_script = NULL; /* Script to disestablish physical link */
 char	*welcomer = NULL;	/* Script to run after phys link estab. */
 char	*ptycommand = NULL;	/* Command to run on other side of pty */
 bool	notty = 0;		/* Stdin/out is not a tty */
 char	*record_file = NULL;	/* File to record chars sent/received */
+static int record_kbytes;	/* size of record file ring, 0 = append */
 int	max_data_rate;		/* max bytes/sec through charshunt */
 bool	sync_serial = 0;	/* Device is synchronous serial device */
 char	*pty_socket = NULL;	/* Socket to connect to pty */
@@ -156,6 +164,7 @@ extern uid_t uid;
 extern int kill_link;
 extern int asked_to_quit;
 extern int got_sigterm;
+extern int got_sighup;
 
 /* XXX */
 extern int privopen;		/* don't lock, open device as root */
@@ -185,6 +194,9 @@ static struct option tty_options[] = {
     { "connect", o_string, &connect_script,
       "A program to set up a connection", OPT_PRIO | OPT_PRIVFIX },
 
+    { "connect-chat", o_string, &connect_chat,
+      "Chat script file to set up a connection", OPT_PRIO | OPT_PRIVFIX },
+
     { "disconnect", o_string, &disconnect_script,
       "Program to disconnect serial device", OPT_PRIO | OPT_PRIVFIX },
 
@@ -204,6 +216,9 @@ static struct option tty_options[] = {
 
     { "record", o_string, &record_file,
       "Record characters sent/received to file", OPT_PRIO },
+    { "record-size", o_int, &record_kbytes,
+      "Keep the record file as a ring of this many kilobytes",
+      OPT_PRIO | OPT_LIMITS | OPT_ZEROOK, NULL, 1048576, 4 },
 
     { "crtscts", o_int, &crtscts,
       "Set hardware (RTS/CTS) flow control",
@@ -498,13 +513,17 @@ tty_check_options(void)
 		ppp_option_error("demand-dialling is incompatible with notty");
 		exit(EXIT_OPTION_ERROR);
 	}
-	if (demand && connect_script == 0 && ptycommand == NULL
-	    && pty_socket == NULL) {
+	if (connect_script != NULL && connect_chat != NULL) {
+		ppp_option_error("connect and connect-chat options are incompatible");
+		exit(EXIT_OPTION_ERROR);
+	}
+	if (demand && connect_script == 0 && connect_chat == 0
+	    && ptycommand == NULL && pty_socket == NULL) {
 		ppp_option_error("connect script is required for demand-dialling\n");
 		exit(EXIT_OPTION_ERROR);
 	}
 	/* default holdoff to 0 if no connect script has been given */
-	if (connect_script == 0 && !holdoff_specified)
+	if (connect_script == 0 && connect_chat == 0 && !holdoff_specified)
 		holdoff = 0;
 
 	if (using_pty) {
@@ -561,7 +580,7 @@ tty_check_options(void)
  */
 int connect_tty(void)
 {
-	char *connector;
+	char *connector, *chat_file;
 	int fdflags;
 #ifndef __linux__
 	struct stat statbuf;
@@ -604,6 +623,7 @@ int connect_tty(void)
 	 */
 	got_sigterm = 0;
 	connector = doing_callback? callback_script: connect_script;
+	chat_file = doing_callback? NULL: connect_chat;
 	if (devnam[0] != 0) {
 		for (;;) {
 			/* If the user specified the device name, become the
@@ -662,7 +682,7 @@ int connect_tty(void)
 		 * we could clear CLOCAL at this point.
 		 */
 		set_up_tty(ttyfd, ((connector != NULL && connector[0] != 0)
-				   || initializer != NULL));
+				   || chat_file != NULL || initializer != NULL));
 	}
 
 	/*
@@ -722,7 +742,7 @@ int connect_tty(void)
 	}
 
 	/* run connection script */
-	if ((connector && connector[0]) || initializer) {
+	if ((connector && connector[0]) || chat_file || initializer) {
 		if (real_ttyfd != -1) {
 			/* XXX do this if doing_callback == CALLBACK_DIALIN? */
 			if (!default_device && modem) {
@@ -756,6 +776,17 @@ int connect_tty(void)
 				goto errretf;
 			}
 			info("Serial connection established.");
+		} else if (chat_file) {
+			if (run_connect_chat(ttyfd, chat_file) < 0) {
+				error("Connect script failed");
+				ppp_set_status(EXIT_CONNECT_FAILED);
+				goto errretf;
+			}
+			if (got_sigterm) {
+				disconnect_tty();
+				goto errretf;
+			}
+			info("Serial connection established.");
 		}
 
 		/* set line speed, flow control, etc.;
@@ -768,7 +799,7 @@ int connect_tty(void)
 	}
 
 	/* reopen tty if necessary to wait for carrier */
-	if (connector == NULL && modem && devnam[0] != 0) {
+	if (connector == NULL && chat_file == NULL && modem && devnam[0] != 0) {
 		int i;
 		for (;;) {
 			if ((i = open(devnam, O_RDWR)) >= 0)
@@ -797,7 +828,8 @@ int connect_tty(void)
 	 * time for something from the peer.  This can avoid bouncing
 	 * our packets off his tty before he has it set up.
 	 */
-	if (connector != NULL || ptycommand != NULL || pty_socket != NULL)
+	if (connector != NULL || chat_file != NULL || ptycommand != NULL
+	    || pty_socket != NULL)
 		listen_time = connect_delay;
 
 	return ttyfd;
@@ -816,6 +848,104 @@ int connect_tty(void)
 	return -1;
 }
 
+/*
+ * Logging and REPORT lines from a connect-chat script go to our log.
+ */
+static void
+connect_chat_log(void *arg, int level, const char *fmt, va_list args)
+{
+	char buf[1024];
+
+	vslprintf(buf, sizeof(buf), fmt, args);
+	if (level == CHAT_LOG_ERR)
+		error("%s", buf);
+	else
+		dbglog("%s", buf);
+}
+
+static void
+connect_chat_report(void *arg, const char *line)
+{
+	info("chat: %s", line);
+}
+
+/*
+ * HANGUP OFF in the script stops SIGHUP from aborting it, as it stops
+ * SIGHUP from killing a chat process.
+ */
+static void
+connect_chat_hangup(void *arg, int on)
+{
+	*(int *)arg = on;
+}
+
+static const struct chat_ops connect_chat_ops = {
+	connect_chat_log, connect_chat_report, connect_chat_hangup
+};
+
+/*
+ * run_connect_chat - run the chat script in file on fd, in pppd
+ * rather than in a chat process.  It runs as the user, as a connect
+ * script would, and stops if we are asked to quit or get SIGHUP.
+ * Returns 0 if the script succeeded, -1 otherwise.
+ */
+static int
+run_connect_chat(int fd, char *file)
+{
+	struct chat script;
+	struct pollfd pfd[3];
+	int ms, status, errfd, hup_on = 1;
+
+	if (log_to_fd >= 0)
+		errfd = log_to_fd;
+	else
+		errfd = open(PPP_PATH_CONNERRS, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (seteuid(uid) == -1) {
+		error("Unable to drop privileges for connect-chat: %m");
+		if (errfd >= 0 && log_to_fd < 0)
+			close(errfd);
+		return -1;
+	}
+
+	chat_init(&script, fd, fd, &connect_chat_ops, &hup_on);
+	script.errfd = errfd;
+	script.verbose = debug;
+	if (chat_read_file(&script, file) == 0) {
+		chat_start(&script);
+		while ((status = script.status) == CHAT_RUNNING) {
+			/* before the checks, so poll wakes for a signal after */
+			pfd[2].fd = signal_wait_start();
+			pfd[2].events = POLLIN;
+			if (got_sigterm || hungup) {
+				chat_stop(&script, 2, "Connect script aborted");
+				break;
+			}
+			if (got_sighup && hup_on) {
+				chat_stop(&script, 2, "SIGHUP");
+				break;
+			}
+			chat_pollfds(&script, pfd, &ms);
+			if (poll(pfd, 3, ms) < 0) {
+				if (errno != EINTR) {
+					error("Connect script: poll: %m");
+					chat_stop(&script, 2, NULL);
+					break;
+				}
+				continue;
+			}
+			chat_handle(&script, pfd);
+		}
+		signal_wait_end();
+	}
+	status = script.exit_code;
+	chat_free(&script);
+
+	if (seteuid(0) == -1)
+		fatal("Unable to regain privileges");
+	if (errfd >= 0 && log_to_fd < 0)
+		close(errfd);
+	return status == 0? 0: -1;
+}
 
 void disconnect_tty(void)
 {
@@ -1006,6 +1136,207 @@ stop_charshunt(void *arg, int sig)
 		kill(charshunt_pid, (sig == SIGINT? sig: SIGTERM));
 }
 
+/*
+ * The character shunt moves the bytes for each direction through a
+ * ring buffer of its own, so that reading in one direction never waits
+ * for a write in the other.  Where the kernel can splice() the fds
+ * involved, and nothing needs to see the bytes, a pipe takes the place
+ * of the ring and the data is not copied through user space at all.
+ */
+#define SHUNT_BUFSIZE	32768
+
+/*
+ * The record file is written through a large stdio buffer, which goes
+ * out when it fills or once it has held data for RECORD_FLUSH_USEC,
+ * rather than with a write() per chunk.  With record-size the chunks
+ * go into a fixed-size ring mapped from the file instead (see trace.h).
+ */
+#define RECORD_BUFSIZE		65536
+#define RECORD_FLUSH_USEC	1000000
+
+static int recording;		/* record file is open and healthy */
+static FILE *recordf;		/* record file in append mode, or */
+static struct trace_ring record_ring; /* record file ring */
+static struct timeval record_last; /* time of the last timestamp written */
+static struct timeval record_dirty; /* when unflushed data was written */
+static volatile sig_atomic_t shunt_stop; /* SIGTERM or SIGINT arrived */
+
+struct shunt {
+    char	*from, *to;	/* fd names for error messages */
+    int		rfd, wfd;
+    int		readable;	/* rfd has not reached end of file */
+    int		data_code;	/* record file codes for data and EOF */
+    int		eof_code;
+    u_char	*buf;		/* ring buffer */
+    int		head;		/* offset of first byte in buf */
+    int		count;		/* bytes held in buf or pipefd */
+    int		pipefd[2];	/* splice() staging pipe, or -1 */
+    double	tokens;		/* datarate token bucket */
+};
+
+static int
+shunt_init(struct shunt *sp, int rfd, int wfd, char *from, char *to,
+	   int data_code, int eof_code, int use_splice)
+{
+    memset(sp, 0, sizeof(*sp));
+    sp->from = from;
+    sp->to = to;
+    sp->rfd = rfd;
+    sp->wfd = wfd;
+    sp->readable = 1;
+    sp->data_code = data_code;
+    sp->eof_code = eof_code;
+    sp->pipefd[0] = sp->pipefd[1] = -1;
+    sp->buf = malloc(SHUNT_BUFSIZE);
+    if (sp->buf == NULL)
+	return 0;
+#ifdef SPLICE_F_NONBLOCK
+    if (use_splice && pipe2(sp->pipefd, O_NONBLOCK | O_CLOEXEC) < 0)
+	sp->pipefd[0] = sp->pipefd[1] = -1;
+#endif
+    return 1;
+}
+
+/*
+ * shunt_nosplice - go back to the ring buffer, moving anything already
+ * in the pipe into it.
+ */
+static void
+shunt_nosplice(struct shunt *sp)
+{
+    int n, got;
+
+    for (got = 0; got < sp->count; got += n) {
+	n = read(sp->pipefd[0], sp->buf + got, sp->count - got);
+	if (n <= 0)
+	    break;
+    }
+    sp->head = 0;
+    sp->count = got;
+    close(sp->pipefd[0]);
+    close(sp->pipefd[1]);
+    sp->pipefd[0] = sp->pipefd[1] = -1;
+}
+
+static void
+shunt_discard(struct shunt *sp)
+{
+    if (sp->pipefd[0] >= 0) {
+	close(sp->pipefd[0]);
+	close(sp->pipefd[1]);
+	sp->pipefd[0] = sp->pipefd[1] = -1;
+    }
+    sp->head = sp->count = 0;
+}
+
+/*
+ * shunt_read - read what is available from sp->rfd.  Returns the
+ * number of bytes read, 0 at end of file (or EIO, which is what a pty
+ * master gets once the slave side has closed), -1 if there was nothing
+ * to read, or -2 on error.
+ */
+static int
+shunt_read(struct shunt *sp)
+{
+    struct iovec iov[2];
+    int n, tail, space;
+
+    space = SHUNT_BUFSIZE - sp->count;
+#ifdef SPLICE_F_NONBLOCK
+    if (sp->pipefd[0] >= 0) {
+	n = splice(sp->rfd, NULL, sp->pipefd[1], NULL, space,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && errno == EINVAL)
+	    shunt_nosplice(sp);		/* and read() it instead */
+	else
+	    goto done;
+    }
+#endif
+    tail = (sp->head + sp->count) % SHUNT_BUFSIZE;
+    iov[0].iov_base = sp->buf + tail;
+    iov[0].iov_len = SHUNT_BUFSIZE - tail;
+    if (iov[0].iov_len > space)
+	iov[0].iov_len = space;
+    iov[1].iov_base = sp->buf;
+    iov[1].iov_len = space - iov[0].iov_len;
+    n = readv(sp->rfd, iov, iov[1].iov_len? 2: 1);
+    if (n > 0 && recording) {
+	if (n <= iov[0].iov_len)
+	    record_write(sp->data_code, iov[0].iov_base, n);
+	else if (record_write(sp->data_code, iov[0].iov_base, iov[0].iov_len))
+	    record_write(sp->data_code, sp->buf, n - iov[0].iov_len);
+    }
+#ifdef SPLICE_F_NONBLOCK
+ done:
+#endif
+    if (n < 0) {
+	if (errno == EINTR || errno == EAGAIN)
+	    return -1;
+	if (errno != EIO)
+	    return -2;
+	n = 0;		/* the other side has closed: treat as EOF */
+    }
+    if (n == 0 && recording)
+	record_write(sp->eof_code, NULL, 0);
+    sp->count += n;
+    return n;
+}
+
+/*
+ * shunt_write - write up to max bytes of the data held to sp->wfd.
+ * Returns the number of bytes written, -1 if none could be, -3 if the
+ * other end has gone away (EIO), or -2 on other errors.
+ */
+static int
+shunt_write(struct shunt *sp, int max)
+{
+    struct iovec iov[2];
+    int n;
+
+    if (max > sp->count)
+	max = sp->count;
+#ifdef SPLICE_F_NONBLOCK
+    if (sp->pipefd[0] >= 0) {
+	n = splice(sp->pipefd[0], NULL, sp->wfd, NULL, max,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && errno == EINVAL)
+	    shunt_nosplice(sp);		/* and write() it instead */
+	else
+	    goto done;
+    }
+#endif
+    iov[0].iov_base = sp->buf + sp->head;
+    iov[0].iov_len = SHUNT_BUFSIZE - sp->head;
+    if (iov[0].iov_len > max)
+	iov[0].iov_len = max;
+    iov[1].iov_base = sp->buf;
+    iov[1].iov_len = max - iov[0].iov_len;
+    n = writev(sp->wfd, iov, iov[1].iov_len? 2: 1);
+#ifdef SPLICE_F_NONBLOCK
+ done:
+#endif
+    if (n < 0) {
+	if (errno == EIO)
+	    return -3;
+	if (errno == EAGAIN || errno == EINTR)
+	    return -1;
+	return -2;
+    }
+    sp->head = (sp->head + n) % SHUNT_BUFSIZE;
+    sp->count -= n;
+    return n;
+}
+
+/*
+ * shunt_sig - SIGTERM or SIGINT in the charshunt: finish up, so that
+ * the record file is flushed on the way out.
+ */
+static void
+shunt_sig(int sig)
+{
+    shunt_stop = 1;
+}
+
 /*
  * charshunt - the character shunt, which passes characters between
  * the pty master side and the serial port (or stdin/stdout).
@@ -1015,24 +1346,24 @@ stop_charshunt(void *arg, int sig)
 static void
 charshunt(int ifd, int ofd, char *record_file)
 {
-    int n, nfds;
+    int n, nw, nfds;
     fd_set ready, writey;
-    u_char *ibufp, *obufp;
-    int nibuf, nobuf;
     int flags;
-    int pty_readable, stdin_readable;
-    struct timeval lasttime;
-    FILE *recordf = NULL;
-    int ilevel, olevel, max_level;
-    struct timeval levelt, tout, *top;
-    extern u_char inpacket_buf[];
+    int max_level;
+    int close_ofd = 0;
+    long wait, usec;
+    struct timeval levelt, now;
+    struct timespec tout, *top;
+    sigset_t mask, omask;
+    struct shunt in, out, *sp;
+    struct shunt *shunts[2];
 
     /*
      * Reset signal handlers.
      */
     signal(SIGHUP, SIG_IGN);		/* Hangup */
-    signal(SIGINT, SIG_DFL);		/* Interrupt */
-    signal(SIGTERM, SIG_DFL);		/* Terminate */
+    signal(SIGINT, shunt_sig);		/* Interrupt */
+    signal(SIGTERM, shunt_sig);		/* Terminate */
     signal(SIGCHLD, SIG_DFL);
     signal(SIGUSR1, SIG_DFL);
     signal(SIGUSR2, SIG_DFL);
@@ -1081,11 +1412,8 @@ charshunt(int ifd, int ofd, char *record_file)
     /*
      * Open the record file if required.
      */
-    if (record_file != NULL) {
-	recordf = fopen(record_file, "a");
-	if (recordf == NULL)
-	    error("Couldn't create record file %s: %m", record_file);
-    }
+    if (record_file != NULL)
+	record_open(record_file);
 
     /* set all the fds to non-blocking mode */
     flags = fcntl(pty_master, F_GETFL);
@@ -1103,195 +1431,285 @@ charshunt(int ifd, int ofd, char *record_file)
 	    warn("couldn't set stdout to nonblock: %m");
     }
 
-    nibuf = nobuf = 0;
-    ibufp = obufp = NULL;
-    pty_readable = stdin_readable = 1;
+    if (!shunt_init(&in, ifd, pty_master, "standard input",
+		    "pseudo-tty master", 2, 4, !recording)
+	|| !shunt_init(&out, pty_master, ofd, "pseudo-tty master",
+		       "standard output", 1, 3, !recording))
+	fatal("Couldn't allocate character shunt buffers");
+    shunts[0] = &in;
+    shunts[1] = &out;
 
-    ilevel = olevel = 0;
-    ppp_get_time(&levelt);
+    /*
+     * With a datarate, each direction has a token bucket which fills
+     * at max_data_rate bytes/s up to a tenth of a second's worth, and
+     * writes take tokens from it.
+     */
     if (max_data_rate) {
 	max_level = max_data_rate / 10;
 	if (max_level < 100)
 	    max_level = 100;
     } else
-	max_level = PPP_MRU + PPP_HDRLEN + 1;
+	max_level = 0;
+    in.tokens = out.tokens = max_level;
+    ppp_get_time(&levelt);
 
     nfds = (ofd > pty_master? ofd: pty_master) + 1;
-    if (recordf != NULL) {
-	gettimeofday(&lasttime, NULL);
-	putc(7, recordf);	/* put start marker */
-	putc(lasttime.tv_sec >> 24, recordf);
-	putc(lasttime.tv_sec >> 16, recordf);
-	putc(lasttime.tv_sec >> 8, recordf);
-	putc(lasttime.tv_sec, recordf);
-	lasttime.tv_usec = 0;
-    }
 
-    while (nibuf != 0 || nobuf != 0 || pty_readable || stdin_readable) {
-	top = 0;
-	tout.tv_sec = 0;
-	tout.tv_usec = 10000;
-	FD_ZERO(&ready);
-	FD_ZERO(&writey);
-	if (nibuf != 0) {
-	    if (ilevel >= max_level)
-		top = &tout;
-	    else
-		FD_SET(pty_master, &writey);
-	} else if (stdin_readable)
-	    FD_SET(ifd, &ready);
-	if (nobuf != 0) {
-	    if (olevel >= max_level)
-		top = &tout;
-	    else
-		FD_SET(ofd, &writey);
-	} else if (pty_readable)
-	    FD_SET(pty_master, &ready);
-	if (select(nfds, &ready, &writey, NULL, top) < 0) {
-	    if (errno != EINTR)
-		fatal("select");
-	    continue;
-	}
+    /* only take SIGTERM and SIGINT while waiting */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &omask);
+
+    while (!shunt_stop
+	   && (in.count != 0 || out.count != 0 || in.readable || out.readable)) {
 	if (max_data_rate) {
 	    double dt;
-	    int nbt;
-	    struct timeval now;
 
 	    ppp_get_time(&now);
 	    dt = (now.tv_sec - levelt.tv_sec
 		  + (now.tv_usec - levelt.tv_usec) / 1e6);
-	    nbt = (int)(dt * max_data_rate);
-	    ilevel = (nbt < 0 || nbt > ilevel)? 0: ilevel - nbt;
-	    olevel = (nbt < 0 || nbt > olevel)? 0: olevel - nbt;
 	    levelt = now;
-	} else
-	    ilevel = olevel = 0;
-	if (FD_ISSET(ifd, &ready)) {
-	    ibufp = inpacket_buf;
-	    nibuf = read(ifd, ibufp, PPP_MRU + PPP_HDRLEN);
-	    if (nibuf < 0 && errno == EIO)
-		nibuf = 0;
-	    if (nibuf < 0) {
-		if (!(errno == EINTR || errno == EAGAIN)) {
-		    error("Error reading standard input: %m");
-		    break;
+	    for (n = 0; n < 2; ++n) {
+		sp = shunts[n];
+		if (dt > 0)
+		    sp->tokens += dt * max_data_rate;
+		if (sp->tokens > max_level)
+		    sp->tokens = max_level;
+	    }
+	}
+
+	/*
+	 * Read while there is room and write while there is data, in
+	 * both directions independently.  A rate-limited write waits
+	 * until the bucket holds enough to send the pending data (or a
+	 * full bucket) in one go.
+	 */
+	top = NULL;
+	wait = 0;
+	FD_ZERO(&ready);
+	FD_ZERO(&writey);
+	for (n = 0; n < 2; ++n) {
+	    sp = shunts[n];
+	    if (sp->readable && sp->count < SHUNT_BUFSIZE)
+		FD_SET(sp->rfd, &ready);
+	    if (sp->count == 0)
+		continue;
+	    if (max_data_rate) {
+		double want = sp->count < max_level? sp->count: max_level;
+
+		if (sp->tokens < want) {
+		    usec = (long) ((want - sp->tokens) * 1e6 / max_data_rate) + 1;
+		    if (top == NULL || usec < wait)
+			wait = usec;
+		    top = &tout;
+		    continue;
 		}
-		nibuf = 0;
-	    } else if (nibuf == 0) {
+	    }
+	    FD_SET(sp->wfd, &writey);
+	}
+	usec = record_flush_wait();
+	if (usec >= 0 && (top == NULL || usec < wait)) {
+	    wait = usec;
+	    top = &tout;
+	}
+	if (top != NULL) {
+	    tout.tv_sec = wait / 1000000;
+	    tout.tv_nsec = (wait % 1000000) * 1000;
+	}
+	if (pselect(nfds, &ready, &writey, NULL, top, &omask) < 0) {
+	    if (errno != EINTR)
+		fatal("select");
+	    continue;
+	}
+
+	if (FD_ISSET(in.rfd, &ready)) {
+	    n = shunt_read(&in);
+	    if (n == 0) {
 		/* end of file from stdin */
-		stdin_readable = 0;
-		if (recordf)
-		    if (!record_write(recordf, 4, NULL, 0, &lasttime))
-			recordf = NULL;
-	    } else {
-		FD_SET(pty_master, &writey);
-		if (recordf)
-		    if (!record_write(recordf, 2, ibufp, nibuf, &lasttime))
-			recordf = NULL;
+		in.readable = 0;
+	    } else if (n == -2) {
+		error("Error reading %s: %m", in.from);
+		break;
 	    }
 	}
-	if (FD_ISSET(pty_master, &ready)) {
-	    obufp = outpacket_buf;
-	    nobuf = read(pty_master, obufp, PPP_MRU + PPP_HDRLEN);
-	    if (nobuf < 0 && errno == EIO)
-		nobuf = 0;
-	    if (nobuf < 0) {
-		if (!(errno == EINTR || errno == EAGAIN)) {
-		    error("Error reading pseudo-tty master: %m");
-		    break;
-		}
-		nobuf = 0;
-	    } else if (nobuf == 0) {
+	if (FD_ISSET(out.rfd, &ready)) {
+	    n = shunt_read(&out);
+	    if (n == 0) {
 		/* end of file from the pty - slave side has closed */
-		pty_readable = 0;
-		stdin_readable = 0;	/* pty is not writable now */
-		nibuf = 0;
-		close(ofd);
-		if (recordf)
-		    if (!record_write(recordf, 3, NULL, 0, &lasttime))
-			recordf = NULL;
-	    } else {
-		FD_SET(ofd, &writey);
-		if (recordf)
-		    if (!record_write(recordf, 1, obufp, nobuf, &lasttime))
-			recordf = NULL;
+		out.readable = 0;
+		in.readable = 0;	/* pty is not writable now */
+		shunt_discard(&in);
+		close_ofd = 1;
+	    } else if (n == -2) {
+		error("Error reading %s: %m", out.from);
+		break;
 	    }
-	} else if (!stdin_readable)
-	    pty_readable = 0;
-	if (FD_ISSET(ofd, &writey)) {
-	    n = nobuf;
-	    if (olevel + n > max_level)
-		n = max_level - olevel;
-	    n = write(ofd, obufp, n);
-	    if (n < 0) {
-		if (errno == EIO) {
-		    pty_readable = 0;
-		    nobuf = 0;
-		} else if (errno != EAGAIN && errno != EINTR) {
-		    error("Error writing standard output: %m");
-		    break;
-		}
-	    } else {
-		obufp += n;
-		nobuf -= n;
-		olevel += n;
+	} else if (!in.readable)
+	    out.readable = 0;
+
+	for (n = 0; n < 2; ++n) {
+	    sp = shunts[n];
+	    if (!FD_ISSET(sp->wfd, &writey))
+		continue;
+	    nw = shunt_write(sp, max_data_rate? (int) sp->tokens: sp->count);
+	    if (nw > 0) {
+		sp->tokens -= nw;
+	    } else if (nw == -3) {
+		/* the other end has gone: stop feeding it */
+		sp->readable = 0;
+		shunt_discard(sp);
+	    } else if (nw == -2) {
+		error("Error writing %s: %m", sp->to);
+		exit(0);
 	    }
 	}
-	if (FD_ISSET(pty_master, &writey)) {
-	    n = nibuf;
-	    if (ilevel + n > max_level)
-		n = max_level - ilevel;
-	    n = write(pty_master, ibufp, n);
-	    if (n < 0) {
-		if (errno == EIO) {
-		    stdin_readable = 0;
-		    nibuf = 0;
-		} else if (errno != EAGAIN && errno != EINTR) {
-		    error("Error writing pseudo-tty master: %m");
-		    break;
-		}
-	    } else {
-		ibufp += n;
-		nibuf -= n;
-		ilevel += n;
-	    }
+	if (close_ofd && out.count == 0) {
+	    close(ofd);
+	    close_ofd = 0;
 	}
     }
     exit(0);
 }
 
+/*
+ * record_open - open the record file, as a ring with record-size or
+ * else for appending, and write the start marker.
+ */
+static void
+record_open(char *name)
+{
+    int fd;
+
+    if (record_kbytes) {
+	fd = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+	    error("Couldn't create record file %s: %m", name);
+	    return;
+	}
+	if (!trace_ring_map(&record_ring, fd, record_kbytes,
+			    TRACE_RECORD_MAGIC)) {
+	    close(fd);
+	    return;
+	}
+	recording = 1;
+	return;
+    }
+
+    recordf = fopen(name, "a");
+    if (recordf == NULL) {
+	error("Couldn't create record file %s: %m", name);
+	return;
+    }
+    setvbuf(recordf, NULL, _IOFBF, RECORD_BUFSIZE);
+    gettimeofday(&record_last, NULL);
+    putc(7, recordf);	/* put start marker */
+    putc(record_last.tv_sec >> 24, recordf);
+    putc(record_last.tv_sec >> 16, recordf);
+    putc(record_last.tv_sec >> 8, recordf);
+    putc(record_last.tv_sec, recordf);
+    record_last.tv_usec = 0;
+    recording = 1;
+}
+
+/*
+ * record_write - record a chunk of data (or, if buf is NULL, the end
+ * of file) for one direction.  In append mode each chunk is preceded
+ * by the time since the previous one in microseconds, as a 2-byte
+ * (code 9) or 4-byte (code 8) delta, with a gap of over an hour taken
+ * up in tenths of a second first (code 5).  Returns 0 and stops
+ * recording if the file could not be written.
+ */
 static int
-record_write(FILE *f, int code, u_char *buf, int nb, struct timeval *tp)
+record_write(int code, u_char *buf, int nb)
 {
     struct timeval now;
-    int diff;
+    long long diff;
+    long tenths;
+    int dir, n;
+
+    if (record_ring.hdr != NULL) {
+	dir = (code == 1 || code == 3)? TRACE_SENT: TRACE_RCVD;
+	if (buf == NULL) {
+	    trace_ring_put(&record_ring, dir | TRACE_EOF, NULL, 0);
+	    return 1;
+	}
+	/* keep a large chunk from displacing the whole ring at once */
+	do {
+	    n = nb;
+	    if (n > record_ring.size / 4)
+		n = record_ring.size / 4;
+	    trace_ring_put(&record_ring, dir, buf, n);
+	    buf += n;
+	    nb -= n;
+	} while (nb > 0);
+	return 1;
+    }
 
     gettimeofday(&now, NULL);
-    now.tv_usec /= 100000;	/* actually 1/10 s, not usec now */
-    diff = (now.tv_sec - tp->tv_sec) * 10 + (now.tv_usec - tp->tv_usec);
+    diff = (now.tv_sec - record_last.tv_sec) * 1000000LL
+	+ (now.tv_usec - record_last.tv_usec);
     if (diff > 0) {
-	if (diff > 255) {
-	    putc(5, f);
-	    putc(diff >> 24, f);
-	    putc(diff >> 16, f);
-	    putc(diff >> 8, f);
-	    putc(diff, f);
-	} else {
-	    putc(6, f);
-	    putc(diff, f);
+	if (diff > 0xffffffffLL) {
+	    tenths = diff / 100000;
+	    putc(5, recordf);
+	    putc(tenths >> 24, recordf);
+	    putc(tenths >> 16, recordf);
+	    putc(tenths >> 8, recordf);
+	    putc(tenths, recordf);
+	    diff -= tenths * 100000LL;
 	}
-	*tp = now;
+	if (diff > 0xffff) {
+	    putc(8, recordf);
+	    putc(diff >> 24, recordf);
+	    putc(diff >> 16, recordf);
+	    putc(diff >> 8, recordf);
+	    putc(diff, recordf);
+	} else if (diff > 0) {
+	    putc(9, recordf);
+	    putc(diff >> 8, recordf);
+	    putc(diff, recordf);
+	}
+	record_last = now;
     }
-    putc(code, f);
+    putc(code, recordf);
     if (buf != NULL) {
-	putc(nb >> 8, f);
-	putc(nb, f);
-	fwrite(buf, nb, 1, f);
+	putc(nb >> 8, recordf);
+	putc(nb, recordf);
+	fwrite(buf, nb, 1, recordf);
     }
-    fflush(f);
-    if (ferror(f)) {
+    if (!timerisset(&record_dirty))
+	ppp_get_time(&record_dirty);
+    if (ferror(recordf)) {
 	error("Error writing record file: %m");
+	recording = 0;
 	return 0;
     }
     return 1;
 }
+
+/*
+ * record_flush_wait - flush the record file if it has held unflushed
+ * data for RECORD_FLUSH_USEC.  Returns the number of microseconds
+ * until the next flush is due, or -1 if nothing is waiting.
+ */
+static long
+record_flush_wait(void)
+{
+    struct timeval now;
+    long long age;
+
+    if (!recording || recordf == NULL || !timerisset(&record_dirty))
+	return -1;
+    ppp_get_time(&now);
+    age = (now.tv_sec - record_dirty.tv_sec) * 1000000LL
+	+ (now.tv_usec - record_dirty.tv_usec);
+    if (age < RECORD_FLUSH_USEC)
+	return RECORD_FLUSH_USEC - age;
+    timerclear(&record_dirty);
+    if (fflush(recordf) == EOF) {
+	error("Error writing record file: %m");
+	recording = 0;
+    }
+    return -1;
+}
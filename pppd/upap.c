@@ -110,6 +110,15 @@ struct protent pap_protent = {
 
 upap_state upap[NUM_PPP];		/* UPAP state; one for each unit */
 
+/*
+ * The auth-req a plugin is still checking (UPAPSS_CHECKING).
+ */
+static struct upap_check {
+    u_char id;
+    u_char userlen;
+    char user[256];
+} upap_check[NUM_PPP];
+
 static void upap_timeout(void *);
 static void upap_reqtimeout(void *);
 static void upap_rauthreq(upap_state *, u_char *, int, int);
@@ -117,6 +126,7 @@ static void upap_rauthack(upap_state *, u_char *, int, int);
 static void upap_rauthnak(upap_state *, u_char *, int, int);
 static void upap_sauthreq(upap_state *);
 static void upap_sresp(upap_state *, int, int, char *, int);
+static void upap_rauthdone(upap_state *, int, int, char *, char *, int);
 
 
 /*
@@ -260,7 +270,7 @@ upap_lowerup(int unit)
 /*
  * upap_lowerdown - The lower layer is down.
  *
- * Cancel all timeouts.
+ * Cancel all timeouts, and any check a plugin still has pending.
  */
 static void
 upap_lowerdown(int unit)
@@ -271,6 +281,8 @@ upap_lowerdown(int unit)
 	UNTIMEOUT(upap_timeout, u);		/* Cancel timeout */
     if (u->us_serverstate == UPAPSS_LISTEN && u->us_reqtimeout > 0)
 	UNTIMEOUT(upap_reqtimeout, u);
+    if (u->us_serverstate == UPAPSS_CHECKING && pap_auth_cancel_hook)
+	(*pap_auth_cancel_hook)();	/* its answer would be stale */
 
     u->us_clientstate = UPAPCS_INITIAL;
     u->us_serverstate = UPAPSS_INITIAL;
@@ -291,7 +303,8 @@ upap_protrej(int unit)
 	error("PAP authentication failed due to protocol-reject");
 	auth_withpeer_fail(unit, PPP_PAP);
     }
-    if (u->us_serverstate == UPAPSS_LISTEN) {
+    if (u->us_serverstate == UPAPSS_LISTEN
+	|| u->us_serverstate == UPAPSS_CHECKING) {
 	error("PAP authentication of peer failed (protocol-reject)");
 	auth_peer_fail(unit, PPP_PAP);
     }
@@ -362,10 +375,8 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 {
     u_char ruserlen, rpasswdlen;
     char *ruser, *rpasswd;
-    char rhostname[256];
     int retcode;
     char *msg;
-    int msglen;
 
     if (u->us_serverstate < UPAPSS_LISTEN)
 	return;
@@ -382,6 +393,12 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 	upap_sresp(u, UPAP_AUTHNAK, id, "", 0);	/* return auth-nak */
 	return;
     }
+    /*
+     * Still checking the first one: the answer will go out when
+     * the check completes.
+     */
+    if (u->us_serverstate == UPAPSS_CHECKING)
+	return;
 
     /*
      * Parse user/passwd.
@@ -412,6 +429,31 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 			   rpasswdlen, &msg);
     BZERO(rpasswd, rpasswdlen);
 
+    if (retcode == UPAP_AUTHPENDING) {
+	/* A plugin will call upap_auth_complete() with the answer. */
+	upap_check[u->us_unit].id = id;
+	upap_check[u->us_unit].userlen = ruserlen;
+	memcpy(upap_check[u->us_unit].user, ruser, ruserlen);
+	u->us_serverstate = UPAPSS_CHECKING;
+	if (u->us_reqtimeout > 0)
+	    UNTIMEOUT(upap_reqtimeout, u);
+	return;
+    }
+
+    upap_rauthdone(u, retcode, id, msg, ruser, ruserlen);
+}
+
+
+/*
+ * upap_rauthdone - Answer an Authenticate once it has been checked.
+ */
+static void
+upap_rauthdone(upap_state *u, int retcode, int id, char *msg,
+	       char *ruser, int ruserlen)
+{
+    char rhostname[256];
+    int msglen;
+
     /*
      * Check remote number authorization.  A plugin may have filled in
      * the remote number or added an allowed number, and rather than
@@ -448,6 +490,28 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 }
 
 
+/*
+ * upap_auth_complete - A plugin has finished checking the auth-req
+ * it left pending.
+ */
+void
+upap_auth_complete(int ok, char *msg, struct wordlist *addrs,
+		   struct wordlist *opts)
+{
+    upap_state *u = &upap[0];
+    struct upap_check *c = &upap_check[0];
+    int retcode;
+
+    if (u->us_serverstate != UPAPSS_CHECKING) {
+	/* the link went down while we were waiting */
+	check_passwd_done(u->us_unit, 0, addrs, opts);
+	return;
+    }
+    retcode = check_passwd_done(u->us_unit, ok, addrs, opts);
+    upap_rauthdone(u, retcode, c->id, msg? msg: "", c->user, c->userlen);
+}
+
+
 /*
  * upap_rauthack - Receive Authenticate-Ack.
  */
@@ -62,6 +62,12 @@ extern "C" {
 #define UPAP_AUTHACK	2	/* Authenticate-Ack */
 #define UPAP_AUTHNAK	3	/* Authenticate-Nak */
 
+/*
+ * Not a packet code: returned by check_passwd() when a plugin is
+ * still checking the peer's credentials.
+ */
+#define UPAP_AUTHPENDING 0
+
 
 /*
  * Each interface is described by upap structure.
@@ -101,6 +107,7 @@ typedef struct upap_state {
 #define UPAPSS_LISTEN	3	/* Listening for an Authenticate */
 #define UPAPSS_OPEN	4	/* We've sent an Ack */
 #define UPAPSS_BADAUTH	5	/* We've sent a Nak */
+#define UPAPSS_CHECKING	6	/* Waiting for a plugin to check an auth-req */
 
 
 /*
@@ -121,6 +128,7 @@ typedef int  (pap_auth_hook_fn)(char *user, char *passwd, char **msgp,
                 struct wordlist **paddrs,
                 struct wordlist **popts);
 typedef void (pap_logout_hook_fn)(void);
+typedef void (pap_auth_cancel_hook_fn)(void);
 typedef int  (pap_passwd_hook_fn)(char *user, char *passwd);
 
 /*
@@ -134,9 +142,31 @@ extern pap_check_hook_fn  *pap_check_hook;
 /*
  * This hook is used to check if a username and password matches against the
  *   PAP secrets.
+ *
+ * Return 1 to accept, 0 to reject, or -1 to fall back to the pap-secrets
+ *   file.  A plugin which has to wait for an answer (e.g. from a server)
+ *   can return PAP_AUTH_PENDING and call upap_auth_complete() later; pppd
+ *   carries on servicing the link in the meantime.
  */
 extern pap_auth_hook_fn   *pap_auth_hook;
 
+#define PAP_AUTH_PENDING	(-2)
+
+/*
+ * Deliver the result of a check which pap_auth_hook left pending.  The
+ *   arguments are as for pap_auth_hook; addrs and opts are consumed.
+ *   Ignored if the link has gone down since.
+ */
+void upap_auth_complete(int ok, char *msg, struct wordlist *addrs,
+			struct wordlist *opts);
+
+/*
+ * Called when the link goes down or PAP is rejected while a check left
+ *   pending by pap_auth_hook is outstanding.  The plugin must forget the
+ *   check and not call upap_auth_complete() for it.
+ */
+extern pap_auth_cancel_hook_fn *pap_auth_cancel_hook;
+
 /*
  * Hook for plugin to know about PAP user logout.
  */
@@ -58,6 +58,7 @@
 #include "fsm.h"
 #include "lcp.h"
 #include "pathnames.h"
+#include "trace.h"
 
 
 #if defined(SUNOS4)
@@ -800,6 +801,14 @@ dump_packet(const char *tag, unsigned char *p, int len)
 {
     int proto;
 
+#ifndef UNIT_TEST
+    /* the trace file replaces the log as the record of frames */
+    if (trace_fd >= 0) {
+	trace_packet(strcmp(tag, "sent") == 0? TRACE_SENT: TRACE_RCVD, p, len);
+	return;
+    }
+#endif
+
     if (!debug)
 	return;
 
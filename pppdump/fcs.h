@@ -0,0 +1,53 @@
+/*
+ * fcs.h - PPP frame check sequence routines for pppdump.
+ *
+ * Copyright (c) 1999-2024 Paul Mackerras. All rights reserved.
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PPPDUMP_FCS_H
+#define PPPDUMP_FCS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PPP_INITFCS	0xffff	/* Initial FCS value */
+#define PPP_GOODFCS	0xf0b8	/* Good final FCS value */
+#define PPP_INITFCS32	0xffffffff	/* Initial 32-bit FCS value */
+#define PPP_GOODFCS32	0xdebb20e3	/* Good final 32-bit FCS value */
+
+/*
+ * fcs16tab[0] and fcs32tab[0] are the usual byte-at-a-time tables;
+ * fcsNtab[k] gives the effect of a byte followed by k zero bytes, for
+ * taking four bytes at a time.
+ */
+extern uint16_t fcs16tab[4][256];
+extern uint32_t fcs32tab[4][256];
+
+#define PPP_FCS(fcs, c)	(((fcs) >> 8) ^ fcs16tab[0][((fcs) ^ (c)) & 0xff])
+#define PPP_FCS32(fcs, c) (((fcs) >> 8) ^ fcs32tab[0][((fcs) ^ (c)) & 0xff])
+
+void fcs_init(void);
+uint16_t fcs16(uint16_t fcs, const unsigned char *p, size_t len);
+uint32_t fcs32(uint32_t fcs, const unsigned char *p, size_t len);
+
+#endif /* PPPDUMP_FCS_H */
@@ -27,33 +27,194 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <time.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "trace.h"
+#include "fcs.h"
 
 int hexmode;
 int pppmode;
 int reverse;
 int mru = 1500;
 int abs_times;
-time_t start_time;
-int start_time_tenths;
+long long now_usec;		/* time of day at the current point, in usec */
 int tot_sent, tot_rcvd;
+FILE *pcapf;			/* pcapng output for -w */
 
 extern int optind;
 extern char *optarg;
 
-void dumplog(FILE *);
-void dumpppp(FILE *);
-void show_time(FILE *, int);
+/*
+ * Input comes from a mapping of the whole file where it can be mapped,
+ * and is otherwise read in blocks, so that taking a byte is not a call
+ * and memory use does not grow with the size of the file.  The parts
+ * of a mapping already dealt with are dropped every INPUT_RELEASE
+ * bytes.
+ */
+#define INPUT_BUFSIZE	65536
+#define INPUT_RELEASE	(4 << 20)
+
+struct input {
+    unsigned char *p;		/* next byte */
+    unsigned char *end;		/* end of the bytes to hand */
+    unsigned char *map;		/* mapping of the file, or NULL */
+    size_t maplen;
+    unsigned char *released;	/* mapping below here has been dropped */
+    int fd;			/* fd to read() from, or -1 */
+    unsigned char buf[INPUT_BUFSIZE];
+};
+
+#define in_getc(in)	((in)->p < (in)->end? *(in)->p++: in_fill(in))
+
+void dumplog(struct input *);
+void dumpppp(struct input *);
+void dumptrace(struct input *);
+void dumprecring(struct input *);
+int istrace(struct input *);
+void show_time(struct input *, int);
+void pcap_open(char *);
+void pcap_frame(int, long long, unsigned char *, int, int);
+
+/*
+ * in_open - set up to read from fd.
+ */
+static void
+in_open(struct input *in, int fd)
+{
+    struct stat sbuf;
+    void *m;
+
+    in->map = NULL;
+    in->released = NULL;
+    in->fd = fd;
+    in->p = in->end = in->buf;
+    if (fstat(fd, &sbuf) < 0 || !S_ISREG(sbuf.st_mode) || sbuf.st_size == 0
+	|| sbuf.st_size != (size_t) sbuf.st_size)
+	return;
+    m = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED)
+	return;
+    madvise(m, sbuf.st_size, MADV_SEQUENTIAL);
+    in->map = in->released = in->p = m;
+    in->maplen = sbuf.st_size;
+    in->end = in->map + in->maplen;
+    in->fd = -1;
+}
+
+/*
+ * in_mem - set up to read len bytes at p.
+ */
+static void
+in_mem(struct input *in, unsigned char *p, size_t len)
+{
+    in->map = in->released = NULL;
+    in->fd = -1;
+    in->p = p;
+    in->end = p + len;
+}
+
+static void
+in_close(struct input *in)
+{
+    if (in->map != NULL)
+	munmap(in->map, in->maplen);
+    in->map = NULL;
+}
+
+/*
+ * in_fill - refill the buffer and return the next byte, or EOF.
+ */
+static int
+in_fill(struct input *in)
+{
+    ssize_t n;
+
+    if (in->fd < 0)
+	return EOF;
+    n = read(in->fd, in->buf, sizeof(in->buf));
+    if (n <= 0) {
+	if (n < 0)
+	    perror("read");
+	return EOF;
+    }
+    in->p = in->buf;
+    in->end = in->buf + n;
+    return *in->p++;
+}
+
+/*
+ * in_bytes - return up to max contiguous bytes, setting *lenp to the
+ * number, or NULL at end of file.
+ */
+static unsigned char *
+in_bytes(struct input *in, int max, int *lenp)
+{
+    unsigned char *p;
+    int n;
+
+    if (in->p >= in->end) {
+	if (in_fill(in) == EOF)
+	    return NULL;
+	--in->p;
+    }
+    p = in->p;
+    n = in->end - p;
+    if (n > max)
+	n = max;
+    in->p += n;
+    *lenp = n;
+    return p;
+}
+
+/*
+ * in_read - copy len bytes into buf.  Returns 0 if there were fewer.
+ */
+static int
+in_read(struct input *in, void *buf, size_t len)
+{
+    unsigned char *p, *q = buf;
+    int n;
+
+    while (len > 0) {
+	if ((p = in_bytes(in, len > INT_MAX? INT_MAX: len, &n)) == NULL)
+	    return 0;
+	memcpy(q, p, n);
+	q += n;
+	len -= n;
+    }
+    return 1;
+}
+
+/*
+ * in_release - drop the part of a mapping that has been dealt with.
+ */
+static void
+in_release(struct input *in)
+{
+    size_t n;
+
+    if (in->map == NULL || in->p - in->released < INPUT_RELEASE)
+	return;
+    n = (in->p - in->released) & ~(size_t) (INPUT_RELEASE - 1);
+    madvise(in->released, n, MADV_DONTNEED);
+    in->released += n;
+}
 
 int
 main(int ac, char **av)
 {
-    int i;
+    int i, fd;
     char *p;
-    FILE *f;
+    static struct input in;
 
-    while ((i = getopt(ac, av, "hprdm:a")) != -1) {
+    while ((i = getopt(ac, av, "hprdm:aw:")) != -1) {
 	switch (i) {
 	case 'h':
 	    hexmode = 1;
@@ -70,38 +231,60 @@ main(int ac, char **av)
 	case 'a':
 	    abs_times = 1;
 	    break;
+	case 'w':
+	    pcap_open(optarg);
+	    pppmode = 1;
+	    break;
 	default:
-	    fprintf(stderr, "Usage: %s [-h | -p[d]] [-r] [-m mru] [-a] [file ...]\n", av[0]);
+	    fprintf(stderr, "Usage: %s [-h | -p[d]] [-r] [-m mru] [-a] [-w pcapng-file] [file ...]\n", av[0]);
 	    exit(1);
 	}
     }
-    if (optind >= ac)
-	dumplog(stdin);
-    else {
-	for (i = optind; i < ac; ++i) {
+    fcs_init();
+    i = optind;
+    do {
+	if (i >= ac) {
+	    fd = 0;
+	} else {
 	    p = av[i];
-	    if ((f = fopen(p, "r")) == NULL) {
+	    if ((fd = open(p, O_RDONLY)) < 0) {
 		perror(p);
 		exit(1);
 	    }
+	}
+	in_open(&in, fd);
+	switch (istrace(&in)) {
+	case 1:
+	    dumptrace(&in);
+	    break;
+	case 2:
+	    dumprecring(&in);
+	    break;
+	default:
 	    if (pppmode)
-		dumpppp(f);
+		dumpppp(&in);
 	    else
-		dumplog(f);
-	    fclose(f);
+		dumplog(&in);
 	}
+	in_close(&in);
+	if (fd != 0)
+	    close(fd);
+    } while (++i < ac);
+    if (pcapf != NULL && fclose(pcapf) == EOF) {
+	perror("pcapng file");
+	exit(1);
     }
     exit(0);
 }
 
 void
-dumplog(FILE *f)
+dumplog(struct input *in)
 {
     int c, n, k, col;
     int nb, c2;
     unsigned char buf[16];
 
-    while ((c = getc(f)) != EOF) {
+    while ((c = in_getc(in)) != EOF) {
 	switch (c) {
 	case 1:
 	case 2:
@@ -109,12 +292,12 @@ dumplog(FILE *f)
 		c = 3 - c;
 	    printf("%s %c", c==1? "sent": "rcvd", hexmode? ' ': '"');
 	    col = 6;
-	    n = getc(f);
-	    n = (n << 8) + getc(f);
+	    n = in_getc(in);
+	    n = (n << 8) + in_getc(in);
 	    *(c==1? &tot_sent: &tot_rcvd) += n;
 	    nb = 0;
 	    for (; n > 0; --n) {
-		c = getc(f);
+		c = in_getc(in);
 		if (c == EOF) {
 		    printf("\nEOF\n");
 		    exit(0);
@@ -169,56 +352,17 @@ dumplog(FILE *f)
 	case 5:
 	case 6:
 	case 7:
-	    show_time(f, c);
+	case 8:
+	case 9:
+	    show_time(in, c);
 	    break;
 	default:
 	    printf("?%.2x\n", c);
 	}
+	in_release(in);
     }
 }
 
-/*
- * FCS lookup table as calculated by genfcstab.
- */
-static u_short fcstab[256] = {
-	0x0000,	0x1189,	0x2312,	0x329b,	0x4624,	0x57ad,	0x6536,	0x74bf,
-	0x8c48,	0x9dc1,	0xaf5a,	0xbed3,	0xca6c,	0xdbe5,	0xe97e,	0xf8f7,
-	0x1081,	0x0108,	0x3393,	0x221a,	0x56a5,	0x472c,	0x75b7,	0x643e,
-	0x9cc9,	0x8d40,	0xbfdb,	0xae52,	0xdaed,	0xcb64,	0xf9ff,	0xe876,
-	0x2102,	0x308b,	0x0210,	0x1399,	0x6726,	0x76af,	0x4434,	0x55bd,
-	0xad4a,	0xbcc3,	0x8e58,	0x9fd1,	0xeb6e,	0xfae7,	0xc87c,	0xd9f5,
-	0x3183,	0x200a,	0x1291,	0x0318,	0x77a7,	0x662e,	0x54b5,	0x453c,
-	0xbdcb,	0xac42,	0x9ed9,	0x8f50,	0xfbef,	0xea66,	0xd8fd,	0xc974,
-	0x4204,	0x538d,	0x6116,	0x709f,	0x0420,	0x15a9,	0x2732,	0x36bb,
-	0xce4c,	0xdfc5,	0xed5e,	0xfcd7,	0x8868,	0x99e1,	0xab7a,	0xbaf3,
-	0x5285,	0x430c,	0x7197,	0x601e,	0x14a1,	0x0528,	0x37b3,	0x263a,
-	0xdecd,	0xcf44,	0xfddf,	0xec56,	0x98e9,	0x8960,	0xbbfb,	0xaa72,
-	0x6306,	0x728f,	0x4014,	0x519d,	0x2522,	0x34ab,	0x0630,	0x17b9,
-	0xef4e,	0xfec7,	0xcc5c,	0xddd5,	0xa96a,	0xb8e3,	0x8a78,	0x9bf1,
-	0x7387,	0x620e,	0x5095,	0x411c,	0x35a3,	0x242a,	0x16b1,	0x0738,
-	0xffcf,	0xee46,	0xdcdd,	0xcd54,	0xb9eb,	0xa862,	0x9af9,	0x8b70,
-	0x8408,	0x9581,	0xa71a,	0xb693,	0xc22c,	0xd3a5,	0xe13e,	0xf0b7,
-	0x0840,	0x19c9,	0x2b52,	0x3adb,	0x4e64,	0x5fed,	0x6d76,	0x7cff,
-	0x9489,	0x8500,	0xb79b,	0xa612,	0xd2ad,	0xc324,	0xf1bf,	0xe036,
-	0x18c1,	0x0948,	0x3bd3,	0x2a5a,	0x5ee5,	0x4f6c,	0x7df7,	0x6c7e,
-	0xa50a,	0xb483,	0x8618,	0x9791,	0xe32e,	0xf2a7,	0xc03c,	0xd1b5,
-	0x2942,	0x38cb,	0x0a50,	0x1bd9,	0x6f66,	0x7eef,	0x4c74,	0x5dfd,
-	0xb58b,	0xa402,	0x9699,	0x8710,	0xf3af,	0xe226,	0xd0bd,	0xc134,
-	0x39c3,	0x284a,	0x1ad1,	0x0b58,	0x7fe7,	0x6e6e,	0x5cf5,	0x4d7c,
-	0xc60c,	0xd785,	0xe51e,	0xf497,	0x8028,	0x91a1,	0xa33a,	0xb2b3,
-	0x4a44,	0x5bcd,	0x6956,	0x78df,	0x0c60,	0x1de9,	0x2f72,	0x3efb,
-	0xd68d,	0xc704,	0xf59f,	0xe416,	0x90a9,	0x8120,	0xb3bb,	0xa232,
-	0x5ac5,	0x4b4c,	0x79d7,	0x685e,	0x1ce1,	0x0d68,	0x3ff3,	0x2e7a,
-	0xe70e,	0xf687,	0xc41c,	0xd595,	0xa12a,	0xb0a3,	0x8238,	0x93b1,
-	0x6b46,	0x7acf,	0x4854,	0x59dd,	0x2d62,	0x3ceb,	0x0e70,	0x1ff9,
-	0xf78f,	0xe606,	0xd49d,	0xc514,	0xb1ab,	0xa022,	0x92b9,	0x8330,
-	0x7bc7,	0x6a4e,	0x58d5,	0x495c,	0x3de3,	0x2c6a,	0x1ef1,	0x0f78
-};
-#define PPP_FCS(fcs, c)	(((fcs) >> 8) ^ fcstab[((fcs) ^ (c)) & 0xff])
-
-#define PPP_INITFCS	0xffff	/* Initial FCS value */
-#define PPP_GOODFCS	0xf0b8	/* Good final FCS value */
-
 struct pkt {
     int	cnt;
     int	esc;
@@ -237,34 +381,138 @@ struct pkt {
 
 unsigned char dbuf[8192];
 
-void
-dumpppp(FILE *f)
+/*
+ * hexdump - print nb bytes at p, 16 to a line in hex and as
+ * characters, with tag at the start of the first line.  Each line is
+ * put together in a buffer and written in one go.
+ */
+static void
+hexdump(char *tag, unsigned char *p, int nb)
 {
-    int c, n, k;
-    int nb, nl, dn, proto, rv;
+    static const char hex[] = "0123456789abcdef";
+    char line[80], *q;
+    int k, nl, c;
+
+    do {
+	nl = nb < 16? nb: 16;
+	q = line + sprintf(line, "%s ", tag);
+	for (k = 0; k < nl; ++k) {
+	    *q++ = ' ';
+	    *q++ = hex[p[k] >> 4];
+	    *q++ = hex[p[k] & 0xf];
+	}
+	for (; k < 16; ++k) {
+	    memcpy(q, "   ", 3);
+	    q += 3;
+	}
+	*q++ = ' ';
+	*q++ = ' ';
+	for (k = 0; k < nl; ++k) {
+	    c = p[k];
+	    *q++ = (' ' <= c && c <= '~')? c: '.';
+	}
+	*q++ = '\n';
+	fwrite(line, q - line, 1, stdout);
+	tag = "    ";
+	p += nl;
+	nb -= nl;
+    } while (nb > 0);
+}
+
+/*
+ * showframe - print (or with -w, write out) a complete frame from
+ * pkt, which is reset for the next one.  c is 1 for sent, 2 for
+ * received.
+ */
+static void
+showframe(struct pkt *pkt, int c)
+{
+    int k, nb, fcsok;
+    unsigned int fcs;
     char *dir, *q;
     unsigned char *p, *r, *endp;
-    unsigned char *d;
-    unsigned short fcs;
+
+    dir = c==1? "sent": "rcvd";
+    q = dir;
+    nb = pkt->cnt;
+    p = pkt->buf;
+    if (pcapf != NULL && (pkt->esc || nb >= sizeof(pkt->buf) || nb <= 2)) {
+	/* leave out aborted, over-long and short frames */
+	pkt->cnt = 0;
+	pkt->esc = 0;
+	return;
+    }
+    if (pkt->esc) {
+	printf("%s aborted packet:\n     ", dir);
+	q = "    ";
+    }
+    if (pkt->cnt >= sizeof(pkt->buf)) {
+	printf("%s over-long packet truncated:\n     ", dir);
+	q = "    ";
+    }
+    pkt->cnt = 0;
+    pkt->esc = 0;
+    if (nb <= 2) {
+	printf("%s short packet [%d bytes]:", q, nb);
+	for (k = 0; k < nb; ++k)
+	    printf(" %.2x", p[k]);
+	printf("\n");
+	return;
+    }
+    /* a good 16-bit FCS, or failing that a good 32-bit one */
+    fcs = fcs16(PPP_INITFCS, p, nb);
+    fcsok = fcs == PPP_GOODFCS;
+    if (fcsok) {
+	nb -= 2;
+    } else if (nb > 4 && fcs32(PPP_INITFCS32, p, nb) == PPP_GOODFCS32) {
+	fcsok = 1;
+	nb -= 4;
+    } else
+	nb -= 2;
+
+    if (pcapf != NULL) {
+	pcap_frame(c == 1, now_usec, p, nb, !fcsok);
+	return;
+    }
+
+    endp = p + nb;
+    r = p;
+    if (r[0] == 0xff && r[1] == 3)
+	r += 2;
+    if ((r[0] & 1) == 0)
+	++r;
+    ++r;
+    if (endp - r > mru)
+	printf("     ERROR: length (%zd) > MRU (%d)\n",
+	       endp - r, mru);
+    hexdump(q, p, nb);
+    if (!fcsok)
+	printf("     BAD FCS: (residue = %x)\n", fcs);
+}
+
+void
+dumpppp(struct input *in)
+{
+    int c, n, k, len;
     struct pkt *pkt;
+    unsigned char *p;
 
     spkt.cnt = rpkt.cnt = 0;
     spkt.esc = rpkt.esc = 0;
-    while ((c = getc(f)) != EOF) {
+    while ((c = in_getc(in)) != EOF) {
 	switch (c) {
 	case 1:
 	case 2:
 	    if (reverse)
 		c = 3 - c;
-	    dir = c==1? "sent": "rcvd";
 	    pkt = c==1? &spkt: &rpkt;
-	    n = getc(f);
-	    n = (n << 8) + getc(f);
+	    n = in_getc(in);
+	    n = (n << 8) + in_getc(in);
 	    *(c==1? &tot_sent: &tot_rcvd) += n;
-	    for (; n > 0; --n) {
-		c = getc(f);
-		switch (c) {
-		case EOF:
+	    for (; n > 0; n -= len) {
+		if ((p = in_bytes(in, n, &len)) == NULL) {
+		    if (pcapf != NULL)
+			return;
 		    printf("\nEOF\n");
 		    if (spkt.cnt > 0)
 			printf("[%d bytes in incomplete send packet]\n",
@@ -273,78 +521,25 @@ dumpppp(FILE *f)
 			printf("[%d bytes in incomplete recv packet]\n",
 			       rpkt.cnt);
 		    exit(0);
-		case '~':
-		    if (pkt->cnt > 0) {
-			q = dir;
-			if (pkt->esc) {
-			    printf("%s aborted packet:\n     ", dir);
-			    q = "    ";
-			}
-			if (pkt->cnt >= sizeof(pkt->buf)) {
-			    printf("%s over-long packet truncated:\n     ", dir);
-			    q = "    ";
-			}
-			nb = pkt->cnt;
-			p = pkt->buf;
-			pkt->cnt = 0;
-			pkt->esc = 0;
-			if (nb <= 2) {
-			    printf("%s short packet [%d bytes]:", q, nb);
-			    for (k = 0; k < nb; ++k)
-				printf(" %.2x", p[k]);
-			    printf("\n");
+		}
+		for (k = 0; k < len; ++k) {
+		    switch (p[k]) {
+		    case '~':
+			if (pkt->cnt > 0)
+			    showframe(pkt, c);
+			break;
+		    case '}':
+			if (!pkt->esc) {
+			    pkt->esc = 1;
 			    break;
 			}
-			fcs = PPP_INITFCS;
-			for (k = 0; k < nb; ++k)
-			    fcs = PPP_FCS(fcs, p[k]);
-			fcs &= 0xFFFF;
-			nb -= 2;
-			endp = p + nb;
-			r = p;
-			if (r[0] == 0xff && r[1] == 3)
-			    r += 2;
-			if ((r[0] & 1) == 0)
-			    ++r;
-			++r;
-			if (endp - r > mru)
-			    printf("     ERROR: length (%zd) > MRU (%d)\n",
-				   endp - r, mru);
-			do {
-			    nl = nb < 16? nb: 16;
-			    printf("%s ", q);
-			    for (k = 0; k < nl; ++k)
-				printf(" %.2x", p[k]);
-			    for (; k < 16; ++k)
-				printf("   ");
-			    printf("  ");
-			    for (k = 0; k < nl; ++k) {
-				c = p[k];
-				putchar((' ' <= c && c <= '~')? c: '.');
-			    }
-			    printf("\n");
-			    q = "    ";
-			    p += nl;
-			    nb -= nl;
-			} while (nb > 0);
-			if (fcs != PPP_GOODFCS)
-			    printf("     BAD FCS: (residue = %x)\n", fcs);
-		    }
-		    break;
-		case '}':
-		    if (!pkt->esc) {
-			pkt->esc = 1;
-			break;
-		    }
-		    /* else fall through */
-		default:
-		    if (pkt->esc) {
-			c ^= 0x20;
+			/* else fall through */
+		    default:
+			if (pkt->cnt < sizeof(pkt->buf))
+			    pkt->buf[pkt->cnt++] = pkt->esc? p[k] ^ 0x20: p[k];
 			pkt->esc = 0;
+			break;
 		    }
-		    if (pkt->cnt < sizeof(pkt->buf))
-			pkt->buf[pkt->cnt++] = c;
-		    break;
 		}
 	    }
 	    break;
@@ -352,55 +547,424 @@ dumpppp(FILE *f)
 	case 4:
 	    if (reverse)
 		c = 7 - c;
-	    dir = c==3? "send": "recv";
 	    pkt = c==3? &spkt: &rpkt;
-	    printf("end %s", dir);
-	    if (pkt->cnt > 0)
-		printf("  [%d bytes in incomplete packet]", pkt->cnt);
-	    printf("\n");
+	    if (pcapf == NULL) {
+		printf("end %s", c==3? "send": "recv");
+		if (pkt->cnt > 0)
+		    printf("  [%d bytes in incomplete packet]", pkt->cnt);
+		printf("\n");
+	    }
 	    break;
 	case 5:
 	case 6:
 	case 7:
-	    show_time(f, c);
+	case 8:
+	case 9:
+	    show_time(in, c);
 	    break;
 	default:
-	    printf("?%.2x\n", c);
+	    if (pcapf == NULL)
+		printf("?%.2x\n", c);
+	}
+	in_release(in);
+    }
+}
+
+/*
+ * istrace - check whether the input is a ring written by pppd's
+ * tracefile option (returns 1) or by its record option with
+ * record-size (returns 2), without consuming anything.
+ */
+int
+istrace(struct input *in)
+{
+    const int n = sizeof(TRACE_MAGIC) - 1;
+    int k;
+
+    if (in->end - in->p < n) {
+	/* only the first block read from a pipe can be short here */
+	while (in->end - in->p < n && in->fd >= 0) {
+	    k = read(in->fd, in->end, in->buf + sizeof(in->buf) - in->end);
+	    if (k <= 0)
+		return 0;
+	    in->end += k;
 	}
+	if (in->end - in->p < n)
+	    return 0;
     }
+    if (memcmp(in->p, TRACE_MAGIC, n) == 0)
+	return 1;
+    if (memcmp(in->p, TRACE_RECORD_MAGIC, n) == 0)
+	return 2;
+    return 0;
 }
 
+/*
+ * readring - read in a ring file.  Returns the ring space, with the
+ * offset of the oldest record in *headp and the number of records in
+ * *countp, or NULL if the file is unusable.
+ */
+static unsigned char *
+readring(struct input *in, uint32_t *sizep, uint32_t *headp, uint32_t *countp)
+{
+    struct trace_header h;
+    unsigned char *ring;
+    uint32_t size;
+
+    if (!in_read(in, &h, sizeof(h)) || ntohl(h.version) != TRACE_VERSION) {
+	printf("unsupported trace file\n");
+	return NULL;
+    }
+    size = ntohl(h.size);
+    if ((ring = malloc(size)) == NULL) {
+	perror("trace ring");
+	exit(1);
+    }
+    if (!in_read(in, ring, size) || ntohl(h.head) >= size) {
+	printf("truncated trace file\n");
+	free(ring);
+	return NULL;
+    }
+    if (ntohl(h.count) > size / TRACE_RECLEN(0)) {
+	printf("corrupt trace header: %u records\n", ntohl(h.count));
+	free(ring);
+	return NULL;
+    }
+    if (ntohl(h.lost) != 0 && pcapf == NULL)
+	printf("[%u older records overwritten]\n", ntohl(h.lost));
+    *sizep = size;
+    *headp = ntohl(h.head);
+    *countp = ntohl(h.count);
+    return ring;
+}
+/*
+ * nextrecord - return the record at *headp and step past it, or NULL
+ * when there are no more.
+ */
+static struct trace_record *
+nextrecord(unsigned char *ring, uint32_t size, uint32_t *headp,
+	   uint32_t *countp)
+{
+    struct trace_record *r;
+    uint32_t head = *headp;
+    int wrapped = 0;
+
+    for (;;) {
+	if (*countp == 0)
+	    return NULL;
+	r = (struct trace_record *) (ring + head);
+	if (head + sizeof(*r) <= size && ntohs(r->len) != TRACE_WRAP)
+	    break;
+	if (wrapped) {
+	    /* a wrap marker at offset 0 would send us round for ever */
+	    printf("corrupt trace ring: wrap marker at offset 0\n");
+	    return NULL;
+	}
+	head = 0;
+	wrapped = 1;
+    }
+    if (head + TRACE_RECLEN(ntohs(r->len)) > size) {
+	printf("corrupt trace record at offset %u\n", head);
+	return NULL;
+    }
+    head += TRACE_RECLEN(ntohs(r->len));
+    *headp = head >= size? 0: head;
+    --*countp;
+    return r;
+}
+
+/*
+ * dumptrace - print the frames in a trace file, oldest first.
+ */
 void
-show_time(FILE *f, int c)
+dumptrace(struct input *in)
 {
+    struct trace_record *r;
+    unsigned char *ring;
+    uint32_t size, head, count, len, sec, usec, psec, pusec;
+    int c;
+    char *dir;
     time_t t;
-    int n;
+    struct tm *tm;
+
+    if ((ring = readring(in, &size, &head, &count)) == NULL)
+	return;
+
+    psec = pusec = 0;
+    while ((r = nextrecord(ring, size, &head, &count)) != NULL) {
+	len = ntohs(r->len);
+	sec = ntohl(r->sec);
+	usec = ntohl(r->usec);
+	c = r->dir == TRACE_SENT? 1: 2;
+	if (reverse)
+	    c = 3 - c;
+	if (pcapf != NULL) {
+	    pcap_frame(c == 1, sec * 1000000LL + usec,
+		       (unsigned char *) (r + 1), len, 0);
+	    continue;
+	}
+	if (psec == 0) {
+	    t = sec;
+	    printf("start %s", ctime(&t));
+	} else if (abs_times) {
+	    t = sec;
+	    tm = localtime(&t);
+	    printf("time  %.2d:%.2d:%.2d.%.6u  (sent %d, rcvd %d)\n",
+		   tm->tm_hour, tm->tm_min, tm->tm_sec, usec,
+		   tot_sent, tot_rcvd);
+	} else if (sec != psec || usec != pusec) {
+	    printf("time  %.6fs\n", (sec - psec) + ((double) usec - pusec) / 1e6);
+	}
+	psec = sec;
+	pusec = usec;
+
+	dir = c == 1? "sent": "rcvd";
+	*(c == 1? &tot_sent: &tot_rcvd) += len;
+	hexdump(dir, (unsigned char *) (r + 1), len);
+    }
+    free(ring);
+}
+
+/*
+ * dumprecring - print a record ring, by turning it back into the
+ * tagged stream that record writes in append mode.
+ */
+void
+dumprecring(struct input *in)
+{
+    struct trace_record *r;
+    unsigned char *ring, *buf, *p;
+    uint32_t size, head, count, len, sec, usec, used;
+    long long now, last, diff;
+    struct input mem;
+
+    if ((ring = readring(in, &size, &head, &count)) == NULL)
+	return;
+    if (count == 0) {
+	free(ring);
+	return;
+    }
+    /*
+     * Each record gets at most 3 bytes of header and 10 of timestamps
+     * in the stream, against the 12 of its trace_record.  That only
+     * holds while the records read take no more than the ring itself,
+     * so stop if they would.
+     */
+    if ((buf = malloc(size + 5 + count)) == NULL) {
+	perror("record ring");
+	exit(1);
+    }
+    p = buf;
+    last = -1;
+    used = 0;
+    while ((r = nextrecord(ring, size, &head, &count)) != NULL) {
+	len = ntohs(r->len);
+	used += TRACE_RECLEN(len);
+	if (used > size) {
+	    printf("corrupt record ring: records overlap\n");
+	    break;
+	}
+	sec = ntohl(r->sec);
+	usec = ntohl(r->usec);
+	now = sec * 1000000LL + usec;
+	if (last < 0) {
+	    *p++ = 7;
+	    *p++ = sec >> 24;
+	    *p++ = sec >> 16;
+	    *p++ = sec >> 8;
+	    *p++ = sec;
+	    last = sec * 1000000LL;
+	}
+	diff = now - last;
+	if (diff > 0xffffffffLL) {
+	    /* too long for a delta: start afresh */
+	    *p++ = 7;
+	    *p++ = sec >> 24;
+	    *p++ = sec >> 16;
+	    *p++ = sec >> 8;
+	    *p++ = sec;
+	    last = sec * 1000000LL;
+	    diff = usec;
+	}
+	if (diff > 0) {
+	    *p++ = 8;
+	    *p++ = diff >> 24;
+	    *p++ = diff >> 16;
+	    *p++ = diff >> 8;
+	    *p++ = diff;
+	    last = now;
+	}
+	if (r->dir & TRACE_EOF) {
+	    *p++ = (r->dir & ~TRACE_EOF) == TRACE_SENT? 3: 4;
+	} else {
+	    *p++ = r->dir == TRACE_SENT? 1: 2;
+	    *p++ = len >> 8;
+	    *p++ = len;
+	    memcpy(p, r + 1, len);
+	    p += len;
+	}
+    }
+    free(ring);
+
+    in_mem(&mem, buf, p - buf);
+    if (pppmode)
+	dumpppp(&mem);
+    else
+	dumplog(&mem);
+    free(buf);
+}
+
+/*
+ * show_time - note a start marker (code 7) or the time since the last
+ * timestamp, in tenths of a second (codes 5 and 6, as written by older
+ * versions of pppd) or microseconds (codes 8 and 9), and print it
+ * unless writing a pcapng file.
+ */
+void
+show_time(struct input *in, int c)
+{
+    time_t t;
+    long long n;
+    int k;
     struct tm *tm;
 
     if (c == 7) {
-	t = getc(f);
-	t = (t << 8) + getc(f);
-	t = (t << 8) + getc(f);
-	t = (t << 8) + getc(f);
-	printf("start %s", ctime(&t));
-	start_time = t;
-	start_time_tenths = 0;
+	t = in_getc(in);
+	t = (t << 8) + in_getc(in);
+	t = (t << 8) + in_getc(in);
+	t = (t << 8) + in_getc(in);
+	now_usec = t * 1000000LL;
 	tot_sent = tot_rcvd = 0;
-    } else {
-	n = getc(f);
-	if (c == 5) {
-	    for (c = 3; c > 0; --c)
-		n = (n << 8) + getc(f);
-	}
-	if (abs_times) {
-	    n += start_time_tenths;
-	    start_time += n / 10;
-	    start_time_tenths = n % 10;
-	    tm = localtime(&start_time);
-	    printf("time  %.2d:%.2d:%.2d.%d", tm->tm_hour, tm->tm_min,
-		   tm->tm_sec, start_time_tenths);
-	    printf("  (sent %d, rcvd %d)\n", tot_sent, tot_rcvd);
-	} else
-	    printf("time  %.1fs\n", (double) n / 10);
+	if (pcapf == NULL)
+	    printf("start %s", ctime(&t));
+	return;
+    }
+    n = in_getc(in);
+    k = (c == 5 || c == 8)? 3: (c == 9)? 1: 0;
+    for (; k > 0; --k)
+	n = (n << 8) + in_getc(in);
+    now_usec += (c >= 8)? n: n * 100000;
+    if (pcapf != NULL)
+	return;
+    if (abs_times) {
+	t = now_usec / 1000000;
+	tm = localtime(&t);
+	printf("time  %.2d:%.2d:%.2d", tm->tm_hour, tm->tm_min,
+	       tm->tm_sec);
+	if (c >= 8)
+	    printf(".%.6d", (int) (now_usec % 1000000));
+	else
+	    printf(".%d", (int) (now_usec % 1000000) / 100000);
+	printf("  (sent %d, rcvd %d)\n", tot_sent, tot_rcvd);
+    } else if (c >= 8)
+	printf("time  %.6fs\n", (double) n / 1e6);
+    else
+	printf("time  %.1fs\n", (double) n / 10);
+}
+
+/*
+ * The -w option writes the frames as a pcapng file with one
+ * LINKTYPE_PPP_WITH_DIR interface: each frame, without its FCS, is
+ * preceded by a byte which is 1 for sent and 0 for received.  Frames
+ * with a bad FCS are written with the CRC error flag set.
+ */
+#define LINKTYPE_PPP_WITH_DIR	204
+
+#define PCAPNG_SHB	0x0a0d0d0a	/* section header block */
+#define PCAPNG_IDB	1		/* interface description block */
+#define PCAPNG_EPB	6		/* enhanced packet block */
+#define PCAPNG_BOM	0x1a2b3c4d
+#define EPB_FLAGS	2		/* option code */
+#define EPB_INBOUND	1
+#define EPB_OUTBOUND	2
+#define EPB_CRC_ERROR	(1 << 24)
+
+static void
+pcap_put(void *p, size_t len)
+{
+    if (fwrite(p, len, 1, pcapf) != 1) {
+	perror("pcapng file");
+	exit(1);
     }
 }
+
+void
+pcap_open(char *name)
+{
+    struct {
+	uint32_t type, len, bom;
+	uint16_t major, minor;
+	uint32_t seclen[2], len2;
+    } shb;
+    struct {
+	uint32_t type, len;
+	uint16_t linktype, reserved;
+	uint32_t snaplen, len2;
+    } idb;
+
+    if (pcapf != NULL) {
+	fprintf(stderr, "only one -w option is allowed\n");
+	exit(1);
+    }
+    if (strcmp(name, "-") == 0)
+	pcapf = stdout;
+    else if ((pcapf = fopen(name, "w")) == NULL) {
+	perror(name);
+	exit(1);
+    }
+    setvbuf(pcapf, NULL, _IOFBF, INPUT_BUFSIZE);
+
+    shb.type = PCAPNG_SHB;
+    shb.len = shb.len2 = sizeof(shb);
+    shb.bom = PCAPNG_BOM;
+    shb.major = 1;		/* version 1.0 */
+    shb.minor = 0;
+    shb.seclen[0] = 0xffffffff;	/* section length unknown */
+    shb.seclen[1] = 0xffffffff;
+    pcap_put(&shb, sizeof(shb));
+
+    idb.type = PCAPNG_IDB;
+    idb.len = idb.len2 = sizeof(idb);
+    idb.linktype = LINKTYPE_PPP_WITH_DIR;
+    idb.reserved = 0;
+    idb.snaplen = 0;		/* no limit */
+    pcap_put(&idb, sizeof(idb));
+}
+
+/*
+ * pcap_frame - write out a frame received or sent at time usec
+ * (microseconds since the epoch, the pcapng default resolution).
+ */
+void
+pcap_frame(int sent, long long usec, unsigned char *p, int len, int badfcs)
+{
+    static const unsigned char pad[4];
+    uint32_t epb[7];
+    struct {
+	uint16_t code, len;
+	uint32_t flags;
+	uint16_t end_code, end_len;	/* opt_endofopt */
+	uint32_t len2;			/* block length again */
+    } opt;
+    unsigned char dir = sent;
+    int caplen = len + 1;
+
+    epb[0] = PCAPNG_EPB;
+    epb[1] = sizeof(epb) + ((caplen + 3) & ~3) + sizeof(opt);
+    epb[2] = 0;			/* interface */
+    epb[3] = (unsigned long long) usec >> 32;
+    epb[4] = usec;
+    epb[5] = caplen;
+    epb[6] = caplen;
+    pcap_put(epb, sizeof(epb));
+    pcap_put(&dir, 1);
+    pcap_put(p, len);
+    if (caplen & 3)
+	pcap_put((void *) pad, 4 - (caplen & 3));
+    opt.code = EPB_FLAGS;
+    opt.len = sizeof(opt.flags);
+    opt.flags = (sent? EPB_OUTBOUND: EPB_INBOUND) | (badfcs? EPB_CRC_ERROR: 0);
+    opt.end_code = opt.end_len = 0;
+    opt.len2 = epb[1];
+    pcap_put(&opt, sizeof(opt));
+}
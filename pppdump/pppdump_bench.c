@@ -0,0 +1,219 @@
+/*
+ * pppdump_bench.c - measure pppdump's FCS routines and its throughput
+ * on a synthetic record file.
+ *
+ * Times the sliced FCS-16 and FCS-32 routines against the byte-at-a-
+ * time loops, then writes record files of 16 and 64 MB of HDLC-framed
+ * traffic in both directions and times ./pppdump on each, printing
+ * frames (-p) and writing pcapng (-w), with its peak memory use.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "fcs.h"
+
+#define FCS_BYTES	(16 << 20)
+#define CHUNK		4096
+
+static void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, " (errno %d)\n", errno);
+    exit(1);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+bench_fcs(void)
+{
+    unsigned char *buf;
+    uint32_t v32, s32;
+    unsigned int v16, s16;
+    double t0, t1, t2, t3, t4;
+    int i;
+
+    if ((buf = malloc(FCS_BYTES)) == NULL)
+	fatal("no memory");
+    for (i = 0; i < FCS_BYTES; ++i)
+	buf[i] = i * 2654435761u >> 24;
+
+    t0 = now_ns();
+    v16 = PPP_INITFCS;
+    for (i = 0; i < FCS_BYTES; ++i)
+	v16 = PPP_FCS(v16, buf[i]);
+    t1 = now_ns();
+    s16 = fcs16(PPP_INITFCS, buf, FCS_BYTES);
+    t2 = now_ns();
+    v32 = PPP_INITFCS32;
+    for (i = 0; i < FCS_BYTES; ++i)
+	v32 = PPP_FCS32(v32, buf[i]);
+    t3 = now_ns();
+    s32 = fcs32(PPP_INITFCS32, buf, FCS_BYTES);
+    t4 = now_ns();
+    if (v16 != s16 || v32 != s32)
+	fatal("sliced FCS disagrees: %x/%x %x/%x", v16, s16, v32, s32);
+
+    printf("FCS over %d MB:\n", FCS_BYTES >> 20);
+    printf("  FCS-16: bytewise %7.0f MB/s, sliced %7.0f MB/s\n",
+	   FCS_BYTES / (t1 - t0) * 1e3, FCS_BYTES / (t2 - t1) * 1e3);
+    printf("  FCS-32: bytewise %7.0f MB/s, sliced %7.0f MB/s\n",
+	   FCS_BYTES / (t3 - t2) * 1e3, FCS_BYTES / (t4 - t3) * 1e3);
+    free(buf);
+}
+
+/*
+ * stuff - HDLC-encode a frame with its FCS into out, returning the
+ * length.
+ */
+static int
+stuff(unsigned char *out, unsigned char *frame, int len)
+{
+    unsigned int fcs;
+    unsigned char *p = out;
+    int i, c;
+
+    fcs = fcs16(PPP_INITFCS, frame, len) ^ 0xffff;
+    frame[len] = fcs;
+    frame[len + 1] = fcs >> 8;
+    *p++ = '~';
+    for (i = 0; i < len + 2; ++i) {
+	c = frame[i];
+	if (c < 0x20 || c == '~' || c == '}') {
+	    *p++ = '}';
+	    c ^= 0x20;
+	}
+	*p++ = c;
+    }
+    *p++ = '~';
+    return p - out;
+}
+
+/*
+ * make_file - write a record file of about mbytes megabytes to fd.
+ */
+static void
+make_file(int fd, int mbytes)
+{
+    static unsigned char frame[1600], enc[3300], out[CHUNK + 3300];
+    long long total = 0, target = (long long) mbytes << 20;
+    unsigned int seed = 1;
+    int n = 0, len, i, k, dir = 1;
+    time_t t = time(NULL);
+
+    out[n++] = 7;
+    out[n++] = t >> 24;
+    out[n++] = t >> 16;
+    out[n++] = t >> 8;
+    out[n++] = t;
+    while (total < target) {
+	/* a chunk of frames in one direction, a millisecond after the last */
+	out[n++] = 9;
+	out[n++] = 0x03;
+	out[n++] = 0xe8 + dir;
+	out[n++] = dir;
+	i = n;
+	n += 2;
+	while (n - i < CHUNK) {
+	    seed = seed * 1103515245 + 12345;
+	    len = 40 + (seed >> 16) % 1460;
+	    frame[0] = 0xff;
+	    frame[1] = 0x03;
+	    frame[2] = 0x00;
+	    frame[3] = 0x21;
+	    for (k = 4; k < len; ++k) {
+		seed = seed * 1103515245 + 12345;
+		frame[k] = seed >> 16;
+	    }
+	    len = stuff(enc, frame, len);
+	    memcpy(out + n, enc, len);
+	    n += len;
+	}
+	out[i] = (n - i - 2) >> 8;
+	out[i + 1] = n - i - 2;
+	if (write(fd, out, n) != n)
+	    fatal("write");
+	total += n;
+	n = 0;
+	dir = 3 - dir;
+    }
+}
+
+/*
+ * run - time ./pppdump with the given arguments, output to /dev/null.
+ */
+static void
+run(char *what, char *path, long long size, char **args)
+{
+    struct rusage ru;
+    double t0, t1;
+    pid_t pid;
+    int status, fd;
+
+    t0 = now_ns();
+    pid = fork();
+    if (pid < 0)
+	fatal("fork");
+    if (pid == 0) {
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, 1);
+	execv("./pppdump", args);
+	_exit(127);
+    }
+    if (wait4(pid, &status, 0, &ru) < 0)
+	fatal("wait4");
+    t1 = now_ns();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	fatal("./pppdump %s %s failed with status %x", what, path, status);
+    printf("  %4lld MB %-3s %7.1f MB/s, max RSS %6ld kB\n",
+	   size >> 20, what, size / (t1 - t0) * 1e3, ru.ru_maxrss);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int sizes[] = { 16, 64 };
+    char path[] = "/tmp/pppdump_benchXXXXXX";
+    char *pargs[] = { "pppdump", "-p", path, NULL };
+    char *wargs[] = { "pppdump", "-w", "/dev/null", path, NULL };
+    off_t size;
+    int i, fd;
+
+    fcs_init();
+    bench_fcs();
+
+    printf("pppdump on a synthetic record file:\n");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	strcpy(path, "/tmp/pppdump_benchXXXXXX");
+	if ((fd = mkstemp(path)) < 0)
+	    fatal("mkstemp");
+	make_file(fd, sizes[i]);
+	size = lseek(fd, 0, SEEK_END);
+	close(fd);
+	run("-p", path, size, pargs);
+	run("-w", path, size, wargs);
+	unlink(path);
+    }
+    return 0;
+}
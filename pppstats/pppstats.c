@@ -1,12 +1,16 @@
 /*
  * print PPP statistics:
  * 	pppstats [-a|-d] [-v|-r|-z] [-c count] [-w wait] [interface]
+ * 	pppstats -A [-a|-d] [-j] [-n top] [-c count] [-w wait]
  *
  *   -a Show absolute values rather than deltas
  *   -d Show data rate (kB/s) rather than bytes
  *   -v Show more stats for VJ TCP header compression
  *   -r Show compression ratio
  *   -z Show compression statistics instead of default display
+ *   -A Show all PPP interfaces, one line each (Linux only)
+ *   -j With -A, print JSON lines
+ *   -n With -A, show only the top interfaces by throughput
  *
  * History:
  *      perkins@cps.msu.edu: Added compression statistics and alternate 
@@ -69,6 +73,10 @@
 #endif
 #include <linux/ppp_defs.h>
 #include <linux/ppp-ioctl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_arp.h>
+#include <time.h>
 
 #endif /* __linux__ */
 
@@ -81,6 +89,9 @@
 
 int	vflag, rflag, zflag;	/* select type of display */
 int	aflag;			/* print absolute values, not deltas */
+int	Aflag;			/* all PPP interfaces via rtnetlink */
+int	jflag;			/* with -A, print JSON lines */
+int	top;			/* with -A, print only this many, 0 = all */
 int	dflag;			/* print data rates, not bytes */
 int	interval, count;
 int	infinite;
@@ -107,6 +118,9 @@ static void catchalarm(int);
 static void get_ppp_stats(struct ppp_stats *);
 static void get_ppp_cstats(struct ppp_comp_stats *);
 static void intpr(void);
+#ifdef __linux__
+static void allpr(void);
+#endif
 
 int main(int, char *argv[]);
 
@@ -115,6 +129,10 @@ usage(void)
 {
     fprintf(stderr, "Usage: %s [-a|-d] [-v|-r|-z] [-c count] [-w wait] [interface]\n",
 	    progname);
+#ifdef __linux__
+    fprintf(stderr, "       %s -A [-a|-d] [-j] [-n top] [-c count] [-w wait]\n",
+	    progname);
+#endif
     exit(1);
 }
 
@@ -422,6 +440,319 @@ intpr(void)
     }
 }
 
+#ifdef __linux__
+/*
+ * With -A, the statistics of every PPP interface come from a single
+ * RTM_GETLINK dump per interval, so the cost is one netlink round trip
+ * however many interfaces there are.  Interfaces are kept in a hash
+ * table by ifindex, and ones which have gone are dropped after each
+ * dump.
+ */
+struct link {
+    int		index;		/* ifindex, 0 if slot free */
+    int		seen;		/* generation of the last dump it was in */
+    char	name[IFNAMSIZ];
+    struct rtnl_link_stats64 cur, old;
+    unsigned long long through;	/* bytes in + out this interval */
+};
+
+static struct link *links;
+static int nlinks, maxlinks;	/* maxlinks is a power of 2 */
+static int generation;
+
+/*
+ * find_link - return the slot for ifindex, making it if necessary.
+ */
+static struct link *
+find_link(int index)
+{
+    struct link *lp, *old;
+    int i, n;
+
+    if (2 * (nlinks + 1) > maxlinks) {
+	/* grow to keep the table at most half full */
+	old = links;
+	n = maxlinks;
+	maxlinks = n? 2 * n: 64;
+	links = calloc(maxlinks, sizeof(*links));
+	if (links == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", progname);
+	    exit(1);
+	}
+	nlinks = 0;
+	for (i = 0; i < n; ++i)
+	    if (old[i].index != 0)
+		*find_link(old[i].index) = old[i];
+	free(old);
+    }
+    for (i = index & (maxlinks - 1); ; i = (i + 1) & (maxlinks - 1)) {
+	lp = &links[i];
+	if (lp->index == index)
+	    return lp;
+	if (lp->index == 0)
+	    break;
+    }
+    memset(lp, 0, sizeof(*lp));
+    lp->index = index;
+    ++nlinks;
+    return lp;
+}
+
+/*
+ * drop_stale_links - remove the interfaces which were not in the last
+ * dump, by rebuilding the table.
+ */
+static void
+drop_stale_links(void)
+{
+    struct link *old;
+    int i, n;
+
+    for (i = 0; i < maxlinks; ++i)
+	if (links[i].index != 0 && links[i].seen != generation)
+	    break;
+    if (i == maxlinks)
+	return;
+    old = links;
+    n = maxlinks;
+    links = calloc(maxlinks, sizeof(*links));
+    if (links == NULL) {
+	fprintf(stderr, "%s: out of memory\n", progname);
+	exit(1);
+    }
+    nlinks = 0;
+    for (i = 0; i < n; ++i)
+	if (old[i].index != 0 && old[i].seen == generation)
+	    *find_link(old[i].index) = old[i];
+    free(old);
+}
+
+/*
+ * dump_links - fetch the statistics of all PPP interfaces.
+ */
+static void
+dump_links(int fd)
+{
+    static char buf[32768];
+    struct {
+	struct nlmsghdr nlh;
+	struct ifinfomsg ifi;
+    } req;
+    struct sockaddr_nl nladdr;
+    struct nlmsghdr *nlh;
+    struct ifinfomsg *ifi;
+    struct rtattr *rta;
+    struct rtnl_link_stats64 *st;
+    struct link *lp;
+    char *name;
+    int len, n, done;
+
+    ++generation;
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = RTM_GETLINK;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = generation;
+    req.ifi.ifi_family = AF_UNSPEC;
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    if (sendto(fd, &req, sizeof(req), 0, (struct sockaddr *) &nladdr,
+	       sizeof(nladdr)) < 0) {
+	fprintf(stderr, "%s: ", progname);
+	perror("couldn't request interface statistics");
+	exit(1);
+    }
+
+    for (done = 0; !done; ) {
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "%s: ", progname);
+	    perror("couldn't read interface statistics");
+	    exit(1);
+	}
+	for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+	     nlh = NLMSG_NEXT(nlh, len)) {
+	    if (nlh->nlmsg_seq != generation)
+		continue;
+	    if (nlh->nlmsg_type == NLMSG_DONE) {
+		done = 1;
+		break;
+	    }
+	    if (nlh->nlmsg_type == NLMSG_ERROR) {
+		fprintf(stderr, "%s: interface statistics dump failed\n",
+			progname);
+		exit(1);
+	    }
+	    if (nlh->nlmsg_type != RTM_NEWLINK)
+		continue;
+	    ifi = NLMSG_DATA(nlh);
+	    if (ifi->ifi_type != ARPHRD_PPP)
+		continue;
+	    name = NULL;
+	    st = NULL;
+	    n = IFLA_PAYLOAD(nlh);
+	    for (rta = IFLA_RTA(ifi); RTA_OK(rta, n); rta = RTA_NEXT(rta, n)) {
+		if (rta->rta_type == IFLA_IFNAME)
+		    name = RTA_DATA(rta);
+		else if (rta->rta_type == IFLA_STATS64
+			 && RTA_PAYLOAD(rta) >= sizeof(*st))
+		    st = RTA_DATA(rta);
+	    }
+	    if (name == NULL || st == NULL)
+		continue;
+	    lp = find_link(ifi->ifi_index);
+	    if (lp->seen == 0 || strncmp(lp->name, name, IFNAMSIZ) != 0) {
+		/* new, or the index has been reused: start afresh */
+		memset(&lp->old, 0, sizeof(lp->old));
+		strncpy(lp->name, name, IFNAMSIZ);
+		lp->name[IFNAMSIZ - 1] = 0;
+	    }
+	    memcpy(&lp->cur, st, sizeof(lp->cur));
+	    lp->seen = generation;
+	}
+    }
+    drop_stale_links();
+}
+
+#define D64(lp, f)	((lp)->cur.f > (lp)->old.f? (lp)->cur.f - (lp)->old.f: 0)
+
+static int
+cmp_through(const void *a, const void *b)
+{
+    const struct link *x = *(const struct link **) a;
+    const struct link *y = *(const struct link **) b;
+
+    if (x->through != y->through)
+	return x->through < y->through? 1: -1;
+    return strcmp(x->name, y->name);
+}
+
+/*
+ * json_name - print an interface name as a JSON string.
+ */
+static void
+json_name(char *name)
+{
+    int c;
+
+    putchar('"');
+    for (; (c = (unsigned char) *name) != 0; ++name) {
+	if (c == '"' || c == '\\')
+	    printf("\\%c", c);
+	else if (c < 0x20)
+	    printf("\\u%04x", c);
+	else
+	    putchar(c);
+    }
+    putchar('"');
+}
+
+/*
+ * Print the statistics of all PPP interfaces every interval seconds,
+ * busiest first.  As with intpr, the first report is cumulative.
+ */
+static void
+allpr(void)
+{
+    struct link **order = NULL;
+    struct link *lp;
+    struct timespec next, now;
+    int fd, i, n, shown, ratef = 0;
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+	fprintf(stderr, "%s: ", progname);
+	perror("couldn't create netlink socket");
+	exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (1) {
+	dump_links(fd);
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	order = realloc(order, (nlinks + 1) * sizeof(*order));
+	if (order == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", progname);
+	    exit(1);
+	}
+	for (i = n = 0; i < maxlinks; ++i) {
+	    lp = &links[i];
+	    if (lp->index == 0)
+		continue;
+	    lp->through = D64(lp, rx_bytes) + D64(lp, tx_bytes);
+	    order[n++] = lp;
+	}
+	qsort(order, n, sizeof(*order), cmp_through);
+	shown = top && top < n? top: n;
+
+	if (jflag) {
+	    for (i = 0; i < shown; ++i) {
+		lp = order[i];
+		printf("{\"time\":%ld.%03ld,\"interface\":",
+		       (long) now.tv_sec, now.tv_nsec / 1000000);
+		json_name(lp->name);
+		printf(",\"ifindex\":%d", lp->index);
+		printf(",\"rx_bytes\":%llu,\"rx_packets\":%llu"
+		       ",\"rx_errors\":%llu,\"rx_dropped\":%llu",
+		       D64(lp, rx_bytes), D64(lp, rx_packets),
+		       D64(lp, rx_errors), D64(lp, rx_dropped));
+		printf(",\"tx_bytes\":%llu,\"tx_packets\":%llu"
+		       ",\"tx_errors\":%llu,\"tx_dropped\":%llu",
+		       D64(lp, tx_bytes), D64(lp, tx_packets),
+		       D64(lp, tx_errors), D64(lp, tx_dropped));
+		if (ratef)
+		    printf(",\"rx_kBps\":%.3f,\"tx_kBps\":%.3f",
+			   KBPS(D64(lp, rx_bytes)), KBPS(D64(lp, tx_bytes)));
+		printf("}\n");
+	    }
+	} else {
+	    printf("%-15.15s %10.10s %8.8s %6.6s  | %10.10s %8.8s %6.6s\n",
+		   "INTERFACE", "IN", "PACK", "ERR", "OUT", "PACK", "ERR");
+	    for (i = 0; i < shown; ++i) {
+		lp = order[i];
+		printf("%-15.15s ", lp->name);
+		if (ratef)
+		    printf("%10.3f", KBPS(D64(lp, rx_bytes)));
+		else
+		    printf("%10llu", D64(lp, rx_bytes));
+		printf(" %8llu %6llu  | ", D64(lp, rx_packets),
+		       D64(lp, rx_errors) + D64(lp, rx_dropped));
+		if (ratef)
+		    printf("%10.3f", KBPS(D64(lp, tx_bytes)));
+		else
+		    printf("%10llu", D64(lp, tx_bytes));
+		printf(" %8llu %6llu\n", D64(lp, tx_packets),
+		       D64(lp, tx_errors) + D64(lp, tx_dropped));
+	    }
+	    if (shown < n)
+		printf("(%d more)\n", n - shown);
+	    putchar('\n');
+	}
+	fflush(stdout);
+
+	count--;
+	if (!infinite && !count)
+	    break;
+
+	next.tv_sec += interval;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+	       == EINTR)
+	    ;
+
+	if (!aflag) {
+	    for (i = 0; i < maxlinks; ++i)
+		links[i].old = links[i].cur;
+	    ratef = dflag;
+	}
+    }
+    close(fd);
+    free(order);
+}
+#endif /* __linux__ */
+
 int
 main(int argc, char *argv[])
 {
@@ -437,8 +768,21 @@ main(int argc, char *argv[])
     else
 	++progname;
 
-    while ((c = getopt(argc, argv, "advrzc:w:")) != -1) {
+    while ((c = getopt(argc, argv, "advrzc:w:Ajn:")) != -1) {
 	switch (c) {
+#ifdef __linux__
+	case 'A':
+	    ++Aflag;
+	    break;
+	case 'j':
+	    ++jflag;
+	    break;
+	case 'n':
+	    top = atoi(optarg);
+	    if (top <= 0)
+		usage();
+	    break;
+#endif
 	case 'a':
 	    ++aflag;
 	    break;
@@ -485,6 +829,17 @@ main(int argc, char *argv[])
     if (argc > 0)
 	interface = argv[0];
 
+#ifdef __linux__
+    if (Aflag) {
+	if (argc > 0 || vflag || rflag || zflag)
+	    usage();
+	allpr();
+	exit(0);
+    }
+#endif
+    if (jflag || top)
+	usage();
+
 #ifndef STREAMS
     {
 	struct ifreq ifr;